@@ -1,181 +1,169 @@
 /*
- * DNS client
- * Abondoned due to the complexity
- */
-
-
-#include <stdint.h>
-#include <stdlib.h>
-
-
-#define DNS_MAX_NAME_LEN 255
-
-
-/*
- * DNS query type
- *
- * @DNS_OPC_STD Standard query
- * @DNS_OPC_REV Reverse query
- * @DNS_OPC_SSTAT Server status query
- */
-enum dns_opcode {
-	DNS_OPC_STD = 0,
-	DNS_OPC_REV = 1,
-	DNS_OPC_SSTAT = 2
-};
-
-
-/*
- * DNS error code
- *
- * @DNS_RC_NO_ERR No error
- * @DNS_RC_FMT_ERR Format error
- * @DNS_RC_SFAIL Server failure
- * @DNS_RC_NAME_ERR Name error
- * @DNS_RC_NIMPL Not implemented
- * @DNS_RC_REFUSED Refused
- */
-enum dns_rcode {
-	DNS_RC_NO_ERR = 0,
-	DNS_RC_FMT_ERR = 1,
-	DNS_RC_SFAIL = 2,
-	DNS_RC_NAME_ERR = 3,
-	DNS_RC_NIMPL = 4,
-	DNS_RC_REFUSED = 5
-};
-
-
-/*
- * DNS record type
- *
- * @DNS_REC_A IPv4 record
- * @DNS_REC_AAAA IPv6 record
- * @DNS_REC_MX Mail exchange record
- * @DNS_REC_TXT Text record
- * @DNS_REC_CNAME Canonical name
- * @DNS_REC_ALL All cached records
- */
-enum dns_record {
-	DNS_REC_A = 1,
-	DNS_REC_AAAA = 28,
-	DNS_REC_MX = 15,
-	DNS_REC_TXT = 16,
-	DNS_REC_CNAME = 28,
-	DNS_REC_ALL = 255
-};
-
-
-// DNS record class
-enum dns_class {
-	DNS_CL_IN = 1,
-	DNS_CL_CH = 3,
-	DNS_CL_HS = 4,
-	DNS_CL_NONE = 254,
-	DNS_CL_ANY = 255
-};
-
-
-/*
- * DNS header
+ * DNS client sending the query straight to the
+ * server with the stub resolver (no getaddrinfo())
  *
- * @id Message ID
- * @qr Message type (query - 0, response - 1)
- * @opcode Query type
- * @aa Authoritative answer (response)
- * @tc Truncated (response)
- * @rd Recursion desired (query)
- * @ra Recursion supported (response)
- * @z Reserved
- * @rcode Error code (response)
- * @qdcount Questions number (query)
- * @ancount Answers number (response)
- * @nscount Nameservers number (response)
- * @arcount Additional records number (response)
+ * Copyright (C) 2025 Semyon Nadutkin
  */
-struct dns_header {
-	uint16_t id;
-
-	unsigned char qr : 1;
-	enum dns_opcode opcode : 4;
-	unsigned char aa : 1;
-	unsigned char tc : 1;
-	unsigned char rd : 1;
-	unsigned char ra : 1;
-	unsigned char z : 3;
-	enum dns_rcode rcode : 4;
-
-	uint16_t qdcount;
-	uint16_t ancount;
-	uint16_t nscount;
-	uint16_t arcount;
-};
 
 
-/*
- * DNS question
- *
- * @name Requested domain name
- * @qtype Requested record type
- * @qclass Requested records class
- */
-struct dns_question {
-	char name[DNS_MAX_NAME_LEN + 1];
-
-	enum dns_record qtype : 16;
-	enum dns_class qclass : 16;
-};
+#include "headers/cross_platform_sockets.h"
+#include "headers/dns_codecs.h"
+#include "headers/dns_resolvers.h"
+#include <stdio.h> // logging
+#include <stdlib.h> // EXIT_FAILURE, EXIT_SUCCESS
 
 
-/*
- * DNS answer
- *
- * @name Requested domain name
- * @qtype Requested record type
- * @qclass Requested records class
- * @ttl Time-to-live
- * @rdlength Length of the "rdata" field
- * @rdata Data associated with the record
- */
-struct dns_answer {
-	char name[DNS_MAX_NAME_LEN + 1];
-	size_t namelen;
-
-	enum dns_record type : 16;
-	enum dns_class class : 16;
-	uint32_t ttl;
-
-	uint16_t rdlength;
-	const char* rdata;
-};
-
-
-struct dns_authority {
-	void* data;
+// Names of the error codes
+static const char* dns_rcode_names[] = {
+	"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"
 };
 
 
-struct dns_additional {
-	void* data;
-};
+// Prints the record data in the presentation format
+void print_rdata(const struct dns_answer* ans)
+{
+	char addr[MAX_ADDRBUF_LEN];
+
+	switch (ans->type) {
+	case DNS_REC_A:
+		inet_ntop(AF_INET, ans->rd.a, addr, sizeof(addr));
+		printf("%s", addr);
+		break;
+	case DNS_REC_AAAA:
+		inet_ntop(AF_INET6, ans->rd.aaaa, addr, sizeof(addr));
+		printf("%s", addr);
+		break;
+	case DNS_REC_CNAME:
+	case DNS_REC_NS:
+	case DNS_REC_PTR:
+		printf("%s", ans->rd.name);
+		break;
+	case DNS_REC_MX:
+		printf("%u %s", ans->rd.mx.pref, ans->rd.mx.exchange);
+		break;
+	case DNS_REC_SOA:
+		printf("serial %u minimum %u", ans->rd.soa.serial,
+			ans->rd.soa.minimum);
+		break;
+	case DNS_REC_TXT: {
+		size_t pos = 0;
+		const uint8_t* str = NULL;
+		uint8_t len = 0;
+		while (!dns_read_txt(ans, &pos, &str, &len)) {
+			printf("\"%.*s\" ", (int) len, (const char*) str);
+		}
+		break;
+	}
+	default:
+		printf("(%u bytes)", ans->rdlength);
+		break;
+	}
+}
 
 
-struct dns_message {
-	struct dns_header header;
-	struct dns_question question;
-	struct dns_answer answer;
-	struct dns_authority authority;
-	struct dns_additional additional;
-};
+// Prints the records of the response
+void print_response(void* data, const enum dns_status status,
+	const uint8_t* resp, const size_t len)
+{
+	int* ret = (int*) data;
+	*ret = EXIT_FAILURE;
+
+	if (status != DNS_ST_OK) {
+		fprintf(stderr, "Query failed: %s\n",
+			status == DNS_ST_TIMEOUT ? "timed out" : "network error");
+		return;
+	}
+
+	struct dns_reader r = { 0 };
+	dns_reader_init(&r, resp, len);
+
+	struct dns_header hdr = { 0 };
+	struct dns_question q = { 0 };
+	if (dns_read_header(&r, &hdr) || dns_read_question(&r, &q)) {
+		fprintf(stderr, "Malformed response\n");
+		return;
+	}
+
+	unsigned rcode = hdr.rcode;
+	printf("Status: %s\n", rcode < sizeof(dns_rcode_names)
+		/ sizeof(dns_rcode_names[0]) ? dns_rcode_names[rcode] : "?");
+
+	// Answer, authority, additional sections
+	size_t count = (size_t) hdr.ancount + hdr.nscount + hdr.arcount;
+	for (size_t i = 0; i < count; ++i) {
+		struct dns_answer ans = { 0 };
+		if (dns_read_answer(&r, &ans)) {
+			fprintf(stderr, "Malformed record\n");
+			return;
+		}
+		if (ans.type == DNS_REC_OPT) continue;
+
+		const char* type = dns_record_to_str(ans.type);
+		printf("\t%s\t%u\t%s\t", ans.name, ans.ttl, type ? type : "?");
+		print_rdata(&ans);
+		printf("\n");
+	}
+
+	*ret = EXIT_SUCCESS;
+}
 
 
-int dns_client(void)
+// Resolves the "name" at the "server"
+int dns_client(const char* server, const char* port, const char* name,
+	const enum dns_record qtype)
 {
-
-	return EXIT_SUCCESS;
+	int sup_res = sockets_startup();
+	if (sup_res) return sup_res;
+
+	struct dns_resolver* res = (struct dns_resolver*) malloc(
+		sizeof(struct dns_resolver));
+	if (!res) goto out_failure_sockets_cleanup;
+
+	if (dns_resolver_init(res, server, port)) goto out_failure_free;
+
+	int ret = EXIT_FAILURE;
+	if (dns_resolve(res, name, qtype, print_response, &ret)) {
+		fprintf(stderr, "Failed to send the query\n");
+		dns_resolver_cleanup(res);
+		goto out_failure_free;
+	}
+
+	while (res->npending) {
+		if (dns_resolver_wait(res)) break;
+	}
+
+	dns_resolver_cleanup(res);
+	free(res);
+	sockets_cleanup();
+	return ret;
+
+out_failure_free:
+	free(res);
+out_failure_sockets_cleanup:
+	sockets_cleanup();
+	return EXIT_FAILURE;
 }
 
 
-int main(void)
+int main(const int argc, const char* argv[])
 {
-	return dns_client();
+	// { [executable name], [server], [name], ([type]), ([port]) }
+	if (argc < 3 || 5 < argc) {
+		const char* exec_name = argv[0];
+		printf("Usage: %s [SERVER] [NAME] [TYPE (A)] [PORT (53)]\n",
+			exec_name);
+		return EXIT_FAILURE;
+	}
+
+	enum dns_record qtype = DNS_REC_A;
+	if (3 < argc) {
+		qtype = dns_str_to_record(argv[3]);
+		if (!qtype) {
+			fprintf(stderr, "Unknown record type: %s\n", argv[3]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	const char* port = (4 < argc ? argv[4] : "53");
+	return dns_client(argv[1], port, argv[2], qtype);
 }
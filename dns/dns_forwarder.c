@@ -0,0 +1,1071 @@
+/*
+ * Caching DNS forwarder: answers UDP and TCP
+ * queries from the cache, forwards the misses
+ * to the upstream servers with the stub resolver
+ *
+ * Identical queries in flight are coalesced:
+ * a burst of the same name makes one upstream query
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#ifdef __linux__
+	#define _GNU_SOURCE // recvmmsg(), sendmmsg()
+#endif // __linux__
+
+
+#include "headers/cross_platform_sockets.h"
+#include "headers/dns_codecs.h"
+#include "headers/dns_caches.h"
+#include "headers/dns_resolvers.h"
+#include <stdio.h> // logging
+#include <stdlib.h> // EXIT_FAILURE, EXIT_SUCCESS
+#include <signal.h> // signal()
+
+#ifndef _WIN32
+	#include <sys/time.h> // struct timeval
+#endif // !_WIN32
+
+
+#define FWD_BATCH 32			// datagrams per recvmmsg() / sendmmsg()
+#define FWD_RECV_BATCHES 8		// recvmmsg() calls per loop iteration
+#define FWD_MAX_QUERY_LEN 1232		// max UDP query length
+#define FWD_MAX_UDP_RESP DNS_EDNS_UDP_LEN // max UDP response length
+#define FWD_MAX_UPSTREAMS 4		// max upstream servers
+#define FWD_MAX_INFLIGHT (FWD_MAX_UPSTREAMS * DNS_MAX_PENDING)
+#define FWD_MAX_WAITERS 4096		// max clients waiting for upstreams
+#define FWD_MAX_TCP 64			// max TCP connections
+#define FWD_TCP_IDLE_MS 10000		// TCP idle timeout (RFC 7766)
+#define FWD_UDP_BUF_LEN (4 << 20)	// UDP socket buffers (bursts)
+
+#ifdef MSG_NOSIGNAL
+	#define FWD_SEND_FLAGS MSG_NOSIGNAL // no SIGPIPE on closed peers
+#else // MSG_NOSIGNAL
+	#define FWD_SEND_FLAGS 0
+#endif // !MSG_NOSIGNAL
+
+
+
+/*
+ * FORWARDER STATE
+ */
+
+
+
+/*
+ * Client waiting for the upstream response
+ *
+ * @tcp Client is connected over TCP
+ * @conn TCP connection index
+ * @conn_gen TCP connection generation (the slot may be reused)
+ * @addr UDP client address
+ * @addr_len Length of "addr"
+ * @id Message ID of the query
+ * @rd Recursion desired flag of the query
+ * @edns Query has the OPT record
+ * @udp_len Max UDP response length
+ * @question Encoded question of the query (case preserved)
+ * @qlen Length of "question"
+ * @next Next waiter of the same query
+ */
+struct fwd_waiter {
+	int tcp;
+	size_t conn;
+	uint64_t conn_gen;
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+
+	uint16_t id;
+	int rd;
+	int edns;
+	size_t udp_len;
+
+	uint8_t question[DNS_MAX_NAME_LEN + 6];
+	size_t qlen;
+
+	struct fwd_waiter* next;
+};
+
+
+/*
+ * Upstream query
+ *
+ * @used Slot is in use
+ * @hash Hash of the key
+ * @name Requested domain name (lowercase)
+ * @qtype Requested record type
+ * @upstream Index of the upstream queried
+ * @tries Upstreams queried
+ * @waiters Clients waiting for the response
+ * @next_parked Next query waiting for a free upstream slot
+ */
+struct fwd_inflight {
+	int used;
+	uint64_t hash;
+	char name[DNS_MAX_NAME_LEN + 1];
+	enum dns_record qtype;
+
+	size_t upstream;
+	size_t tries;
+
+	struct fwd_waiter* waiters;
+	struct fwd_inflight* next_parked;
+};
+
+
+/*
+ * TCP connection
+ *
+ * @sock Socket (INVALID_SOCKET if the slot is free)
+ * @gen Generation of the slot
+ * @in Received bytes
+ * @in_len Length of "in"
+ * @out Bytes to send
+ * @out_len Length of "out"
+ * @out_cap Capacity of "out"
+ * @last Last activity time (ms)
+ */
+struct fwd_tcp_conn {
+	SOCKET sock;
+	uint64_t gen;
+
+	uint8_t* in;
+	size_t in_len;
+
+	uint8_t* out;
+	size_t out_len;
+	size_t out_cap;
+
+	uint64_t last;
+};
+
+
+/*
+ * Forwarder
+ *
+ * @udp UDP socket
+ * @tcp Listening TCP socket
+ * @ups Resolvers of the upstreams
+ * @nups Number of upstreams
+ * @next_up Next upstream to query (round-robin)
+ * @cache Cache shared by the resolvers
+ * @inflight Upstream queries
+ * @parked Upstream queries waiting for a free upstream slot (FIFO)
+ * @parked_tail Last parked query
+ * @waiters Waiters pool
+ * @free_waiters Free waiters list
+ * @conns TCP connections
+ * @next_gen Generation of the next TCP connection
+ * @out UDP responses to send
+ * @out_len Lengths of the responses
+ * @out_addr Addresses of the responses
+ * @out_addr_len Lengths of the addresses
+ * @nout Number of the responses
+ * @in Received UDP queries
+ * @in_addr Addresses of the queries
+ * @queries Queries received
+ * @coalesced Queries attached to the ones in flight
+ * @failed Queries answered with SERVFAIL
+ * @dropped Queries dropped (malformed, no waiters left)
+ */
+struct forwarder {
+	SOCKET udp;
+	SOCKET tcp;
+
+	struct dns_resolver* ups[FWD_MAX_UPSTREAMS];
+	size_t nups;
+	size_t next_up;
+	struct dns_cache* cache;
+
+	struct fwd_inflight inflight[FWD_MAX_INFLIGHT];
+	struct fwd_inflight* parked;
+	struct fwd_inflight* parked_tail;
+	struct fwd_waiter waiters[FWD_MAX_WAITERS];
+	struct fwd_waiter* free_waiters;
+
+	struct fwd_tcp_conn conns[FWD_MAX_TCP];
+	uint64_t next_gen;
+
+	uint8_t out[FWD_BATCH][FWD_MAX_UDP_RESP];
+	size_t out_len[FWD_BATCH];
+	struct sockaddr_storage out_addr[FWD_BATCH];
+	socklen_t out_addr_len[FWD_BATCH];
+	size_t nout;
+
+	uint8_t in[FWD_BATCH][FWD_MAX_QUERY_LEN];
+	struct sockaddr_storage in_addr[FWD_BATCH];
+
+	size_t queries;
+	size_t coalesced;
+	size_t failed;
+	size_t dropped;
+};
+
+
+// Forwarder of the callbacks
+static struct forwarder* fwd = NULL;
+
+
+// Set by the signal handler
+static volatile sig_atomic_t stop_requested = 0;
+
+
+// Requests the forwarder to stop
+void handle_stop_signal(int sig)
+{
+	(void) sig;
+	stop_requested = 1;
+}
+
+
+
+/*
+ * UDP BATCHING
+ */
+
+
+
+// Sends the queued UDP responses
+void flush_udp_responses(struct forwarder* f)
+{
+	if (!f->nout) return;
+
+#ifdef __linux__
+	struct mmsghdr msgs[FWD_BATCH];
+	struct iovec iovs[FWD_BATCH];
+	memset(msgs, 0, sizeof(msgs));
+
+	for (size_t i = 0; i < f->nout; ++i) {
+		iovs[i].iov_base = f->out[i];
+		iovs[i].iov_len = f->out_len[i];
+		msgs[i].msg_hdr.msg_iov = &(iovs[i]);
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &(f->out_addr[i]);
+		msgs[i].msg_hdr.msg_namelen = f->out_addr_len[i];
+	}
+
+	// A failed datagram stops sendmmsg(), skip it
+	size_t sent = 0;
+	while (sent < f->nout) {
+		int res = sendmmsg(f->udp, msgs + sent,
+			(unsigned) (f->nout - sent), 0);
+		if (res < 0) {
+			if (errno == EINTR) continue;
+			++sent;
+			continue;
+		}
+		sent += (size_t) res;
+	}
+#else // __linux__
+	for (size_t i = 0; i < f->nout; ++i) {
+		sendto(f->udp, (const char*) f->out[i], (int) f->out_len[i], 0,
+			(struct sockaddr*) &(f->out_addr[i]), f->out_addr_len[i]);
+	}
+#endif // !__linux__
+
+	f->nout = 0;
+}
+
+
+// Gets the buffer for the next UDP response to the address
+uint8_t* queue_udp_response(struct forwarder* f,
+	const struct sockaddr_storage* addr, const socklen_t addr_len)
+{
+	if (FWD_BATCH <= f->nout) flush_udp_responses(f);
+
+	memcpy(&(f->out_addr[f->nout]), addr, addr_len);
+	f->out_addr_len[f->nout] = addr_len;
+	return f->out[f->nout];
+}
+
+
+// Commits the response written to the buffer of queue_udp_response()
+void commit_udp_response(struct forwarder* f, const size_t len)
+{
+	f->out_len[f->nout++] = len;
+}
+
+
+
+/*
+ * TCP CONNECTIONS
+ */
+
+
+
+// Closes the TCP connection
+void close_tcp_conn(struct fwd_tcp_conn* c)
+{
+	closesocket(c->sock);
+	free(c->in);
+	free(c->out);
+	memset(c, 0, sizeof(*c));
+	c->sock = INVALID_SOCKET;
+}
+
+
+// Sends the pending bytes, closes the connection on errors
+void flush_tcp_conn(struct fwd_tcp_conn* c)
+{
+	while (c->out_len) {
+		int sent = send(c->sock, (const char*) c->out, (int) c->out_len,
+			FWD_SEND_FLAGS);
+		if (sent < 0) {
+			if (socket_would_block()) return;
+			close_tcp_conn(c);
+			return;
+		}
+
+		memmove(c->out, c->out + sent, c->out_len - (size_t) sent);
+		c->out_len -= (size_t) sent;
+	}
+}
+
+
+// Queues the length-prefixed message to the TCP connection
+void send_tcp_message(struct fwd_tcp_conn* c, const uint8_t* msg,
+	const size_t len)
+{
+	size_t need = c->out_len + len + 2;
+	if (c->out_cap < need) {
+		size_t cap = (c->out_cap ? c->out_cap : 1024);
+		while (cap < need) cap *= 2;
+
+		uint8_t* out = (uint8_t*) realloc(c->out, cap);
+		if (!out) {
+			close_tcp_conn(c);
+			return;
+		}
+		c->out = out;
+		c->out_cap = cap;
+	}
+
+	c->out[c->out_len++] = (uint8_t) (len >> 8);
+	c->out[c->out_len++] = (uint8_t) len;
+	memcpy(c->out + c->out_len, msg, len);
+	c->out_len += len;
+
+	flush_tcp_conn(c);
+}
+
+
+
+/*
+ * RESPONSES
+ */
+
+
+
+/*
+ * Writes the response of the upstream for the waiter
+ *
+ * Description: the ID, the RD flag and the question (with
+ * its letter case) of the client are restored, the OPT record
+ * is removed for clients without EDNS, the responses larger
+ * than the client accepts (without the OPT record) are
+ * truncated to the question
+ *
+ * Returns:
+ *	- Response length
+ */
+size_t write_client_response(const struct fwd_waiter* w,
+	const uint8_t* resp, const size_t len, uint8_t* out, const size_t sz)
+{
+	size_t limit = (w->tcp ? DNS_MAX_MSG_LEN : w->udp_len);
+	if (sz < limit) limit = sz;
+
+	struct dns_reader r = { 0 };
+	dns_reader_init(&r, resp, len);
+	struct dns_header hdr = { 0 };
+	struct dns_question q = { 0 };
+	dns_read_header(&r, &hdr);
+	int question_ok = (!dns_read_question(&r, &q)
+		&& r.pos - DNS_HEADER_LEN == w->qlen);
+
+	// No OPT record for clients without EDNS (RFC 6891), removed
+	// before the size check: the rest of the response may fit
+	size_t out_len = len;
+	if (!w->edns && question_ok) {
+		size_t count = (size_t) hdr.ancount + hdr.nscount + hdr.arcount;
+		for (size_t i = 0; i < count; ++i) {
+			size_t start = r.pos;
+			struct dns_answer ans = { 0 };
+			if (dns_read_answer(&r, &ans)) break;
+
+			if (ans.type == DNS_REC_OPT && r.pos == len) {
+				out_len = start;
+				--hdr.arcount;
+			}
+		}
+	}
+
+	memcpy(out, resp, (out_len <= limit ? out_len : DNS_HEADER_LEN));
+	if (out_len <= limit) {
+		out[10] = (uint8_t) (hdr.arcount >> 8);
+		out[11] = (uint8_t) hdr.arcount;
+
+		// Echo the question of the client
+		if (question_ok) {
+			memcpy(out + DNS_HEADER_LEN, w->question, w->qlen);
+		}
+	}
+
+	// Too large: the question only, TC set
+	if (limit < out_len) {
+		memset(out + 4, 0, 8);
+		out[5] = 1; // QDCOUNT
+		out[2] |= 0x02; // TC
+		memcpy(out + DNS_HEADER_LEN, w->question, w->qlen);
+		out_len = DNS_HEADER_LEN + w->qlen;
+	}
+
+	// ID and RD of the client
+	out[0] = (uint8_t) (w->id >> 8);
+	out[1] = (uint8_t) w->id;
+	out[2] = (uint8_t) ((out[2] & ~0x01) | (w->rd ? 0x01 : 0x00));
+
+	return out_len;
+}
+
+
+// Writes an error response with the question of the waiter
+size_t write_error_response(const struct fwd_waiter* w,
+	const enum dns_rcode rcode, uint8_t* out)
+{
+	memset(out, 0, DNS_HEADER_LEN);
+	out[0] = (uint8_t) (w->id >> 8);
+	out[1] = (uint8_t) w->id;
+	out[2] = (uint8_t) (0x80 | (w->rd ? 0x01 : 0x00)); // QR, RD
+	out[3] = (uint8_t) (0x80 | rcode); // RA, RCODE
+	out[5] = (w->qlen ? 1 : 0); // QDCOUNT
+
+	memcpy(out + DNS_HEADER_LEN, w->question, w->qlen);
+	return DNS_HEADER_LEN + w->qlen;
+}
+
+
+// Sends the response (or the error if "resp" is NULL) to the waiter
+void answer_waiter(struct forwarder* f, const struct fwd_waiter* w,
+	const uint8_t* resp, const size_t len, const enum dns_rcode rcode)
+{
+	if (!w->tcp) {
+		uint8_t* out = queue_udp_response(f, &(w->addr), w->addr_len);
+		size_t out_len = (resp
+			? write_client_response(w, resp, len, out, FWD_MAX_UDP_RESP)
+			: write_error_response(w, rcode, out));
+		commit_udp_response(f, out_len);
+		return;
+	}
+
+	// The connection may be closed while the query was in flight
+	struct fwd_tcp_conn* c = &(f->conns[w->conn]);
+	if (!validate_socket(c->sock) || c->gen != w->conn_gen) return;
+
+	if (!resp) {
+		uint8_t out[DNS_HEADER_LEN + sizeof(w->question)];
+		send_tcp_message(c, out, write_error_response(w, rcode, out));
+		return;
+	}
+
+	uint8_t* out = (uint8_t*) malloc(len);
+	if (!out) return;
+	send_tcp_message(c, out, write_client_response(w, resp, len, out, len));
+	free(out);
+}
+
+
+
+/*
+ * FORWARDING
+ */
+
+
+
+// Queries the upstreams until one accepts the query
+void forward_inflight(struct forwarder* f, struct fwd_inflight* inf);
+
+
+// Answers the waiters of the upstream query and frees it
+void complete_inflight(void* data, const enum dns_status status,
+	const uint8_t* resp, const size_t len)
+{
+	struct fwd_inflight* inf = (struct fwd_inflight*) data;
+
+	// Failover to the next upstream
+	if (status != DNS_ST_OK && status != DNS_ST_CANCELLED
+		&& inf->tries < fwd->nups) {
+		forward_inflight(fwd, inf);
+		return;
+	}
+
+	if (status != DNS_ST_OK) ++fwd->failed;
+
+	struct fwd_waiter* w = inf->waiters;
+	while (w) {
+		answer_waiter(fwd, w, (status == DNS_ST_OK ? resp : NULL), len,
+			DNS_RC_SFAIL);
+
+		struct fwd_waiter* next = w->next;
+		w->next = fwd->free_waiters;
+		fwd->free_waiters = w;
+		w = next;
+	}
+
+	memset(inf, 0, sizeof(*inf));
+}
+
+
+// Checks if every upstream has the maximum of queries in flight
+int upstreams_full(const struct forwarder* f)
+{
+	for (size_t i = 0; i < f->nups; ++i) {
+		if (f->ups[i]->npending < DNS_MAX_PENDING) return 0;
+	}
+
+	return 1;
+}
+
+
+void forward_inflight(struct forwarder* f, struct fwd_inflight* inf)
+{
+	while (inf->tries < f->nups) {
+		// Wait for a free slot instead of failing the query
+		if (upstreams_full(f)) {
+			inf->next_parked = NULL;
+			if (f->parked_tail) f->parked_tail->next_parked = inf;
+			else f->parked = inf;
+			f->parked_tail = inf;
+			return;
+		}
+
+		// Busy upstreams are skipped without using up the tries
+		inf->upstream = f->next_up;
+		f->next_up = (f->next_up + 1) % f->nups;
+		if (DNS_MAX_PENDING <= f->ups[inf->upstream]->npending) continue;
+		++inf->tries;
+
+		// Cache hits complete "inf" right away
+		if (!dns_resolve(f->ups[inf->upstream], inf->name, inf->qtype,
+			complete_inflight, inf)) {
+			return;
+		}
+	}
+
+	// No upstream accepted the query
+	inf->tries = f->nups;
+	complete_inflight(inf, DNS_ST_NET_ERR, NULL, 0);
+}
+
+
+// Forwards the parked queries while the upstreams have free slots
+void forward_parked(struct forwarder* f)
+{
+	while (f->parked && !upstreams_full(f)) {
+		struct fwd_inflight* inf = f->parked;
+		f->parked = inf->next_parked;
+		if (!f->parked) f->parked_tail = NULL;
+
+		forward_inflight(f, inf);
+	}
+}
+
+
+/*
+ * Parses the query of the client into the waiter
+ *
+ * Returns:
+ *	- Valid query: DNS_RC_NO_ERR
+ *	- Invalid query: error code to answer with
+ *	- Not a query: -EXIT_FAILURE (dropped)
+ */
+int parse_client_query(const uint8_t* msg, const size_t len,
+	struct fwd_waiter* w, struct dns_question* q)
+{
+	struct dns_reader r = { 0 };
+	dns_reader_init(&r, msg, len);
+
+	struct dns_header hdr = { 0 };
+	if (dns_read_header(&r, &hdr) || hdr.qr) return -EXIT_FAILURE;
+
+	w->id = hdr.id;
+	w->rd = hdr.rd;
+	w->qlen = 0;
+	w->edns = 0;
+	w->udp_len = DNS_MAX_UDP_LEN;
+
+	if (hdr.opcode != DNS_OPC_STD) return DNS_RC_NIMPL;
+	if (hdr.qdcount != 1 || dns_read_question(&r, q)) return DNS_RC_FMT_ERR;
+
+	// Question of the client for the responses
+	struct dns_writer wr = { 0 };
+	dns_writer_init(&wr, w->question, sizeof(w->question));
+	if (dns_write_question(&wr, q)) return DNS_RC_FMT_ERR;
+	w->qlen = wr.len;
+
+	// EDNS payload size of the client
+	size_t count = (size_t) hdr.ancount + hdr.nscount + hdr.arcount;
+	for (size_t i = 0; i < count; ++i) {
+		struct dns_answer ans = { 0 };
+		if (dns_read_answer(&r, &ans)) return DNS_RC_FMT_ERR;
+		if (ans.type != DNS_REC_OPT) continue;
+
+		w->edns = 1;
+		size_t udp_len = (size_t) ans.class;
+		if (DNS_MAX_UDP_LEN < udp_len) w->udp_len = udp_len;
+		if (FWD_MAX_UDP_RESP < w->udp_len) w->udp_len = FWD_MAX_UDP_RESP;
+	}
+
+	if (q->qclass != DNS_CL_IN) return DNS_RC_REFUSED;
+	return DNS_RC_NO_ERR;
+}
+
+
+// Handles the query of a UDP client (tcp = 0) or a TCP connection
+void handle_client_query(struct forwarder* f, const uint8_t* msg,
+	const size_t len, const int tcp, const size_t conn,
+	const struct sockaddr_storage* addr, const socklen_t addr_len)
+{
+	++f->queries;
+
+	struct fwd_waiter* w = f->free_waiters;
+	if (!w) {
+		++f->dropped; // the client retries
+		return;
+	}
+
+	w->tcp = tcp;
+	w->conn = conn;
+	w->conn_gen = (tcp ? f->conns[conn].gen : 0);
+	if (addr) memcpy(&(w->addr), addr, addr_len);
+	w->addr_len = addr_len;
+
+	struct dns_question q = { 0 };
+	int rcode = parse_client_query(msg, len, w, &q);
+	if (rcode < 0) {
+		++f->dropped;
+		return;
+	}
+	if (rcode != DNS_RC_NO_ERR) {
+		answer_waiter(f, w, NULL, 0, (enum dns_rcode) rcode);
+		return;
+	}
+
+	f->free_waiters = w->next;
+	w->next = NULL;
+
+	// Coalesce with the identical query in flight
+	char lname[DNS_MAX_NAME_LEN + 1];
+	normalize_dns_name(q.name, lname);
+	uint64_t hash = hash_dns_key(lname, q.qtype, DNS_CL_IN);
+
+	struct fwd_inflight* free_inf = NULL;
+	for (size_t i = 0; i < FWD_MAX_INFLIGHT; ++i) {
+		struct fwd_inflight* inf = &(f->inflight[i]);
+		if (!inf->used) {
+			if (!free_inf) free_inf = inf;
+			continue;
+		}
+
+		if (inf->hash == hash && inf->qtype == q.qtype
+			&& !strcmp(inf->name, lname)) {
+			w->next = inf->waiters;
+			inf->waiters = w;
+			++f->coalesced;
+			return;
+		}
+	}
+
+	if (!free_inf) {
+		answer_waiter(f, w, NULL, 0, DNS_RC_SFAIL);
+		w->next = f->free_waiters;
+		f->free_waiters = w;
+		++f->failed;
+		return;
+	}
+
+	free_inf->used = 1;
+	free_inf->hash = hash;
+	strcpy(free_inf->name, lname);
+	free_inf->qtype = q.qtype;
+	free_inf->tries = 0;
+	free_inf->waiters = w;
+
+	forward_inflight(f, free_inf);
+}
+
+
+
+/*
+ * SOCKETS
+ */
+
+
+
+// Starts the dual stack non-blocking server socket on the port
+SOCKET start_dns_server(const char* port, const int socktype)
+{
+	struct addrinfo hints = { 0 };
+	hints.ai_family = AF_INET6;
+	hints.ai_socktype = socktype;
+	hints.ai_flags = AI_PASSIVE;
+
+	struct addrinfo* addr = NULL;
+	if (getaddrinfo(NULL, port, &hints, &addr)) {
+		psockerror("getaddrinfo() failed");
+		return INVALID_SOCKET;
+	}
+
+	SOCKET s = socket(addr->ai_family, addr->ai_socktype,
+		addr->ai_protocol);
+	if (!validate_socket(s)) {
+		psockerror("socket() failed");
+		freeaddrinfo(addr);
+		return INVALID_SOCKET;
+	}
+
+	int opt = 0;
+	if (setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, (const char*) &opt,
+		sizeof(opt))) {
+		psockerror("Failed to make dual stack");
+	}
+
+	opt = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*) &opt,
+		sizeof(opt));
+
+	// Default buffers overflow on bursts of queries
+	if (socktype == SOCK_DGRAM) {
+		opt = FWD_UDP_BUF_LEN;
+		setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*) &opt,
+			sizeof(opt));
+		setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char*) &opt,
+			sizeof(opt));
+	}
+
+	int res = bind(s, addr->ai_addr, addr->ai_addrlen);
+	freeaddrinfo(addr);
+	if (res) {
+		psockerror("bind() failed");
+		goto out_failure_close;
+	}
+
+	if (socktype == SOCK_STREAM && listen(s, MAX_CONN)) {
+		psockerror("listen() failed");
+		goto out_failure_close;
+	}
+
+	if (set_socket_nonblocking(s)) {
+		psockerror("Failed to make the socket non-blocking");
+		goto out_failure_close;
+	}
+
+	return s;
+
+out_failure_close:
+	closesocket(s);
+	return INVALID_SOCKET;
+}
+
+
+// Receives and handles the UDP queries in batches
+void receive_udp_queries(struct forwarder* f)
+{
+	for (int batch = 0; batch < FWD_RECV_BATCHES; ++batch) {
+#ifdef __linux__
+		struct mmsghdr msgs[FWD_BATCH];
+		struct iovec iovs[FWD_BATCH];
+		memset(msgs, 0, sizeof(msgs));
+
+		for (size_t i = 0; i < FWD_BATCH; ++i) {
+			iovs[i].iov_base = f->in[i];
+			iovs[i].iov_len = FWD_MAX_QUERY_LEN;
+			msgs[i].msg_hdr.msg_iov = &(iovs[i]);
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &(f->in_addr[i]);
+			msgs[i].msg_hdr.msg_namelen = sizeof(f->in_addr[i]);
+		}
+
+		int rcvd = recvmmsg(f->udp, msgs, FWD_BATCH, MSG_DONTWAIT, NULL);
+		if (rcvd <= 0) return;
+
+		for (int i = 0; i < rcvd; ++i) {
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				++f->dropped;
+				continue;
+			}
+
+			handle_client_query(f, f->in[i], msgs[i].msg_len, 0, 0,
+				&(f->in_addr[i]), msgs[i].msg_hdr.msg_namelen);
+		}
+
+		if (rcvd < FWD_BATCH) return;
+#else // __linux__
+		socklen_t addr_len = sizeof(f->in_addr[0]);
+		int rcvd = recvfrom(f->udp, (char*) f->in[0], FWD_MAX_QUERY_LEN,
+			0, (struct sockaddr*) &(f->in_addr[0]), &addr_len);
+		if (rcvd <= 0) return;
+
+		handle_client_query(f, f->in[0], (size_t) rcvd, 0, 0,
+			&(f->in_addr[0]), addr_len);
+#endif // !__linux__
+	}
+}
+
+
+// Accepts the TCP connection
+void accept_tcp_conn(struct forwarder* f)
+{
+	SOCKET s = accept(f->tcp, NULL, NULL);
+	if (!validate_socket(s)) return;
+
+	struct fwd_tcp_conn* c = NULL;
+	for (size_t i = 0; i < FWD_MAX_TCP && !c; ++i) {
+		if (!validate_socket(f->conns[i].sock)) c = &(f->conns[i]);
+	}
+
+	if (!c || set_socket_nonblocking(s)) {
+		closesocket(s);
+		return;
+	}
+
+	c->in = (uint8_t*) malloc(DNS_MAX_MSG_LEN + 2);
+	if (!c->in) {
+		closesocket(s);
+		return;
+	}
+
+	c->sock = s;
+	c->gen = ++f->next_gen;
+	c->last = dns_now_ms();
+}
+
+
+// Receives the length-prefixed queries of the TCP connection
+void receive_tcp_queries(struct forwarder* f, const size_t conn)
+{
+	struct fwd_tcp_conn* c = &(f->conns[conn]);
+
+	int rcvd = recv(c->sock, (char*) c->in + c->in_len,
+		(int) (DNS_MAX_MSG_LEN + 2 - c->in_len), 0);
+	if (rcvd <= 0) {
+		if (rcvd < 0 && socket_would_block()) return;
+		close_tcp_conn(c);
+		return;
+	}
+
+	c->in_len += (size_t) rcvd;
+	c->last = dns_now_ms();
+
+	// Pipelined queries (RFC 7766)
+	while (2 <= c->in_len) {
+		size_t len = ((size_t) c->in[0] << 8) | c->in[1];
+		if (c->in_len < len + 2) return;
+
+		handle_client_query(f, c->in + 2, len, 1, conn, NULL, 0);
+		if (!validate_socket(c->sock)) return; // closed on error
+
+		memmove(c->in, c->in + len + 2, c->in_len - len - 2);
+		c->in_len -= len + 2;
+	}
+}
+
+
+// Gets the upstream address and port from "ADDR" or "ADDR#PORT"
+void split_upstream(const char* spec, char* addr, const size_t sz,
+	const char** port)
+{
+	const char* sep = strchr(spec, '#');
+	size_t len = (sep ? (size_t) (sep - spec) : strlen(spec));
+	if (sz <= len) len = sz - 1;
+
+	memcpy(addr, spec, len);
+	addr[len] = '\0';
+	*port = (sep ? sep + 1 : "53");
+}
+
+
+
+/*
+ * MAIN LOOP
+ */
+
+
+
+// Waits for the sockets and handles them
+int run_forwarder_iteration(struct forwarder* f)
+{
+	fd_set rfds, wfds;
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+
+	SOCKET max_fd = (f->udp < f->tcp ? f->tcp : f->udp);
+	FD_SET(f->udp, &rfds);
+	FD_SET(f->tcp, &rfds);
+
+	int timeout = FWD_TCP_IDLE_MS;
+	for (size_t i = 0; i < f->nups; ++i) {
+		SOCKET up_fd = dns_resolver_fds(f->ups[i], &rfds, &wfds);
+		if (max_fd < up_fd) max_fd = up_fd;
+
+		int up_timeout = dns_resolver_timeout(f->ups[i]);
+		if (0 <= up_timeout && up_timeout < timeout) timeout = up_timeout;
+	}
+
+	for (size_t i = 0; i < FWD_MAX_TCP; ++i) {
+		struct fwd_tcp_conn* c = &(f->conns[i]);
+		if (!validate_socket(c->sock)) continue;
+
+		FD_SET(c->sock, &rfds);
+		if (c->out_len) FD_SET(c->sock, &wfds);
+		if (max_fd < c->sock) max_fd = c->sock;
+	}
+
+	struct timeval tv = { 0 };
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	if (select((int) max_fd + 1, &rfds, &wfds, NULL, &tv) < 0) {
+		if (sockerrno() == EINTR) return EXIT_SUCCESS;
+		psockerror("select() failed");
+		return EXIT_FAILURE;
+	}
+
+	if (FD_ISSET(f->udp, &rfds)) receive_udp_queries(f);
+	if (FD_ISSET(f->tcp, &rfds)) accept_tcp_conn(f);
+
+	uint64_t now = dns_now_ms();
+	for (size_t i = 0; i < FWD_MAX_TCP; ++i) {
+		struct fwd_tcp_conn* c = &(f->conns[i]);
+		if (!validate_socket(c->sock)) continue;
+
+		if (FD_ISSET(c->sock, &wfds)) flush_tcp_conn(c);
+		if (validate_socket(c->sock) && FD_ISSET(c->sock, &rfds)) {
+			receive_tcp_queries(f, i);
+		}
+
+		if (validate_socket(c->sock) && !c->out_len
+			&& FWD_TCP_IDLE_MS <= now - c->last) {
+			close_tcp_conn(c);
+		}
+	}
+
+	// Upstream responses and retransmissions
+	for (size_t i = 0; i < f->nups; ++i) {
+		dns_resolver_process(f->ups[i]);
+	}
+	forward_parked(f);
+
+	flush_udp_responses(f);
+	return EXIT_SUCCESS;
+}
+
+
+// Frees the forwarder
+void cleanup_forwarder(struct forwarder* f)
+{
+	for (size_t i = 0; i < f->nups; ++i) {
+		dns_resolver_cleanup(f->ups[i]);
+		free(f->ups[i]);
+	}
+	flush_udp_responses(f);
+
+	for (size_t i = 0; i < FWD_MAX_TCP; ++i) {
+		if (validate_socket(f->conns[i].sock)) {
+			close_tcp_conn(&(f->conns[i]));
+		}
+	}
+
+	if (f->cache) {
+		dns_cache_cleanup(f->cache);
+		free(f->cache);
+	}
+
+	if (validate_socket(f->udp)) closesocket(f->udp);
+	if (validate_socket(f->tcp)) closesocket(f->tcp);
+	free(f);
+}
+
+
+// Runs the forwarder until SIGINT / SIGTERM
+int dns_forwarder(const char* port, const char** upstreams,
+	const size_t nups)
+{
+	int sup_res = sockets_startup();
+	if (sup_res) return sup_res;
+
+	int ret = EXIT_FAILURE;
+	fwd = (struct forwarder*) calloc(1, sizeof(struct forwarder));
+	if (!fwd) goto out_sockets_cleanup;
+
+	fwd->tcp = INVALID_SOCKET;
+	for (size_t i = 0; i < FWD_MAX_TCP; ++i) {
+		fwd->conns[i].sock = INVALID_SOCKET;
+	}
+	for (size_t i = 0; i < FWD_MAX_WAITERS; ++i) {
+		fwd->waiters[i].next = fwd->free_waiters;
+		fwd->free_waiters = &(fwd->waiters[i]);
+	}
+
+	fwd->udp = start_dns_server(port, SOCK_DGRAM);
+	if (!validate_socket(fwd->udp)) goto out_cleanup_forwarder;
+	fwd->tcp = start_dns_server(port, SOCK_STREAM);
+	if (!validate_socket(fwd->tcp)) goto out_cleanup_forwarder;
+
+	fwd->cache = (struct dns_cache*) malloc(sizeof(struct dns_cache));
+	if (!fwd->cache) goto out_cleanup_forwarder;
+	dns_cache_init(fwd->cache);
+
+	for (size_t i = 0; i < nups; ++i) {
+		char addr[MAX_ADDRBUF_LEN];
+		const char* up_port = NULL;
+		split_upstream(upstreams[i], addr, sizeof(addr), &up_port);
+
+		fwd->ups[i] = (struct dns_resolver*) malloc(
+			sizeof(struct dns_resolver));
+		if (!fwd->ups[i]) goto out_cleanup_forwarder;
+
+		if (dns_resolver_init(fwd->ups[i], addr, up_port)) {
+			free(fwd->ups[i]);
+			goto out_cleanup_forwarder;
+		}
+		fwd->ups[i]->cache = fwd->cache;
+		++fwd->nups;
+	}
+
+	signal(SIGINT, handle_stop_signal);
+	signal(SIGTERM, handle_stop_signal);
+	printf("Forwarding port %s to %zu upstream(s)\n", port, nups);
+
+	while (!stop_requested) {
+		if (run_forwarder_iteration(fwd)) goto out_cleanup_forwarder;
+	}
+
+	printf("%zu queries: %zu cache hits, %zu stale, %zu coalesced, "
+		"%zu forwarded, %zu failed, %zu dropped\n", fwd->queries,
+		fwd->cache->hits, fwd->cache->stale_hits, fwd->coalesced,
+		fwd->cache->misses, fwd->failed, fwd->dropped);
+	ret = EXIT_SUCCESS;
+
+out_cleanup_forwarder:
+	cleanup_forwarder(fwd);
+	fwd = NULL;
+out_sockets_cleanup:
+	sockets_cleanup();
+	return ret;
+}
+
+
+int main(const int argc, const char* argv[])
+{
+	// { [executable name], [port], [upstream], ... }
+	if (argc < 3 || FWD_MAX_UPSTREAMS + 2 < argc) {
+		const char* exec_name = argv[0];
+		printf("Usage: %s [PORT] [UPSTREAM[#PORT]] ... (max %d)\n",
+			exec_name, FWD_MAX_UPSTREAMS);
+		return EXIT_FAILURE;
+	}
+
+	return dns_forwarder(argv[1], argv + 2, (size_t) (argc - 2));
+}
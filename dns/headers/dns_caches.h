@@ -0,0 +1,156 @@
+/*
+ * File: dns_caches.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: TTL-aware cache of DNS responses
+ * with negative caching (RFC 2308) and serving
+ * stale data while refreshing (RFC 8767)
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include "dns_codecs.h"		// struct dns_reader, ...
+
+
+#define DNS_CACHE_SLOTS 1024		// hash table slots (power of 2)
+#define DNS_CACHE_MAX_ENTRIES 768	// max entries (75% of the slots)
+#define DNS_CACHE_MAX_TTL 86400		// max positive TTL (s)
+#define DNS_CACHE_MAX_NEG_TTL 10800	// max negative TTL (s, RFC 2308)
+#define DNS_CACHE_STALE_TTL 30		// TTL of stale records (s, RFC 8767)
+#define DNS_CACHE_DEF_STALE_SEC 86400	// default stale data lifetime (s)
+#define DNS_CACHE_REFRESH_MS 5000	// time given to a refresh (ms)
+
+
+/*
+ * Cache lookup result
+ *
+ * @DNS_CACHE_MISS Nothing cached
+ * @DNS_CACHE_HIT Fresh response
+ * @DNS_CACHE_STALE Expired response, the refresh is in progress
+ * @DNS_CACHE_REFRESH Expired response, the caller must refresh it
+ */
+enum dns_cache_result {
+	DNS_CACHE_MISS = 0,
+	DNS_CACHE_HIT = 1,
+	DNS_CACHE_STALE = 2,
+	DNS_CACHE_REFRESH = 3
+};
+
+
+/*
+ * Cached response
+ *
+ * @used Slot is in use
+ * @hash Hash of the key
+ * @name Requested domain name (lowercase)
+ * @qtype Requested record type
+ * @qclass Requested records class
+ * @msg Response message
+ * @len Response length
+ * @negative Response is NXDOMAIN / NODATA
+ * @stored Time the response was stored (ms)
+ * @expires Time the response becomes stale (ms)
+ * @refresh Time the refresh was requested (ms, 0 if none)
+ * @heap_pos Position in the expiry heap
+ */
+struct dns_cache_entry {
+	int used;
+	uint64_t hash;
+
+	char name[DNS_MAX_NAME_LEN + 1];
+	uint16_t qtype;
+	uint16_t qclass;
+
+	uint8_t* msg;
+	size_t len;
+	int negative;
+
+	uint64_t stored;
+	uint64_t expires;
+	uint64_t refresh;
+	size_t heap_pos;
+};
+
+
+/*
+ * Responses cache
+ *
+ * @slots Open addressing hash table (linear probing)
+ * @heap Min-heap of the slot indices by removal time
+ * @count Number of entries
+ * @stale_ms Time expired responses are kept (0 - never served)
+ * @hits Fresh responses served
+ * @stale_hits Stale responses served
+ * @misses Lookups without a response
+ */
+struct dns_cache {
+	struct dns_cache_entry slots[DNS_CACHE_SLOTS];
+	size_t heap[DNS_CACHE_MAX_ENTRIES];
+	size_t count;
+
+	uint64_t stale_ms;
+
+	size_t hits;
+	size_t stale_hits;
+	size_t misses;
+};
+
+
+// Writes the lowercase name without the trailing dot
+// ("lname" is DNS_MAX_NAME_LEN + 1 bytes)
+void normalize_dns_name(const char* name, char* lname);
+
+
+// Hashes the normalized key
+uint64_t hash_dns_key(const char* lname, const uint16_t qtype,
+	const uint16_t qclass);
+
+
+// Initializes the cache
+void dns_cache_init(struct dns_cache* cache);
+
+
+/*
+ * Looks the response up
+ *
+ * @cache Cache
+ * @name Requested domain name
+ * @qtype Requested record type
+ * @qclass Requested records class
+ * @now Current monotonic time (ms)
+ * @buf Buffer for the response, its TTLs are decreased
+ *	by the time spent in the cache (the ID is left to the caller)
+ * @sz Buffer size
+ * @len Response length
+ */
+enum dns_cache_result dns_cache_get(struct dns_cache* cache,
+	const char* name, const uint16_t qtype, const uint16_t qclass,
+	const uint64_t now, uint8_t* buf, const size_t sz, size_t* len);
+
+
+/*
+ * Stores the response
+ *
+ * Description: positive responses live for the min TTL
+ * of the answers, NXDOMAIN / NODATA ones for the TTL of
+ * the SOA record in the authority section, truncated,
+ * failed and uncacheable responses are ignored
+ *
+ * Returns:
+ *	- Response stored: EXIT_SUCCESS
+ *	- Response ignored / out of memory: EXIT_FAILURE
+ */
+int dns_cache_put(struct dns_cache* cache, const uint8_t* resp,
+	const size_t len, const uint64_t now);
+
+
+// Removes the responses which may not be served anymore
+void dns_cache_expire(struct dns_cache* cache, const uint64_t now);
+
+
+// Frees the cached responses
+void dns_cache_cleanup(struct dns_cache* cache);
@@ -0,0 +1,343 @@
+/*
+ * File: dns_codecs.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: allocation-free encoding
+ * and decoding of DNS messages (RFC 1035)
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdint.h>	// uint8_t, uint16_t, ...
+#include <stdlib.h>	// size_t, EXIT_SUCCESS, EXIT_FAILURE
+#include <string.h>	// memcpy(), ...
+
+
+#define DNS_MAX_NAME_LEN 255	// max domain name length (presentation)
+#define DNS_MAX_LABEL_LEN 63	// max label length
+#define DNS_HEADER_LEN 12	// header length
+#define DNS_MAX_UDP_LEN 512	// max UDP message length without EDNS
+#define DNS_EDNS_UDP_LEN 1232	// advertised EDNS UDP payload size
+#define DNS_MAX_MSG_LEN 65535	// max TCP message length
+#define DNS_MAX_COMP_NAMES 32	// max names remembered for compression
+#define DNS_MAX_PTR_JUMPS 16	// max compression pointers followed
+
+
+/*
+ * DNS query type
+ *
+ * @DNS_OPC_STD Standard query
+ * @DNS_OPC_REV Reverse query
+ * @DNS_OPC_SSTAT Server status query
+ */
+enum dns_opcode {
+	DNS_OPC_STD = 0,
+	DNS_OPC_REV = 1,
+	DNS_OPC_SSTAT = 2
+};
+
+
+/*
+ * DNS error code
+ *
+ * @DNS_RC_NO_ERR No error
+ * @DNS_RC_FMT_ERR Format error
+ * @DNS_RC_SFAIL Server failure
+ * @DNS_RC_NAME_ERR Name error
+ * @DNS_RC_NIMPL Not implemented
+ * @DNS_RC_REFUSED Refused
+ */
+enum dns_rcode {
+	DNS_RC_NO_ERR = 0,
+	DNS_RC_FMT_ERR = 1,
+	DNS_RC_SFAIL = 2,
+	DNS_RC_NAME_ERR = 3,
+	DNS_RC_NIMPL = 4,
+	DNS_RC_REFUSED = 5
+};
+
+
+/*
+ * DNS record type
+ *
+ * @DNS_REC_A IPv4 record
+ * @DNS_REC_NS Name server
+ * @DNS_REC_CNAME Canonical name
+ * @DNS_REC_SOA Start of authority
+ * @DNS_REC_PTR Domain name pointer
+ * @DNS_REC_MX Mail exchange record
+ * @DNS_REC_TXT Text record
+ * @DNS_REC_AAAA IPv6 record
+ * @DNS_REC_OPT EDNS pseudo-record
+ * @DNS_REC_ALL All cached records
+ */
+enum dns_record {
+	DNS_REC_A = 1,
+	DNS_REC_NS = 2,
+	DNS_REC_CNAME = 5,
+	DNS_REC_SOA = 6,
+	DNS_REC_PTR = 12,
+	DNS_REC_MX = 15,
+	DNS_REC_TXT = 16,
+	DNS_REC_AAAA = 28,
+	DNS_REC_OPT = 41,
+	DNS_REC_ALL = 255
+};
+
+
+// DNS record class
+enum dns_class {
+	DNS_CL_IN = 1,
+	DNS_CL_CH = 3,
+	DNS_CL_HS = 4,
+	DNS_CL_NONE = 254,
+	DNS_CL_ANY = 255
+};
+
+
+/*
+ * DNS header
+ *
+ * @id Message ID
+ * @qr Message type (query - 0, response - 1)
+ * @opcode Query type
+ * @aa Authoritative answer (response)
+ * @tc Truncated (response)
+ * @rd Recursion desired (query)
+ * @ra Recursion supported (response)
+ * @z Reserved
+ * @rcode Error code (response)
+ * @qdcount Questions number (query)
+ * @ancount Answers number (response)
+ * @nscount Nameservers number (response)
+ * @arcount Additional records number (response)
+ */
+struct dns_header {
+	uint16_t id;
+
+	unsigned char qr : 1;
+	enum dns_opcode opcode : 4;
+	unsigned char aa : 1;
+	unsigned char tc : 1;
+	unsigned char rd : 1;
+	unsigned char ra : 1;
+	unsigned char z : 3;
+	enum dns_rcode rcode : 4;
+
+	uint16_t qdcount;
+	uint16_t ancount;
+	uint16_t nscount;
+	uint16_t arcount;
+};
+
+
+/*
+ * DNS question
+ *
+ * @name Requested domain name
+ * @qtype Requested record type
+ * @qclass Requested records class
+ */
+struct dns_question {
+	char name[DNS_MAX_NAME_LEN + 1];
+
+	enum dns_record qtype : 16;
+	enum dns_class qclass : 16;
+};
+
+
+/*
+ * DNS answer (resource record)
+ *
+ * @name Owner domain name
+ * @namelen Length of "name"
+ * @type Record type
+ * @class Record class
+ * @ttl Time-to-live
+ * @rdlength Length of the "rdata" field
+ * @rdata Data associated with the record (points into the message)
+ * @rd Decoded "rdata" of the known record types:
+ *	A / AAAA addresses, CNAME / NS / PTR names,
+ *	MX preference and exchange, SOA minimum TTL
+ *	(TXT strings are read from "rdata" with dns_read_txt())
+ */
+struct dns_answer {
+	char name[DNS_MAX_NAME_LEN + 1];
+	size_t namelen;
+
+	enum dns_record type : 16;
+	enum dns_class class : 16;
+	uint32_t ttl;
+
+	uint16_t rdlength;
+	const uint8_t* rdata;
+
+	union {
+		uint8_t a[4];
+		uint8_t aaaa[16];
+		char name[DNS_MAX_NAME_LEN + 1];
+		struct {
+			uint16_t pref;
+			char exchange[DNS_MAX_NAME_LEN + 1];
+		} mx;
+		struct {
+			uint32_t serial;
+			uint32_t minimum;
+		} soa;
+	} rd;
+};
+
+
+/*
+ * Decoding cursor over a received message
+ *
+ * @msg Message
+ * @len Message length
+ * @pos Offset of the next byte to read
+ */
+struct dns_reader {
+	const uint8_t* msg;
+	size_t len;
+	size_t pos;
+};
+
+
+/*
+ * Encoding cursor over a caller provided buffer
+ *
+ * @buf Buffer
+ * @sz Buffer size
+ * @len Bytes written
+ * @names Offsets of the written names (for compression)
+ * @nnames Number of remembered names
+ */
+struct dns_writer {
+	uint8_t* buf;
+	size_t sz;
+	size_t len;
+	uint16_t names[DNS_MAX_COMP_NAMES];
+	size_t nnames;
+};
+
+
+
+/*
+ * DECODING
+ *
+ * Functions return EXIT_SUCCESS on success
+ * and EXIT_FAILURE on a malformed message
+ */
+
+
+
+// Initializes the reader over the message
+void dns_reader_init(struct dns_reader* r, const uint8_t* msg,
+	const size_t len);
+
+
+// Reads the header
+int dns_read_header(struct dns_reader* r, struct dns_header* hdr);
+
+
+/*
+ * Reads a (possibly compressed) domain name at "*pos"
+ *
+ * @msg Message
+ * @len Message length
+ * @pos Offset of the name, moved past it
+ * @name Buffer of DNS_MAX_NAME_LEN + 1 bytes, "." for the root
+ */
+int dns_read_name(const uint8_t* msg, const size_t len, size_t* pos,
+	char* name);
+
+
+// Reads a question
+int dns_read_question(struct dns_reader* r, struct dns_question* q);
+
+
+// Reads a resource record, decodes its data if the type is known
+int dns_read_answer(struct dns_reader* r, struct dns_answer* ans);
+
+
+/*
+ * Reads the next character-string of TXT record data
+ *
+ * @ans TXT record
+ * @pos Offset in "rdata", 0 for the first string, moved past the string
+ * @str Start of the string (not null-terminated)
+ * @len String length
+ *
+ * Returns:
+ *	- String was read: EXIT_SUCCESS
+ *	- No more strings / malformed data: EXIT_FAILURE
+ */
+int dns_read_txt(const struct dns_answer* ans, size_t* pos,
+	const uint8_t** str, uint8_t* len);
+
+
+// Compares domain names ignoring case and the trailing dot
+int dns_names_equal(const char* a, const char* b);
+
+
+
+/*
+ * ENCODING
+ *
+ * Functions return EXIT_SUCCESS on success
+ * and EXIT_FAILURE if the name is invalid
+ * or the buffer is too small
+ */
+
+
+
+// Initializes the writer over the buffer
+void dns_writer_init(struct dns_writer* w, uint8_t* buf, const size_t sz);
+
+
+// Writes the header
+int dns_write_header(struct dns_writer* w, const struct dns_header* hdr);
+
+
+// Writes a domain name, compressing it against the written ones
+int dns_write_name(struct dns_writer* w, const char* name);
+
+
+// Writes a question
+int dns_write_question(struct dns_writer* w, const struct dns_question* q);
+
+
+/*
+ * Writes a resource record
+ *
+ * Description: the data of A, AAAA, CNAME, NS, PTR and MX
+ * records is encoded from "ans->rd" (names are compressed),
+ * "ans->rdata" of "ans->rdlength" bytes is copied otherwise
+ */
+int dns_write_answer(struct dns_writer* w, const struct dns_answer* ans);
+
+
+// Writes the EDNS OPT pseudo-record advertising "udp_len"
+int dns_write_edns(struct dns_writer* w, const uint16_t udp_len);
+
+
+/*
+ * Encodes a recursive query with an EDNS OPT record
+ *
+ * Returns:
+ *	- Success: message length
+ *	- Failure: -EXIT_FAILURE
+ */
+int dns_encode_query(uint8_t* buf, const size_t sz, const uint16_t id,
+	const char* name, const enum dns_record qtype);
+
+
+// Gets the name of the record type ("A", "AAAA", ...) or NULL
+const char* dns_record_to_str(const enum dns_record type);
+
+
+// Parses the name of the record type, 0 if unknown
+enum dns_record dns_str_to_record(const char* str);
@@ -0,0 +1,232 @@
+/*
+ * File: dns_resolvers.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: asynchronous UDP stub resolver
+ * with non-blocking TCP fallback on truncated responses
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include "cross_platform_sockets.h"	// SOCKET, ...
+#include "dns_codecs.h"			// dns_encode_query(), ...
+#include "dns_caches.h"			// struct dns_cache
+
+
+#define DNS_MAX_PENDING 64		// max queries in flight
+#define DNS_MAX_TCP 4			// max TCP fallbacks in progress
+#define DNS_DEF_TIMEOUT_MS 1000		// default retransmission timeout
+#define DNS_DEF_MAX_TRIES 3		// default number of transmissions
+
+
+/*
+ * Query completion status
+ *
+ * @DNS_ST_OK Response received (its RCODE may still be an error)
+ * @DNS_ST_TIMEOUT No response after all the retransmissions
+ * @DNS_ST_NET_ERR Failed to send the query / TCP fallback failed
+ * @DNS_ST_CANCELLED Resolver was cleaned up
+ */
+enum dns_status {
+	DNS_ST_OK = 0,
+	DNS_ST_TIMEOUT = 1,
+	DNS_ST_NET_ERR = 2,
+	DNS_ST_CANCELLED = 3
+};
+
+
+/*
+ * Query completion callback
+ *
+ * @data User data passed to dns_resolve()
+ * @status Completion status
+ * @resp Response message (valid only during the call and until
+ *	the next dns_resolve() call, NULL on failure)
+ * @len Response length
+ */
+typedef void (*dns_callback)(void* data, const enum dns_status status,
+	const uint8_t* resp, const size_t len);
+
+
+/*
+ * Query in flight
+ *
+ * @active Slot is in use
+ * @id Message ID
+ * @name Requested domain name
+ * @qtype Requested record type
+ * @msg Encoded query (kept for retransmissions)
+ * @len Encoded query length
+ * @deadline Retransmission time / TCP fallback timeout (monotonic, ms)
+ * @tries Transmissions made
+ * @tcp Truncated response: 0 - no, 1 - waiting for a free TCP
+ *	exchange, 2 - repeated over TCP (UDP responses are ignored)
+ * @cb Completion callback
+ * @data User data for "cb"
+ */
+struct dns_query {
+	int active;
+	uint16_t id;
+	char name[DNS_MAX_NAME_LEN + 1];
+	enum dns_record qtype;
+
+	uint8_t msg[DNS_MAX_UDP_LEN];
+	size_t len;
+
+	uint64_t deadline;
+	int tries;
+	int tcp;
+
+	dns_callback cb;
+	void* data;
+};
+
+
+/*
+ * TCP exchange of a truncated query (RFC 7766)
+ *
+ * @sock Non-blocking socket (INVALID_SOCKET - exchange is free)
+ * @query Query repeated over TCP
+ * @out Length-prefixed query
+ * @out_len Length of "out"
+ * @sent Bytes of "out" sent
+ * @in Length prefix and the response
+ * @in_len Bytes of "in" received
+ */
+struct dns_tcp_exchange {
+	SOCKET sock;
+	struct dns_query* query;
+
+	uint8_t out[DNS_MAX_UDP_LEN + 2];
+	size_t out_len;
+	size_t sent;
+
+	uint8_t in[DNS_MAX_MSG_LEN + 2];
+	size_t in_len;
+};
+
+
+/*
+ * Stub resolver
+ *
+ * @sock Non-blocking UDP socket connected to the server
+ * @server Server address (for the TCP fallback)
+ * @server_len Length of "server"
+ * @pending Queries in flight
+ * @npending Number of queries in flight
+ * @tcp TCP fallbacks in progress
+ * @timeout_ms Retransmission timeout
+ * @max_tries Transmissions before DNS_ST_TIMEOUT
+ * @rng Message ID generator state
+ * @cache Responses cache (optional, set by the caller)
+ * @resp Receive buffer
+ * @cached Buffer for the cached responses
+ */
+struct dns_resolver {
+	SOCKET sock;
+	struct sockaddr_storage server;
+	socklen_t server_len;
+
+	struct dns_query pending[DNS_MAX_PENDING];
+	size_t npending;
+
+	struct dns_tcp_exchange tcp[DNS_MAX_TCP];
+
+	unsigned timeout_ms;
+	int max_tries;
+
+	uint64_t rng;
+
+	struct dns_cache* cache;
+	uint8_t resp[DNS_MAX_MSG_LEN];
+	uint8_t cached[DNS_MAX_MSG_LEN];
+};
+
+
+// Makes the socket non-blocking
+int set_socket_nonblocking(const SOCKET s);
+
+
+// Checks if the non-blocking call failed only because it would block
+int socket_would_block(void);
+
+
+// Gets monotonic time in microseconds
+uint64_t dns_now_us(void);
+
+
+// Gets monotonic time in milliseconds
+uint64_t dns_now_ms(void);
+
+
+/*
+ * Initializes the resolver
+ *
+ * @res Resolver
+ * @server Numeric server address
+ * @port Server port ("53")
+ *
+ * Returns:
+ *	- Success: EXIT_SUCCESS
+ *	- Failure: EXIT_FAILURE
+ */
+int dns_resolver_init(struct dns_resolver* res, const char* server,
+	const char* port);
+
+
+/*
+ * Sends the query, the callback is called from dns_resolver_process()
+ *
+ * Description: if the resolver has a cache, cached responses
+ * are passed to the callback right away, stale ones are
+ * refreshed in the background
+ *
+ * Returns:
+ *	- Query sent: EXIT_SUCCESS
+ *	- Too many queries / invalid name / send() failed: EXIT_FAILURE
+ */
+int dns_resolve(struct dns_resolver* res, const char* name,
+	const enum dns_record qtype, dns_callback cb, void* data);
+
+
+/*
+ * Adds the sockets of the resolver to the select() sets:
+ * the UDP socket and the TCP fallbacks
+ *
+ * Returns: the largest socket added
+ */
+SOCKET dns_resolver_fds(const struct dns_resolver* res, fd_set* rfds,
+	fd_set* wfds);
+
+
+/*
+ * Reads the received responses, drives the TCP fallbacks,
+ * retransmits and expires the queries, calls the callbacks
+ *
+ * Description: call when a socket of dns_resolver_fds() is ready
+ * or dns_resolver_timeout() has passed
+ */
+void dns_resolver_process(struct dns_resolver* res);
+
+
+// Gets milliseconds until the next retransmission / TCP timeout,
+// -1 if nothing is pending
+int dns_resolver_timeout(const struct dns_resolver* res);
+
+
+/*
+ * Waits for the socket or the next retransmission and processes it
+ *
+ * Returns:
+ *	- Success: EXIT_SUCCESS
+ *	- select() failed: EXIT_FAILURE
+ */
+int dns_resolver_wait(struct dns_resolver* res);
+
+
+// Cancels the pending queries and closes the sockets
+void dns_resolver_cleanup(struct dns_resolver* res);
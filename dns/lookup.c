@@ -2,13 +2,23 @@
  * Simple DNS lookup program utilizing
  * getaddrinfo(), getnameinfo() functions
  *
+ * Batch mode resolves the names read from a file
+ * concurrently with the stub resolver
+ *
  * Copyright (C) 2025 Semyon Nadutkin
  */
 
 
 #include "headers/cross_platform_sockets.h"
+#include "headers/dns_resolvers.h"
 #include <stdio.h> // logging
 #include <stdlib.h> // EXIT_FAILURE, EXIT_SUCCESS
+#include <ctype.h> // isspace()
+
+
+#define BATCH_SOCKETS 4		// UDP sockets used in batch mode
+#define BATCH_MAX_QUERIES (BATCH_SOCKETS * DNS_MAX_PENDING)
+#define BATCH_LINE_LEN 1024	// max input line length
 
 
 // Gets all the IPv4 / IPv6 addresses
@@ -48,7 +58,7 @@ int print_addresses(struct addrinfo* start)
 		printf("\t%s\n", host);
 
 		start = start->ai_next;
-	} while (start->ai_next);
+	} while (start);
 
 	return EXIT_SUCCESS;
 }
@@ -78,11 +88,375 @@ out_failure_sockets_cleanup:
 }
 
 
+/*
+ * BATCH MODE
+ */
+
+
+
+// Record types requested for each name
+static const enum dns_record batch_types[] = { DNS_REC_A, DNS_REC_AAAA };
+#define BATCH_TYPES_NUM (sizeof(batch_types) / sizeof(batch_types[0]))
+
+
+/*
+ * Query of the batch
+ *
+ * @name Requested domain name
+ * @qtype Requested record type
+ * @start Time the query was sent (us)
+ * @next Next free query
+ */
+struct batch_query {
+	char name[DNS_MAX_NAME_LEN + 1];
+	enum dns_record qtype;
+	uint64_t start;
+	struct batch_query* next;
+};
+
+
+/*
+ * Batch state
+ *
+ * @input Names source
+ * @res Resolvers (one per socket)
+ * @cache Cache shared by the resolvers (repeated names)
+ * @queries Queries pool
+ * @free_queries Free queries list
+ * @name Name being sent
+ * @type_idx Index of the next record type of "name"
+ * @eof Input is exhausted
+ * @rate Max queries per second (0 - unlimited)
+ * @tokens Queries allowed to be sent now (token bucket)
+ * @refilled Time the bucket was refilled (us)
+ * @sent Queries sent
+ * @answered Queries answered with NOERROR
+ * @failed Queries failed / answered with an error
+ */
+struct batch {
+	FILE* input;
+	struct dns_resolver* res[BATCH_SOCKETS];
+	struct dns_cache* cache;
+
+	struct batch_query queries[BATCH_MAX_QUERIES];
+	struct batch_query* free_queries;
+
+	char name[DNS_MAX_NAME_LEN + 1];
+	size_t type_idx;
+	int eof;
+
+	double rate;
+	double tokens;
+	uint64_t refilled;
+
+	size_t sent;
+	size_t answered;
+	size_t failed;
+};
+
+
+// Global batch state for the callbacks
+static struct batch* batch = NULL;
+
+
+// Prints the result of the query as a line:
+// [NAME] [TYPE] [STATUS] [LATENCY (ms)] [ADDRESSES...]
+void print_batch_result(void* data, const enum dns_status status,
+	const uint8_t* resp, const size_t len)
+{
+	struct batch_query* q = (struct batch_query*) data;
+	double latency = (double) (dns_now_us() - q->start) / 1000.0;
+
+	printf("%s\t%s\t", q->name, dns_record_to_str(q->qtype));
+
+	struct dns_reader r = { 0 };
+	struct dns_header hdr = { 0 };
+	struct dns_question question = { 0 };
+	if (status != DNS_ST_OK) {
+		printf("%s\t%.3f\n", status == DNS_ST_TIMEOUT ? "TIMEOUT"
+			: "NETERR", latency);
+		++batch->failed;
+		goto out_free;
+	}
+
+	dns_reader_init(&r, resp, len);
+	if (dns_read_header(&r, &hdr) || dns_read_question(&r, &question)) {
+		printf("MALFORMED\t%.3f\n", latency);
+		++batch->failed;
+		goto out_free;
+	}
+
+	static const char* rcodes[] = {
+		"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"
+	};
+	unsigned rcode = hdr.rcode;
+	printf("%s\t%.3f", rcode < sizeof(rcodes) / sizeof(rcodes[0])
+		? rcodes[rcode] : "?", latency);
+
+	if (rcode == DNS_RC_NO_ERR) ++batch->answered;
+	else ++batch->failed;
+
+	// Addresses of the answer section
+	for (size_t i = 0; i < hdr.ancount; ++i) {
+		struct dns_answer ans = { 0 };
+		if (dns_read_answer(&r, &ans)) break;
+
+		char addr[MAX_ADDRBUF_LEN];
+		if (ans.type == DNS_REC_A && q->qtype == DNS_REC_A) {
+			inet_ntop(AF_INET, ans.rd.a, addr, sizeof(addr));
+			printf("\t%s", addr);
+		} else if (ans.type == DNS_REC_AAAA && q->qtype == DNS_REC_AAAA) {
+			inet_ntop(AF_INET6, ans.rd.aaaa, addr, sizeof(addr));
+			printf("\t%s", addr);
+		}
+	}
+	printf("\n");
+
+out_free:
+	q->next = batch->free_queries;
+	batch->free_queries = q;
+}
+
+
+// Reads the next name to resolve, sets "eof" at the end of the input
+void read_batch_name(struct batch* b)
+{
+	char line[BATCH_LINE_LEN];
+	while (fgets(line, sizeof(line), b->input)) {
+		// Trim, skip empty lines and comments
+		char* start = line;
+		while (isspace((unsigned char) *start)) ++start;
+		char* end = start + strlen(start);
+		while (start < end && isspace((unsigned char) end[-1])) --end;
+		*end = '\0';
+
+		if (!*start || *start == '#') continue;
+		if (DNS_MAX_NAME_LEN < (size_t) (end - start)) {
+			fprintf(stderr, "Name is too long: %.32s...\n", start);
+			continue;
+		}
+
+		strcpy(b->name, start);
+		b->type_idx = 0;
+		return;
+	}
+
+	b->eof = 1;
+}
+
+
+// Refills the token bucket
+void refill_batch_tokens(struct batch* b, const uint64_t now)
+{
+	if (!b->rate) return;
+
+	b->tokens += b->rate * (double) (now - b->refilled) / 1000000.0;
+	if (b->rate < b->tokens) b->tokens = b->rate; // 1 second burst
+	b->refilled = now;
+}
+
+
+// Sends the queries allowed by the rate and the free sockets
+void send_batch_queries(struct batch* b)
+{
+	static size_t next_res = 0;
+
+	refill_batch_tokens(b, dns_now_us());
+	while (!b->eof && b->free_queries && (!b->rate || 1.0 <= b->tokens)) {
+		// Round-robin over the resolvers with free slots
+		struct dns_resolver* res = NULL;
+		for (size_t i = 0; i < BATCH_SOCKETS && !res; ++i) {
+			struct dns_resolver* cur = b->res[next_res];
+			next_res = (next_res + 1) % BATCH_SOCKETS;
+			if (cur->npending < DNS_MAX_PENDING) res = cur;
+		}
+		if (!res) return;
+
+		struct batch_query* q = b->free_queries;
+		b->free_queries = q->next;
+
+		strcpy(q->name, b->name);
+		q->qtype = batch_types[b->type_idx];
+		q->start = dns_now_us();
+
+		++b->sent;
+		if (b->rate) b->tokens -= 1.0;
+		if (dns_resolve(res, q->name, q->qtype, print_batch_result, q)) {
+			print_batch_result(q, DNS_ST_NET_ERR, NULL, 0);
+		}
+
+		if (BATCH_TYPES_NUM <= ++b->type_idx) read_batch_name(b);
+	}
+}
+
+
+// Counts the queries in flight
+size_t count_batch_pending(const struct batch* b)
+{
+	size_t pending = 0;
+	for (size_t i = 0; i < BATCH_SOCKETS; ++i) {
+		pending += b->res[i]->npending;
+	}
+
+	return pending;
+}
+
+
+// Waits for the responses, the retransmissions or the rate limit
+int wait_batch(struct batch* b)
+{
+	fd_set rfds, wfds;
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	SOCKET max_fd = 0;
+
+	int timeout = -1;
+	for (size_t i = 0; i < BATCH_SOCKETS; ++i) {
+		SOCKET res_fd = dns_resolver_fds(b->res[i], &rfds, &wfds);
+		if (max_fd < res_fd) max_fd = res_fd;
+
+		int res_timeout = dns_resolver_timeout(b->res[i]);
+		if (0 <= res_timeout && (timeout < 0 || res_timeout < timeout)) {
+			timeout = res_timeout;
+		}
+	}
+
+	// Time until the next token
+	if (!b->eof && b->rate && b->free_queries && b->tokens < 1.0) {
+		int token_timeout = (int) ((1.0 - b->tokens) * 1000.0 / b->rate)
+			+ 1;
+		if (timeout < 0 || token_timeout < timeout) {
+			timeout = token_timeout;
+		}
+	}
+	if (timeout < 0) timeout = 0;
+
+	struct timeval tv = { 0 };
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	if (select((int) max_fd + 1, &rfds, &wfds, NULL, &tv) < 0) {
+		if (sockerrno() == EINTR) return EXIT_SUCCESS;
+		psockerror("select() failed");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < BATCH_SOCKETS; ++i) {
+		dns_resolver_process(b->res[i]);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+
+// Frees the batch state
+void cleanup_batch(struct batch* b)
+{
+	for (size_t i = 0; i < BATCH_SOCKETS; ++i) {
+		if (b->res[i]) {
+			dns_resolver_cleanup(b->res[i]);
+			free(b->res[i]);
+		}
+	}
+
+	if (b->cache) {
+		dns_cache_cleanup(b->cache);
+		free(b->cache);
+	}
+
+	if (b->input && b->input != stdin) fclose(b->input);
+	free(b);
+}
+
+
+// Resolves the names of the file at the server
+int dns_batch_lookup(const char* server, const char* port, const char* path,
+	const double rate)
+{
+	int sup_res = sockets_startup();
+	if (sup_res) return sup_res;
+
+	int ret = EXIT_FAILURE;
+	batch = (struct batch*) calloc(1, sizeof(struct batch));
+	if (!batch) goto out_sockets_cleanup;
+
+	batch->input = (strcmp(path, "-") ? fopen(path, "r") : stdin);
+	if (!batch->input) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		goto out_cleanup_batch;
+	}
+
+	batch->cache = (struct dns_cache*) malloc(sizeof(struct dns_cache));
+	if (!batch->cache) goto out_cleanup_batch;
+	dns_cache_init(batch->cache);
+
+	for (size_t i = 0; i < BATCH_SOCKETS; ++i) {
+		batch->res[i] = (struct dns_resolver*) malloc(
+			sizeof(struct dns_resolver));
+		if (!batch->res[i]) goto out_cleanup_batch;
+
+		if (dns_resolver_init(batch->res[i], server, port)) {
+			free(batch->res[i]);
+			batch->res[i] = NULL;
+			goto out_cleanup_batch;
+		}
+		batch->res[i]->cache = batch->cache;
+	}
+
+	for (size_t i = 0; i < BATCH_MAX_QUERIES; ++i) {
+		batch->queries[i].next = batch->free_queries;
+		batch->free_queries = &(batch->queries[i]);
+	}
+
+	batch->rate = rate;
+	batch->refilled = dns_now_us();
+	batch->tokens = (rate && rate < 1.0 ? rate : 1.0);
+
+	uint64_t start = dns_now_us();
+	read_batch_name(batch);
+	while (1) {
+		send_batch_queries(batch);
+		fflush(stdout);
+
+		if (batch->eof && !count_batch_pending(batch)) break;
+		if (wait_batch(batch)) goto out_cleanup_batch;
+	}
+
+	double elapsed = (double) (dns_now_us() - start) / 1000000.0;
+	fprintf(stderr, "%zu queries, %zu answered, %zu failed, "
+		"%zu cache hits in %.3f s (%.0f queries/s)\n",
+		batch->sent, batch->answered, batch->failed,
+		batch->cache->hits + batch->cache->stale_hits, elapsed,
+		elapsed ? (double) batch->sent / elapsed : 0.0);
+	ret = EXIT_SUCCESS;
+
+out_cleanup_batch:
+	cleanup_batch(batch);
+	batch = NULL;
+out_sockets_cleanup:
+	sockets_cleanup();
+	return ret;
+}
+
+
 int main(const int argc, const char* argv[])
 {
+	// { [executable name], --batch, [server], ([file]), ([rate]), ([port]) }
+	if (3 <= argc && argc <= 6 && !strcmp(argv[1], "--batch")) {
+		const char* path = (3 < argc ? argv[3] : "-");
+		double rate = (4 < argc ? atof(argv[4]) : 0.0);
+		if (rate < 0) rate = 0;
+		const char* port = (5 < argc ? argv[5] : "53");
+
+		return dns_batch_lookup(argv[2], port, path, rate);
+	}
+
 	if (argc != 2) { // { [executable name], [node] }
 		const char* exec_name = argv[0];
-		printf("Usage: %s [NODE]\n", exec_name);
+		printf("Usage:\n\t%s [NODE]\n"
+			"\t%s --batch [SERVER] [FILE (- for stdin)] "
+			"[QUERIES PER SECOND (0 - unlimited)] [PORT (53)]\n",
+			exec_name, exec_name);
 		return EXIT_FAILURE;
 	}
 
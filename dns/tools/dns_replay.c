@@ -0,0 +1,355 @@
+/*
+ * File: dns_replay.c
+ * Author: Semyon Nadutkin
+ *
+ * Description: benchmark replaying the names
+ * of a file as A queries to a DNS server at
+ * a fixed rate, reports the throughput and
+ * the latency percentiles
+ *
+ * Usage: dns_replay [SERVER] [PORT] [NAMES FILE] [QUERIES] [QPS (0)]
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#ifdef __linux__
+	#define _GNU_SOURCE // recvmmsg(), sendmmsg()
+#endif // __linux__
+
+
+#include "../headers/cross_platform_sockets.h"
+#include "../headers/dns_codecs.h"
+#include "../headers/dns_resolvers.h"	// dns_now_us(), ...
+#include <stdio.h>	// logging, file I/O
+#include <stdlib.h>	// memory management
+#include <ctype.h>	// isspace()
+
+#ifndef _WIN32
+	#include <sys/time.h>	// struct timeval
+#endif // !_WIN32
+
+
+#define REPLAY_BATCH 32			// datagrams per sendmmsg() / recvmmsg()
+#define REPLAY_WINDOW 4096		// max queries in flight
+#define REPLAY_QUERY_LEN 512		// max query length
+#define REPLAY_DRAIN_US 1000000		// wait for the last responses (us)
+#define REPLAY_BUF_LEN (4 << 20)	// socket buffers (response bursts)
+
+
+/*
+ * Replay state
+ *
+ * @names Names to query (cycled)
+ * @nnames Number of names
+ * @sent_at Send time of the query by ID (us, 0 if not in flight)
+ * @latencies Latencies of the answered queries (us)
+ * @total Queries to send
+ * @sent Queries sent
+ * @received Responses received
+ * @errors Responses with an error code
+ * @inflight Queries in flight
+ */
+struct replay {
+	char** names;
+	size_t nnames;
+
+	uint64_t sent_at[65536];
+	uint32_t* latencies;
+
+	size_t total;
+	size_t sent;
+	size_t received;
+	size_t errors;
+	size_t inflight;
+};
+
+
+// Reads the names of the file, one per line
+int load_names(struct replay* rp, const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return EXIT_FAILURE;
+	}
+
+	size_t cap = 0;
+	char line[1024];
+	while (fgets(line, sizeof(line), f)) {
+		char* start = line;
+		while (isspace((unsigned char) *start)) ++start;
+		char* end = start + strlen(start);
+		while (start < end && isspace((unsigned char) end[-1])) --end;
+		*end = '\0';
+		if (!*start || *start == '#') continue;
+
+		if (rp->nnames == cap) {
+			cap = (cap ? cap * 2 : 1024);
+			char** names = (char**) realloc(rp->names,
+				cap * sizeof(char*));
+			if (!names) goto out_failure_close;
+			rp->names = names;
+		}
+
+		rp->names[rp->nnames] = strdup(start);
+		if (!rp->names[rp->nnames]) goto out_failure_close;
+		++rp->nnames;
+	}
+
+	fclose(f);
+	return rp->nnames ? EXIT_SUCCESS : EXIT_FAILURE;
+
+out_failure_close:
+	fclose(f);
+	return EXIT_FAILURE;
+}
+
+
+// Sends up to "count" queries
+void send_queries(struct replay* rp, const SOCKET s, size_t count)
+{
+	static uint16_t next_id = 0;
+
+	uint8_t bufs[REPLAY_BATCH][REPLAY_QUERY_LEN];
+	size_t lens[REPLAY_BATCH];
+	size_t n = 0;
+
+	while (n < count && n < REPLAY_BATCH) {
+		// Skip the IDs still in flight
+		while (rp->sent_at[next_id]) ++next_id;
+
+		const char* name = rp->names[rp->sent % rp->nnames];
+		int len = dns_encode_query(bufs[n], REPLAY_QUERY_LEN, next_id,
+			name, DNS_REC_A);
+		++rp->sent;
+		if (len < 0) continue; // invalid name
+
+		lens[n++] = (size_t) len;
+		rp->sent_at[next_id++] = dns_now_us();
+		++rp->inflight;
+	}
+
+#ifdef __linux__
+	struct mmsghdr msgs[REPLAY_BATCH];
+	struct iovec iovs[REPLAY_BATCH];
+	memset(msgs, 0, sizeof(msgs));
+	for (size_t i = 0; i < n; ++i) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = lens[i];
+		msgs[i].msg_hdr.msg_iov = &(iovs[i]);
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	size_t done = 0;
+	while (done < n) {
+		int res = sendmmsg(s, msgs + done, (unsigned) (n - done), 0);
+		if (res < 0) {
+			if (errno == EINTR) continue;
+			++done; // lost, counted at the end
+			continue;
+		}
+		done += (size_t) res;
+	}
+#else // __linux__
+	for (size_t i = 0; i < n; ++i) {
+		send(s, (const char*) bufs[i], (int) lens[i], 0);
+	}
+#endif // !__linux__
+}
+
+
+// Matches the received responses to the queries
+void receive_responses(struct replay* rp, const SOCKET s)
+{
+	static uint8_t bufs[REPLAY_BATCH][DNS_EDNS_UDP_LEN];
+
+	while (1) {
+		size_t lens[REPLAY_BATCH];
+		size_t n = 0;
+
+#ifdef __linux__
+		struct mmsghdr msgs[REPLAY_BATCH];
+		struct iovec iovs[REPLAY_BATCH];
+		memset(msgs, 0, sizeof(msgs));
+		for (size_t i = 0; i < REPLAY_BATCH; ++i) {
+			iovs[i].iov_base = bufs[i];
+			iovs[i].iov_len = DNS_EDNS_UDP_LEN;
+			msgs[i].msg_hdr.msg_iov = &(iovs[i]);
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int res = recvmmsg(s, msgs, REPLAY_BATCH, MSG_DONTWAIT, NULL);
+		if (res <= 0) return;
+		for (int i = 0; i < res; ++i) lens[n++] = msgs[i].msg_len;
+#else // __linux__
+		int res = recv(s, (char*) bufs[0], DNS_EDNS_UDP_LEN, 0);
+		if (res <= 0) return;
+		lens[n++] = (size_t) res;
+#endif // !__linux__
+
+		uint64_t now = dns_now_us();
+		for (size_t i = 0; i < n; ++i) {
+			if (lens[i] < DNS_HEADER_LEN) continue;
+
+			uint16_t id = (uint16_t) ((bufs[i][0] << 8) | bufs[i][1]);
+			if (!rp->sent_at[id]) continue; // late duplicate
+
+			rp->latencies[rp->received++] = (uint32_t)
+				(now - rp->sent_at[id]);
+			rp->sent_at[id] = 0;
+			--rp->inflight;
+
+			// NXDOMAIN is a valid answer
+			uint8_t rcode = bufs[i][3] & 0x0F;
+			if (rcode != DNS_RC_NO_ERR && rcode != DNS_RC_NAME_ERR) {
+				++rp->errors;
+			}
+		}
+	}
+}
+
+
+// Compares the latencies for qsort()
+int compare_latencies(const void* a, const void* b)
+{
+	uint32_t la = *(const uint32_t*) a;
+	uint32_t lb = *(const uint32_t*) b;
+	return (la > lb) - (la < lb);
+}
+
+
+// Gets the latency percentile (ms)
+double latency_percentile(const struct replay* rp, const double pct)
+{
+	if (!rp->received) return 0.0;
+
+	size_t idx = (size_t) (pct / 100.0 * (double) (rp->received - 1));
+	return (double) rp->latencies[idx] / 1000.0;
+}
+
+
+// Replays the queries and prints the report
+int run_replay(struct replay* rp, const SOCKET s, const double rate)
+{
+	uint64_t start = dns_now_us();
+	uint64_t last_sent = start;
+
+	while (1) {
+		uint64_t now = dns_now_us();
+
+		// Queries allowed by the rate and the window
+		size_t allowed = rp->total - rp->sent;
+		if (rate) {
+			size_t due = (size_t) ((double) (now - start) * rate
+				/ 1000000.0) + 1;
+			allowed = (due < rp->sent ? 0 : due - rp->sent);
+			if (rp->total - rp->sent < allowed) {
+				allowed = rp->total - rp->sent;
+			}
+		}
+		if (REPLAY_WINDOW - rp->inflight < allowed) {
+			allowed = REPLAY_WINDOW - rp->inflight;
+		}
+
+		if (allowed) {
+			send_queries(rp, s, allowed);
+			last_sent = dns_now_us();
+		}
+
+		now = dns_now_us();
+		if (rp->sent == rp->total && (!rp->inflight
+			|| REPLAY_DRAIN_US <= now - last_sent)) {
+			break;
+		}
+
+		fd_set rfds;
+		FD_ZERO(&rfds);
+		FD_SET(s, &rfds);
+		struct timeval tv = { 0 };
+		tv.tv_usec = (allowed ? 0 : 1000);
+		if (select((int) s + 1, &rfds, NULL, NULL, &tv) < 0
+			&& sockerrno() != EINTR) {
+			psockerror("select() failed");
+			return EXIT_FAILURE;
+		}
+
+		receive_responses(rp, s);
+	}
+
+	double elapsed = (double) (dns_now_us() - start) / 1000000.0;
+	qsort(rp->latencies, rp->received, sizeof(uint32_t), compare_latencies);
+
+	printf("Sent: %zu, received: %zu (%zu errors), lost: %zu\n",
+		rp->sent, rp->received, rp->errors, rp->sent - rp->received);
+	printf("Time: %.3f s, throughput: %.0f responses/s\n", elapsed,
+		elapsed ? (double) rp->received / elapsed : 0.0);
+	printf("Latency (ms): p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+		latency_percentile(rp, 50), latency_percentile(rp, 90),
+		latency_percentile(rp, 99), latency_percentile(rp, 100));
+
+	return EXIT_SUCCESS;
+}
+
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 5 || 6 < argc) {
+		fprintf(stderr, "Usage:\n\tdns_replay [SERVER] [PORT] "
+			"[NAMES FILE] [QUERIES] [QPS (0 - unlimited)]\n");
+		return EXIT_FAILURE;
+	}
+
+	if (sockets_startup()) return EXIT_FAILURE;
+
+	int ret = EXIT_FAILURE;
+	struct replay* rp = (struct replay*) calloc(1, sizeof(struct replay));
+	if (!rp) goto out_sockets_cleanup;
+
+	rp->total = (size_t) strtoull(argv[4], NULL, 10);
+	double rate = (5 < argc ? atof(argv[5]) : 0.0);
+
+	rp->latencies = (uint32_t*) malloc((rp->total + 1) * sizeof(uint32_t));
+	if (!rp->latencies || load_names(rp, argv[3])) goto out_free;
+
+	// Connected UDP socket to the server
+	struct addrinfo hints = { 0 };
+	hints.ai_flags = AI_NUMERICHOST;
+	hints.ai_socktype = SOCK_DGRAM;
+	struct addrinfo* addr = NULL;
+	if (getaddrinfo(argv[1], argv[2], &hints, &addr)) {
+		fprintf(stderr, "Invalid server address: %s\n", argv[1]);
+		goto out_free;
+	}
+
+	SOCKET s = socket(addr->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+	if (!validate_socket(s)) {
+		psockerror("socket() failed");
+		freeaddrinfo(addr);
+		goto out_free;
+	}
+
+	int opt = REPLAY_BUF_LEN;
+	setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*) &opt, sizeof(opt));
+	setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char*) &opt, sizeof(opt));
+
+	int conn_res = connect(s, addr->ai_addr, addr->ai_addrlen);
+	freeaddrinfo(addr);
+	if (conn_res || set_socket_nonblocking(s)) {
+		psockerror("Failed to set up the socket");
+		closesocket(s);
+		goto out_free;
+	}
+
+	ret = run_replay(rp, s, rate);
+	closesocket(s);
+
+out_free:
+	for (size_t i = 0; i < rp->nnames; ++i) free(rp->names[i]);
+	free(rp->names);
+	free(rp->latencies);
+	free(rp);
+out_sockets_cleanup:
+	sockets_cleanup();
+	return ret;
+}
@@ -0,0 +1,717 @@
+/*
+ * File: dns_standin.c
+ * Author: Semyon Nadutkin
+ *
+ * Description: stand-in DNS server answering a fixed
+ * "test." zone over UDP and TCP (A, AAAA, CNAME, MX, TXT,
+ * NXDOMAIN / NODATA with SOA, oversized answers truncated
+ * over UDP), with a check mode running the stub resolver
+ * against it in the same event loop
+ *
+ * Usage: dns_standin [PORT] | dns_standin --check
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#include "../headers/cross_platform_sockets.h"
+#include "../headers/dns_codecs.h"
+#include "../headers/dns_resolvers.h"	// set_socket_nonblocking(), ...
+#include <stdio.h>	// logging
+#include <stdlib.h>	// memory management
+#include <string.h>	// memcpy(), strcmp()
+
+#ifndef _WIN32
+	#include <sys/time.h>	// struct timeval
+#endif // !_WIN32
+
+
+#define STANDIN_MAX_CONNS 8		// TCP connections served at once
+#define STANDIN_TTL 60			// TTL of the records
+#define STANDIN_MAX_CHAIN 8		// CNAME records followed
+#define STANDIN_BIG_TXT 16		// TXT records of "big.test"
+#define STANDIN_CHECK_MS 5000		// time given to the check
+
+#define STANDIN_TEN "0123456789"
+#define STANDIN_HUNDRED STANDIN_TEN STANDIN_TEN STANDIN_TEN STANDIN_TEN \
+	STANDIN_TEN STANDIN_TEN STANDIN_TEN STANDIN_TEN STANDIN_TEN STANDIN_TEN
+
+
+/*
+ * Record of the zone
+ *
+ * @name Owner name
+ * @type Record type
+ * @data Address, target name or TXT string
+ * @pref MX preference
+ * @repeat Number of copies (oversized answers)
+ */
+struct standin_record {
+	const char* name;
+	enum dns_record type;
+	const char* data;
+	uint16_t pref;
+	size_t repeat;
+};
+
+
+// The zone, every other name of it is NXDOMAIN
+static const struct standin_record standin_zone[] = {
+	{ "a.test", DNS_REC_A, "192.0.2.1", 0, 1 },
+	{ "a.test", DNS_REC_AAAA, "2001:db8::1", 0, 1 },
+	{ "www.test", DNS_REC_CNAME, "a.test", 0, 1 },
+	{ "mail.test", DNS_REC_MX, "mx.test", 10, 1 },
+	{ "mx.test", DNS_REC_A, "192.0.2.25", 0, 1 },
+	{ "txt.test", DNS_REC_TXT, "hello world", 0, 1 },
+	{ "big.test", DNS_REC_TXT, STANDIN_HUNDRED, 0, STANDIN_BIG_TXT }
+};
+
+
+// SOA of the negative answers: ns.test. host.test. 1 3600 600 86400 30
+static const uint8_t standin_soa[] = {
+	2, 'n', 's', 4, 't', 'e', 's', 't', 0,
+	4, 'h', 'o', 's', 't', 4, 't', 'e', 's', 't', 0,
+	0, 0, 0, 1,  0, 0, 0x0e, 0x10,  0, 0, 0x02, 0x58,
+	0, 0x01, 0x51, 0x80,  0, 0, 0, 30
+};
+
+
+/*
+ * TCP connection of a client
+ *
+ * @sock Non-blocking socket (INVALID_SOCKET - free)
+ * @in Length-prefixed query
+ * @in_len Bytes of "in" received
+ * @out Length-prefixed response
+ * @out_len Length of "out" (0 - nothing to send)
+ * @sent Bytes of "out" sent
+ */
+struct standin_conn {
+	SOCKET sock;
+
+	uint8_t in[DNS_MAX_UDP_LEN + 2];
+	size_t in_len;
+
+	uint8_t out[DNS_MAX_MSG_LEN + 2];
+	size_t out_len;
+	size_t sent;
+};
+
+
+/*
+ * Stand-in server
+ *
+ * @udp UDP socket
+ * @tcp Listening TCP socket
+ * @conns TCP connections
+ * @buf Receive / response buffer of the UDP socket
+ */
+struct standin {
+	SOCKET udp;
+	SOCKET tcp;
+	struct standin_conn conns[STANDIN_MAX_CONNS];
+	uint8_t buf[DNS_MAX_MSG_LEN];
+};
+
+
+
+/*
+ * ANSWERS
+ */
+
+
+
+// Checks if the zone has the name
+int standin_has_name(const char* name)
+{
+	for (size_t i = 0; i < sizeof(standin_zone) / sizeof(standin_zone[0]);
+		++i) {
+		if (dns_names_equal(standin_zone[i].name, name)) return 1;
+	}
+
+	return 0;
+}
+
+
+// Writes the copies of the record
+int write_standin_record(struct dns_writer* w,
+	const struct standin_record* rec, uint16_t* count)
+{
+	struct dns_answer ans = { 0 };
+	strcpy(ans.name, rec->name);
+	ans.type = rec->type;
+	ans.class = DNS_CL_IN;
+	ans.ttl = STANDIN_TTL;
+
+	uint8_t txt[256];
+	switch (rec->type) {
+	case DNS_REC_A:
+		inet_pton(AF_INET, rec->data, ans.rd.a);
+		break;
+	case DNS_REC_AAAA:
+		inet_pton(AF_INET6, rec->data, ans.rd.aaaa);
+		break;
+	case DNS_REC_CNAME:
+		strcpy(ans.rd.name, rec->data);
+		break;
+	case DNS_REC_MX:
+		ans.rd.mx.pref = rec->pref;
+		strcpy(ans.rd.mx.exchange, rec->data);
+		break;
+	default: // TXT: one character-string
+		txt[0] = (uint8_t) strlen(rec->data);
+		memcpy(txt + 1, rec->data, txt[0]);
+		ans.rdata = txt;
+		ans.rdlength = (uint16_t) (txt[0] + 1);
+		break;
+	}
+
+	for (size_t i = 0; i < rec->repeat; ++i) {
+		if (dns_write_answer(w, &ans)) return EXIT_FAILURE;
+		++(*count);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * Answers the query from the zone, follows the CNAME records
+ *
+ * @udp Answers longer than DNS_MAX_UDP_LEN are truncated
+ *	(EDNS is ignored, so the TCP fallback is exercised)
+ *
+ * Returns:
+ *	- Success: response length
+ *	- Malformed query: -EXIT_FAILURE (not answered)
+ */
+int answer_standin_query(const uint8_t* query, const size_t len,
+	uint8_t* buf, const size_t sz, const int udp)
+{
+	struct dns_reader r = { 0 };
+	dns_reader_init(&r, query, len);
+
+	struct dns_header hdr = { 0 };
+	struct dns_question q = { 0 };
+	if (dns_read_header(&r, &hdr) || hdr.qr || hdr.qdcount != 1
+		|| dns_read_question(&r, &q)) {
+		return -EXIT_FAILURE;
+	}
+
+	struct dns_header resp = { 0 };
+	resp.id = hdr.id;
+	resp.qr = 1;
+	resp.aa = 1;
+	resp.rd = hdr.rd;
+	resp.ra = 1;
+	resp.qdcount = 1;
+
+	// The header is rewritten once the counts are known
+	struct dns_writer w = { 0 };
+	dns_writer_init(&w, buf, sz);
+	if (dns_write_header(&w, &resp) || dns_write_question(&w, &q)) {
+		return -EXIT_FAILURE;
+	}
+	size_t question_len = w.len;
+
+	const size_t nrecs = sizeof(standin_zone) / sizeof(standin_zone[0]);
+	char name[DNS_MAX_NAME_LEN + 1];
+	strcpy(name, q.name);
+	for (size_t hop = 0; hop < STANDIN_MAX_CHAIN; ++hop) {
+		const char* target = NULL;
+		for (size_t i = 0; i < nrecs; ++i) {
+			const struct standin_record* rec = &(standin_zone[i]);
+			if (!dns_names_equal(rec->name, name)) continue;
+
+			int alias = (rec->type == DNS_REC_CNAME
+				&& q.qtype != DNS_REC_CNAME);
+			if (rec->type != q.qtype && !alias) continue;
+
+			if (write_standin_record(&w, rec, &(resp.ancount))) {
+				return -EXIT_FAILURE;
+			}
+			if (alias) target = rec->data;
+		}
+
+		if (!target) break;
+		strcpy(name, target);
+	}
+
+	// NXDOMAIN / NODATA: SOA for the negative caching (RFC 2308)
+	if (!resp.ancount) {
+		if (!standin_has_name(q.name)) resp.rcode = DNS_RC_NAME_ERR;
+
+		struct dns_answer soa = { 0 };
+		strcpy(soa.name, "test");
+		soa.type = DNS_REC_SOA;
+		soa.class = DNS_CL_IN;
+		soa.ttl = STANDIN_TTL;
+		soa.rdata = standin_soa;
+		soa.rdlength = sizeof(standin_soa);
+		if (dns_write_answer(&w, &soa)) return -EXIT_FAILURE;
+		resp.nscount = 1;
+	}
+
+	// Oversized UDP answer: the header and the question only
+	size_t resp_len = w.len;
+	if (udp && DNS_MAX_UDP_LEN < resp_len) {
+		resp.tc = 1;
+		resp.ancount = resp.nscount = 0;
+		resp_len = question_len;
+	}
+
+	struct dns_writer hw = { 0 };
+	dns_writer_init(&hw, buf, DNS_HEADER_LEN);
+	if (dns_write_header(&hw, &resp)) return -EXIT_FAILURE;
+
+	return (int) resp_len;
+}
+
+
+
+/*
+ * SERVER
+ */
+
+
+
+// Opens the socket bound to 127.0.0.1:port
+SOCKET open_standin_socket(const char* port, const int type)
+{
+	struct addrinfo hints = { 0 };
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = type;
+
+	struct addrinfo* addr = NULL;
+	if (getaddrinfo("127.0.0.1", port, &hints, &addr)) {
+		fprintf(stderr, "Invalid port: %s\n", port);
+		return INVALID_SOCKET;
+	}
+
+	SOCKET s = socket(addr->ai_family, addr->ai_socktype,
+		addr->ai_protocol);
+	if (!validate_socket(s)) {
+		psockerror("socket() failed");
+		freeaddrinfo(addr);
+		return INVALID_SOCKET;
+	}
+
+	int opt = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*) &opt,
+		sizeof(opt));
+	int res = bind(s, addr->ai_addr, addr->ai_addrlen);
+	freeaddrinfo(addr);
+	if (res || (type == SOCK_STREAM && listen(s, STANDIN_MAX_CONNS))
+		|| set_socket_nonblocking(s)) {
+		psockerror("Failed to set up the socket");
+		closesocket(s);
+		return INVALID_SOCKET;
+	}
+
+	return s;
+}
+
+
+/*
+ * Opens the sockets, port "0" picks a free port
+ *
+ * Returns:
+ *	- Success: EXIT_SUCCESS
+ *	- Failure: EXIT_FAILURE
+ */
+int standin_init(struct standin* sv, const char* port)
+{
+	sv->tcp = INVALID_SOCKET;
+	for (size_t i = 0; i < STANDIN_MAX_CONNS; ++i) {
+		sv->conns[i].sock = INVALID_SOCKET;
+	}
+
+	sv->udp = open_standin_socket(port, SOCK_DGRAM);
+	if (!validate_socket(sv->udp)) return EXIT_FAILURE;
+
+	// TCP on the port UDP got
+	struct sockaddr_in addr = { 0 };
+	socklen_t addr_len = sizeof(addr);
+	getsockname(sv->udp, (struct sockaddr*) &addr, &addr_len);
+	char bound[MAX_SERVBUF_LEN];
+	snprintf(bound, sizeof(bound), "%u", ntohs(addr.sin_port));
+
+	sv->tcp = open_standin_socket(bound, SOCK_STREAM);
+	if (!validate_socket(sv->tcp)) return EXIT_FAILURE;
+
+	printf("Serving the \"test.\" zone on 127.0.0.1:%s\n", bound);
+	return EXIT_SUCCESS;
+}
+
+
+// Closes the sockets
+void standin_cleanup(struct standin* sv)
+{
+	for (size_t i = 0; i < STANDIN_MAX_CONNS; ++i) {
+		if (validate_socket(sv->conns[i].sock)) {
+			closesocket(sv->conns[i].sock);
+		}
+	}
+
+	if (validate_socket(sv->tcp)) closesocket(sv->tcp);
+	if (validate_socket(sv->udp)) closesocket(sv->udp);
+}
+
+
+// Answers the received datagrams
+void serve_standin_udp(struct standin* sv)
+{
+	for (;;) {
+		uint8_t query[DNS_MAX_UDP_LEN];
+		struct sockaddr_storage peer = { 0 };
+		socklen_t peer_len = sizeof(peer);
+		int rcvd = recvfrom(sv->udp, (char*) query, sizeof(query), 0,
+			(struct sockaddr*) &peer, &peer_len);
+		if (rcvd < 0) return;
+
+		int len = answer_standin_query(query, (size_t) rcvd, sv->buf,
+			sizeof(sv->buf), 1);
+		if (len < 0) continue;
+
+		sendto(sv->udp, (const char*) sv->buf, len, 0,
+			(struct sockaddr*) &peer, peer_len);
+	}
+}
+
+
+// Accepts the waiting connections
+void accept_standin_conns(struct standin* sv)
+{
+	for (size_t i = 0; i < STANDIN_MAX_CONNS; ++i) {
+		struct standin_conn* c = &(sv->conns[i]);
+		if (validate_socket(c->sock)) continue;
+
+		c->sock = accept(sv->tcp, NULL, NULL);
+		if (!validate_socket(c->sock)) return;
+
+		set_socket_nonblocking(c->sock);
+		c->in_len = c->out_len = c->sent = 0;
+	}
+}
+
+
+// Reads the query of the connection, sends the response
+void serve_standin_conn(struct standin_conn* c)
+{
+	// Response first: one query at a time
+	while (c->sent < c->out_len) {
+		int sent = send(c->sock, (const char*) c->out + c->sent,
+			(int) (c->out_len - c->sent), 0);
+		if (sent < 0) {
+			if (socket_would_block()) return;
+			goto out_close;
+		}
+		c->sent += (size_t) sent;
+	}
+	c->out_len = c->sent = 0;
+
+	for (;;) {
+		size_t want = 2;
+		if (2 <= c->in_len) want += ((size_t) c->in[0] << 8) | c->in[1];
+		if (sizeof(c->in) < want) goto out_close;
+		if (2 < want && c->in_len == want) break;
+
+		int rcvd = recv(c->sock, (char*) c->in + c->in_len,
+			(int) (want - c->in_len), 0);
+		if (rcvd == 0) goto out_close;
+		if (rcvd < 0) {
+			if (socket_would_block()) return;
+			goto out_close;
+		}
+		c->in_len += (size_t) rcvd;
+	}
+
+	int len = answer_standin_query(c->in + 2, c->in_len - 2, c->out + 2,
+		sizeof(c->out) - 2, 0);
+	c->in_len = 0;
+	if (len < 0) goto out_close;
+
+	c->out[0] = (uint8_t) (len >> 8);
+	c->out[1] = (uint8_t) len;
+	c->out_len = (size_t) len + 2;
+	serve_standin_conn(c);
+	return;
+
+out_close:
+	closesocket(c->sock);
+	c->sock = INVALID_SOCKET;
+}
+
+
+// Adds the sockets of the server to the select() sets
+SOCKET standin_fds(const struct standin* sv, fd_set* rfds, fd_set* wfds)
+{
+	SOCKET max_fd = (sv->udp < sv->tcp ? sv->tcp : sv->udp);
+	FD_SET(sv->udp, rfds);
+	FD_SET(sv->tcp, rfds);
+
+	for (size_t i = 0; i < STANDIN_MAX_CONNS; ++i) {
+		const struct standin_conn* c = &(sv->conns[i]);
+		if (!validate_socket(c->sock)) continue;
+
+		FD_SET(c->sock, c->out_len ? wfds : rfds);
+		if (max_fd < c->sock) max_fd = c->sock;
+	}
+
+	return max_fd;
+}
+
+
+// Handles the ready sockets of the server
+void standin_process(struct standin* sv, const fd_set* rfds,
+	const fd_set* wfds)
+{
+	if (FD_ISSET(sv->udp, rfds)) serve_standin_udp(sv);
+	if (FD_ISSET(sv->tcp, rfds)) accept_standin_conns(sv);
+
+	for (size_t i = 0; i < STANDIN_MAX_CONNS; ++i) {
+		struct standin_conn* c = &(sv->conns[i]);
+		if (validate_socket(c->sock) && (FD_ISSET(c->sock, rfds)
+			|| FD_ISSET(c->sock, wfds))) {
+			serve_standin_conn(c);
+		}
+	}
+}
+
+
+
+/*
+ * CHECK
+ */
+
+
+
+/*
+ * Expected outcome of a query
+ *
+ * @name Queried name
+ * @qtype Queried type
+ * @rcode Expected error code
+ * @type Type of the expected record (0 - no answers)
+ * @data Presentation of the expected record's data
+ * @count Expected number of the "type" records
+ * @done Response was checked
+ * @ok Response was as expected
+ */
+struct standin_case {
+	const char* name;
+	enum dns_record qtype;
+	enum dns_rcode rcode;
+	enum dns_record type;
+	const char* data;
+	size_t count;
+
+	int done;
+	int ok;
+};
+
+
+// Formats the record data for the comparison
+void format_standin_rdata(const struct dns_answer* ans, char* buf,
+	const size_t sz)
+{
+	const uint8_t* str = NULL;
+	uint8_t len = 0;
+	size_t pos = 0;
+
+	buf[0] = '\0';
+	switch (ans->type) {
+	case DNS_REC_A:
+		inet_ntop(AF_INET, ans->rd.a, buf, (socklen_t) sz);
+		break;
+	case DNS_REC_AAAA:
+		inet_ntop(AF_INET6, ans->rd.aaaa, buf, (socklen_t) sz);
+		break;
+	case DNS_REC_CNAME:
+		snprintf(buf, sz, "%s", ans->rd.name);
+		break;
+	case DNS_REC_MX:
+		snprintf(buf, sz, "%u %s", ans->rd.mx.pref,
+			ans->rd.mx.exchange);
+		break;
+	case DNS_REC_TXT:
+		if (!dns_read_txt(ans, &pos, &str, &len)) {
+			snprintf(buf, sz, "%.*s", (int) len, (const char*) str);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+
+// Checks the response against the expected outcome
+void check_standin_response(void* data, const enum dns_status status,
+	const uint8_t* resp, const size_t len)
+{
+	struct standin_case* tc = (struct standin_case*) data;
+	tc->done = 1;
+	if (status != DNS_ST_OK) return;
+
+	struct dns_reader r = { 0 };
+	dns_reader_init(&r, resp, len);
+
+	struct dns_header hdr = { 0 };
+	struct dns_question q = { 0 };
+	if (dns_read_header(&r, &hdr) || dns_read_question(&r, &q)) return;
+	if (hdr.rcode != tc->rcode || hdr.tc) return;
+
+	size_t count = 0, matched = 0;
+	for (size_t i = 0; i < hdr.ancount; ++i) {
+		struct dns_answer ans = { 0 };
+		if (dns_read_answer(&r, &ans)) return;
+		if (ans.type != tc->type) continue;
+
+		char rdata[DNS_MAX_NAME_LEN + 8];
+		format_standin_rdata(&ans, rdata, sizeof(rdata));
+		++count;
+		if (!strcmp(rdata, tc->data)) ++matched;
+	}
+
+	tc->ok = (tc->type ? count == tc->count && matched == tc->count
+		: !hdr.ancount);
+}
+
+
+/*
+ * Resolves the cases with the stub resolver, the server
+ * is served by the same loop (a blocking resolver would
+ * never get its TCP answers)
+ *
+ * Returns:
+ *	- Every case passed: EXIT_SUCCESS
+ *	- Failure: EXIT_FAILURE
+ */
+int run_standin_check(struct standin* sv, struct dns_resolver* res)
+{
+	struct standin_case cases[] = {
+		{ "a.test", DNS_REC_A, DNS_RC_NO_ERR, DNS_REC_A,
+			"192.0.2.1", 1, 0, 0 },
+		{ "a.test", DNS_REC_AAAA, DNS_RC_NO_ERR, DNS_REC_AAAA,
+			"2001:db8::1", 1, 0, 0 },
+		{ "www.test", DNS_REC_A, DNS_RC_NO_ERR, DNS_REC_CNAME,
+			"a.test", 1, 0, 0 },
+		{ "www.test", DNS_REC_A, DNS_RC_NO_ERR, DNS_REC_A,
+			"192.0.2.1", 1, 0, 0 },
+		{ "mail.test", DNS_REC_MX, DNS_RC_NO_ERR, DNS_REC_MX,
+			"10 mx.test", 1, 0, 0 },
+		{ "txt.test", DNS_REC_TXT, DNS_RC_NO_ERR, DNS_REC_TXT,
+			"hello world", 1, 0, 0 },
+		{ "big.test", DNS_REC_TXT, DNS_RC_NO_ERR, DNS_REC_TXT,
+			STANDIN_HUNDRED, STANDIN_BIG_TXT, 0, 0 },
+		{ "missing.test", DNS_REC_A, DNS_RC_NAME_ERR, 0, NULL, 0, 0, 0 },
+		{ "a.test", DNS_REC_MX, DNS_RC_NO_ERR, 0, NULL, 0, 0, 0 }
+	};
+	const size_t ncases = sizeof(cases) / sizeof(cases[0]);
+
+	// Every query in flight at once
+	for (size_t i = 0; i < ncases; ++i) {
+		if (dns_resolve(res, cases[i].name, cases[i].qtype,
+			check_standin_response, &(cases[i]))) {
+			cases[i].done = 1;
+		}
+	}
+
+	uint64_t deadline = dns_now_ms() + STANDIN_CHECK_MS;
+	while (res->npending && dns_now_ms() < deadline) {
+		fd_set rfds, wfds;
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		SOCKET max_fd = standin_fds(sv, &rfds, &wfds);
+		SOCKET res_fd = dns_resolver_fds(res, &rfds, &wfds);
+		if (max_fd < res_fd) max_fd = res_fd;
+
+		int timeout = dns_resolver_timeout(res);
+		if (timeout < 0 || 100 < timeout) timeout = 100;
+		struct timeval tv = { 0 };
+		tv.tv_usec = timeout * 1000;
+
+		if (select((int) max_fd + 1, &rfds, &wfds, NULL, &tv) < 0) {
+			if (socket_would_block()) continue; // EINTR
+			psockerror("select() failed");
+			return EXIT_FAILURE;
+		}
+
+		standin_process(sv, &rfds, &wfds);
+		dns_resolver_process(res);
+	}
+
+	size_t passed = 0;
+	for (size_t i = 0; i < ncases; ++i) {
+		const struct standin_case* tc = &(cases[i]);
+		const char* type = dns_record_to_str(tc->qtype);
+		printf("%s\t%s\t%s\n", tc->ok ? "ok" : "FAIL", tc->name,
+			type ? type : "?");
+		passed += (tc->ok != 0);
+	}
+
+	printf("%zu of %zu passed\n", passed, ncases);
+	return passed == ncases ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+int main(int argc, const char* argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage:\n\tdns_standin [PORT]\n"
+			"\tdns_standin --check\n");
+		return EXIT_FAILURE;
+	}
+
+	if (sockets_startup()) return EXIT_FAILURE;
+
+	int ret = EXIT_FAILURE;
+	int check = !strcmp(argv[1], "--check");
+	struct standin* sv = (struct standin*) calloc(1,
+		sizeof(struct standin));
+	struct dns_resolver* res = (struct dns_resolver*) malloc(
+		sizeof(struct dns_resolver));
+	if (!sv || !res) goto out_free;
+
+	if (standin_init(sv, check ? "0" : argv[1])) goto out_cleanup;
+
+	if (check) {
+		struct sockaddr_in addr = { 0 };
+		socklen_t addr_len = sizeof(addr);
+		getsockname(sv->udp, (struct sockaddr*) &addr, &addr_len);
+		char port[MAX_SERVBUF_LEN];
+		snprintf(port, sizeof(port), "%u", ntohs(addr.sin_port));
+
+		if (dns_resolver_init(res, "127.0.0.1", port)) {
+			dns_resolver_cleanup(res);
+			goto out_cleanup;
+		}
+		ret = run_standin_check(sv, res);
+		dns_resolver_cleanup(res);
+		goto out_cleanup;
+	}
+
+	for (;;) {
+		fd_set rfds, wfds;
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		SOCKET max_fd = standin_fds(sv, &rfds, &wfds);
+
+		if (select((int) max_fd + 1, &rfds, &wfds, NULL, NULL) < 0) {
+			if (socket_would_block()) continue; // EINTR
+			psockerror("select() failed");
+			break;
+		}
+
+		standin_process(sv, &rfds, &wfds);
+	}
+
+out_cleanup:
+	standin_cleanup(sv);
+out_free:
+	free(res);
+	free(sv);
+	sockets_cleanup();
+	return ret;
+}
@@ -0,0 +1,401 @@
+#include "../headers/dns_caches.h"
+#include <ctype.h>	// tolower()
+
+
+
+/*
+ * UTILITIES
+ */
+
+
+
+void normalize_dns_name(const char* name, char* lname)
+{
+	size_t len = strlen(name);
+	if (1 < len && name[len - 1] == '.') --len;
+	if (DNS_MAX_NAME_LEN < len) len = DNS_MAX_NAME_LEN;
+
+	for (size_t i = 0; i < len; ++i) {
+		lname[i] = (char) tolower((unsigned char) name[i]);
+	}
+	lname[len] = '\0';
+}
+
+
+// FNV-1a
+uint64_t hash_dns_key(const char* lname, const uint16_t qtype,
+	const uint16_t qclass)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (const char* cur = lname; *cur; ++cur) {
+		hash ^= (unsigned char) *cur;
+		hash *= 1099511628211ULL;
+	}
+
+	uint32_t tail = ((uint32_t) qtype << 16) | qclass;
+	for (int i = 0; i < 4; ++i) {
+		hash ^= (tail >> (8 * i)) & 0xFF;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+
+// Finds the slot of the key, SIZE_MAX if it is not cached
+size_t find_dns_cache_slot(const struct dns_cache* cache, const char* lname,
+	const uint64_t hash, const uint16_t qtype, const uint16_t qclass)
+{
+	size_t mask = DNS_CACHE_SLOTS - 1;
+	for (size_t i = hash & mask; cache->slots[i].used; i = (i + 1) & mask) {
+		const struct dns_cache_entry* e = &(cache->slots[i]);
+		if (e->hash == hash && e->qtype == qtype && e->qclass == qclass
+			&& !strcmp(e->name, lname)) {
+			return i;
+		}
+	}
+
+	return SIZE_MAX;
+}
+
+
+// Gets the time the entry may not be served anymore
+static inline
+uint64_t dns_entry_removal(const struct dns_cache* cache,
+	const struct dns_cache_entry* e)
+{
+	return e->expires + cache->stale_ms;
+}
+
+
+
+/*
+ * EXPIRY HEAP
+ */
+
+
+
+// Compares the heap nodes by removal time
+static inline
+int dns_heap_less(const struct dns_cache* cache, const size_t a,
+	const size_t b)
+{
+	return dns_entry_removal(cache, &(cache->slots[cache->heap[a]]))
+		< dns_entry_removal(cache, &(cache->slots[cache->heap[b]]));
+}
+
+
+// Swaps the heap nodes
+void dns_heap_swap(struct dns_cache* cache, const size_t a, const size_t b)
+{
+	size_t tmp = cache->heap[a];
+	cache->heap[a] = cache->heap[b];
+	cache->heap[b] = tmp;
+
+	cache->slots[cache->heap[a]].heap_pos = a;
+	cache->slots[cache->heap[b]].heap_pos = b;
+}
+
+
+// Moves the node up to its place
+void dns_heap_sift_up(struct dns_cache* cache, size_t pos)
+{
+	while (pos && dns_heap_less(cache, pos, (pos - 1) / 2)) {
+		dns_heap_swap(cache, pos, (pos - 1) / 2);
+		pos = (pos - 1) / 2;
+	}
+}
+
+
+// Moves the node down to its place
+void dns_heap_sift_down(struct dns_cache* cache, size_t pos)
+{
+	while (1) {
+		size_t min = pos;
+		size_t left = 2 * pos + 1;
+		size_t right = left + 1;
+
+		if (left < cache->count && dns_heap_less(cache, left, min)) {
+			min = left;
+		}
+		if (right < cache->count && dns_heap_less(cache, right, min)) {
+			min = right;
+		}
+		if (min == pos) return;
+
+		dns_heap_swap(cache, pos, min);
+		pos = min;
+	}
+}
+
+
+// Restores the heap order after the removal time of the node changed
+void dns_heap_fix(struct dns_cache* cache, const size_t pos)
+{
+	size_t slot = cache->heap[pos];
+	dns_heap_sift_up(cache, pos);
+	dns_heap_sift_down(cache, cache->slots[slot].heap_pos);
+}
+
+
+// Removes the entry from the heap and the table
+void remove_dns_cache_entry(struct dns_cache* cache, size_t slot)
+{
+	struct dns_cache_entry* e = &(cache->slots[slot]);
+	free(e->msg);
+
+	// Replace the heap node with the last one
+	size_t pos = e->heap_pos;
+	--cache->count;
+	if (pos != cache->count) {
+		dns_heap_swap(cache, pos, cache->count);
+		dns_heap_fix(cache, pos);
+	}
+
+	// Backward shift deletion: no tombstones for linear probing
+	size_t mask = DNS_CACHE_SLOTS - 1;
+	size_t i = slot;
+	for (size_t j = (slot + 1) & mask; cache->slots[j].used;
+		j = (j + 1) & mask) {
+		size_t home = cache->slots[j].hash & mask;
+
+		// Move only if the home slot is not in (i, j]
+		int in_range = (i <= j) ? (i < home && home <= j)
+			: (i < home || home <= j);
+		if (in_range) continue;
+
+		cache->slots[i] = cache->slots[j];
+		cache->heap[cache->slots[i].heap_pos] = i;
+		i = j;
+	}
+
+	memset(&(cache->slots[i]), 0, sizeof(struct dns_cache_entry));
+}
+
+
+
+/*
+ * RESPONSES
+ */
+
+
+
+/*
+ * Gets the TTL the response is cached for
+ *
+ * Returns:
+ *	- Cacheable: TTL (s), "negative" is set for NXDOMAIN / NODATA
+ *	- Uncacheable: 0
+ */
+uint32_t get_dns_response_ttl(const uint8_t* resp, const size_t len,
+	struct dns_question* q, int* negative)
+{
+	struct dns_reader r = { 0 };
+	dns_reader_init(&r, resp, len);
+
+	struct dns_header hdr = { 0 };
+	if (dns_read_header(&r, &hdr)) return 0;
+	if (!hdr.qr || hdr.tc || hdr.qdcount != 1) return 0;
+	if (hdr.rcode != DNS_RC_NO_ERR && hdr.rcode != DNS_RC_NAME_ERR) {
+		return 0;
+	}
+
+	if (dns_read_question(&r, q)) return 0;
+
+	*negative = (hdr.rcode == DNS_RC_NAME_ERR || !hdr.ancount);
+
+	uint32_t ttl = UINT32_MAX;
+	int soa_found = 0;
+	for (size_t i = 0; i < (size_t) hdr.ancount + hdr.nscount; ++i) {
+		struct dns_answer ans = { 0 };
+		if (dns_read_answer(&r, &ans)) return 0;
+
+		if (i < hdr.ancount) {
+			if (!*negative && ans.ttl < ttl) ttl = ans.ttl;
+		} else if (*negative && ans.type == DNS_REC_SOA) {
+			// RFC 2308: min of the SOA TTL and its MINIMUM field
+			uint32_t neg_ttl = (ans.ttl < ans.rd.soa.minimum
+				? ans.ttl : ans.rd.soa.minimum);
+			if (neg_ttl < ttl) ttl = neg_ttl;
+			soa_found = 1;
+		}
+	}
+
+	// Negative responses without SOA are not cached
+	if (*negative && !soa_found) return 0;
+	if (ttl == UINT32_MAX) return 0;
+
+	uint32_t max_ttl = (*negative ? DNS_CACHE_MAX_NEG_TTL
+		: DNS_CACHE_MAX_TTL);
+	return ttl < max_ttl ? ttl : max_ttl;
+}
+
+
+// Decreases the TTLs of the records by "elapsed" seconds
+void age_dns_response(uint8_t* msg, const size_t len, const uint32_t elapsed,
+	const int stale)
+{
+	struct dns_reader r = { 0 };
+	dns_reader_init(&r, msg, len);
+
+	struct dns_header hdr = { 0 };
+	struct dns_question q = { 0 };
+	if (dns_read_header(&r, &hdr)) return;
+	for (size_t i = 0; i < hdr.qdcount; ++i) {
+		if (dns_read_question(&r, &q)) return;
+	}
+
+	size_t count = (size_t) hdr.ancount + hdr.nscount + hdr.arcount;
+	for (size_t i = 0; i < count; ++i) {
+		struct dns_answer ans = { 0 };
+		if (dns_read_answer(&r, &ans)) return;
+		if (ans.type == DNS_REC_OPT) continue; // TTL holds EDNS flags
+
+		uint32_t ttl = 0;
+		if (stale) {
+			ttl = DNS_CACHE_STALE_TTL;
+		} else if (elapsed < ans.ttl) {
+			ttl = ans.ttl - elapsed;
+		}
+
+		// TTL precedes RDLENGTH and RDATA
+		uint8_t* p = msg + (ans.rdata - msg) - 6;
+		p[0] = (uint8_t) (ttl >> 24);
+		p[1] = (uint8_t) (ttl >> 16);
+		p[2] = (uint8_t) (ttl >> 8);
+		p[3] = (uint8_t) ttl;
+	}
+}
+
+
+
+/*
+ * CACHE
+ */
+
+
+
+void dns_cache_init(struct dns_cache* cache)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->stale_ms = (uint64_t) DNS_CACHE_DEF_STALE_SEC * 1000;
+}
+
+
+enum dns_cache_result dns_cache_get(struct dns_cache* cache,
+	const char* name, const uint16_t qtype, const uint16_t qclass,
+	const uint64_t now, uint8_t* buf, const size_t sz, size_t* len)
+{
+	char lname[DNS_MAX_NAME_LEN + 1];
+	normalize_dns_name(name, lname);
+
+	uint64_t hash = hash_dns_key(lname, qtype, qclass);
+	size_t slot = find_dns_cache_slot(cache, lname, hash, qtype, qclass);
+	if (slot == SIZE_MAX) goto out_miss;
+
+	struct dns_cache_entry* e = &(cache->slots[slot]);
+	if (dns_entry_removal(cache, e) <= now) {
+		remove_dns_cache_entry(cache, slot);
+		goto out_miss;
+	}
+	if (sz < e->len) goto out_miss;
+
+	int stale = (e->expires <= now);
+	memcpy(buf, e->msg, e->len);
+	*len = e->len;
+	age_dns_response(buf, e->len, (uint32_t) ((now - e->stored) / 1000),
+		stale);
+
+	if (!stale) {
+		++cache->hits;
+		return DNS_CACHE_HIT;
+	}
+
+	// A single caller refreshes, the others are served stale data
+	++cache->stale_hits;
+	if (e->refresh && now - e->refresh < DNS_CACHE_REFRESH_MS) {
+		return DNS_CACHE_STALE;
+	}
+
+	e->refresh = now;
+	return DNS_CACHE_REFRESH;
+
+out_miss:
+	++cache->misses;
+	return DNS_CACHE_MISS;
+}
+
+
+int dns_cache_put(struct dns_cache* cache, const uint8_t* resp,
+	const size_t len, const uint64_t now)
+{
+	struct dns_question q = { 0 };
+	int negative = 0;
+	uint32_t ttl = get_dns_response_ttl(resp, len, &q, &negative);
+	if (!ttl) return EXIT_FAILURE;
+
+	uint8_t* msg = (uint8_t*) malloc(len);
+	if (!msg) return EXIT_FAILURE;
+	memcpy(msg, resp, len);
+
+	char lname[DNS_MAX_NAME_LEN + 1];
+	normalize_dns_name(q.name, lname);
+	uint64_t hash = hash_dns_key(lname, q.qtype, q.qclass);
+
+	size_t slot = find_dns_cache_slot(cache, lname, hash,
+		q.qtype, q.qclass);
+	if (slot == SIZE_MAX) {
+		// Make room: drop the dead entries, then the closest to death
+		if (cache->count == DNS_CACHE_MAX_ENTRIES) {
+			dns_cache_expire(cache, now);
+		}
+		if (cache->count == DNS_CACHE_MAX_ENTRIES) {
+			remove_dns_cache_entry(cache, cache->heap[0]);
+		}
+
+		size_t mask = DNS_CACHE_SLOTS - 1;
+		slot = hash & mask;
+		while (cache->slots[slot].used) slot = (slot + 1) & mask;
+
+		struct dns_cache_entry* e = &(cache->slots[slot]);
+		e->used = 1;
+		e->hash = hash;
+		strcpy(e->name, lname);
+		e->qtype = q.qtype;
+		e->qclass = q.qclass;
+		e->heap_pos = cache->count;
+		cache->heap[cache->count++] = slot;
+	} else {
+		free(cache->slots[slot].msg);
+	}
+
+	struct dns_cache_entry* e = &(cache->slots[slot]);
+	e->msg = msg;
+	e->len = len;
+	e->negative = negative;
+	e->stored = now;
+	e->expires = now + (uint64_t) ttl * 1000;
+	e->refresh = 0;
+	dns_heap_fix(cache, e->heap_pos);
+
+	return EXIT_SUCCESS;
+}
+
+
+void dns_cache_expire(struct dns_cache* cache, const uint64_t now)
+{
+	while (cache->count && dns_entry_removal(cache,
+		&(cache->slots[cache->heap[0]])) <= now) {
+		remove_dns_cache_entry(cache, cache->heap[0]);
+	}
+}
+
+
+void dns_cache_cleanup(struct dns_cache* cache)
+{
+	for (size_t i = 0; i < DNS_CACHE_SLOTS; ++i) {
+		if (cache->slots[i].used) free(cache->slots[i].msg);
+	}
+
+	memset(cache, 0, sizeof(*cache));
+}
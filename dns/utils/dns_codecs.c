@@ -0,0 +1,494 @@
+#include "../headers/dns_codecs.h"
+#include <ctype.h>	// tolower()
+
+
+
+/*
+ * DECODING
+ */
+
+
+
+void dns_reader_init(struct dns_reader* r, const uint8_t* msg,
+	const size_t len)
+{
+	r->msg = msg;
+	r->len = len;
+	r->pos = 0;
+}
+
+
+// Reads a 16-bit number in network byte order
+static inline
+uint16_t dns_get16(const uint8_t* p)
+{
+	return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+
+// Reads a 32-bit number in network byte order
+static inline
+uint32_t dns_get32(const uint8_t* p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+		| ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+
+int dns_read_header(struct dns_reader* r, struct dns_header* hdr)
+{
+	if (r->len - r->pos < DNS_HEADER_LEN) return EXIT_FAILURE;
+
+	const uint8_t* p = r->msg + r->pos;
+	uint16_t flags = dns_get16(p + 2);
+
+	hdr->id = dns_get16(p);
+	hdr->qr = (flags >> 15) & 1;
+	hdr->opcode = (enum dns_opcode) ((flags >> 11) & 0xF);
+	hdr->aa = (flags >> 10) & 1;
+	hdr->tc = (flags >> 9) & 1;
+	hdr->rd = (flags >> 8) & 1;
+	hdr->ra = (flags >> 7) & 1;
+	hdr->z = (flags >> 4) & 7;
+	hdr->rcode = (enum dns_rcode) (flags & 0xF);
+	hdr->qdcount = dns_get16(p + 4);
+	hdr->ancount = dns_get16(p + 6);
+	hdr->nscount = dns_get16(p + 8);
+	hdr->arcount = dns_get16(p + 10);
+
+	r->pos += DNS_HEADER_LEN;
+	return EXIT_SUCCESS;
+}
+
+
+int dns_read_name(const uint8_t* msg, const size_t len, size_t* pos,
+	char* name)
+{
+	size_t cur = *pos;
+	size_t end = 0;		// offset after the name in the message
+	size_t out = 0;		// bytes written to "name"
+	int jumps = 0;
+
+	while (1) {
+		if (len <= cur) return EXIT_FAILURE;
+		uint8_t llen = msg[cur];
+
+		// Compression pointer
+		if ((llen & 0xC0) == 0xC0) {
+			if (len <= cur + 1) return EXIT_FAILURE;
+			if (DNS_MAX_PTR_JUMPS < ++jumps) return EXIT_FAILURE;
+			if (!end) end = cur + 2;
+
+			cur = ((size_t) (llen & 0x3F) << 8) | msg[cur + 1];
+			continue;
+		}
+
+		if (llen & 0xC0) return EXIT_FAILURE; // extended labels
+		if (!llen) break; // root label
+
+		// Label and a dot
+		if (len < cur + 1 + llen) return EXIT_FAILURE;
+		if (DNS_MAX_NAME_LEN < out + llen + 1) return EXIT_FAILURE;
+
+		memcpy(name + out, msg + cur + 1, llen);
+		out += llen;
+		name[out++] = '.';
+		cur += 1 + llen;
+	}
+
+	// No trailing dot, "." for the root
+	if (out) {
+		name[out - 1] = '\0';
+	} else {
+		name[0] = '.';
+		name[1] = '\0';
+	}
+
+	*pos = (end ? end : cur + 1);
+	return EXIT_SUCCESS;
+}
+
+
+int dns_read_question(struct dns_reader* r, struct dns_question* q)
+{
+	if (dns_read_name(r->msg, r->len, &(r->pos), q->name)) {
+		return EXIT_FAILURE;
+	}
+
+	if (r->len - r->pos < 4) return EXIT_FAILURE;
+
+	q->qtype = (enum dns_record) dns_get16(r->msg + r->pos);
+	q->qclass = (enum dns_class) dns_get16(r->msg + r->pos + 2);
+	r->pos += 4;
+
+	return EXIT_SUCCESS;
+}
+
+
+// Decodes the data of the known record types
+int dns_read_rdata(struct dns_reader* r, struct dns_answer* ans)
+{
+	size_t pos = r->pos;
+	size_t end = r->pos + ans->rdlength;
+
+	switch (ans->type) {
+	case DNS_REC_A:
+		if (ans->rdlength != 4) return EXIT_FAILURE;
+		memcpy(ans->rd.a, ans->rdata, 4);
+		return EXIT_SUCCESS;
+	case DNS_REC_AAAA:
+		if (ans->rdlength != 16) return EXIT_FAILURE;
+		memcpy(ans->rd.aaaa, ans->rdata, 16);
+		return EXIT_SUCCESS;
+	case DNS_REC_CNAME:
+	case DNS_REC_NS:
+	case DNS_REC_PTR:
+		if (dns_read_name(r->msg, r->len, &pos, ans->rd.name)) {
+			return EXIT_FAILURE;
+		}
+		return pos == end ? EXIT_SUCCESS : EXIT_FAILURE;
+	case DNS_REC_MX:
+		if (ans->rdlength < 3) return EXIT_FAILURE;
+		ans->rd.mx.pref = dns_get16(ans->rdata);
+		pos += 2;
+		if (dns_read_name(r->msg, r->len, &pos, ans->rd.mx.exchange)) {
+			return EXIT_FAILURE;
+		}
+		return pos == end ? EXIT_SUCCESS : EXIT_FAILURE;
+	case DNS_REC_SOA: {
+		// MNAME, RNAME, SERIAL, REFRESH, RETRY, EXPIRE, MINIMUM
+		char skipped[DNS_MAX_NAME_LEN + 1];
+		if (dns_read_name(r->msg, r->len, &pos, skipped)
+			|| dns_read_name(r->msg, r->len, &pos, skipped)) {
+			return EXIT_FAILURE;
+		}
+		if (pos + 20 != end) return EXIT_FAILURE;
+
+		ans->rd.soa.serial = dns_get32(r->msg + pos);
+		ans->rd.soa.minimum = dns_get32(r->msg + pos + 16);
+		return EXIT_SUCCESS;
+	}
+	default:
+		return EXIT_SUCCESS; // kept in "rdata" only
+	}
+}
+
+
+int dns_read_answer(struct dns_reader* r, struct dns_answer* ans)
+{
+	if (dns_read_name(r->msg, r->len, &(r->pos), ans->name)) {
+		return EXIT_FAILURE;
+	}
+	ans->namelen = strlen(ans->name);
+
+	// TYPE, CLASS, TTL, RDLENGTH
+	if (r->len - r->pos < 10) return EXIT_FAILURE;
+
+	const uint8_t* p = r->msg + r->pos;
+	ans->type = (enum dns_record) dns_get16(p);
+	ans->class = (enum dns_class) dns_get16(p + 2);
+	ans->ttl = dns_get32(p + 4);
+	ans->rdlength = dns_get16(p + 8);
+	r->pos += 10;
+
+	if (r->len - r->pos < ans->rdlength) return EXIT_FAILURE;
+	ans->rdata = r->msg + r->pos;
+
+	if (dns_read_rdata(r, ans)) return EXIT_FAILURE;
+
+	r->pos += ans->rdlength;
+	return EXIT_SUCCESS;
+}
+
+
+int dns_read_txt(const struct dns_answer* ans, size_t* pos,
+	const uint8_t** str, uint8_t* len)
+{
+	if (ans->rdlength <= *pos) return EXIT_FAILURE;
+
+	uint8_t slen = ans->rdata[*pos];
+	if (ans->rdlength < *pos + 1 + slen) return EXIT_FAILURE;
+
+	*str = ans->rdata + *pos + 1;
+	*len = slen;
+	*pos += 1 + slen;
+
+	return EXIT_SUCCESS;
+}
+
+
+int dns_names_equal(const char* a, const char* b)
+{
+	size_t alen = strlen(a);
+	size_t blen = strlen(b);
+	if (alen && a[alen - 1] == '.') --alen;
+	if (blen && b[blen - 1] == '.') --blen;
+	if (alen != blen) return 0;
+
+	for (size_t i = 0; i < alen; ++i) {
+		if (tolower((unsigned char) a[i]) != tolower((unsigned char) b[i])) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+
+/*
+ * ENCODING
+ */
+
+
+
+void dns_writer_init(struct dns_writer* w, uint8_t* buf, const size_t sz)
+{
+	w->buf = buf;
+	w->sz = sz;
+	w->len = 0;
+	w->nnames = 0;
+}
+
+
+// Writes a 16-bit number in network byte order
+int dns_put16(struct dns_writer* w, const uint16_t val)
+{
+	if (w->sz - w->len < 2) return EXIT_FAILURE;
+
+	w->buf[w->len++] = (uint8_t) (val >> 8);
+	w->buf[w->len++] = (uint8_t) val;
+
+	return EXIT_SUCCESS;
+}
+
+
+// Writes a 32-bit number in network byte order
+int dns_put32(struct dns_writer* w, const uint32_t val)
+{
+	if (dns_put16(w, (uint16_t) (val >> 16))) return EXIT_FAILURE;
+	return dns_put16(w, (uint16_t) val);
+}
+
+
+// Writes raw bytes
+int dns_put_bytes(struct dns_writer* w, const void* data, const size_t len)
+{
+	if (w->sz - w->len < len) return EXIT_FAILURE;
+
+	memcpy(w->buf + w->len, data, len);
+	w->len += len;
+
+	return EXIT_SUCCESS;
+}
+
+
+int dns_write_header(struct dns_writer* w, const struct dns_header* hdr)
+{
+	uint16_t flags = (uint16_t) ((hdr->qr << 15) | (hdr->opcode << 11)
+		| (hdr->aa << 10) | (hdr->tc << 9) | (hdr->rd << 8)
+		| (hdr->ra << 7) | (hdr->z << 4) | hdr->rcode);
+
+	int res = dns_put16(w, hdr->id);
+	res |= dns_put16(w, flags);
+	res |= dns_put16(w, hdr->qdcount);
+	res |= dns_put16(w, hdr->ancount);
+	res |= dns_put16(w, hdr->nscount);
+	res |= dns_put16(w, hdr->arcount);
+
+	return res ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+// Finds a written name equal to the suffix, returns its offset or 0
+uint16_t dns_find_written_name(const struct dns_writer* w, const char* suffix)
+{
+	char written[DNS_MAX_NAME_LEN + 1];
+	for (size_t i = 0; i < w->nnames; ++i) {
+		size_t pos = w->names[i];
+		if (dns_read_name(w->buf, w->len, &pos, written)) continue;
+		if (dns_names_equal(written, suffix)) return w->names[i];
+	}
+
+	return 0; // the header occupies offset 0, no name can start there
+}
+
+
+int dns_write_name(struct dns_writer* w, const char* name)
+{
+	size_t len = strlen(name);
+	if (len && name[len - 1] == '.') --len; // trailing dot
+	if (DNS_MAX_NAME_LEN < len) return EXIT_FAILURE;
+
+	size_t start = 0;
+	while (start < len) {
+		// Compress the rest of the name if it was written before
+		char suffix[DNS_MAX_NAME_LEN + 1];
+		memcpy(suffix, name + start, len - start);
+		suffix[len - start] = '\0';
+
+		uint16_t off = dns_find_written_name(w, suffix);
+		if (off) return dns_put16(w, (uint16_t) (0xC000 | off));
+
+		// Find the label end
+		size_t end = start;
+		while (end < len && name[end] != '.') ++end;
+
+		size_t llen = end - start;
+		if (!llen || DNS_MAX_LABEL_LEN < llen) return EXIT_FAILURE;
+
+		// Remember the suffix (pointers are 14-bit)
+		if (w->nnames < DNS_MAX_COMP_NAMES && w->len < 0x4000) {
+			w->names[w->nnames++] = (uint16_t) w->len;
+		}
+
+		uint8_t llen_byte = (uint8_t) llen;
+		if (dns_put_bytes(w, &llen_byte, 1)
+			|| dns_put_bytes(w, name + start, llen)) {
+			return EXIT_FAILURE;
+		}
+
+		start = end + 1;
+	}
+
+	// Root label
+	uint8_t root = 0;
+	return dns_put_bytes(w, &root, 1);
+}
+
+
+int dns_write_question(struct dns_writer* w, const struct dns_question* q)
+{
+	int res = dns_write_name(w, q->name);
+	res |= dns_put16(w, (uint16_t) q->qtype);
+	res |= dns_put16(w, (uint16_t) q->qclass);
+
+	return res ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+int dns_write_answer(struct dns_writer* w, const struct dns_answer* ans)
+{
+	int res = dns_write_name(w, ans->name);
+	res |= dns_put16(w, (uint16_t) ans->type);
+	res |= dns_put16(w, (uint16_t) ans->class);
+	res |= dns_put32(w, ans->ttl);
+	if (res) return EXIT_FAILURE;
+
+	// RDLENGTH is patched once the data is written
+	size_t rdlen_pos = w->len;
+	if (dns_put16(w, 0)) return EXIT_FAILURE;
+
+	switch (ans->type) {
+	case DNS_REC_A:
+		res = dns_put_bytes(w, ans->rd.a, 4);
+		break;
+	case DNS_REC_AAAA:
+		res = dns_put_bytes(w, ans->rd.aaaa, 16);
+		break;
+	case DNS_REC_CNAME:
+	case DNS_REC_NS:
+	case DNS_REC_PTR:
+		res = dns_write_name(w, ans->rd.name);
+		break;
+	case DNS_REC_MX:
+		res = dns_put16(w, ans->rd.mx.pref);
+		res |= dns_write_name(w, ans->rd.mx.exchange);
+		break;
+	default:
+		res = dns_put_bytes(w, ans->rdata, ans->rdlength);
+		break;
+	}
+	if (res) return EXIT_FAILURE;
+
+	size_t rdlen = w->len - rdlen_pos - 2;
+	w->buf[rdlen_pos] = (uint8_t) (rdlen >> 8);
+	w->buf[rdlen_pos + 1] = (uint8_t) rdlen;
+
+	return EXIT_SUCCESS;
+}
+
+
+int dns_write_edns(struct dns_writer* w, const uint16_t udp_len)
+{
+	// Root name, OPT, payload size as class, no flags, no options
+	uint8_t root = 0;
+	int res = dns_put_bytes(w, &root, 1);
+	res |= dns_put16(w, DNS_REC_OPT);
+	res |= dns_put16(w, udp_len);
+	res |= dns_put32(w, 0);
+	res |= dns_put16(w, 0);
+
+	return res ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+int dns_encode_query(uint8_t* buf, const size_t sz, const uint16_t id,
+	const char* name, const enum dns_record qtype)
+{
+	struct dns_writer w = { 0 };
+	dns_writer_init(&w, buf, sz);
+
+	struct dns_header hdr = { 0 };
+	hdr.id = id;
+	hdr.rd = 1;
+	hdr.qdcount = 1;
+	hdr.arcount = 1;
+
+	struct dns_question q = { 0 };
+	if (DNS_MAX_NAME_LEN < strlen(name)) return -EXIT_FAILURE;
+	strcpy(q.name, name);
+	q.qtype = qtype;
+	q.qclass = DNS_CL_IN;
+
+	if (dns_write_header(&w, &hdr) || dns_write_question(&w, &q)
+		|| dns_write_edns(&w, DNS_EDNS_UDP_LEN)) {
+		return -EXIT_FAILURE;
+	}
+
+	return (int) w.len;
+}
+
+
+// Record types with names
+static const struct {
+	enum dns_record type;
+	const char* name;
+} dns_record_names[] = {
+	{ DNS_REC_A, "A" },
+	{ DNS_REC_NS, "NS" },
+	{ DNS_REC_CNAME, "CNAME" },
+	{ DNS_REC_SOA, "SOA" },
+	{ DNS_REC_PTR, "PTR" },
+	{ DNS_REC_MX, "MX" },
+	{ DNS_REC_TXT, "TXT" },
+	{ DNS_REC_AAAA, "AAAA" },
+	{ DNS_REC_OPT, "OPT" },
+	{ DNS_REC_ALL, "ANY" }
+};
+
+
+const char* dns_record_to_str(const enum dns_record type)
+{
+	size_t n = sizeof(dns_record_names) / sizeof(dns_record_names[0]);
+	for (size_t i = 0; i < n; ++i) {
+		if (dns_record_names[i].type == type) {
+			return dns_record_names[i].name;
+		}
+	}
+
+	return NULL;
+}
+
+
+enum dns_record dns_str_to_record(const char* str)
+{
+	size_t n = sizeof(dns_record_names) / sizeof(dns_record_names[0]);
+	for (size_t i = 0; i < n; ++i) {
+		if (dns_names_equal(dns_record_names[i].name, str)) {
+			return dns_record_names[i].type;
+		}
+	}
+
+	return (enum dns_record) 0;
+}
@@ -0,0 +1,602 @@
+#include "../headers/dns_resolvers.h"
+#include <time.h>	// clock_gettime(), time()
+
+#ifndef _WIN32
+	#include <fcntl.h>	// fcntl()
+	#include <sys/time.h>	// struct timeval
+#endif // !_WIN32
+
+#ifdef MSG_NOSIGNAL
+	#define DNS_TCP_SEND_FLAGS MSG_NOSIGNAL // no SIGPIPE on resets
+#else // MSG_NOSIGNAL
+	#define DNS_TCP_SEND_FLAGS 0
+#endif // !MSG_NOSIGNAL
+
+
+
+/*
+ * UTILITIES
+ */
+
+
+
+uint64_t dns_now_us(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, cnt;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&cnt);
+	return (uint64_t) (cnt.QuadPart / freq.QuadPart) * 1000000
+		+ (uint64_t) (cnt.QuadPart % freq.QuadPart) * 1000000
+		/ freq.QuadPart;
+#else // _WIN32
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+#endif // !_WIN32
+}
+
+
+uint64_t dns_now_ms(void)
+{
+	return dns_now_us() / 1000;
+}
+
+
+// Makes the socket non-blocking
+int set_socket_nonblocking(const SOCKET s)
+{
+#ifdef _WIN32
+	u_long mode = 1;
+	return ioctlsocket(s, FIONBIO, &mode) ? EXIT_FAILURE : EXIT_SUCCESS;
+#else // _WIN32
+	int flags = fcntl(s, F_GETFL, 0);
+	if (flags < 0) return EXIT_FAILURE;
+	return fcntl(s, F_SETFL, flags | O_NONBLOCK) ? EXIT_FAILURE
+		: EXIT_SUCCESS;
+#endif // !_WIN32
+}
+
+
+// Checks if the non-blocking call failed only because it would block
+int socket_would_block(void)
+{
+#ifdef _WIN32
+	return sockerrno() == WSAEWOULDBLOCK;
+#else // _WIN32
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif // !_WIN32
+}
+
+
+// Seeds the message ID generator (unpredictable IDs hinder spoofing)
+void seed_dns_rng(struct dns_resolver* res)
+{
+	res->rng = 0;
+
+	FILE* urandom = fopen("/dev/urandom", "rb");
+	if (urandom) {
+		if (fread(&(res->rng), sizeof(res->rng), 1, urandom) != 1) {
+			res->rng = 0;
+		}
+		fclose(urandom);
+	}
+
+	if (!res->rng) {
+		res->rng = ((uint64_t) time(NULL) << 32) ^ dns_now_ms()
+			^ (uint64_t) (uintptr_t) res;
+	}
+	if (!res->rng) res->rng = 0x9E3779B97F4A7C15ULL;
+}
+
+
+// Generates the next message ID (xorshift64*)
+uint16_t next_dns_id(struct dns_resolver* res)
+{
+	res->rng ^= res->rng >> 12;
+	res->rng ^= res->rng << 25;
+	res->rng ^= res->rng >> 27;
+	return (uint16_t) ((res->rng * 0x2545F4914F6CDD1DULL) >> 48);
+}
+
+
+// Finds the pending query by message ID
+struct dns_query* find_dns_query(struct dns_resolver* res, const uint16_t id)
+{
+	for (size_t i = 0; i < DNS_MAX_PENDING; ++i) {
+		if (res->pending[i].active && res->pending[i].id == id) {
+			return &(res->pending[i]);
+		}
+	}
+
+	return NULL;
+}
+
+
+// Completes the query and frees its slot
+void complete_dns_query(struct dns_resolver* res, struct dns_query* q,
+	const enum dns_status status, const uint8_t* resp, const size_t len)
+{
+	// Free the slot first: the callback may send new queries
+	dns_callback cb = q->cb;
+	void* data = q->data;
+	q->active = 0;
+	--res->npending;
+
+	if (cb) cb(data, status, resp, len);
+}
+
+
+
+/*
+ * RESOLVER
+ */
+
+
+
+int dns_resolver_init(struct dns_resolver* res, const char* server,
+	const char* port)
+{
+	memset(res, 0, sizeof(*res));
+	res->sock = INVALID_SOCKET;
+	for (size_t i = 0; i < DNS_MAX_TCP; ++i) {
+		res->tcp[i].sock = INVALID_SOCKET;
+	}
+	res->timeout_ms = DNS_DEF_TIMEOUT_MS;
+	res->max_tries = DNS_DEF_MAX_TRIES;
+	seed_dns_rng(res);
+
+	struct addrinfo hints = { 0 };
+	hints.ai_flags = AI_NUMERICHOST;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	struct addrinfo* addr = NULL;
+	if (getaddrinfo(server, port, &hints, &addr)) {
+		fprintf(stderr, "Invalid DNS server address: %s\n", server);
+		return EXIT_FAILURE;
+	}
+
+	memcpy(&(res->server), addr->ai_addr, addr->ai_addrlen);
+	res->server_len = (socklen_t) addr->ai_addrlen;
+
+	res->sock = socket(addr->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+	freeaddrinfo(addr);
+	if (!validate_socket(res->sock)) {
+		psockerror("socket() failed");
+		return EXIT_FAILURE;
+	}
+
+	// Connected socket: datagrams of other peers are not delivered
+	if (connect(res->sock, (struct sockaddr*) &(res->server),
+		res->server_len)) {
+		psockerror("connect() failed");
+		goto out_failure_close;
+	}
+
+	if (set_socket_nonblocking(res->sock)) {
+		psockerror("Failed to make the socket non-blocking");
+		goto out_failure_close;
+	}
+
+	return EXIT_SUCCESS;
+
+out_failure_close:
+	closesocket(res->sock);
+	res->sock = INVALID_SOCKET;
+	return EXIT_FAILURE;
+}
+
+
+// Sends the query without looking into the cache
+int send_dns_query(struct dns_resolver* res, const char* name,
+	const enum dns_record qtype, dns_callback cb, void* data)
+{
+	if (DNS_MAX_PENDING <= res->npending) return EXIT_FAILURE;
+
+	struct dns_query* q = NULL;
+	for (size_t i = 0; i < DNS_MAX_PENDING; ++i) {
+		if (!res->pending[i].active) {
+			q = &(res->pending[i]);
+			break;
+		}
+	}
+
+	// Unique ID among the pending queries
+	uint16_t id = next_dns_id(res);
+	while (find_dns_query(res, id)) id = next_dns_id(res);
+
+	int len = dns_encode_query(q->msg, sizeof(q->msg), id, name, qtype);
+	if (len < 0) return EXIT_FAILURE;
+
+	q->id = id;
+	q->len = (size_t) len;
+	strcpy(q->name, name);
+	q->qtype = qtype;
+	q->cb = cb;
+	q->data = data;
+	q->tries = 1;
+	q->tcp = 0;
+	q->deadline = dns_now_ms() + res->timeout_ms;
+
+	if (send(res->sock, (const char*) q->msg, q->len, 0) < 0
+		&& !socket_would_block()) {
+		psockerror("send() failed");
+		return EXIT_FAILURE;
+	}
+
+	q->active = 1;
+	++res->npending;
+
+	return EXIT_SUCCESS;
+}
+
+
+int dns_resolve(struct dns_resolver* res, const char* name,
+	const enum dns_record qtype, dns_callback cb, void* data)
+{
+	if (DNS_MAX_NAME_LEN < strlen(name)) return EXIT_FAILURE;
+	if (!res->cache) return send_dns_query(res, name, qtype, cb, data);
+
+	size_t len = 0;
+	enum dns_cache_result cres = dns_cache_get(res->cache, name, qtype,
+		DNS_CL_IN, dns_now_ms(), res->cached, sizeof(res->cached), &len);
+	if (cres == DNS_CACHE_MISS) {
+		return send_dns_query(res, name, qtype, cb, data);
+	}
+
+	// Stale response: the refresh only updates the cache
+	if (cres == DNS_CACHE_REFRESH) {
+		send_dns_query(res, name, qtype, NULL, NULL);
+	}
+
+	if (cb) cb(data, DNS_ST_OK, res->cached, len);
+	return EXIT_SUCCESS;
+}
+
+
+// Checks that the response answers the query
+int dns_response_matches(const struct dns_query* q, const uint8_t* resp,
+	const size_t len, struct dns_header* hdr)
+{
+	struct dns_reader r = { 0 };
+	dns_reader_init(&r, resp, len);
+
+	if (dns_read_header(&r, hdr) || !hdr->qr) return 0;
+	if (hdr->id != q->id || hdr->qdcount != 1) return 0;
+
+	struct dns_question question = { 0 };
+	if (dns_read_question(&r, &question)) return 0;
+
+	return question.qtype == q->qtype && question.qclass == DNS_CL_IN
+		&& dns_names_equal(question.name, q->name);
+}
+
+
+
+/*
+ * TCP FALLBACK
+ */
+
+
+
+// Checks if the TCP call failed only because the connection
+// is not established yet or the call would block
+int dns_tcp_would_block(void)
+{
+#ifdef _WIN32
+	return socket_would_block() || sockerrno() == WSAENOTCONN;
+#else // _WIN32
+	return socket_would_block() || errno == EINPROGRESS
+		|| errno == ENOTCONN;
+#endif // !_WIN32
+}
+
+
+// Closes the exchange, the query stays pending
+void close_dns_tcp(struct dns_tcp_exchange* x)
+{
+	if (validate_socket(x->sock)) closesocket(x->sock);
+	x->sock = INVALID_SOCKET;
+	x->query = NULL;
+}
+
+
+/*
+ * Starts repeating the truncated query over TCP (RFC 7766)
+ *
+ * Returns:
+ *	- Connecting: EXIT_SUCCESS
+ *	- No free exchange: 1 (the query waits)
+ *	- Failure: -EXIT_FAILURE
+ */
+int start_dns_tcp(struct dns_resolver* res, struct dns_query* q)
+{
+	struct dns_tcp_exchange* x = NULL;
+	for (size_t i = 0; i < DNS_MAX_TCP && !x; ++i) {
+		if (!validate_socket(res->tcp[i].sock)) x = &(res->tcp[i]);
+	}
+	if (!x) return 1;
+
+	x->sock = socket(res->server.ss_family, SOCK_STREAM, IPPROTO_TCP);
+	if (!validate_socket(x->sock)) {
+		psockerror("socket() failed");
+		return -EXIT_FAILURE;
+	}
+
+	if (set_socket_nonblocking(x->sock)) {
+		psockerror("Failed to make the socket non-blocking");
+		goto out_failure_close;
+	}
+
+	if (connect(x->sock, (struct sockaddr*) &(res->server),
+		res->server_len) && !dns_tcp_would_block()) {
+		psockerror("connect() failed");
+		goto out_failure_close;
+	}
+
+	// Two-byte length prefix and the query
+	x->query = q;
+	x->out[0] = (uint8_t) (q->len >> 8);
+	x->out[1] = (uint8_t) q->len;
+	memcpy(x->out + 2, q->msg, q->len);
+	x->out_len = q->len + 2;
+	x->sent = 0;
+	x->in_len = 0;
+
+	q->tcp = 2;
+	q->deadline = dns_now_ms() + res->timeout_ms;
+	return EXIT_SUCCESS;
+
+out_failure_close:
+	close_dns_tcp(x);
+	return -EXIT_FAILURE;
+}
+
+
+/*
+ * Sends the query and receives the response as far as
+ * the socket allows (the connection is established meanwhile)
+ *
+ * Returns:
+ *	- Response received: EXIT_SUCCESS
+ *	- In progress: 1
+ *	- Failure / connection closed: -EXIT_FAILURE
+ */
+int drive_dns_tcp(struct dns_resolver* res, struct dns_tcp_exchange* x)
+{
+	size_t progress = 0;
+	while (x->sent < x->out_len) {
+		int sent = send(x->sock, (const char*) x->out + x->sent,
+			(int) (x->out_len - x->sent), DNS_TCP_SEND_FLAGS);
+		if (sent < 0) {
+			if (dns_tcp_would_block()) return 1;
+			return -EXIT_FAILURE;
+		}
+
+		x->sent += (size_t) sent;
+		progress += (size_t) sent;
+	}
+
+	// Length prefix, then the message
+	for (;;) {
+		size_t want = 2;
+		if (2 <= x->in_len) want += ((size_t) x->in[0] << 8) | x->in[1];
+		if (2 < want && x->in_len == want) break;
+		if (want == 2 && x->in_len == 2) return -EXIT_FAILURE; // empty
+
+		int rcvd = recv(x->sock, (char*) x->in + x->in_len,
+			(int) (want - x->in_len), 0);
+		if (rcvd == 0) return -EXIT_FAILURE;
+		if (rcvd < 0) {
+			if (!dns_tcp_would_block()) return -EXIT_FAILURE;
+
+			// The timeout applies to each step of the exchange
+			if (progress) {
+				x->query->deadline = dns_now_ms()
+					+ res->timeout_ms;
+			}
+			return 1;
+		}
+
+		x->in_len += (size_t) rcvd;
+		progress += (size_t) rcvd;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+
+// Drives the TCP exchanges, completes the finished ones
+// and gives the free exchanges to the waiting queries
+void process_dns_tcp(struct dns_resolver* res)
+{
+	for (size_t i = 0; i < DNS_MAX_TCP; ++i) {
+		struct dns_tcp_exchange* x = &(res->tcp[i]);
+		if (!validate_socket(x->sock)) continue;
+
+		int dres = drive_dns_tcp(res, x);
+		if (dres == 1) continue;
+
+		struct dns_query* q = x->query;
+		size_t len = x->in_len - 2;
+		struct dns_header hdr = { 0 };
+		if (dres || !dns_response_matches(q, x->in + 2, len, &hdr)) {
+			close_dns_tcp(x);
+			complete_dns_query(res, q, DNS_ST_NET_ERR, NULL, 0);
+			continue;
+		}
+
+		// Valid until the next call, as the UDP responses
+		memcpy(res->resp, x->in + 2, len);
+		close_dns_tcp(x);
+		if (res->cache) dns_cache_put(res->cache, res->resp, len,
+			dns_now_ms());
+		complete_dns_query(res, q, DNS_ST_OK, res->resp, len);
+	}
+
+	for (size_t i = 0; i < DNS_MAX_PENDING; ++i) {
+		struct dns_query* q = &(res->pending[i]);
+		if (!q->active || q->tcp != 1) continue;
+
+		int sres = start_dns_tcp(res, q);
+		if (sres == 1) break;
+		if (sres) complete_dns_query(res, q, DNS_ST_NET_ERR, NULL, 0);
+	}
+}
+
+
+// Fails the TCP fallback of the expired query
+void expire_dns_tcp(struct dns_resolver* res, struct dns_query* q)
+{
+	for (size_t i = 0; i < DNS_MAX_TCP; ++i) {
+		if (res->tcp[i].query == q) close_dns_tcp(&(res->tcp[i]));
+	}
+
+	complete_dns_query(res, q, DNS_ST_NET_ERR, NULL, 0);
+}
+
+
+// Handles the received datagram
+void handle_dns_response(struct dns_resolver* res, const size_t len)
+{
+	if (len < DNS_HEADER_LEN) return;
+
+	uint16_t id = (uint16_t) ((res->resp[0] << 8) | res->resp[1]);
+	struct dns_query* q = find_dns_query(res, id);
+	if (!q) return; // late or unsolicited
+
+	// Mismatching responses are ignored, the query keeps waiting
+	struct dns_header hdr = { 0 };
+	if (q->tcp || !dns_response_matches(q, res->resp, len, &hdr)) return;
+
+	if (!hdr.tc) {
+		if (res->cache) dns_cache_put(res->cache, res->resp, len,
+			dns_now_ms());
+		complete_dns_query(res, q, DNS_ST_OK, res->resp, len);
+		return;
+	}
+
+	// Truncated: repeat over TCP once an exchange is free
+	q->tcp = 1;
+	q->deadline = dns_now_ms()
+		+ (uint64_t) res->timeout_ms * (uint64_t) res->max_tries;
+	int sres = start_dns_tcp(res, q);
+	if (sres < 0) complete_dns_query(res, q, DNS_ST_NET_ERR, NULL, 0);
+}
+
+
+SOCKET dns_resolver_fds(const struct dns_resolver* res, fd_set* rfds,
+	fd_set* wfds)
+{
+	SOCKET max_fd = res->sock;
+	FD_SET(res->sock, rfds);
+
+	for (size_t i = 0; i < DNS_MAX_TCP; ++i) {
+		const struct dns_tcp_exchange* x = &(res->tcp[i]);
+		if (!validate_socket(x->sock)) continue;
+
+		// Writable once connected, then readable
+		FD_SET(x->sock, x->sent < x->out_len ? wfds : rfds);
+		if (max_fd < x->sock) max_fd = x->sock;
+	}
+
+	return max_fd;
+}
+
+
+void dns_resolver_process(struct dns_resolver* res)
+{
+	// Drain the socket
+	size_t errors = 0;
+	while (res->npending) {
+		int rcvd = recv(res->sock, (char*) res->resp,
+			sizeof(res->resp), 0);
+		if (rcvd < 0) {
+			// ICMP errors of connected sockets are left to timeouts
+			if (socket_would_block() || DNS_MAX_PENDING < ++errors) {
+				break;
+			}
+			continue;
+		}
+
+		handle_dns_response(res, (size_t) rcvd);
+	}
+	process_dns_tcp(res);
+
+	// Retransmit and expire
+	uint64_t now = dns_now_ms();
+	if (res->cache) dns_cache_expire(res->cache, now);
+	for (size_t i = 0; i < DNS_MAX_PENDING; ++i) {
+		struct dns_query* q = &(res->pending[i]);
+		if (!q->active || now < q->deadline) continue;
+
+		if (q->tcp) {
+			expire_dns_tcp(res, q);
+			continue;
+		}
+		if (res->max_tries <= q->tries) {
+			complete_dns_query(res, q, DNS_ST_TIMEOUT, NULL, 0);
+			continue;
+		}
+
+		++q->tries;
+		q->deadline = now + res->timeout_ms;
+		send(res->sock, (const char*) q->msg, q->len, 0);
+	}
+}
+
+
+int dns_resolver_timeout(const struct dns_resolver* res)
+{
+	if (!res->npending) return -1;
+
+	uint64_t now = dns_now_ms();
+	uint64_t next = UINT64_MAX;
+	for (size_t i = 0; i < DNS_MAX_PENDING; ++i) {
+		const struct dns_query* q = &(res->pending[i]);
+		if (q->active && q->deadline < next) next = q->deadline;
+	}
+
+	return (int) (next <= now ? 0 : next - now);
+}
+
+
+int dns_resolver_wait(struct dns_resolver* res)
+{
+	int timeout = dns_resolver_timeout(res);
+	if (timeout < 0) return EXIT_SUCCESS;
+
+	fd_set rfds, wfds;
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	SOCKET max_fd = dns_resolver_fds(res, &rfds, &wfds);
+
+	struct timeval tv = { 0 };
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	if (select((int) max_fd + 1, &rfds, &wfds, NULL, &tv) < 0) {
+		if (socket_would_block()) return EXIT_SUCCESS; // EINTR
+		psockerror("select() failed");
+		return EXIT_FAILURE;
+	}
+
+	dns_resolver_process(res);
+	return EXIT_SUCCESS;
+}
+
+
+void dns_resolver_cleanup(struct dns_resolver* res)
+{
+	for (size_t i = 0; i < DNS_MAX_TCP; ++i) close_dns_tcp(&(res->tcp[i]));
+
+	for (size_t i = 0; i < DNS_MAX_PENDING; ++i) {
+		if (res->pending[i].active) {
+			complete_dns_query(res, &(res->pending[i]),
+				DNS_ST_CANCELLED, NULL, 0);
+		}
+	}
+
+	if (validate_socket(res->sock)) closesocket(res->sock);
+	res->sock = INVALID_SOCKET;
+}
@@ -5,16 +5,28 @@
 #include "headers/http_parsers.h"
 #include "headers/http_writers.h"   // write_http_from_code(), ...
 #include "headers/path_checkers.h"
+#include "headers/asset_bundles.h"  // find_asset(), ...
+
+#ifdef _WIN32
+        #include <windows.h>        // FindFirstFileA(), ...
+#else   // _WIN32
+        #include <dirent.h>         // opendir(), readdir(), ...
+        #include <sys/stat.h>       // stat()
+#endif  // !_WIN32
+
+
+#define DIR_LISTING_MAX_ENTRY 3072  // max formatted entry (escaped name)
 
 
 /*
- * Reads the file to rbuf
+ * Reads the file to rbuf, allocated from the request's arena
+ * (optional, rbuf is freed by the caller if NULL)
  *
  * Returns:
  *      - Success: Number of bytes read
  *      - Failure: -EXIT_FAILURE
  */
-int read_file(FILE* f, char** rbuf)
+int read_file(FILE* f, char** rbuf, struct http_arena* arena)
 {
         // Calculate the file size
         if (fseek(f, 0, SEEK_END)) return -EXIT_FAILURE;
@@ -25,14 +37,17 @@ int read_file(FILE* f, char** rbuf)
         if (fseek(f, 0, SEEK_SET)) return -EXIT_FAILURE;
 
         // Read the contents
-        *rbuf = (char*) calloc((size_t) sz + 1, sizeof(char));
+        *rbuf = (arena ? (char*) http_arena_alloc(arena, (size_t) sz + 1)
+                : (char*) malloc((size_t) sz + 1));
         if (!*rbuf) return -EXIT_FAILURE;
 
         unsigned long read = fread(*rbuf, sizeof(char), sz, f);
         if (read != (size_t) sz) {
-                free(*rbuf);
+                if (!arena) free(*rbuf);
+                *rbuf = NULL;
                 return -EXIT_FAILURE;
         }
+        (*rbuf)[sz] = '\0';
 
         return read;
 }
@@ -49,7 +64,7 @@ size_t get_404_page(char** page)
         FILE* f = fopen(path, "rb");
         if (!f) return 0;
 
-        int read = read_file(f, page);
+        int read = read_file(f, page, NULL);
 
         fclose(f);
         return read == -EXIT_FAILURE ? 0 : read;
@@ -59,6 +74,14 @@ size_t get_404_page(char** page)
 // Writes 404 response with a page
 int write_404_page(struct strinfo* dest)
 {
+        // Serve the compiled page if there is one
+        const struct asset* a = find_asset(
+                "public/frontend/templates/not_found.html");
+        if (a) {
+                return write_http_from_code(HTTP_NOT_FOUND, dest,
+                        a->ctype, a->len, a->body, "close");
+        }
+
         char* page404 = NULL;
         size_t read = get_404_page(&page404);
         char* ctype = (page404 ? "text/html" : NULL);
@@ -82,25 +105,330 @@ int write_500_page(struct strinfo* dest)
 }
 
 
+// Reads the next piece of the file straight to the send string
+int stream_file_piece(struct http_stream* strm, struct strinfo* sstr)
+{
+        if (reserve_strinfo(sstr, MAX_NETBUF_LEN)) return -EXIT_FAILURE;
+
+        // Body is sent with "Content-Length", no chunk framing is needed
+        FILE* f = (FILE*) strm->data;
+        size_t read = fread(sstr->buf + sstr->len, sizeof(char),
+                MAX_NETBUF_LEN, f);
+        if (ferror(f)) return -EXIT_FAILURE;
+
+        sstr->len += read;
+        sstr->buf[sstr->len] = '\0';
+
+        return (int) read;
+}
+
+
+// Closes the streamed file
+void close_streamed_file(void* f)
+{
+        fclose((FILE*) f);
+}
+
+
+/*
+ * Starts streaming the file to the client
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE (the file is closed)
+ */
+int stream_file(struct strinfo* dest, struct http_stream* strm,
+        FILE* f, const size_t sz, const char* ctype, const char* connection)
+{
+        strm->next = stream_file_piece;
+        strm->cleanup = close_streamed_file;
+        strm->data = f;
+        strm->file = f; // or sent with sendfile()
+        strm->file_off = 0;
+        strm->file_left = sz;
+
+        int wsr_res = write_http_stream_response(dest, strm,
+                http_code_to_str_1_1(HTTP_OK), ctype, sz,
+                1, http_conn_header(connection));
+        if (wsr_res) {
+                cleanup_http_stream(strm);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+/*
+ * Directory listing produced entry by entry
+ *
+ * @path    Path to the directory ("/" terminated)
+ * @url     URL path of the directory (the page title)
+ * @started Page head was written
+ * @ended   Closing tags were written
+ * @find    Search handle (Windows)
+ * @found   Entry of "find" not listed yet (Windows)
+ * @has_found "found" is set (Windows)
+ * @name    Name of the entry returned last (Windows)
+ * @dir     Open directory (Unix)
+ */
+struct dir_listing {
+        char path[FILENAME_MAX];
+        char url[FILENAME_MAX];
+        int started;
+        int ended;
+#ifdef _WIN32
+        HANDLE find;
+        WIN32_FIND_DATAA found;
+        int has_found;
+        char name[MAX_PATH];
+#else   // _WIN32
+        DIR* dir;
+#endif  // !_WIN32
+};
+
+
+// Appends the text escaped for HTML, returns the new length
+size_t append_html_escaped(char* buf, size_t len, const char* text)
+{
+        for (; *text; ++text) {
+                switch (*text) {
+                case '&': len += sprintf(buf + len, "&amp;"); break;
+                case '<': len += sprintf(buf + len, "&lt;"); break;
+                case '>': len += sprintf(buf + len, "&gt;"); break;
+                case '"': len += sprintf(buf + len, "&quot;"); break;
+                case '\'': len += sprintf(buf + len, "&#39;"); break;
+                default: buf[len++] = *text; break;
+                }
+        }
+
+        buf[len] = '\0';
+        return len;
+}
+
+
+// Appends the name percent-encoded for a relative URL,
+// returns the new length
+size_t append_url_escaped(char* buf, size_t len, const char* name)
+{
+        for (; *name; ++name) {
+                unsigned char c = (unsigned char) *name;
+                if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')
+                        || ('0' <= c && c <= '9') || strchr("-._~", c)) {
+                        buf[len++] = (char) c;
+                } else {
+                        len += sprintf(buf + len, "%%%02X", c);
+                }
+        }
+
+        buf[len] = '\0';
+        return len;
+}
+
+
 /*
-* Gets the resource and writes the response
+ * Gets the next entry of the directory (hidden ones are skipped)
+ *
+ * Returns:
+ *      - Entry found: 1 ("name" and "is_dir" are set)
+ *      - End of the directory: 0
+ */
+int next_dir_entry(struct dir_listing* dl, const char** name, int* is_dir)
+{
+#ifdef _WIN32
+        while (dl->has_found) {
+                WIN32_FIND_DATAA* fd = &(dl->found);
+                dl->has_found = 0;
+                if (fd->cFileName[0] == '.') {
+                        dl->has_found = FindNextFileA(dl->find, fd);
+                        continue;
+                }
+
+                // Kept until the next call
+                strcpy(dl->name, fd->cFileName);
+                *name = dl->name;
+                *is_dir = !!(fd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+                dl->has_found = FindNextFileA(dl->find, fd);
+                return 1;
+        }
+#else   // _WIN32
+        struct dirent* ent = NULL;
+        while ((ent = readdir(dl->dir))) {
+                if (ent->d_name[0] == '.') continue;
+
+                char full[2 * FILENAME_MAX];
+                snprintf(full, sizeof(full), "%s%s", dl->path, ent->d_name);
+                struct stat st = { 0 };
+                if (stat(full, &st)) continue;
+
+                *name = ent->d_name;
+                *is_dir = S_ISDIR(st.st_mode);
+                return 1;
+        }
+#endif  // !_WIN32
+
+        return 0;
+}
+
+
+// Writes the next entries of the listing as one chunk
+int stream_dir_listing_piece(struct http_stream* strm, struct strinfo* sstr)
+{
+        struct dir_listing* dl = (struct dir_listing*) strm->data;
+        if (dl->ended) return 0; // the last chunk follows
+
+        char piece[MAX_NETBUF_LEN];
+        size_t len = 0;
+        if (!dl->started) {
+                len += sprintf(piece, "<!DOCTYPE html>\n<html>\n<head>\n"
+                        "<meta charset=\"UTF-8\">\n<title>Index of ");
+                len = append_html_escaped(piece, len, dl->url);
+                len += sprintf(piece + len, "</title>\n</head>\n<body>\n"
+                        "<h1>Index of ");
+                len = append_html_escaped(piece, len, dl->url);
+                len += sprintf(piece + len, "</h1>\n<ul>\n"
+                        "<li><a href=\"../\">../</a></li>\n");
+                dl->started = 1;
+        }
+
+        // Entries while the longest one still fits
+        const char* name = NULL;
+        int is_dir = 0;
+        while (len + DIR_LISTING_MAX_ENTRY < sizeof(piece)
+                && next_dir_entry(dl, &name, &is_dir)) {
+                const char* slash = (is_dir ? "/" : "");
+                len += sprintf(piece + len, "<li><a href=\"");
+                len = append_url_escaped(piece, len, name);
+                len += sprintf(piece + len, "%s\">", slash);
+                len = append_html_escaped(piece, len, name);
+                len += sprintf(piece + len, "%s</a></li>\n", slash);
+        }
+
+        if (len + DIR_LISTING_MAX_ENTRY < sizeof(piece)) {
+                len += sprintf(piece + len, "</ul>\n</body>\n</html>\n");
+                dl->ended = 1;
+        }
+
+        if (write_http_stream(sstr, strm, piece, len)) return -EXIT_FAILURE;
+        return (int) len;
+}
+
+
+// Closes the listed directory
+void close_dir_listing(void* data)
+{
+        struct dir_listing* dl = (struct dir_listing*) data;
+#ifdef _WIN32
+        FindClose(dl->find);
+#else   // _WIN32
+        closedir(dl->dir);
+#endif  // !_WIN32
+        free(dl);
+}
+
+
+/*
+ * Starts streaming the listing of the directory,
+ * its length is not known: the body is chunked
+ *
+ * @path    Path to the directory ("/" terminated)
+ * @url     URL path of the directory
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - No such directory: -EXIT_FAILURE
+ *      - Failure: EXIT_FAILURE
+ */
+int stream_dir_listing(struct strinfo* dest, struct http_stream* strm,
+        const char* path, const char* url, const char* connection)
+{
+        if (FILENAME_MAX <= strlen(path) + 2 || FILENAME_MAX <= strlen(url)) {
+                return -EXIT_FAILURE;
+        }
+
+        struct dir_listing* dl = (struct dir_listing*) calloc(1,
+                sizeof(struct dir_listing));
+        if (!dl) return EXIT_FAILURE;
+        strcpy(dl->path, path);
+        strcpy(dl->url, url);
+
+#ifdef _WIN32
+        char pattern[FILENAME_MAX];
+        snprintf(pattern, sizeof(pattern), "%s*", path);
+        dl->find = FindFirstFileA(pattern, &(dl->found));
+        if (dl->find == INVALID_HANDLE_VALUE) {
+                free(dl);
+                return -EXIT_FAILURE;
+        }
+        dl->has_found = 1;
+#else   // _WIN32
+        dl->dir = opendir(path);
+        if (!dl->dir) {
+                free(dl);
+                return -EXIT_FAILURE;
+        }
+#endif  // !_WIN32
+
+        strm->next = stream_dir_listing_piece;
+        strm->cleanup = close_dir_listing;
+        strm->data = dl;
+
+        int wsr_res = write_http_stream_response(dest, strm,
+                http_code_to_str_1_1(HTTP_OK), "text/html; charset=utf-8",
+                HTTP_UNKNOWN_LEN, 1, http_conn_header(connection));
+        if (wsr_res) {
+                cleanup_http_stream(strm);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+/*
+ * Gets the resource and writes the response
  *
  * @dest        Send string (struct strinfo*)
  * @path        Path to the resource
  * @prefix      Required path prefix (optional)
  * @req         Client's HTTP request (optional)
+ * @strm        Stream for big files (optional, read fully if NULL)
  * 
  * Returns:
  *      - Success: EXIT_SUCCESS
  *      - Failure: EXIT_FAILURE
  */
 int process_default_resource_request(void* dest,
-        char* path, const char* prefix, struct http_request* req)
+        char* path, const char* prefix, struct http_request* req,
+        struct http_stream* strm)
 {
         if (!path || check_path(path, prefix, 0)) { // write 404
                 return write_404_page(dest);
         }
 
+        // Serve the compiled resource without touching the disk
+        const struct asset* a = find_asset(path);
+        if (a) return write_asset_response(dest, a, req);
+
+        // List the directory ("/" terminated), streamed as it is read;
+        // only the directories below the path are listed (no ".." moves)
+        const char* connection = (req ? req->conn : "close"); // same as client
+        size_t path_len = strlen(path);
+        if (strm && path_len && path[path_len - 1] == '/') {
+                if (!strncmp(path, "../", 3) || strstr(path, "/../")) {
+                        return write_404_page(dest);
+                }
+
+                const char* url = (req ? req->url : path);
+                make_path_cross_platform(path);
+                int sdl_res = stream_dir_listing(dest, strm, path, url,
+                        connection);
+                if (sdl_res < 0) return write_404_page(dest);
+                if (sdl_res) goto out_write_500;
+
+                return EXIT_SUCCESS;
+        }
+
         // Check if the target is a file
         if (!strchr(path, '.')) return write_404_page(dest);
 
@@ -108,17 +436,30 @@ int process_default_resource_request(void* dest,
         FILE* f = fopen(path, "rb");
         if (!f) return write_404_page(dest);
 
-        // Read the file
+        // Stream big files instead of reading them fully
+        if (strm && !fseek(f, 0, SEEK_END)) {
+                long sz = ftell(f);
+                if (MAX_NETBUF_LEN < sz && !fseek(f, 0, SEEK_SET)) {
+                        if (stream_file(dest, strm, f, (size_t) sz,
+                                path_to_content_type(path), connection)) {
+                                goto out_write_500;
+                        }
+
+                        return EXIT_SUCCESS;
+                }
+        }
+
+        // Read the file (the request's scratch memory)
+        struct http_arena* arena = (req ? req->arena : NULL);
         char* rbuf = NULL;
-        int bytes_read = read_file(f, &rbuf);
+        int bytes_read = read_file(f, &rbuf, arena);
         fclose(f);
         if (bytes_read < 0) goto out_write_500;
 
         // Write the response
-        const char* connection = (req ? req->conn : "close"); // same as client
         int w200_res = write_http_from_code(HTTP_OK, dest,
                 path_to_content_type(path), bytes_read, rbuf, connection);
-        free(rbuf);
+        if (!arena) free(rbuf);
         return w200_res;
 
 out_write_500:
@@ -130,7 +471,8 @@ out_write_500:
  * Gets the front page and writes the response
  *
  * @dest Send string (struct strinfo*)
- * @...  Client's HTTP request (optional, struct http_request*)
+ * @...  Client's HTTP request (optional, struct http_request*),
+ *       response stream (optional, struct http_stream*)
  * 
  * Returns:
  *      - Success: EXIT_SUCCESS
@@ -138,16 +480,94 @@ out_write_500:
  */
 int get_front_page(void* dest, const size_t argc, ...)
 {
-        // TODO: accept HTTP request as an argument
         struct http_request* req = NULL;
+        struct http_stream* strm = NULL;
 
-        if (argc) {
-                va_list args = { 0 };
-                va_start(args, argc);
-                req = va_arg(args, struct http_request*);
-                va_end(args);
-        }
+        va_list args = { 0 };
+        va_start(args, argc);
+        if (0 < argc) req = va_arg(args, struct http_request*);
+        if (1 < argc) strm = va_arg(args, struct http_stream*);
+        va_end(args);
 
         char* path = "public/frontend/templates/index.html";
-        return process_default_resource_request(dest, path, NULL, req);
+        return process_default_resource_request(dest, path, NULL, req, strm);
+}
+
+
+/*
+ * Digest of the uploaded content
+ *
+ * @len  Bytes received
+ * @hash FNV-1a hash of the bytes
+ */
+struct upload_digest {
+        size_t len;
+        uint64_t hash;
+};
+
+
+/*
+ * Hashes a piece of the uploaded content as it arrives,
+ * nothing is buffered ("on_body" of the upload route)
+ *
+ * @req  Client's HTTP request (struct http_request*),
+ *       the digest is kept in its "add_data"
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - No memory: EXIT_FAILURE
+ */
+int hash_upload_piece(void* req, const char* data, const size_t len)
+{
+        struct http_request* r = (struct http_request*) req;
+        struct upload_digest* d = (struct upload_digest*) r->add_data;
+        if (!d) { // the request's arena
+                d = (struct upload_digest*) http_arena_alloc(r->arena,
+                        sizeof(struct upload_digest));
+                if (!d) return EXIT_FAILURE;
+
+                d->len = 0;
+                d->hash = 0xcbf29ce484222325ull; // FNV offset basis
+                r->add_data = d;
+        }
+
+        for (size_t i = 0; i < len; ++i) {
+                d->hash ^= (uint8_t) data[i];
+                d->hash *= 0x100000001b3ull; // FNV prime
+        }
+        d->len += len;
+
+        return EXIT_SUCCESS;
+}
+
+
+/*
+ * Answers the upload with the length and the hash of its content
+ *
+ * @dest Send string (struct strinfo*)
+ * @...  Client's HTTP request (struct http_request*)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int post_upload(void* dest, const size_t argc, ...)
+{
+        struct http_request* req = NULL;
+
+        va_list args = { 0 };
+        va_start(args, argc);
+        if (0 < argc) req = va_arg(args, struct http_request*);
+        va_end(args);
+
+        // Empty content: on_body was never called
+        const struct upload_digest* d = (req
+                ? (const struct upload_digest*) req->add_data : NULL);
+        char body[64];
+        int len = snprintf(body, sizeof(body), "%zu bytes, fnv1a %016llx\n",
+                d ? d->len : 0, (unsigned long long) (d ? d->hash
+                : 0xcbf29ce484222325ull));
+
+        return write_http_from_code(HTTP_OK, dest, "text/plain", len, body,
+                req ? req->conn : "close");
 }
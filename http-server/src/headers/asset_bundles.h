@@ -0,0 +1,80 @@
+/*
+ * File: asset_bundles.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: resources of the "public" directory
+ * compiled into the binary (see tools/pack_assets.c)
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "tcp_socks.h"          // struct strinfo
+#include "http_parsers.h"       // struct http_request
+
+
+/*
+ * Resource compiled into the binary
+ *
+ * @path        Path to the resource (e.g. "public/frontend/...")
+ * @ctype       Content type
+ * @etag        Entity tag (quoted)
+ * @body        Contents
+ * @len         Contents length
+ * @gz          Gzip compressed contents (NULL if compression does not help)
+ * @gzlen       Compressed contents length
+ * @gz_etag     Entity tag of the compressed contents (quoted)
+ * @head        Status line and headers without "Connection" and blank line
+ * @head_len    Length of "head"
+ * @gz_head     Same as "head" for the compressed contents
+ * @gz_head_len Length of "gz_head"
+ */
+struct asset {
+        const char* path;
+        const char* ctype;
+        const char* etag;
+        const char* body;
+        size_t len;
+        const char* gz;
+        size_t gzlen;
+        const char* gz_etag;
+        const char* head;
+        size_t head_len;
+        const char* gz_head;
+        size_t gz_head_len;
+};
+
+
+/*
+ * Finds the compiled resource
+ *
+ * Returns:
+ *      - Found:     pointer to the resource
+ *      - Not found: NULL (always, unless built with HTTP_EMBEDDED_ASSETS)
+ */
+const struct asset* find_asset(const char* path);
+
+
+/*
+ * Writes the compiled resource as a response
+ *
+ * Description: sends the compressed contents if the client
+ * accepts gzip ("Accept-Encoding" weights, "gzip;q=0" refuses it),
+ * answers 304 if "If-None-Match" lists the entity tag of the chosen
+ * variant (weak comparison) or is "*"
+ *
+ * @sstr        Send string
+ * @a           Compiled resource
+ * @req         Client's HTTP request (optional)
+ *
+ * Returns:
+ *      - Success:      EXIT_SUCCESS
+ *      - No memory:    EXIT_FAILURE
+ */
+int write_asset_response(struct strinfo* sstr, const struct asset* a,
+        const struct http_request* req);
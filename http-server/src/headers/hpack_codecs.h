@@ -0,0 +1,117 @@
+/*
+ * File: hpack_codecs.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: HPACK (RFC 7541) header compression
+ * of HTTP/2: static and dynamic tables, integer
+ * and Huffman string coding
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+#include <stdint.h>             // uint8_t
+#include "tcp_socks.h"          // struct strinfo
+
+
+#define HPACK_TABLE_SIZE 4096           // dynamic table size (the default
+                                        // SETTINGS_HEADER_TABLE_SIZE)
+#define HPACK_ENTRY_OVERHEAD 32         // counted for every entry
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+#define HPACK_STATIC_ENTRIES 61         // entries of the static table
+#define HPACK_MAX_STRING_LEN 8192       // longest decoded name / value
+
+
+/*
+ * Dynamic table entry
+ *
+ * @name       Header name (the value follows it in the same allocation)
+ * @name_len   Length of "name"
+ * @value      Header value
+ * @value_len  Length of "value"
+ */
+struct hpack_entry {
+        char* name;
+        size_t name_len;
+        char* value;
+        size_t value_len;
+};
+
+
+/*
+ * Dynamic table (one per direction of a connection)
+ *
+ * @entries     Ring of the entries
+ * @first       Newest entry (index 62)
+ * @count       Number of the entries
+ * @size        Size of the entries (RFC 7541 4.1)
+ * @max_size    Size the entries are evicted at
+ * @size_update Encoder: the new "max_size" is to be signalled
+ */
+struct hpack_table {
+        struct hpack_entry entries[HPACK_MAX_ENTRIES];
+        size_t first;
+        size_t count;
+        size_t size;
+        size_t max_size;
+        int size_update;
+};
+
+
+/*
+ * Called for every decoded header
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE (decoding stops)
+ */
+typedef int (*hpack_header_fn)(void* data, const char* name,
+        const size_t name_len, const char* value, const size_t value_len);
+
+
+// Initializes an empty table of HPACK_TABLE_SIZE
+void init_hpack_table(struct hpack_table* table);
+
+
+// Frees the entries
+void cleanup_hpack_table(struct hpack_table* table);
+
+
+// Sets the size of the encoder's table (SETTINGS_HEADER_TABLE_SIZE
+// of the peer, at most HPACK_TABLE_SIZE), evicts the entries
+void resize_hpack_table(struct hpack_table* table, const size_t max_size);
+
+
+/*
+ * Decodes a header block
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Malformed block / "on_header" failure: EXIT_FAILURE
+ *        (COMPRESSION_ERROR, the table may not be used anymore)
+ */
+int decode_hpack_block(struct hpack_table* table, const uint8_t* in,
+        const size_t len, hpack_header_fn on_header, void* data);
+
+
+// Starts a header block: signals the table size update if due
+int begin_hpack_block(struct hpack_table* table, struct strinfo* out);
+
+
+/*
+ * Encodes a header (the name is lowercase)
+ *
+ * @index Add the header to the table (headers
+ *        repeated across the responses)
+ *
+ * Returns:
+ *      - Success:      EXIT_SUCCESS
+ *      - No memory:    EXIT_FAILURE
+ */
+int encode_hpack_header(struct hpack_table* table, struct strinfo* out,
+        const char* name, const char* value, const size_t value_len,
+        const int index);
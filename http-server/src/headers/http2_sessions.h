@@ -0,0 +1,259 @@
+/*
+ * File: http2_sessions.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: HTTP/2 over cleartext TCP (h2c, RFC 7540):
+ * sessions started with the connection preface ("prior
+ * knowledge") or upgraded from HTTP/1.1, concurrent streams
+ * executed by the route handlers, flow controlled responses
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+#include <stdint.h>             // uint8_t, uint32_t, int64_t
+#include "tcp_socks.h"          // struct strinfo
+#include "http_parsers.h"       // struct http_request
+#include "http_conns.h"         // struct http_conninfo
+#include "hpack_codecs.h"       // struct hpack_table
+
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LEN 24
+#define HTTP2_FRAME_HEAD_LEN 9
+#define HTTP2_MAX_FRAME_LEN 16384       // SETTINGS_MAX_FRAME_SIZE (default)
+#define HTTP2_MAX_STREAMS 32            // SETTINGS_MAX_CONCURRENT_STREAMS
+#define HTTP2_DEF_WINDOW 65535          // initial flow control window
+#define HTTP2_MAX_WINDOW 0x7fffffff
+#define HTTP2_MAX_HEADERS_LEN (4 * HTTP2_MAX_FRAME_LEN) // header block
+#define HTTP2_MAX_SEND_LEN (4 * MAX_NETBUF_LEN) // frames written at once
+
+
+// Frame types
+enum http2_frame_type {
+        HTTP2_DATA = 0x0,
+        HTTP2_HEADERS = 0x1,
+        HTTP2_PRIORITY = 0x2,
+        HTTP2_RST_STREAM = 0x3,
+        HTTP2_SETTINGS = 0x4,
+        HTTP2_PUSH_PROMISE = 0x5,
+        HTTP2_PING = 0x6,
+        HTTP2_GOAWAY = 0x7,
+        HTTP2_WINDOW_UPDATE = 0x8,
+        HTTP2_CONTINUATION = 0x9
+};
+
+
+// Frame flags
+#define HTTP2_FLAG_END_STREAM 0x1
+#define HTTP2_FLAG_ACK 0x1
+#define HTTP2_FLAG_END_HEADERS 0x4
+#define HTTP2_FLAG_PADDED 0x8
+#define HTTP2_FLAG_PRIORITY 0x20
+
+
+// Error codes (RST_STREAM, GOAWAY)
+enum http2_error {
+        HTTP2_NO_ERROR = 0x0,
+        HTTP2_PROTOCOL_ERROR = 0x1,
+        HTTP2_INTERNAL_ERROR = 0x2,
+        HTTP2_FLOW_CONTROL_ERROR = 0x3,
+        HTTP2_STREAM_CLOSED = 0x5,
+        HTTP2_FRAME_SIZE_ERROR = 0x6,
+        HTTP2_REFUSED_STREAM = 0x7,
+        HTTP2_CANCEL = 0x8,
+        HTTP2_COMPRESSION_ERROR = 0x9,
+        HTTP2_ENHANCE_YOUR_CALM = 0xb
+};
+
+
+// Settings identifiers
+enum http2_setting {
+        HTTP2_SETTINGS_HEADER_TABLE_SIZE = 0x1,
+        HTTP2_SETTINGS_ENABLE_PUSH = 0x2,
+        HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+        HTTP2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+        HTTP2_SETTINGS_MAX_FRAME_SIZE = 0x5
+};
+
+
+/*
+ * Stream state
+ *
+ * @H2S_FREE        Slot is not used
+ * @H2S_RECEIVING   Request headers / content are being received
+ * @H2S_RESPONDING  Request was executed, the response is being sent
+ */
+enum http2_stream_state {
+        H2S_FREE,
+        H2S_RECEIVING,
+        H2S_RESPONDING
+};
+
+
+/*
+ * HTTP/2 stream
+ *
+ * @id          Stream identifier
+ * @state       Stream state
+ * @conn        Request being received, response body stream
+ *              (the state of a HTTP/1.1 connection)
+ * @resp        HTTP/1.1 response written by the handler,
+ *              sent from "adv" (the head is converted)
+ * @head_req    Request is "HEAD" (the response has no body)
+ * @resp_head   Response HEADERS were sent
+ * @skip_body   Request content is discarded (answered with
+ *              413 before it was received)
+ * @send_window Stream's flow control window of the peer
+ */
+struct http2_stream {
+        uint32_t id;
+        enum http2_stream_state state;
+
+        struct http_conninfo conn;
+        struct strinfo resp;
+        int head_req;
+        int resp_head;
+        int skip_body;
+
+        int64_t send_window;
+};
+
+
+/*
+ * Executes the received request, writes a HTTP/1.1
+ * response (or its head, "conn->strm" produces the body)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE / -EXIT_FAILURE
+ */
+typedef int (*http2_execute_fn)(struct http_request* req,
+        struct http_conninfo* conn, struct strinfo* resp);
+
+
+/*
+ * HTTP/2 session, stored in struct http_conninfo's "h2"
+ *
+ * @execute       Executes the requests of the streams
+ * @cinfo         Client whose rate limits the streams take
+ *                their tokens of (optional)
+ * @preface_left  Bytes of the client's preface not received yet
+ * @decoder       HPACK table of the requests
+ * @encoder       HPACK table of the responses
+ * @hblock        Header block being received (HEADERS + CONTINUATION)
+ * @hblock_stream Stream of "hblock" (0 - none)
+ * @hblock_flags  Flags of the HEADERS frame
+ * @hout          Encoded response header block
+ * @streams       Open streams
+ * @last_stream   Highest stream identifier of the client
+ * @init_window   Initial stream window of the peer
+ * @send_window   Connection's flow control window of the peer
+ * @next          Next stream of the round robin
+ * @goaway        GOAWAY was sent, no new streams are accepted
+ * @closing       Connection is closed once the frames are sent
+ */
+struct http2_session {
+        http2_execute_fn execute;
+        const struct clientinfo* cinfo;
+        size_t preface_left;
+
+        struct hpack_table decoder;
+        struct hpack_table encoder;
+        struct strinfo hblock;
+        uint32_t hblock_stream;
+        uint8_t hblock_flags;
+        struct strinfo hout;
+
+        struct http2_stream streams[HTTP2_MAX_STREAMS];
+        uint32_t last_stream;
+        int64_t init_window;
+        int64_t send_window;
+        size_t next;
+
+        int goaway;
+        int closing;
+};
+
+
+/*
+ * Checks if the received bytes start with the connection preface
+ *
+ * Returns:
+ *      - Preface: 1
+ *      - Not HTTP/2: 0
+ *      - Preface may follow: -1 (wait for more bytes)
+ */
+int is_http2_preface(const struct strinfo* rvstr);
+
+
+/*
+ * Starts a session with the client that sent the preface,
+ * writes the server's SETTINGS to "out"
+ *
+ * Returns:
+ *      - Success: the session
+ *      - No memory: NULL
+ */
+struct http2_session* create_http2_session(http2_execute_fn execute,
+        struct strinfo* out);
+
+
+/*
+ * Upgrades the connection whose request asked for h2c
+ * ("Upgrade: h2c" and "HTTP2-Settings")
+ *
+ * Description: writes "101 Switching Protocols" and the
+ * server's SETTINGS to "out", applies the client's settings,
+ * executes "conn->req" as stream 1 (the request is taken over)
+ *
+ * Returns:
+ *      - Success: the session
+ *      - Invalid settings: NULL (nothing was written)
+ *      - No memory: NULL
+ */
+struct http2_session* upgrade_http2_session(http2_execute_fn execute,
+        struct http_conninfo* conn, struct strinfo* out);
+
+
+/*
+ * Consumes the received frames, executes the completed requests
+ *
+ * Note: protocol errors write GOAWAY to "out"
+ * and close the session (see is_http2_session_done())
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - No memory: EXIT_FAILURE
+ */
+int receive_http2_frames(struct http2_session* s, struct strinfo* rvstr,
+        struct strinfo* out);
+
+
+/*
+ * Appends the frames of the responses to "out" (the streams
+ * take turns, up to HTTP2_MAX_SEND_LEN bytes while the flow
+ * control windows allow)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - No memory / body failure: EXIT_FAILURE
+ */
+int send_http2_frames(struct http2_session* s, struct strinfo* out);
+
+
+// Stops accepting streams (GOAWAY), the open ones are completed
+int shutdown_http2_session(struct http2_session* s, struct strinfo* out);
+
+
+// Checks if the connection may be closed (closing or
+// shut down with no open streams)
+int is_http2_session_done(const struct http2_session* s);
+
+
+// Frees the streams and the session
+void cleanup_http2_session(struct http2_session* s);
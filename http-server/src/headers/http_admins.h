@@ -0,0 +1,68 @@
+/*
+ * File: http_admins.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: introspection endpoint on a separate
+ * local port: JSON snapshot of the connections (state,
+ * buffered bytes, age, activity, peer), of the response
+ * cache and of the event loop load, served without
+ * blocking the loop
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+#include "tcp_socks.h"          // struct serverinfo, struct strinfo
+
+
+#define HTTP_ADMIN_ADDR "127.0.0.1"     // admin port is never public
+#define HTTP_ADMIN_MAX_CONN 4           // admin connections served at once
+#define HTTP_ADMIN_MAX_REQUEST_LEN 4096 // longer requests are dropped
+
+
+/*
+ * Admin connection
+ *
+ * @sock    Client's socket (INVALID_SOCKET - free slot)
+ * @rvstr   Request being received
+ * @sdstr   Snapshot being sent
+ */
+struct http_admin_conn {
+        SOCKET sock;
+        struct strinfo rvstr;
+        struct strinfo sdstr;
+};
+
+
+/*
+ * Listens for the admin requests on HTTP_ADMIN_ADDR:port
+ * (sets the select() hooks, keeps the ones already set)
+ *
+ * Description: "GET /" answers the JSON snapshot,
+ * the listening socket is closed once the server
+ * drains, so the next process may bind the port
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS (the bind is retried every
+ *        second if the port is still taken)
+ *      - Failure: EXIT_FAILURE
+ */
+int attach_http_admin(struct serverinfo* sinfo, const char* port);
+
+
+/*
+ * Writes the JSON snapshot of the server
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - No memory: EXIT_FAILURE
+ */
+int write_http_admin_snapshot(struct serverinfo* sinfo, struct strinfo* out);
+
+
+// Closes the listening socket and the admin connections
+void cleanup_http_admin(void);
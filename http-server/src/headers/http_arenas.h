@@ -0,0 +1,80 @@
+/*
+ * File: http_arenas.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: bump allocator of the request-scoped data
+ * (parsed fields, handler scratch), reset at once when
+ * the response is queued, the memory is kept for the next
+ * requests of the connection
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+
+
+#define HTTP_ARENA_BLOCK_LEN 4096       // min block size
+#define HTTP_ARENA_ALIGN 16             // alignment of the allocations
+
+
+/*
+ * Block of the arena
+ *
+ * @next    Previous block (allocated before this one)
+ * @sz      Size of "data"
+ * @used    Bytes of "data" given out
+ * @data    Memory of the allocations
+ */
+struct http_arena_block {
+        struct http_arena_block* next;
+        size_t sz;
+        size_t used;
+        char data[];
+};
+
+
+/*
+ * Arena, zero-initialized one is empty
+ *
+ * @head    Block the allocations are taken from (NULL - none yet)
+ * @total   Size of all the blocks
+ */
+struct http_arena {
+        struct http_arena_block* head;
+        size_t total;
+};
+
+
+/*
+ * Allocates "len" bytes (not zeroed, aligned to HTTP_ARENA_ALIGN),
+ * a new block is added if the current one is full
+ *
+ * Returns:
+ *      - Success: the memory, valid until the arena is reset
+ *      - No memory: NULL
+ */
+void* http_arena_alloc(struct http_arena* arena, const size_t len);
+
+
+// Copies "len" bytes of "str" to the arena, terminates
+// the copy with '\0' (NULL if there is no memory)
+char* http_arena_strndup(struct http_arena* arena, const char* str,
+        const size_t len);
+
+
+/*
+ * Frees all the allocations at once
+ *
+ * Description: the first block is kept, an arena which grew
+ * is merged into one block of its total size, so the next
+ * requests of the same size are served without malloc()
+ */
+void reset_http_arena(struct http_arena* arena);
+
+
+// Frees the blocks of the arena
+void cleanup_http_arena(struct http_arena* arena);
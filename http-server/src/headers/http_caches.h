@@ -0,0 +1,105 @@
+/*
+ * File: http_caches.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: cache of fully serialized
+ * HTTP responses of the routed handlers
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdio.h>  // snprintf()
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>             // uint64_t
+#include <time.h>               // time()
+#include "tcp_socks.h"          // struct strinfo
+#include "http_parsers.h"       // struct http_request
+
+
+#define HTTP_CACHE_SLOTS        256     // cache capacity (power of two)
+#define HTTP_CACHE_PROBES       8       // max slots checked per lookup
+#define HTTP_MAX_CACHE_KEY_LEN  512     // max cache key length
+
+
+/*
+ * Cached response
+ *
+ * @hash    Hash of the key (0 for an empty slot)
+ * @key     Method, URL and the headers the response depends on
+ * @resp    Serialized response
+ * @len     Length of "resp"
+ * @expires Time the response becomes stale
+ */
+struct http_cache_entry {
+        uint64_t hash;
+        char* key;
+        char* resp;
+        size_t len;
+        time_t expires;
+};
+
+
+/*
+ * Response cache (open addressing, linear probing)
+ *
+ * @entries Cached responses
+ * @count   Number of used slots
+ * @hits    Lookups answered from the cache
+ * @misses  Lookups that were not
+ */
+struct http_cache {
+        struct http_cache_entry entries[HTTP_CACHE_SLOTS];
+        size_t count;
+        size_t hits;
+        size_t misses;
+};
+
+
+// Gets the response cache
+struct http_cache* get_http_cache(void);
+
+
+/*
+ * Makes the cache key of the request: method, URL
+ * and the headers the serialized response depends on
+ *
+ * Returns:
+ *      - Success:              EXIT_SUCCESS
+ *      - Key is too long or
+ *        "If-None-Match" set:  EXIT_FAILURE (the response is not cached)
+ */
+int make_http_cache_key(const struct http_request* req,
+        char* key, const size_t sz);
+
+
+/*
+ * Finds a fresh cached response
+ *
+ * Returns:
+ *      - Found:     the entry
+ *      - Not found: NULL
+ */
+const struct http_cache_entry* http_cache_get(const char* key);
+
+
+/*
+ * Stores the serialized response for "ttl" seconds
+ *
+ * Description: takes an empty or stale slot within the probe
+ * window, evicts the entry expiring first otherwise
+ *
+ * Returns:
+ *      - Success:      EXIT_SUCCESS
+ *      - No memory:    EXIT_FAILURE
+ */
+int http_cache_put(const char* key, const char* resp, const size_t len,
+        const unsigned ttl);
+
+
+// Frees all the cached responses
+void cleanup_http_cache(void);
@@ -14,9 +14,17 @@
 
 // HTTP status code
 enum http_code {
+        HTTP_GATEWAY_TIMEOUT = 504,
+        HTTP_SERVICE_UNAVAILABLE = 503,
+        HTTP_BAD_GATEWAY = 502,
+        HTTP_NOT_IMPLEMENTED = 501,
         HTTP_INTERNAL_SERVER_ERROR = 500,
+        HTTP_REQUEST_HEADER_FIELDS_TOO_LARGE = 431,
+        HTTP_CONTENT_TOO_LARGE = 413,
+        HTTP_TOO_MANY_REQUESTS = 429,
         HTTP_NOT_FOUND = 404,
         HTTP_BAD_REQUEST = 400,
+        HTTP_NOT_MODIFIED = 304,
         HTTP_OK = 200
 };
 
@@ -0,0 +1,145 @@
+/*
+ * File: http_conns.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: per-connection state
+ * of the HTTP server
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+#include "tcp_socks.h"          // struct clientinfo
+#include "http_writers.h"       // struct http_stream
+#include "http_parsers.h"       // struct http_request, ...
+#include "http_routers.h"       // struct http_route
+
+
+// Max request content length kept in memory,
+// longer contents are spilled to a temporary file
+#define HTTP_MAX_MEM_BODY_LEN (4 * MAX_NETBUF_LEN)
+
+// Max send buffer kept for the next response of the connection
+#define HTTP_MAX_KEPT_SEND_LEN (4 * MAX_NETBUF_LEN)
+
+// Default max request content length (--max-body-size)
+#define HTTP_DEF_MAX_BODY_LEN (16u << 20)
+
+
+/*
+ * HTTP connection state, stored in clientinfo's "add_data"
+ *
+ * @keep_alive  Keep the connection open after the response is sent
+ * @strm        Response body being streamed (optional)
+ * @req         Request being received
+ * @dec         Decoder of the request content
+ * @rt          Route of the request being received (optional)
+ * @body        Content buffered in memory
+ * @in_body     Request head was parsed, the content is being received
+ * @upc         Upstream connection relaying the proxied request (optional)
+ * @h2          HTTP/2 session of the connection (optional)
+ * @h2c_settings "HTTP2-Settings" of the request asking to switch
+ *              to h2c (optional)
+ * @tls         TLS connection (optional)
+ * @ws          WebSocket session of the connection (optional)
+ * @ws_key      "Sec-WebSocket-Key" of the request to a WebSocket
+ *              route (optional)
+ * @corked      TCP_CORK holds the head of the streamed response
+ * @arena       Memory of the request being received (its fields,
+ *              "h2c_settings", "ws_key"), reset once it is executed
+ */
+struct http_conninfo {
+        int keep_alive;
+        struct http_stream strm;
+
+        struct http_request req;
+        struct http_body_decoder dec;
+        struct http_route* rt;
+        struct strinfo body;
+        int in_body;
+
+        struct http_upconn* upc;
+
+        struct http2_session* h2;
+        char* h2c_settings;
+
+        struct tls_conn* tls;
+
+        struct ws_session* ws;
+        char* ws_key;
+
+        int corked;
+
+        struct http_arena arena;
+};
+
+
+// Gets the HTTP state of the client's connection,
+// allocates it on the first use
+//
+// Returns NULL if there is no memory
+struct http_conninfo* get_http_conninfo(struct clientinfo* cinfo);
+
+
+// Frees the HTTP connection state (clientinfo's "cleanup_add_data")
+void cleanup_http_conninfo(void* conn);
+
+
+// Sets the max request content length, received or buffered
+// (0 - unlimited, HTTP_DEF_MAX_BODY_LEN by default)
+void set_http_max_body_len(const size_t len);
+
+
+// Gets the max request content length (0 - unlimited)
+size_t get_http_max_body_len(void);
+
+
+/*
+ * Consumes the received bytes of the request: parses the head,
+ * then streams the content to the route's "on_body" or buffers it
+ * (spilling to a temporary file when too long)
+ *
+ * Note: the request is stored in "conn->req" once fully received,
+ * the caller owns it then; requests to proxy routes are complete
+ * once the head is parsed, the head and the content are left
+ * in "rvstr" to be relayed as they are
+ *
+ * Returns:
+ *      - Fully received: HTTP_OK
+ *      - Not received fully: 0
+ *      - Malformed request / WebSocket route
+ *        without the upgrade: HTTP_BAD_REQUEST
+ *      - Content over get_http_max_body_len(): HTTP_CONTENT_TOO_LARGE
+ *      - Failure: HTTP_INTERNAL_SERVER_ERROR
+ */
+int receive_http_request(struct http_conninfo* conn, struct strinfo* rvstr);
+
+
+/*
+ * Passes a piece of the request content to the route's
+ * "on_body" or buffers it (decode_http_body()'s "on_data")
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int receive_http_body_piece(void* conn, const char* piece, const size_t len);
+
+
+/*
+ * Hands the received content ("total" bytes) over to "conn->req"
+ *
+ * Returns:
+ *      - Success: HTTP_OK
+ *      - Spill file failure: HTTP_INTERNAL_SERVER_ERROR
+ *        (the request is dropped)
+ */
+int finish_http_request_body(struct http_conninfo* conn, const size_t total);
+
+
+// Drops the partially received request
+void reset_http_request_receiving(struct http_conninfo* conn);
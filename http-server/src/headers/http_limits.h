@@ -0,0 +1,126 @@
+/*
+ * File: http_limits.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: admission control: per-address and global
+ * token buckets limiting the request rate (429 / 503 written
+ * from pre-serialized bytes), connections shed when the
+ * event loop lags behind
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+#include <stdint.h>             // uint8_t, uint64_t
+#include "tcp_socks.h"          // struct serverinfo, struct clientinfo
+#include "http_codes.h"         // enum http_code
+
+
+#define HTTP_LIMIT_SLOTS 4096           // addresses tracked (power of two)
+#define HTTP_LIMIT_PROBES 8             // slots an address may be stored in
+
+
+/*
+ * Token bucket: "rate" tokens are added a second up to "burst",
+ * every request takes one
+ *
+ * @tokens  Tokens left at "last"
+ * @last    Time of the last refill (microseconds)
+ */
+struct http_bucket {
+        double tokens;
+        uint64_t last;
+};
+
+
+/*
+ * Bucket of a client's address
+ *
+ * @addr    IPv6 address (IPv4 ones are mapped)
+ * @used    Slot is taken
+ * @bucket  Bucket of the address
+ */
+struct http_limit_entry {
+        uint8_t addr[16];
+        int used;
+        struct http_bucket bucket;
+};
+
+
+/*
+ * Admitted and rejected traffic
+ *
+ * @limited     Requests answered 429 (address over its rate)
+ * @overloaded  Requests answered 503 (server over its rate)
+ * @shed        Connections answered 503 on accept
+ */
+struct http_limit_stats {
+        size_t limited;
+        size_t overloaded;
+        size_t shed;
+};
+
+
+/*
+ * Limits the request rate of every client's address
+ * ("RATE[:BURST]", requests a second, the burst is RATE by default)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Invalid "spec": EXIT_FAILURE
+ */
+int set_http_rate_limit(const char* spec);
+
+
+// Limits the request rate of the server (see set_http_rate_limit())
+int set_http_global_rate_limit(const char* spec);
+
+
+// Sheds the new connections while the loop lags
+// more than "ms" milliseconds (0 - never)
+void set_http_max_loop_lag(const int ms);
+
+
+/*
+ * Takes a token of the client's address and a global one
+ *
+ * Returns:
+ *      - Admitted: HTTP_OK
+ *      - Address is over its rate: HTTP_TOO_MANY_REQUESTS
+ *      - Server is over its rate: HTTP_SERVICE_UNAVAILABLE
+ */
+enum http_code check_http_rate_limit(const struct clientinfo* cinfo);
+
+
+/*
+ * Writes the pre-serialized response of the rejected request
+ * ("Connection: close", "Retry-After")
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - No memory: EXIT_FAILURE
+ */
+int write_http_limit_response(const enum http_code code, struct strinfo* out);
+
+
+/*
+ * Checks if the connecting clients may be served
+ *
+ * Description: while the loop lags or there is no room
+ * for the clients, the waiting connections (ACCEPT_BUDGET
+ * at most) are accepted, answered 503 and closed instead
+ * of waiting in the backlog
+ *
+ * Returns:
+ *      - Clients may be accepted: 1
+ *      - Clients were shed: 0
+ */
+int admit_http_client(struct serverinfo* sinfo);
+
+
+// Gets the counters of the admission control
+const struct http_limit_stats* get_http_limit_stats(void);
@@ -12,21 +12,174 @@
 #pragma once
 
 
+#include <stdio.h>  // FILE
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h> // uint8_t, uint32_t
 #include "tcp_socks.h"
 #include "http_codes.h"
+#include "http_arenas.h"        // struct http_arena
+
+
+#define HTTP_MAX_HEADERS 64     // header lines of a message
+
+
+/*
+ * Common headers, looked up in O(1)
+ *
+ * @HH_OTHER             Header without an identifier
+ * @HH_HOST              Host
+ * @HH_CONNECTION        Connection
+ * @HH_CONTENT_LENGTH    Content-Length
+ * @HH_CONTENT_TYPE      Content-Type
+ * @HH_TRANSFER_ENCODING Transfer-Encoding
+ * @HH_ACCEPT_ENCODING   Accept-Encoding
+ * @HH_IF_NONE_MATCH     If-None-Match
+ * @HH_RANGE             Range
+ * @HH_UPGRADE           Upgrade
+ * @HH_COUNT             Number of the identifiers
+ */
+enum http_header_id {
+        HH_OTHER,
+        HH_HOST,
+        HH_CONNECTION,
+        HH_CONTENT_LENGTH,
+        HH_CONTENT_TYPE,
+        HH_TRANSFER_ENCODING,
+        HH_ACCEPT_ENCODING,
+        HH_IF_NONE_MATCH,
+        HH_RANGE,
+        HH_UPGRADE,
+        HH_COUNT
+};
+
+
+/*
+ * Header of a message, slices of the head
+ * (the values of a request's headers are null-terminated)
+ *
+ * @name      Name as it was sent
+ * @name_len  Length of "name"
+ * @value     Value without the surrounding whitespace
+ * @value_len Length of "value"
+ * @hash      Case-insensitive hash of the name
+ * @id        Identifier of a common header
+ */
+struct http_header {
+        const char* name;
+        size_t name_len;
+        const char* value;
+        size_t value_len;
+        uint32_t hash;
+        enum http_header_id id;
+};
+
+
+/*
+ * Headers of a message in the order they were sent
+ *
+ * @list   Headers
+ * @count  Number of the headers
+ * @known  Index + 1 of the first header of every identifier
+ *         (0 - the header was not sent)
+ */
+struct http_headers {
+        struct http_header list[HTTP_MAX_HEADERS];
+        size_t count;
+        uint8_t known[HH_COUNT];
+};
+
+
+// Empties the header table
+void initialize_http_headers(struct http_headers* hdrs);
+
+
+/*
+ * Adds a header to the table (the slices are not copied)
+ *
+ * Returns:
+ *      - Success: HTTP_OK
+ *      - Repeated "Host" / "Transfer-Encoding", conflicting
+ *        "Content-Length": HTTP_BAD_REQUEST
+ *      - Table is full: HTTP_REQUEST_HEADER_FIELDS_TOO_LARGE
+ */
+enum http_code add_http_header(struct http_headers* hdrs,
+        const char* name, const size_t name_len,
+        const char* value, const size_t value_len);
+
+
+/*
+ * Parses the header lines of a message head into the table
+ *
+ * @head     Start line and header lines
+ * @head_len Length of the head including the blank line
+ * @hdrs     Table, the slices point to "head"
+ *
+ * Returns:
+ *      - Success: HTTP_OK
+ *      - Malformed header line: HTTP_BAD_REQUEST
+ *      - Failure: see add_http_header()
+ */
+enum http_code parse_http_headers(const char* head, const size_t head_len,
+        struct http_headers* hdrs);
+
+
+// Gets the first header of the identifier (O(1)), NULL if absent
+const struct http_header* get_http_known_header(
+        const struct http_headers* hdrs, const enum http_header_id id);
+
+
+// Gets the first header of the name (case-insensitive), NULL if absent
+const struct http_header* get_http_header(const struct http_headers* hdrs,
+        const char* name);
+
+
+/*
+ * Gets the next element of a comma-separated header value
+ * (the whitespace around it is trimmed, empty ones are skipped)
+ *
+ * @cur Position in the value, moved past the element
+ * @end End of the value
+ * @tok Start of the element
+ * @len Length of the element
+ *
+ * Returns:
+ *      - Element was found: 1
+ *      - End of the value: 0
+ */
+int next_http_list_token(const char** cur, const char* end,
+        const char** tok, size_t* len);
+
+
+// Checks if the comma-separated values of the headers of the identifier
+// (all the lines) have the token (case-insensitive)
+int has_http_header_token(const struct http_headers* hdrs,
+        const enum http_header_id id, const char* token);
+
+
+
+/*
+ * REQUESTS
+ */
+
 
 
 /*
  * HTTP request
  *
- * @method  GET / POST / ...
- * @url     Route
- * @conn    Connection
- * @ctype   Content-Type
- * @content Content
- * @clen    Content-Length
+ * @method   GET / POST / ...
+ * @url      Route
+ * @conn     Connection
+ * @ctype    Content-Type
+ * @aenc     Accept-Encoding
+ * @inm      If-None-Match
+ * @content  Content (NULL if spilled to "body_file")
+ * @clen     Content length (decoded)
+ * @body_file Content spilled to a temporary file (optional)
+ * @add_data Data of the route's body handler (freed by the route)
+ * @arena    Memory of the fields and of the handler's scratch
+ *           (the connection's arena, reset with the request)
+ * @headers  All the headers of the request (allocated from "arena")
  */
 struct http_request {
         char* method;
@@ -35,63 +188,142 @@ struct http_request {
         char* host;
         char* conn;
         char* ctype;
+        char* aenc;
+        char* inm;
         char* content;
         size_t clen;
+        FILE* body_file;
+        void* add_data;
+        struct http_arena* arena;
+        struct http_headers* headers;
 };
 
 
-// Cleans up the http_request structure
+// Cleans up the http_request structure,
+// resets its arena (the fields are freed at once)
 void cleanup_http_request(struct http_request* req);
 
 
+// Allocates an empty header table of the request from its arena
+// (NULL if there is no memory)
+struct http_headers* create_http_request_headers(struct http_request* req);
+
+
+// Points the fields of the request ("host", "conn", ...)
+// to the values of the common headers
+void set_http_request_fields(struct http_request* req);
+
+
 /*
- * Parses a HTTP header
+ * Checks if the request head (request line and headers) is fully read,
+ * the content is read separately with decode_http_body()
  *
- * @req    Full null-terminated HTTP request
- * @header Header which value is needed
- * @dest   NULL pointer where the header value should be written
+ * Returns:
+ *      - Fully read: HTTP_OK
+ *      - Not read fully: 0
+ */
+int http_request_read_status(const char* const req);
+
+
+// Gets the length of the fully read request head including the blank line
+size_t http_request_head_len(const char* const req);
+
+
+/*
+ * Parses the head of a HTTP request
  *
- * Description: takes a header,
- * parses the value, allocates memory to "dest",
- * writes the value to "dest"
+ * Description: the head is copied to "req->arena" once,
+ * the request line and the header table are slices
+ * of the copy
  *
  * Returns:
- *      - Success: HTTP status code except 500
- *      - Failure: HTTP_INTERNAL_SERVER_ERROR
+ *      - Success: HTTP_OK
+ *      - Malformed head: HTTP_BAD_REQUEST
+ *      - Too many headers: HTTP_REQUEST_HEADER_FIELDS_TOO_LARGE
+ *      - No memory: HTTP_INTERNAL_SERVER_ERROR
  */
-enum http_code parse_http_header(const char* const req,
-        char* header, char** dest);
+enum http_code parse_http_request(const char* const rbuf,
+        struct http_request* req);
 
 
-// Parses HTTP method
-enum http_code parse_http_method(const char* const req, char** method);
+
+/*
+ * REQUEST BODIES
+ */
 
 
-// Parses the URL part of the HTTP request
-enum http_code parse_http_url(const char* const req, char** url);
 
+#define HTTP_MAX_LINE_LEN 1024 // max chunk size / trailer line length
 
-// Parses HTTP request contents
-enum http_code parse_http_content(const char* const req,
-        char** content, const size_t clen);
+
+/*
+ * Request body decoder state
+ *
+ * @HBS_LENGTH     Reading a "Content-Length" body
+ * @HBS_CHUNK_SIZE Reading a chunk size line
+ * @HBS_CHUNK_DATA Reading chunk data
+ * @HBS_CHUNK_CRLF Reading "\r\n" after chunk data
+ * @HBS_TRAILERS   Reading the trailer section
+ * @HBS_DONE       Body was fully read
+ */
+enum http_body_state {
+        HBS_LENGTH,
+        HBS_CHUNK_SIZE,
+        HBS_CHUNK_DATA,
+        HBS_CHUNK_CRLF,
+        HBS_TRAILERS,
+        HBS_DONE
+};
 
 
-// Moves everything after the content section to the beginning of the request
-int move_http_request(struct strinfo* reqstr, size_t content_len);
+/*
+ * Request body decoder
+ *
+ * @state Decoding state
+ * @left  Bytes left in the body / current chunk
+ * @total Decoded bytes count
+ * @max   Max content length (0 - unlimited), set by the caller
+ */
+struct http_body_decoder {
+        enum http_body_state state;
+        size_t left;
+        size_t total;
+        size_t max;
+};
 
 
 /*
- * Checks if the request is fully read
+ * Sets the decoder up from the "Transfer-Encoding"
+ * and "Content-Length" headers of the message
  *
  * Returns:
- *      - No memory: HTTP_INTERNAL_SERVER_ERROR
- *      - Invalid "Content-Length" header: HTTP_BAD_REQUEST
- *      - Fully read: HTTP_OK
- *      - Not read fully: 0
+ *      - Success: HTTP_OK
+ *      - Invalid / conflicting headers: HTTP_BAD_REQUEST
+ *      - Codings other than "chunked": HTTP_NOT_IMPLEMENTED
+ *      - "Content-Length" over "dec->max": HTTP_CONTENT_TOO_LARGE
  */
-int http_request_read_status(const char* const req);
+enum http_code parse_http_body_framing(const struct http_headers* hdrs,
+        struct http_body_decoder* dec);
 
 
-// Parses a HTTP request
-enum http_code parse_http_request(const char* const rbuf,
-        struct http_request* req);
+/*
+ * Decodes the next part of the request body
+ *
+ * @dec     Body decoder
+ * @in      Received bytes following the already decoded part
+ * @len     Length of "in"
+ * @used    Number of bytes of "in" that were consumed
+ * @on_data Called with each decoded piece of the content
+ * @data    Argument of "on_data"
+ *
+ * Returns:
+ *      - Body fully decoded: HTTP_OK
+ *      - More input needed: 0
+ *      - Malformed body: HTTP_BAD_REQUEST
+ *      - Chunks over "dec->max" in total: HTTP_CONTENT_TOO_LARGE
+ *      - "on_data" failed: HTTP_INTERNAL_SERVER_ERROR
+ */
+int decode_http_body(struct http_body_decoder* dec,
+        const char* in, const size_t len, size_t* used,
+        int (*on_data)(void* data, const char* piece, const size_t len),
+        void* data);
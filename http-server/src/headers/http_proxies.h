@@ -0,0 +1,255 @@
+/*
+ * File: http_proxies.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: reverse proxy routes: requests are
+ * forwarded to upstream HTTP servers over pooled
+ * keep-alive connections, bodies are relayed in both
+ * directions as they arrive, the upstreams are
+ * health checked in the background
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+#include <stdint.h>             // uint32_t, uint64_t
+#include <time.h>               // time_t
+#include "tcp_socks.h"          // struct serverinfo, struct strinfo
+#include "http_parsers.h"       // struct http_body_decoder
+#include "http_conns.h"         // struct http_conninfo
+
+
+#define HTTP_MAX_PROXIES 4              // proxies of the server
+#define HTTP_PROXY_MAX_UPSTREAMS 8      // upstreams of a proxy
+#define HTTP_PROXY_MAX_CONNS 16         // connections per upstream
+#define HTTP_PROXY_IDLE_SEC 30          // pooled connection lifetime
+#define HTTP_PROXY_TIMEOUT_SEC 10       // upstream inactivity timeout
+#define HTTP_PROXY_CHECK_SEC 5          // health check interval
+#define HTTP_PROXY_MAX_BUFFERED MAX_NETBUF_LEN // bytes buffered before
+                                               // the sender is paused
+#define HTTP_PROXY_RING_POINTS 64       // hash ring points per upstream
+#define HTTP_PROXY_EJECT_ERRORS 5       // consecutive errors ejecting
+                                        // an upstream
+#define HTTP_PROXY_EJECT_SEC 10         // first ejection time (doubles)
+#define HTTP_PROXY_MAX_EJECT_SEC 300    // longest ejection time
+#define HTTP_PROXY_SLOW_MS 2000         // slower responses count as errors
+
+
+/*
+ * Upstream connection state
+ *
+ * @HUC_FREE        Slot is not used
+ * @HUC_CONNECTING  Non-blocking connect() is in progress
+ * @HUC_IDLE        Kept alive in the pool
+ * @HUC_ACTIVE      Relaying a client's request and the response
+ * @HUC_CHECKING    Health check request is in progress
+ */
+enum http_upconn_state {
+        HUC_FREE,
+        HUC_CONNECTING,
+        HUC_IDLE,
+        HUC_ACTIVE,
+        HUC_CHECKING
+};
+
+
+/*
+ * Upstream selection policy
+ *
+ * @HTTP_BALANCE_ROUND_ROBIN   Upstreams in turn
+ * @HTTP_BALANCE_LEAST_CONN    Fewest requests in progress
+ * @HTTP_BALANCE_TWO_CHOICES   Less loaded of two random upstreams
+ * @HTTP_BALANCE_HASH          Consistent hashing of the request key
+ */
+enum http_balance {
+        HTTP_BALANCE_ROUND_ROBIN,
+        HTTP_BALANCE_LEAST_CONN,
+        HTTP_BALANCE_TWO_CHOICES,
+        HTTP_BALANCE_HASH
+};
+
+
+/*
+ * Connection to an upstream
+ *
+ * @sock        Non-blocking socket
+ * @state       Connection state
+ * @up          Upstream of the connection
+ * @client      Client whose request is relayed (optional)
+ * @out         Request bytes not sent to the upstream yet
+ * @in          Response bytes not relayed to the client yet
+ * @req_done    Whole request was queued to "out"
+ * @head_req    Request is "HEAD" (the response has no body)
+ * @resp_head   Response head was relayed
+ * @dec         Response body framing
+ * @until_close Response body ends with the connection
+ * @keep_alive  Upstream keeps the connection open
+ * @sent_ms     Time the whole request was sent (0 - not yet)
+ * @deadline    Inactivity / idle expiry time
+ */
+struct http_upconn {
+        SOCKET sock;
+        enum http_upconn_state state;
+        struct http_upstream* up;
+        struct clientinfo* client;
+
+        struct strinfo out;
+        struct strinfo in;
+
+        int req_done;
+        int head_req;
+        int resp_head;
+        struct http_body_decoder dec;
+        int until_close;
+        int keep_alive;
+
+        uint64_t sent_ms;
+        time_t deadline;
+};
+
+
+/*
+ * Upstream server
+ *
+ * @name        "HOST:PORT" as configured
+ * @addr        Resolved address
+ * @addr_len    Length of "addr"
+ * @healthy     Last health check / connection attempt succeeded
+ * @next_check  Time of the next health check
+ * @errors      Consecutive failed / slow responses
+ * @ejections   Ejections since the last good response
+ * @eject_until Upstream gets no requests until then
+ * @conns       Connections (pooled and active)
+ * @active      Requests in progress
+ * @requests    Requests forwarded
+ * @failures    Requests failed (connection errors, timeouts)
+ */
+struct http_upstream {
+        char name[MAX_ADDRBUF_LEN + MAX_SERVBUF_LEN];
+        struct sockaddr_storage addr;
+        socklen_t addr_len;
+
+        int healthy;
+        time_t next_check;
+
+        size_t errors;
+        size_t ejections;
+        time_t eject_until;
+
+        struct http_upconn conns[HTTP_PROXY_MAX_CONNS];
+        size_t active;
+
+        size_t requests;
+        size_t failures;
+};
+
+
+// Point of the consistent hashing ring
+struct http_ring_point {
+        uint32_t hash;
+        uint32_t upstream;
+};
+
+
+/*
+ * Reverse proxy (target of struct http_route's "proxy")
+ *
+ * @upstreams   Upstream servers
+ * @nupstreams  Number of upstreams
+ * @balance     Upstream selection policy
+ * @hash_key    Header hashed by HTTP_BALANCE_HASH (empty - the URL)
+ * @next        Next upstream of the round robin
+ * @rand        State of the two choices' random generator
+ * @ring        Consistent hashing ring (sorted by the hash)
+ * @nring       Number of the ring points
+ * @check_path  URL requested by the health checks
+ */
+struct http_proxy {
+        struct http_upstream upstreams[HTTP_PROXY_MAX_UPSTREAMS];
+        size_t nupstreams;
+
+        enum http_balance balance;
+        char hash_key[MAX_ADDRBUF_LEN];
+        size_t next;
+        uint32_t rand;
+        struct http_ring_point ring[HTTP_PROXY_MAX_UPSTREAMS
+                * HTTP_PROXY_RING_POINTS];
+        size_t nring;
+
+        char check_path[MAX_ADDRBUF_LEN];
+};
+
+
+/*
+ * Creates a proxy from the list of upstreams
+ *
+ * @upstreams   "HOST:PORT,HOST:PORT,..." ("[ADDR]:PORT" for IPv6)
+ * @check_path  URL requested by the health checks (NULL - "/")
+ *
+ * Returns:
+ *      - Success: the proxy (lives until cleanup_http_proxies())
+ *      - Invalid / unresolvable upstream, too many proxies: NULL
+ */
+struct http_proxy* create_http_proxy(const char* upstreams,
+        const char* check_path);
+
+
+/*
+ * Sets the upstream selection policy of the proxy
+ *
+ * @policy "round-robin", "least-conn", "two-choices",
+ *         "hash" (the URL) or "hash:HEADER"
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Unknown policy: EXIT_FAILURE
+ */
+int set_http_proxy_balance(struct http_proxy* proxy, const char* policy);
+
+
+/*
+ * Starts forwarding the request whose head was just received
+ *
+ * Description: takes a pooled connection to an upstream
+ * (or opens a new one), queues the rewritten head and
+ * the received part of the content; the client is served
+ * by the server's select() hooks from then on
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: HTTP status code to respond with:
+ *        HTTP_SERVICE_UNAVAILABLE (no healthy upstream below
+ *        HTTP_PROXY_MAX_CONNS), HTTP_BAD_GATEWAY (connecting failed),
+ *        HTTP_CONTENT_TOO_LARGE (chunks over get_http_max_body_len())
+ */
+int start_http_proxy_request(struct http_proxy* proxy,
+        struct clientinfo* cinfo, struct http_conninfo* conn);
+
+
+/*
+ * Queues the received content of the proxied request
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Chunks over get_http_max_body_len(): HTTP_CONTENT_TOO_LARGE
+ *      - Malformed content / no memory: EXIT_FAILURE
+ */
+int relay_http_proxy_request(struct clientinfo* cinfo,
+        struct http_conninfo* conn);
+
+
+// Detaches the client from its upstream connection,
+// the connection is closed (the exchange is not complete)
+void abort_http_upconn(struct http_upconn* upc);
+
+
+// Sets the select() hooks and the timeout of the server
+void attach_http_proxies(struct serverinfo* sinfo);
+
+
+// Closes the upstream connections, frees the proxies
+void cleanup_http_proxies(void);
@@ -0,0 +1,92 @@
+/*
+ * File: http_reloads.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: zero-downtime restarts and graceful
+ * shutdowns: the running server hands its listening
+ * socket over to the new process through a Unix domain
+ * socket (SCM_RIGHTS) or gets SIGINT / SIGTERM, then
+ * stops accepting and drains its connections
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+#include "tcp_socks.h"          // struct serverinfo
+
+
+#define HTTP_DRAIN_SEC 30               // default time before the remaining
+                                        // connections are dropped
+#define HTTP_RELOAD_TIMEOUT_SEC 5       // max wait for the running server
+
+
+/*
+ * Takes the listening socket over from the server
+ * listening for the reloads at "path"
+ *
+ * Description: the running server sends its listening
+ * socket and the reload socket, then drains its
+ * connections; the reload socket is kept for
+ * attach_http_reload()
+ *
+ * Returns:
+ *      - Success: listening socket
+ *      - No server at "path" / failure: INVALID_SOCKET
+ */
+SOCKET take_over_http_server(const char* path);
+
+
+/*
+ * Listens for the next server process at "path"
+ * (sets the select() hooks, keeps the ones already set)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int attach_http_reload(struct serverinfo* sinfo, const char* path);
+
+
+/*
+ * Drains the server on SIGINT / SIGTERM, the second
+ * signal drops the remaining connections
+ *
+ * Description: the signal handler writes to a pipe
+ * watched by select(), so the signal is handled
+ * in the server loop without races
+ *
+ * @drain_sec Time the connections are given to complete
+ *            (on the shutdowns and on the reloads)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int attach_http_shutdown(struct serverinfo* sinfo, const int drain_sec);
+
+
+/*
+ * Stops accepting: closes the listening socket, drops the idle
+ * connections, the rest are closed after their responses
+ *
+ * @sec Remaining connections are dropped after "sec" seconds
+ */
+void start_http_drain(struct serverinfo* sinfo, const int sec);
+
+
+// Checks if the server stopped accepting
+int is_http_server_draining(void);
+
+
+// Checks if the draining server may exit (no connections left
+// or the deadline passed, the remaining ones are dropped)
+int is_http_server_drained(struct serverinfo* sinfo);
+
+
+// Closes the reload socket (removes it if it was not handed over)
+// and the signal pipe
+void cleanup_http_reload(void);
@@ -7,13 +7,29 @@
 /*
  * HTTP route and the related handler function storage
  *
- * @route Route used by a client
- * @path  Related handler function
+ * @method  Method used by a client ("*" matches any)
+ * @route   Route used by a client
+ * @handler Related handler function
+ * @on_body Receives the request content piece by piece as it arrives
+ *          (optional, struct http_request* is passed as the first argument;
+ *          the content is buffered for "handler" otherwise)
+ * @cache_ttl Seconds the serialized "200 OK" responses of the handler
+ *          are replayed from the cache (optional, 0 - not cached)
+ * @prefix  Route matches every URL starting with "route"
+ * @proxy   Requests are forwarded to the upstreams of the proxy
+ *          instead of the handler (optional)
+ * @ws      Requests are upgraded to WebSocket connections
+ *          served by the endpoint instead of the handler (optional)
  */
 struct http_route {
         const char* method;
         const char* route;
         int (*handler)(void*, const size_t argc, ...);
+        int (*on_body)(void* req, const char* data, const size_t len);
+        unsigned cache_ttl;
+        int prefix;
+        struct http_proxy* proxy;
+        struct ws_endpoint* ws;
 };
 
 
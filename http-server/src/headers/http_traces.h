@@ -0,0 +1,123 @@
+/*
+ * File: http_traces.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: hot path tracing (built with HTTP_TRACE):
+ * stages of the event loop timed with the time stamp counter
+ * into a ring buffer, written as Chrome trace JSON
+ * (chrome://tracing, ui.perfetto.dev) on SIGUSR1 and on exit
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+#include <stdint.h>             // uint64_t, uint32_t
+
+#ifdef HTTP_TRACE
+        #if defined(_MSC_VER)
+                #include <intrin.h>     // __rdtsc()
+        #elif defined(__x86_64__) || defined(__i386__)
+                #include <x86intrin.h>  // __rdtsc()
+        #else
+                #include <time.h>       // timespec_get()
+        #endif
+#endif  // HTTP_TRACE
+
+
+#define HTTP_TRACE_RING_LEN 65536       // events kept (the latest ones)
+
+
+// Traced stages
+enum http_trace_stage {
+        HTS_SELECT,
+        HTS_RECV,
+        HTS_READ_STATUS,
+        HTS_PARSE,
+        HTS_HANDLER,
+        HTS_FORMAT,
+        HTS_SEND,
+        HTS_COUNT
+};
+
+
+/*
+ * Traced stage
+ *
+ * @start   Clock value at the start
+ * @end     Clock value at the end
+ * @arg     Bytes / fds involved (stage specific)
+ * @stage   Stage
+ */
+struct http_trace_event {
+        uint64_t start;
+        uint64_t end;
+        uint32_t arg;
+        uint32_t stage;
+};
+
+
+#ifdef HTTP_TRACE
+// Reads the time stamp counter (nanoseconds where there is none)
+static inline
+uint64_t read_http_trace_clock(void)
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+        return (uint64_t) __rdtsc();
+#else
+        struct timespec ts = { 0 };
+        timespec_get(&ts, TIME_UTC);
+        return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+
+// Starts timing a stage (declares the start variable)
+#define HTTP_TRACE_BEGIN(name) \
+        const uint64_t http_trace_##name = read_http_trace_clock()
+
+// Records the stage started with HTTP_TRACE_BEGIN(name)
+#define HTTP_TRACE_END(name, stage, arg) \
+        record_http_trace((stage), http_trace_##name, (arg))
+#else   // HTTP_TRACE
+#define HTTP_TRACE_BEGIN(name)
+#define HTTP_TRACE_END(name, stage, arg)
+#endif  // !HTTP_TRACE
+
+
+// Adds the stage ending now to the ring (the oldest one is overwritten)
+void record_http_trace(const enum http_trace_stage stage,
+        const uint64_t start, const size_t arg);
+
+
+/*
+ * Sets the file the trace is written to on SIGUSR1 (Unix)
+ * and on exit
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Not built with HTTP_TRACE: EXIT_FAILURE
+ */
+int attach_http_trace(const char* path);
+
+
+// Writes the trace if it was requested (SIGUSR1),
+// called by the event loop
+void poll_http_trace(void);
+
+
+/*
+ * Writes the events of the ring as Chrome trace JSON
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure / no file set: EXIT_FAILURE
+ */
+int dump_http_trace(void);
+
+
+// Writes the trace a last time
+void cleanup_http_trace(void);
@@ -60,3 +60,92 @@ int write_http_response(struct strinfo* sstr,
 int write_http_from_code(const enum http_code code, struct strinfo* sstr,
         const char* content_type, const size_t content_len,
         const char* content, const char* connection);
+
+
+// Gets the "Connection" header line matching
+// the client's "Connection" header value (may be NULL)
+const char* http_conn_header(const char* connection);
+
+
+
+/*
+ * STREAMED RESPONSES
+ */
+
+
+
+// Content length of a body produced on the fly
+#define HTTP_UNKNOWN_LEN ((size_t) -1)
+
+
+/*
+ * Response body written to the send string piece by piece
+ *
+ * @next     Writes the next piece of the body with write_http_stream(),
+ *           returns the number of bytes written, 0 at the end of the body
+ *           or -EXIT_FAILURE on failure
+ * @cleanup  Frees "data" (optional)
+ * @data     Producer state
+ * @chunked  Body is sent with "Transfer-Encoding: chunked"
+ * @active   Body is still being produced
+ * @file     File of the body, may be sent with sendfile() from
+ *           "file_off" instead of calling "next" (optional)
+ * @file_off Offset of the part of "file" not sent yet
+ * @file_left Bytes of "file" not sent yet
+ */
+struct http_stream {
+        int (*next)(struct http_stream* strm, struct strinfo* sstr);
+        void (*cleanup)(void* data);
+        void* data;
+        int chunked;
+        int active;
+
+        FILE* file;
+        size_t file_off;
+        size_t file_left;
+};
+
+
+/*
+ * Writes the status line and headers of a streamed HTTP response
+ *
+ * Notes:
+ *      - "strm->next" should be set, the body is produced by
+ *        fill_http_stream() calls once the head is sent
+ *      - HTTP_UNKNOWN_LEN "content_len" switches to chunked encoding
+ *
+ * Returns:
+ *      - Success:      EXIT_SUCCESS
+ *      - No memory:    EXIT_FAILURE
+ */
+int write_http_stream_response(struct strinfo* sstr,
+        struct http_stream* strm,
+        const char* response,
+        const char* content_type,
+        const size_t content_len,
+        const size_t argc,
+        ...);
+
+
+// Appends a piece of the streamed body to the send string,
+// framed as a chunk if the stream is chunked
+int write_http_stream(struct strinfo* sstr, const struct http_stream* strm,
+        const char* data, const size_t len);
+
+
+/*
+ * Replaces the sent contents of the send string
+ * with the next piece of the body
+ *
+ * Description: calls "strm->next", ends the body
+ * and cleans up the stream once the producer is done
+ *
+ * Returns:
+ *      - Success:      EXIT_SUCCESS
+ *      - Failure:      EXIT_FAILURE (stream is cleaned up)
+ */
+int fill_http_stream(struct http_stream* strm, struct strinfo* sstr);
+
+
+// Frees the producer state, deactivates the stream
+void cleanup_http_stream(struct http_stream* strm);
@@ -13,6 +13,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h> // uint64_t
 
 
 // Changes '/' to '\\' on Windows
@@ -34,11 +35,45 @@ void make_path_cross_platform(char* const cur_path);
 int check_path(const char* path, const char* prefix, const int max_ups);
 
 
-#define MAX_EXT_LEN 64  // max file extension length
+#define MAX_EXT_LEN     8       // max file extension length (packed to 64 bits)
+#define MAX_MIME_TYPES  4096    // max number of known extensions
 
 
 /*
  * Translates a path to resourse
  * to the related content type string
+ *
+ * Description: the extension is packed into a 64-bit key
+ * and looked up in a perfect hash table with a single probe,
+ * the table of built-in types is made on the first call
+ *
+ * Returns: "text/plain" for unknown extensions
  */
 const char* path_to_content_type(const char* const path);
+
+
+/*
+ * Builds the table of content types if it is not built yet
+ *
+ * Description: a failure is kept, every content type
+ * is "text/plain" then (the table is not rebuilt per request)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int prepare_mime_table(void);
+
+
+/*
+ * Loads content types from a "mime.types"-style file
+ *
+ * Description: each line is a content type followed by
+ * its extensions, '#' starts a comment; the loaded types
+ * override the built-in ones
+ *
+ * Returns:
+ *      - Success:                       EXIT_SUCCESS
+ *      - No file / memory / too many:   EXIT_FAILURE
+ */
+int load_mime_types(const char* path);
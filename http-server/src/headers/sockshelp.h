@@ -16,6 +16,34 @@
 #include <stdlib.h>
 
 
+#define SOCKET_CPU_UNSET (-1)           // SO_INCOMING_CPU is not set
+#define SOCKET_CPU_WORKER (-2)          // CPU the server loop runs on
+
+
+/*
+ * Tuning of the server sockets (0 - the option is left as is)
+ *
+ * @nodelay      Segments are sent at once (TCP_NODELAY)
+ * @cork         Partial segments are held while the head and
+ *               the body of a response are written (TCP_CORK, Linux)
+ * @fastopen     Queue of the TCP Fast Open connections (TCP_FASTOPEN)
+ * @sndbuf       Send buffer size (SO_SNDBUF)
+ * @rcvbuf       Receive buffer size (SO_RCVBUF)
+ * @busy_poll_us Time recv() polls the device queue (SO_BUSY_POLL, Linux)
+ * @incoming_cpu CPU the connections are handled on (SO_INCOMING_CPU,
+ *               Linux), SOCKET_CPU_UNSET / SOCKET_CPU_WORKER
+ */
+struct socket_profile {
+        int nodelay;
+        int cork;
+        int fastopen;
+        int sndbuf;
+        int rcvbuf;
+        int busy_poll_us;
+        int incoming_cpu;
+};
+
+
 /*
  * Allocates as much bytes as possible
  *
@@ -44,6 +72,79 @@ int sockets_startup(void);
 int sockets_cleanup(void);
 
 
+/*
+ * Makes the socket non-blocking
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int set_socket_nonblocking(const SOCKET s);
+
+
+/*
+ * Lets accept() return the connection only once its
+ * first bytes arrive or "sec" seconds pass
+ * (TCP_DEFER_ACCEPT, Linux)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure / not supported: EXIT_FAILURE
+ */
+int set_socket_defer_accept(const SOCKET s, const int sec);
+
+
+// Initializes the profile leaving every option as is
+void initialize_socket_profile(struct socket_profile* prof);
+
+
+/*
+ * Parses the comma separated options of the profile:
+ * "nodelay", "cork", "fastopen=QLEN", "sndbuf=BYTES",
+ * "rcvbuf=BYTES", "busy-poll=USEC", "incoming-cpu[=CPU]"
+ * (the CPU of the server loop by default)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Invalid "spec": EXIT_FAILURE
+ */
+int parse_socket_profile(const char* spec, struct socket_profile* prof);
+
+
+/*
+ * Applies the profile to the listening socket
+ * (Fast Open queue, buffers inherited by the accepted
+ * sockets, CPU; SOCKET_CPU_WORKER pins the process
+ * to the CPU it runs on)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Some options were not set: EXIT_FAILURE
+ */
+int apply_listener_profile(const SOCKET s, struct socket_profile* prof);
+
+
+/*
+ * Applies the profile to the accepted socket
+ * (TCP_NODELAY, buffers, busy polling, CPU)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Some options were not set: EXIT_FAILURE
+ */
+int apply_socket_profile(const SOCKET s, const struct socket_profile* prof);
+
+
+/*
+ * Holds the partial segments until uncorked (TCP_CORK, Linux)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure / not supported: EXIT_FAILURE
+ */
+int set_socket_cork(const SOCKET s, const int on);
+
+
 /*
  * Configures an address using the provided parameters
  *
@@ -14,6 +14,12 @@
 #include "cross_platform_sockets.h"
 #include "sockshelp.h"
 #include <stdlib.h>
+#include <stdint.h> // uint64_t
+#include <string.h> // memcpy()
+#include <time.h>   // time_t
+
+
+#define ACCEPT_BUDGET 32        // max connections accepted per select()
 
 
 /*
@@ -58,6 +64,11 @@ struct strinfo {
  * @sdstr       Client's request
  * @rvstr       Response to the client
  * @add_data    Additional data
+ * @cleanup_add_data Frees the additional data (optional)
+ * @addr        Client's address
+ * @addr_len    Length of "addr"
+ * @connected   Time the client was accepted
+ * @active      Time the client's fd was last ready
  */
 struct clientinfo {
         SOCKET client;
@@ -66,18 +77,40 @@ struct clientinfo {
         struct strinfo sdstr;
         struct strinfo rvstr;
 
+        struct sockaddr_storage addr;
+        socklen_t addr_len;
+        time_t connected;
+        time_t active;
+
         void* add_data;
+        void (*cleanup_add_data)(void* add_data);
 };
 
 
 /*
  * Stores info about a server
  *
- * @serv        Server fd
+ * @serv        Server fd (INVALID_SOCKET - not accepting)
  * @max_fd      Max fd among the connected clients and server
  * @clients     Info about clients
  * @readfds     Set of fds ready for read operation
  * @writefds    Set of fds ready for write operation
+ * @timeout_ms  Max time select() waits (-1 - until an fd is ready)
+ * @on_select   Adds other fds (e.g. outgoing connections) to the sets
+ *              before select() (optional)
+ * @on_selected Handles the other fds after select(), also called
+ *              on the timeout with empty sets (optional)
+ * @on_wait     Called before ("done" 0) and after ("done" 1, "ready"
+ *              is the result of select()) the wait (optional, e.g.
+ *              tracing)
+ * @loops       Iterations of the loop
+ * @wait_us     Time spent in select() (microseconds)
+ * @busy_us     Time spent handling the fds (microseconds)
+ * @lag_us      Time the last iteration spent handling the fds,
+ *              the ready fds wait as long (loop lag)
+ * @profile     Options of the accepted sockets (optional)
+ * @full        Connection table was full at the last accept
+ * @full_waits  Accepts postponed because the table was full
  */
 struct serverinfo {
         SOCKET serv;
@@ -87,6 +120,24 @@ struct serverinfo {
 
         fd_set readfds;
         fd_set writefds;
+
+        int timeout_ms;
+        void (*on_select)(struct serverinfo* sinfo,
+                fd_set* readfds, fd_set* writefds, SOCKET* max_fd);
+        void (*on_selected)(struct serverinfo* sinfo,
+                const fd_set* readfds, const fd_set* writefds);
+        void (*on_wait)(struct serverinfo* sinfo, const int done,
+                const int ready);
+
+        uint64_t loops;
+        uint64_t wait_us;
+        uint64_t busy_us;
+        uint64_t lag_us;
+
+        const struct socket_profile* profile;
+
+        int full;
+        size_t full_waits;
 };
 
 
@@ -99,6 +150,41 @@ void initialize_strinfo(struct strinfo* strinf);
 void cleanup_strinfo(struct strinfo* strinf);
 
 
+// Empties the string, keeps the buffer for the next writes
+void clear_strinfo(struct strinfo* strinf);
+
+
+/*
+ * Makes room for "len" more bytes (and '\0') in the string buffer
+ *
+ * Returns:
+ *      - Success:      EXIT_SUCCESS
+ *      - No memory:    EXIT_FAILURE
+ */
+int reserve_strinfo(struct strinfo* strinf, const size_t len);
+
+
+/*
+ * Appends "len" bytes of "data" to the string
+ *
+ * Description: grows the buffer when needed,
+ * keeps the string null-terminated
+ *
+ * Returns:
+ *      - Success:      EXIT_SUCCESS
+ *      - No memory:    EXIT_FAILURE
+ */
+int append_strinfo(struct strinfo* strinf, const char* data, const size_t len);
+
+
+// Appends a formatted string to the string (see append_strinfo())
+int appendf_strinfo(struct strinfo* strinf, const char* format, ...);
+
+
+// Removes the first "len" bytes of the string
+void consume_strinfo(struct strinfo* strinf, const size_t len);
+
+
 // Initializes struct clientinfo
 // Sets "client" to "INVALID_SOCKET",
 // initalizes the related strinfo structures
@@ -109,8 +195,9 @@ void initialize_clientinfo(struct clientinfo* cinfo);
 void cleanup_clientinfo(struct clientinfo* cinfo);
 
 
-// Initializes server and max fds with "serv",
+// Initializes server and max fds with "serv" (made non-blocking),
 // initializes the related clientinfo structures
+// (the hooks are reset, select() blocks until an fd is ready)
 void initialize_serverinfo(struct serverinfo* sinfo, const SOCKET serv);
 
 
@@ -124,7 +211,7 @@ void cleanup_serverinfo(struct serverinfo* sinfo);
  * 
  * Returns:
  *      - Success:      bytes read
- *      - Disconnect:   EXIT_SUCCESS  (0)
+ *      - Disconnect / nothing to read: EXIT_SUCCESS  (0)
  *      - Error:        -EXIT_FAILURE (-1)
  */
 int server_receive_request(struct serverinfo* sinfo, struct clientinfo* cinfo,
@@ -135,10 +222,16 @@ int server_receive_request(struct serverinfo* sinfo, struct clientinfo* cinfo,
 int find_place_for_client(struct serverinfo* sinfo);
 
 
-// Accepts a new client, initializes the free cell
+// Accepts the waiting clients (ACCEPT_BUDGET at most, while there
+// is room), the sockets are non-blocking, initializes the free cells
 void server_accept_client(struct serverinfo* sinfo);
 
 
+// Writes the client's address as "host:port" ("[host]:port" - IPv6)
+void format_client_address(const struct clientinfo* cinfo, char* buf,
+        const size_t len);
+
+
 // Disconnects the given client and clears the related clientinfo structure
 int drop_client(struct serverinfo* sinfo, const SOCKET client);
 
@@ -170,6 +263,10 @@ void sinfo_to_write_fds(const struct serverinfo* sinfo, fd_set* res);
 void update_max_fd(struct serverinfo* sinfo);
 
 
+// Gets the time in microseconds (for the loop statistics)
+uint64_t get_loop_time_us(void);
+
+
 /*
  * Blocks until at least one fd has input
  *
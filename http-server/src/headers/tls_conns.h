@@ -0,0 +1,110 @@
+/*
+ * File: tls_conns.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: TLS termination of the client connections
+ * (OpenSSL, built with HTTP_TLS): non-blocking handshakes,
+ * session resumption, kernel TLS offload letting the files
+ * be sent with sendfile() as on the plain connections
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdio.h>              // FILE
+#include <stdlib.h>
+#include "cross_platform_sockets.h" // SOCKET
+
+
+#define TLS_CONN_AGAIN (-2)             // socket is not ready, retry later
+#define TLS_SESSION_TIMEOUT_SEC 7200    // lifetime of the resumable sessions
+
+
+// TLS connection state (opaque)
+struct tls_conn;
+
+
+/*
+ * Loads the certificate chain and the private key (PEM),
+ * every accepted connection is TLS from then on
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Invalid files / not built with HTTP_TLS: EXIT_FAILURE
+ */
+int load_tls_context(const char* cert_path, const char* key_path);
+
+
+// Checks if the connections are TLS (load_tls_context() succeeded)
+int is_tls_enabled(void);
+
+
+/*
+ * Starts the server side of a TLS connection on the accepted
+ * socket (the socket is made non-blocking), the handshake is
+ * completed by the first recv_tls_conn() calls
+ *
+ * Returns:
+ *      - Success: TLS connection
+ *      - Failure: NULL
+ */
+struct tls_conn* create_tls_conn(const SOCKET client);
+
+
+/*
+ * Receives the decrypted bytes (plain recv() if "tls" is NULL)
+ *
+ * Returns:
+ *      - Success: number of bytes received
+ *      - Handshake / record not complete yet: TLS_CONN_AGAIN
+ *      - Closed by the client: 0
+ *      - Failure: -EXIT_FAILURE
+ */
+int recv_tls_conn(const SOCKET client, struct tls_conn* tls, char* buf,
+        const size_t len);
+
+
+// Checks if decrypted bytes are left after recv_tls_conn()
+// filled the buffer (the socket won't be readable for them)
+size_t tls_conn_pending(struct tls_conn* tls);
+
+
+/*
+ * Sends the bytes (plain send() if "tls" is NULL)
+ *
+ * Returns:
+ *      - Success: number of bytes sent
+ *      - Socket buffer is full: TLS_CONN_AGAIN
+ *      - Failure: -EXIT_FAILURE
+ */
+int send_tls_conn(const SOCKET client, struct tls_conn* tls,
+        const char* buf, const size_t len);
+
+
+// Checks if files can be sent without copying them to user space
+// (sendfile() on Linux, over TLS only with the kernel TLS offload)
+int can_sendfile_tls_conn(struct tls_conn* tls);
+
+
+/*
+ * Sends "len" bytes of the file starting at "off" without copying
+ * (see can_sendfile_tls_conn())
+ *
+ * Returns:
+ *      - Success: number of bytes sent
+ *      - Socket buffer is full: TLS_CONN_AGAIN
+ *      - Failure: -EXIT_FAILURE
+ */
+int sendfile_tls_conn(const SOCKET client, struct tls_conn* tls, FILE* f,
+        const size_t off, const size_t len);
+
+
+// Frees the TLS connection (the socket is closed by the caller)
+void cleanup_tls_conn(struct tls_conn* tls);
+
+
+// Frees the certificate and the session cache
+void cleanup_tls_context(void);
@@ -0,0 +1,255 @@
+/*
+ * File: ws_sessions.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: WebSocket connections (RFC 6455) upgraded
+ * on the routes: opening handshake, frames of the clients,
+ * messages pushed to the channels of subscribers sharing
+ * one serialized frame
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include <stdlib.h>
+#include <stdint.h>             // uint8_t
+#include "tcp_socks.h"          // struct clientinfo, struct strinfo
+#include "tls_conns.h"          // struct tls_conn
+
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11" // accept key suffix
+#define WS_KEY_LEN 24                   // base64 of the 16-byte nonce
+#define WS_MAX_MESSAGE_LEN (64 * MAX_NETBUF_LEN) // received message
+#define WS_MAX_QUEUED_FRAMES 256        // frames waiting to be sent
+
+
+// Frame opcodes
+enum ws_opcode {
+        WS_CONTINUATION = 0x0,
+        WS_TEXT = 0x1,
+        WS_BINARY = 0x2,
+        WS_CLOSE = 0x8,
+        WS_PING = 0x9,
+        WS_PONG = 0xa
+};
+
+
+// Close status codes
+enum ws_close_code {
+        WS_CLOSE_NORMAL = 1000,
+        WS_CLOSE_GOING_AWAY = 1001,
+        WS_CLOSE_PROTOCOL_ERROR = 1002,
+        WS_CLOSE_INVALID_DATA = 1007,
+        WS_CLOSE_TOO_BIG = 1009,
+        WS_CLOSE_INTERNAL_ERROR = 1011
+};
+
+
+/*
+ * Serialized server frame, shared by the queues
+ * of the sessions it is sent to
+ *
+ * @refs    Owners of the frame (freed by the last one)
+ * @len     Length of "data"
+ * @data    Frame head and payload
+ */
+struct ws_frame {
+        size_t refs;
+        size_t len;
+        char data[];
+};
+
+
+struct ws_session;
+
+
+// Subscribers of the messages broadcast together
+struct ws_channel {
+        struct ws_session* head;
+        size_t count;
+};
+
+
+/*
+ * WebSocket route handlers (struct http_route's "ws")
+ *
+ * @channel     Channel every session of the route joins (optional)
+ * @on_open     Called once the connection is upgraded (optional,
+ *              fails the upgrade if nonzero is returned)
+ * @on_message  Receives the complete text / binary messages
+ *              ("data" is not null-terminated), the connection
+ *              is closed if nonzero is returned
+ * @on_close    Called before the session is freed (optional)
+ */
+struct ws_endpoint {
+        struct ws_channel* channel;
+        int (*on_open)(struct ws_session* ws);
+        int (*on_message)(struct ws_session* ws, const enum ws_opcode op,
+                const char* data, const size_t len);
+        void (*on_close)(struct ws_session* ws);
+};
+
+
+/*
+ * WebSocket session, stored in struct http_conninfo's "ws"
+ *
+ * @ep          Handlers of the route
+ * @cinfo       Client of the session (woken up to send the queue)
+ * @data        Data of the handlers (optional)
+ * @msg         Fragmented message being received
+ * @msg_op      Opcode of "msg" (WS_CONTINUATION - none)
+ * @queue       Frames to send (ring)
+ * @qhead       First frame of "queue"
+ * @qlen        Number of frames in "queue"
+ * @frame_adv   Sent bytes of the first frame
+ * @closing     Close frame was queued, nothing is received anymore,
+ *              the connection is closed once the queue is sent
+ * @failed      Queue overflowed (slow client), the connection is dropped
+ * @ch          Channel of the session (optional)
+ * @prev        Previous session of the channel
+ * @next        Next session of the channel
+ */
+struct ws_session {
+        struct ws_endpoint* ep;
+        struct clientinfo* cinfo;
+        void* data;
+
+        struct strinfo msg;
+        enum ws_opcode msg_op;
+
+        struct ws_frame* queue[WS_MAX_QUEUED_FRAMES];
+        size_t qhead;
+        size_t qlen;
+        size_t frame_adv;
+
+        int closing;
+        int failed;
+
+        struct ws_channel* ch;
+        struct ws_session* prev;
+        struct ws_session* next;
+};
+
+
+/*
+ * Writes the "Sec-WebSocket-Accept" value of the key
+ * (base64 of the SHA-1 of the key and WS_GUID, null-terminated)
+ */
+void make_ws_accept(const char* key, char accept[29]);
+
+
+// Applies (or removes) the mask of the frame payload in place
+void mask_ws_payload(char* data, const size_t len, const uint8_t key[4]);
+
+
+/*
+ * Upgrades the connection of the client
+ * whose request asked for WebSocket
+ *
+ * Description: writes "101 Switching Protocols" to "out",
+ * joins the channel of the endpoint, calls "on_open"
+ *
+ * Returns:
+ *      - Success: the session
+ *      - No memory / "on_open" failed: NULL
+ */
+struct ws_session* create_ws_session(struct ws_endpoint* ep,
+        struct clientinfo* cinfo, const char* key, struct strinfo* out);
+
+
+/*
+ * Consumes the received frames, passes the complete
+ * messages to "on_message", answers pings and closes
+ *
+ * Note: protocol errors queue a close frame
+ * (see is_ws_session_done())
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - No memory: EXIT_FAILURE
+ */
+int receive_ws_frames(struct ws_session* ws, struct strinfo* rvstr);
+
+
+/*
+ * Serializes a server frame (not masked), the caller
+ * owns the only reference
+ *
+ * Returns:
+ *      - Success: the frame
+ *      - No memory: NULL
+ */
+struct ws_frame* create_ws_frame(const enum ws_opcode op, const char* data,
+        const size_t len);
+
+
+// Takes a reference to the frame
+struct ws_frame* retain_ws_frame(struct ws_frame* f);
+
+
+// Drops a reference to the frame, frees it with the last one
+void release_ws_frame(struct ws_frame* f);
+
+
+/*
+ * Queues the frame (a reference is taken),
+ * wakes the client up to send it
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Session is closing / queue is full: EXIT_FAILURE
+ *        (the session fails if the queue is full)
+ */
+int queue_ws_frame(struct ws_session* ws, struct ws_frame* f);
+
+
+// Queues a message for the session (see queue_ws_frame())
+int send_ws_message(struct ws_session* ws, const enum ws_opcode op,
+        const char* data, const size_t len);
+
+
+// Queues the frame for every session of the channel,
+// returns the number of the sessions it was queued for
+size_t broadcast_ws_frame(struct ws_channel* ch, struct ws_frame* f);
+
+
+// Adds the session to the channel (leaves the current one)
+void join_ws_channel(struct ws_channel* ch, struct ws_session* ws);
+
+
+// Removes the session from its channel
+void leave_ws_channel(struct ws_session* ws);
+
+
+/*
+ * Queues a close frame, nothing is received afterwards
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - No memory: EXIT_FAILURE
+ */
+int close_ws_session(struct ws_session* ws, const enum ws_close_code code);
+
+
+/*
+ * Sends the queued frames from the shared buffers
+ * until the socket buffer is full (the socket is non-blocking)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS ("qlen" frames are left)
+ *      - Failure: EXIT_FAILURE
+ */
+int send_ws_frames(struct ws_session* ws, const SOCKET client,
+        struct tls_conn* tls);
+
+
+// Checks if the connection may be closed
+// (close frame was sent / the session failed)
+int is_ws_session_done(const struct ws_session* ws);
+
+
+// Calls "on_close", leaves the channel, frees the queue and the session
+void cleanup_ws_session(struct ws_session* ws);
@@ -4,12 +4,45 @@
 #include "headers/http_routers.h"
 #include "headers/tcp_socks.h"
 #include "headers/http_writers.h"
+#include "headers/http_conns.h"
+#include "headers/http_caches.h"
+#include "headers/http_proxies.h"
+#include "headers/http_reloads.h"
+#include "headers/http2_sessions.h"
+#include "headers/tls_conns.h"
+#include "headers/ws_sessions.h"
+#include "headers/http_traces.h"
+#include "headers/http_admins.h"
+#include "headers/http_limits.h"
 #include "file_getters.c"
 
 #include <stdio.h>      // fprintf(), ...
 #include <stdlib.h>     // EXIT_SUCCESS / EXIT_FAILURE
 
 
+// Options of the server sockets (--socket-profile)
+static struct socket_profile http_profile = {
+        .incoming_cpu = SOCKET_CPU_UNSET
+};
+
+
+// Pushes the received message to every client of the route
+int broadcast_ws_message(struct ws_session* ws, const enum ws_opcode op,
+        const char* data, const size_t len)
+{
+        // Serialized once, shared by the queues of the clients
+        struct ws_frame* f = create_ws_frame(op, data, len);
+        if (!f) return EXIT_FAILURE;
+
+        size_t clients = broadcast_ws_frame(ws->ep->channel, f);
+        release_ws_frame(f);
+
+        printf("\nBroadcast message (%zu bytes) to %zu clients\n", len,
+                clients);
+        return EXIT_SUCCESS;
+}
+
+
 // Sets the used routes
 void set_routes(void)
 {
@@ -17,44 +50,99 @@ void set_routes(void)
         struct http_route fpage = {
                 .method = "GET",
                 .route = "/",
-                .handler = get_front_page
+                .handler = get_front_page,
+                .cache_ttl = 5
         };
 
         if (set_http_route(fpage)) pfatal("setup_routes() failed\n");
+
+        // Set the upload route hashing the content as it arrives
+        struct http_route upload = {
+                .method = "POST",
+                .route = "/upload",
+                .handler = post_upload,
+                .on_body = hash_upload_piece
+        };
+
+        if (set_http_route(upload)) pfatal("setup_routes() failed\n");
+
+        // Set the WebSocket route relaying the messages to its clients
+        static struct ws_channel updates_channel = { 0 };
+        static struct ws_endpoint updates_endpoint = {
+                .channel = &updates_channel,
+                .on_message = broadcast_ws_message
+        };
+        struct http_route updates = {
+                .method = "GET",
+                .route = "/updates",
+                .ws = &updates_endpoint
+        };
+
+        if (set_http_route(updates)) pfatal("setup_routes() failed\n");
 }
 
 
 /*
  * Executes a HTTP request, writes the response
+ * (HTTP/1.1 connection or HTTP/2 stream)
  *
  * Returns:
  *      - Success: EXIT_SUCCESS
  *      - Failure: EXIT_FAILURE
  */
 int execute_http_request(struct http_request* req,
-        struct clientinfo* cinfo)
+        struct http_conninfo* conn, struct strinfo* respstr)
 {
-        struct strinfo* respstr = &(cinfo->sdstr);
+        // Keep the connection only if the response says so
+        conn->keep_alive = (req->conn && !strcmp(req->conn, "keep-alive"));
 
         // Get the needed HTTP route structure
         struct http_route* rt = get_http_route(req->method, req->url);
         if (!rt) {
                 // Move the start of the URL to "public/" (for simplicity)
                 int def_res = process_default_resource_request(respstr,
-                        strstr(req->url, "public/"), NULL, req);
+                        strstr(req->url, "public/"), NULL, req,
+                        &(conn->strm));
+                cleanup_http_request(req);
                 if (def_res) {
-                        cleanup_http_request(req);
+                        conn->keep_alive = 0;
                         return write_404_page(respstr);
                 }
 
-                cleanup_http_request(req);
-                cinfo->add_data = req->conn;
                 return EXIT_SUCCESS;
         }
 
+        // Replay the cached response
+        char key[HTTP_MAX_CACHE_KEY_LEN];
+        int cacheable = (rt->cache_ttl
+                && !make_http_cache_key(req, key, sizeof(key)));
+        if (cacheable) {
+                const struct http_cache_entry* entry = http_cache_get(key);
+                if (entry) {
+                        cleanup_http_request(req);
+                        clear_strinfo(respstr);
+                        if (append_strinfo(respstr, entry->resp, entry->len)) {
+                                return -EXIT_FAILURE;
+                        }
+
+                        return EXIT_SUCCESS;
+                }
+        }
+
         // Handle the request
-        int hres = rt->handler(respstr, 1, req);
-        cinfo->add_data = req->conn;
+        HTTP_TRACE_BEGIN(handler);
+        int hres = rt->handler(respstr, 2, req, &(conn->strm));
+        HTTP_TRACE_END(handler, HTS_HANDLER, respstr->len);
+
+        // Store the serialized response (streamed ones are not complete)
+        const char* ok = http_code_to_str_1_1(HTTP_OK);
+        if (cacheable && !hres && !conn->strm.active && respstr->buf
+                && !strncmp(respstr->buf, ok, strlen(ok))) {
+                if (http_cache_put(key, respstr->buf, respstr->len,
+                        rt->cache_ttl)) {
+                        fprintf(stderr, "http_cache_put() failed\n");
+                }
+        }
 
         // Cleanup the request
         cleanup_http_request(req);
@@ -62,8 +150,39 @@ int execute_http_request(struct http_request* req,
 }
 
 
+// Answers the request that could not be proxied, closes the connection
+void reject_proxied_request(struct clientinfo* cinfo,
+        struct http_conninfo* conn, const int code)
+{
+        // The content is not read, the connection can't be reused
+        reset_http_request_receiving(conn);
+        consume_strinfo(&(cinfo->rvstr), cinfo->rvstr.len);
+        conn->keep_alive = 0;
+
+        if (write_http_from_code(code, &(cinfo->sdstr), NULL, 0, NULL, NULL)) {
+                fprintf(stderr, "Failed to send %d\n", code);
+                return;
+        }
+        cinfo->state = CS_READY;
+}
+
+
+// Starts relaying the request to an upstream of the proxy route,
+// responds with the error if there is none available
+void forward_http_request(struct clientinfo* cinfo,
+        struct http_conninfo* conn)
+{
+        printf("\nProxying request\n%s %s\n", conn->req.method,
+                conn->req.url);
+
+        int code = start_http_proxy_request(conn->rt->proxy, cinfo, conn);
+        if (code) reject_proxied_request(cinfo, conn, code);
+}
+
+
+
 /*
- * Parses HTTP request, executes the request,
+ * Executes the received HTTP request
  * and writes the response to the related send buffer
  * 
  * Returns:
@@ -72,34 +191,212 @@ int execute_http_request(struct http_request* req,
  */
 int process_http_request(struct clientinfo* cinfo)
 {
-        // Parse the request
-        struct http_request req = { 0 };
-        int parse_res = parse_http_request(cinfo->rvstr.buf, &req);
-        if (parse_res != HTTP_OK) {
-                if (parse_res == HTTP_INTERNAL_SERVER_ERROR) {
-                        fprintf(stderr, "parse_http_request() failed\n");
-                        return -EXIT_FAILURE;
+        // Take the received request over
+        struct http_conninfo* conn = cinfo->add_data;
+        struct http_request req = conn->req;
+        memset(&(conn->req), 0, sizeof(conn->req));
+        conn->rt = NULL;
+
+        // Write the execution result to send string
+        int exec_res = execute_http_request(&req, conn, &(cinfo->sdstr));
+        if (exec_res < 0) {
+                fprintf(stderr, "Failed to execute HTTP request\n");
+                return exec_res;
+        }
+
+        cinfo->state = CS_READY;
+        return exec_res;
+}
+
+
+// Answers the request rejected by the rate limits from the
+// pre-serialized response, the connection is closed after it
+void reject_http_request(struct clientinfo* cinfo,
+        struct http_conninfo* conn, const enum http_code code)
+{
+        reset_http_request_receiving(conn);
+        consume_strinfo(&(cinfo->rvstr), cinfo->rvstr.len);
+        conn->keep_alive = 0;
+
+        if (write_http_limit_response(code, &(cinfo->sdstr))) {
+                fprintf(stderr, "Failed to send %d\n", code);
+                return;
+        }
+        cinfo->state = CS_READY;
+}
+
+
+// Handles the received frames of the HTTP/2 connection,
+// sends the frames of the responses
+void serve_http2_input(struct serverinfo* sinfo, struct clientinfo* cinfo,
+        struct http_conninfo* conn)
+{
+        struct http2_session* s = conn->h2;
+        int res = receive_http2_frames(s, &(cinfo->rvstr), &(cinfo->sdstr));
+
+        // Draining: complete the received streams only
+        if (!res && is_http_server_draining()) {
+                res = shutdown_http2_session(s, &(cinfo->sdstr));
+        }
+
+        res |= send_http2_frames(s, &(cinfo->sdstr));
+        if (res) {
+                fprintf(stderr, "No memory: serve_http2_input()\n");
+                if (drop_client(sinfo, cinfo->client)) { // bug
+                        pfatal("drop_client() failed\n");
+                }
+
+                return;
+        }
+
+        if (cinfo->sdstr.len) {
+                cinfo->state = CS_READY;
+        } else if (is_http2_session_done(s)) {
+                if (drop_client(sinfo, cinfo->client)) { // bug
+                        pfatal("drop_client() failed\n");
+                }
+        } else {
+                cinfo->state = CS_IDLE;
+        }
+}
+
+
+// Switches the connection to HTTP/2 ("Upgrade: h2c"),
+// the request is responded to on stream 1
+void upgrade_http_connection(struct serverinfo* sinfo,
+        struct clientinfo* cinfo, struct http_conninfo* conn)
+{
+        printf("\nUpgrading to HTTP/2\n%s %s\n", conn->req.method,
+                conn->req.url);
+
+        conn->h2 = upgrade_http2_session(execute_http_request, conn,
+                &(cinfo->sdstr));
+        if (conn->h2) {
+                conn->h2->cinfo = cinfo;
+                serve_http2_input(sinfo, cinfo, conn);
+                return;
+        }
+
+        // Invalid settings: stay on HTTP/1.1
+        conn->h2c_settings = NULL;
+        if (process_http_request(cinfo) < 0) { // error
+                fprintf(stderr, "process_request() failed\n");
+        }
+}
+
+
+// Handles the received frames of the WebSocket connection
+void serve_ws_input(struct serverinfo* sinfo, struct clientinfo* cinfo,
+        struct http_conninfo* conn)
+{
+        struct ws_session* ws = conn->ws;
+        if (receive_ws_frames(ws, &(cinfo->rvstr))) {
+                fprintf(stderr, "No memory: serve_ws_input()\n");
+                if (drop_client(sinfo, cinfo->client)) { // bug
+                        pfatal("drop_client() failed\n");
                 }
 
-                /* TODO: Write the error message */
+                return;
+        }
+
+        int pending = (ws->qlen || ws->failed
+                || cinfo->sdstr.adv < cinfo->sdstr.len);
+        cinfo->state = (pending ? CS_READY : CS_IDLE);
+}
 
 
+// Switches the connection to the WebSocket protocol of the route
+void upgrade_ws_connection(struct serverinfo* sinfo,
+        struct clientinfo* cinfo, struct http_conninfo* conn)
+{
+        printf("\nUpgrading to WebSocket\n%s %s\n", conn->req.method,
+                conn->req.url);
+
+        // Draining: no new long-lived connections
+        struct ws_endpoint* ep = conn->rt->ws;
+        if (is_http_server_draining()) {
+                reset_http_request_receiving(conn);
+                conn->keep_alive = 0;
+                if (write_http_from_code(HTTP_SERVICE_UNAVAILABLE,
+                        &(cinfo->sdstr), NULL, 0, NULL, NULL)) {
+                        fprintf(stderr, "Failed to send %d\n",
+                                HTTP_SERVICE_UNAVAILABLE);
+                        return;
+                }
                 cinfo->state = CS_READY;
-                return parse_res;
+                return;
         }
 
-        // Write the execution result to send string
-        int exec_res = execute_http_request(&req, cinfo);
-        if (exec_res < 0) {
-                fprintf(stderr, "Failed to execute HTTP request\n");
-                return exec_res;
+        // Frames are sent until the socket buffer is full
+        conn->ws = (set_socket_nonblocking(cinfo->client) ? NULL
+                : create_ws_session(ep, cinfo, conn->ws_key,
+                &(cinfo->sdstr)));
+        reset_http_request_receiving(conn);
+        if (!conn->ws) {
+                fprintf(stderr, "Failed to upgrade to WebSocket\n");
+                if (drop_client(sinfo, cinfo->client)) { // bug
+                        pfatal("drop_client() failed\n");
+                }
+
+                return;
         }
 
-        // Move to a new request
-        move_http_request(&(cinfo->rvstr), req.clen);
+        // Frames may follow the request
         cinfo->state = CS_READY;
+        if (cinfo->rvstr.len) serve_ws_input(sinfo, cinfo, conn);
+}
 
-        return exec_res;
+
+/*
+ * Receives the decrypted bytes of the TLS connection
+ * (starts it on the first call)
+ *
+ * Returns: see server_receive_request(), 0 is also returned
+ * while the handshake / a record is not complete
+ */
+int server_receive_tls(struct serverinfo* sinfo, struct clientinfo* cinfo)
+{
+        struct http_conninfo* conn = get_http_conninfo(cinfo);
+        if (conn && !conn->tls) conn->tls = create_tls_conn(cinfo->client);
+        if (!conn || !conn->tls) {
+                fprintf(stderr, "Failed to start TLS\n");
+                if (drop_client(sinfo, cinfo->client)) { // bug
+                        pfatal("drop_client() failed\n");
+                }
+
+                return EXIT_SUCCESS;
+        }
+
+        // Make room, the decrypted bytes left in the TLS connection
+        // are not signalled by select()
+        struct strinfo* rvstr = &(cinfo->rvstr);
+        size_t room = (rvstr->len < MAX_NETBUF_LEN
+                ? MAX_NETBUF_LEN - rvstr->len : 0);
+        size_t pending = tls_conn_pending(conn->tls);
+        if (reserve_strinfo(rvstr, room < pending ? pending : room)) {
+                return -EXIT_FAILURE;
+        }
+
+        HTTP_TRACE_BEGIN(recv);
+        int recvd = recv_tls_conn(cinfo->client, conn->tls,
+                rvstr->buf + rvstr->len, rvstr->sz - rvstr->len - 1);
+        HTTP_TRACE_END(recv, HTS_RECV, recvd < 0 ? 0 : recvd);
+        if (recvd == TLS_CONN_AGAIN) {
+                if (!rvstr->len) cinfo->state = CS_IDLE;
+                return EXIT_SUCCESS;
+        }
+
+        if (recvd <= 0) { // client has disconnected / failure
+                if (drop_client(sinfo, cinfo->client)) { // bug
+                        pfatal("drop_client() failed\n");
+                }
+
+                return EXIT_SUCCESS;
+        }
+
+        rvstr->len += (size_t) recvd;
+        rvstr->buf[rvstr->len] = '\0';
+        return recvd;
 }
 
 
@@ -113,33 +410,129 @@ void handle_http_input(struct serverinfo* sinfo, const SOCKET client)
                 // Set the state to "RECEIVING"
                 if (cinfo->state == CS_IDLE) {
                         cinfo->state = CS_RECEIVING;
-                } else {
+                } else if (cinfo->state != CS_RECEIVING) {
                         return; // wait for another operation
                 }
 
-                int rr_res = server_receive_request(sinfo, cinfo, drop_client);
+                int rr_res = EXIT_SUCCESS;
+                if (is_tls_enabled()) {
+                        rr_res = server_receive_tls(sinfo, cinfo);
+                } else {
+                        HTTP_TRACE_BEGIN(recv);
+                        rr_res = server_receive_request(sinfo, cinfo,
+                                drop_client);
+                        HTTP_TRACE_END(recv, HTS_RECV,
+                                rr_res < 0 ? 0 : rr_res);
+                }
                 if (rr_res < 0) { // bug
                         pfatal("Invalid data: receive_request()");
                 } else if (rr_res == 0) { // received disconnect
                         return;
                 }
 
-                // Check if the request was fully scanned
-                int req_status = http_request_read_status(cinfo->rvstr.buf);
-                if (req_status == HTTP_OK) {
-                        printf("\nReceived request (%zu bytes)\n%s\n",
-                                cinfo->rvstr.len, cinfo->rvstr.buf);
+                struct http_conninfo* conn = get_http_conninfo(cinfo);
+                if (!conn) {
+                        fprintf(stderr, "No memory: handle_http_input()\n");
+                        if (drop_client(sinfo, client)) { // bug
+                                pfatal("drop_client() failed\n");
+                        }
+
+                        return;
+                }
+
+                // Relay the content of the proxied request
+                if (conn->upc) {
+                        int code = relay_http_proxy_request(cinfo, conn);
+
+                        // Too long: 413 unless the upstream has answered
+                        if (code == HTTP_CONTENT_TOO_LARGE
+                                && !conn->upc->resp_head) {
+                                abort_http_upconn(conn->upc);
+                                reject_proxied_request(cinfo, conn, code);
+                        } else if (code && drop_client(sinfo, client)) { // bug
+                                pfatal("drop_client() failed\n");
+                        }
+
+                        return;
+                }
+
+                // Serve the WebSocket connection
+                if (conn->ws) {
+                        serve_ws_input(sinfo, cinfo, conn);
+                        return;
+                }
+
+                // Serve the HTTP/2 connection
+                if (conn->h2) {
+                        serve_http2_input(sinfo, cinfo, conn);
+                        return;
+                }
+
+                // HTTP/2 connection preface ("prior knowledge")
+                int preface = (conn->in_body ? 0
+                        : is_http2_preface(&(cinfo->rvstr)));
+                if (preface < 0) return; // wait for the rest
+                if (preface) {
+                        conn->h2 = create_http2_session(execute_http_request,
+                                &(cinfo->sdstr));
+                        if (!conn->h2) {
+                                fprintf(stderr, "No memory: "
+                                        "create_http2_session()\n");
+                                if (drop_client(sinfo, client)) { // bug
+                                        pfatal("drop_client() failed\n");
+                                }
+
+                                return;
+                        }
+
+                        conn->h2->cinfo = cinfo;
+                        printf("\nHTTP/2 connection\n");
+                        serve_http2_input(sinfo, cinfo, conn);
+                        return;
+                }
+
+                // Check if the request was fully received
+                int req_status = receive_http_request(conn, &(cinfo->rvstr));
+
+                // Draining: close the connection after the response
+                int draining = is_http_server_draining();
+                if (req_status == HTTP_OK && draining) {
+                        conn->req.conn = NULL;
+                }
+
+                // Don't switch to HTTP/2 while draining / over TLS
+                // (h2c is cleartext only, TLS clients use ALPN)
+                if (draining || conn->tls) conn->h2c_settings = NULL;
+
+                // Every request takes a token of the rate limits
+                enum http_code limit = (req_status == HTTP_OK
+                        ? check_http_rate_limit(cinfo) : HTTP_OK);
+                if (limit != HTTP_OK) {
+                        reject_http_request(cinfo, conn, limit);
+                } else if (req_status == HTTP_OK && conn->rt
+                        && conn->rt->proxy) {
+                        forward_http_request(cinfo, conn);
+                } else if (req_status == HTTP_OK && conn->ws_key) {
+                        upgrade_ws_connection(sinfo, cinfo, conn);
+                } else if (req_status == HTTP_OK && conn->h2c_settings) {
+                        upgrade_http_connection(sinfo, cinfo, conn);
+                } else if (req_status == HTTP_OK) {
+                        printf("\nReceived request\n%s %s (%zu bytes)\n",
+                                conn->req.method, conn->req.url,
+                                conn->req.clen);
 
-                        cinfo->rvstr.len = 0;
                         if (process_http_request(cinfo) < 0) { // error
                                 fprintf(stderr, "process_request() failed\n");
                         }
-                } else if (req_status == HTTP_BAD_REQUEST) {
-                        cinfo->rvstr.len = 0;
-                        int whfc_res = write_http_from_code(HTTP_BAD_REQUEST,
+                } else if (req_status) { // "Connection: close" is sent
+                        consume_strinfo(&(cinfo->rvstr), cinfo->rvstr.len);
+                        conn->keep_alive = 0;
+
+                        int whfc_res = write_http_from_code(req_status,
                                 &(cinfo->sdstr), NULL, 0, NULL, NULL);
                         if (whfc_res) {
-                                fprintf(stderr, "Failed to send 400\n");
+                                fprintf(stderr, "Failed to send %d\n",
+                                        req_status);
                         } else {
                                 cinfo->state = CS_READY;
                         }
@@ -152,6 +545,48 @@ void handle_http_input(struct serverinfo* sinfo, const SOCKET client)
 }
 
 
+/*
+ * Sends the next part of the streamed file without copying it
+ * to user space (sendfile(), kernel TLS)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS (the stream ends with the file)
+ *      - Failure: EXIT_FAILURE
+ */
+int send_http_stream_file(const SOCKET client, struct http_conninfo* conn)
+{
+        struct http_stream* strm = &(conn->strm);
+        size_t len = strm->file_left;
+        if (4 * MAX_NETBUF_LEN < len) len = 4 * MAX_NETBUF_LEN;
+
+        HTTP_TRACE_BEGIN(sendfile);
+        int sent = len ? sendfile_tls_conn(client, conn->tls, strm->file,
+                strm->file_off, len) : 0;
+        HTTP_TRACE_END(sendfile, HTS_SEND, sent < 0 ? 0 : sent);
+        if (sent == TLS_CONN_AGAIN) return EXIT_SUCCESS;
+        if (sent < 0 || (len && !sent)) return EXIT_FAILURE;
+
+        strm->file_off += (size_t) sent;
+        strm->file_left -= (size_t) sent;
+        if (!strm->file_left) cleanup_http_stream(strm);
+
+        return EXIT_SUCCESS;
+}
+
+
+// Holds the head of the streamed response until the body
+// is written (one segment instead of a short one for the head)
+void cork_http_response(const SOCKET client, struct http_conninfo* conn,
+        const int on)
+{
+        if (!http_profile.cork || conn->corked == on) return;
+        if (on && !conn->strm.active) return;
+
+        if (set_socket_cork(client, on)) return;
+        conn->corked = on;
+}
+
+
 // Called when a client's fd is set for a write operation
 void send_http_response(struct serverinfo* sinfo, const SOCKET client)
 {
@@ -164,30 +599,133 @@ void send_http_response(struct serverinfo* sinfo, const SOCKET client)
                 // Set the state to "SENDING"
                 if (cinfo->state == CS_READY) {
                         cinfo->state = CS_SENDING;
-                } else {
+                } else if (cinfo->state != CS_SENDING) {
                         return; // wait for another operation
                 }
 
                 struct strinfo* sdstr = &cinfo->sdstr;
-                int sent = send(client, sdstr->buf + sdstr->adv,
-                        sdstr->len - sdstr->adv, 0);
-                if (sent <= 0) {
-                        psockerror("send() failed");
+                struct http_conninfo* conn = cinfo->add_data;
+                if (conn) cork_http_response(client, conn, 1);
+                if (sdstr->adv < sdstr->len) {
+                        HTTP_TRACE_BEGIN(send);
+                        int sent = send_tls_conn(client,
+                                conn ? conn->tls : NULL,
+                                sdstr->buf + sdstr->adv,
+                                sdstr->len - sdstr->adv);
+                        HTTP_TRACE_END(send, HTS_SEND, sent < 0 ? 0 : sent);
+                        if (sent == TLS_CONN_AGAIN) return;
+                        if (sent < 0) {
+                                if (drop_client(sinfo, client)) { // bug
+                                        pfatal("drop_client() failed\n");
+                                }
+
+                                return;
+                        }
+
+                        sdstr->adv += sent; // move the cursor
+                        if (sdstr->adv < sdstr->len) return; // not sent yet
                 }
 
-                sdstr->adv += sent; // move the cursor
-                if (sdstr->adv == sdstr->len) { // fully sent
-                        printf("\nSent response (%zu bytes)\n%s\n\n",
-                                sdstr->len, sdstr->buf);
-                        cleanup_strinfo(sdstr); // -> optional <- cleanup
+                // Wait for the rest of the proxied response
+                if (conn && conn->upc) {
+                        sdstr->len = 0;
+                        sdstr->adv = 0;
+                        cinfo->state = (conn->upc->req_done
+                                ? CS_EXECUTING : CS_RECEIVING);
+                        return;
+                }
+
+                // Write the next frames of the HTTP/2 responses
+                if (conn && conn->h2) {
+                        sdstr->len = 0;
+                        sdstr->adv = 0;
+                        if (send_http2_frames(conn->h2, sdstr)) {
+                                fprintf(stderr, "send_http2_frames() failed\n");
+                                if (drop_client(sinfo, client)) { // bug
+                                        pfatal("drop_client() failed\n");
+                                }
+
+                                return;
+                        }
+
+                        if (sdstr->len) return; // send the frames
                         cinfo->state = CS_IDLE;
 
-                        // Check the connection
-                        if (cinfo->add_data
-                                && !strcmp(cinfo->add_data, "close")) {
-                                if (drop_client(sinfo, cinfo->client)) { // bug
+                        if (is_http2_session_done(conn->h2)
+                                && drop_client(sinfo, client)) { // bug
+                                pfatal("drop_client() failed\n");
+                        }
+
+                        return;
+                }
+
+                // Send the queued WebSocket frames
+                if (conn && conn->ws) {
+                        sdstr->len = 0;
+                        sdstr->adv = 0;
+                        if (send_ws_frames(conn->ws, client, conn->tls)) {
+                                if (drop_client(sinfo, client)) { // bug
                                         pfatal("drop_client() failed\n");
                                 }
+
+                                return;
+                        }
+
+                        if (conn->ws->qlen) return; // not sent yet
+                        cinfo->state = CS_IDLE;
+
+                        if (is_ws_session_done(conn->ws)
+                                && drop_client(sinfo, client)) { // bug
+                                pfatal("drop_client() failed\n");
+                        }
+
+                        return;
+                }
+
+                // Send the file from the page cache
+                if (conn && conn->strm.active && conn->strm.file
+                        && can_sendfile_tls_conn(conn->tls)) {
+                        sdstr->len = 0;
+                        sdstr->adv = 0;
+                        if (send_http_stream_file(client, conn)) {
+                                if (drop_client(sinfo, client)) { // bug
+                                        pfatal("drop_client() failed\n");
+                                }
+
+                                return;
+                        }
+
+                        if (conn->strm.active) return; // not sent yet
+                } else if (conn && conn->strm.active) {
+                        // Produce the next piece of the streamed body
+                        if (fill_http_stream(&(conn->strm), sdstr)) {
+                                fprintf(stderr, "fill_http_stream() failed\n");
+                                if (drop_client(sinfo, client)) { // bug
+                                        pfatal("drop_client() failed\n");
+                                }
+
+                                return;
+                        }
+
+                        if (sdstr->len) return; // send the piece
+                } else {
+                        printf("\nSent response (%zu bytes)\n%s\n\n",
+                                sdstr->len, sdstr->buf);
+                }
+
+                // Keep the buffer for the next response
+                if (HTTP_MAX_KEPT_SEND_LEN < sdstr->sz) {
+                        cleanup_strinfo(sdstr);
+                } else {
+                        clear_strinfo(sdstr);
+                }
+                cinfo->state = CS_IDLE;
+                if (conn) cork_http_response(client, conn, 0);
+
+                // Check the connection
+                if (!conn || !conn->keep_alive) {
+                        if (drop_client(sinfo, cinfo->client)) { // bug
+                                pfatal("drop_client() failed\n");
                         }
                 }
 
@@ -198,54 +736,138 @@ void send_http_response(struct serverinfo* sinfo, const SOCKET client)
 }
 
 
-int http_server_handle_communication(const SOCKET serv)
+#ifdef HTTP_TRACE
+// Times the select() of the event loop
+void trace_http_wait(struct serverinfo* sinfo, const int done,
+        const int ready)
+{
+        static uint64_t start = 0;
+
+        (void) sinfo;
+        if (!done) {
+                start = read_http_trace_clock();
+                return;
+        }
+
+        record_http_trace(HTS_SELECT, start, ready < 0 ? 0 : ready);
+}
+#endif  // HTTP_TRACE
+
+
+// Accepts the client unless it is shed by the admission control
+void accept_http_client(struct serverinfo* sinfo)
+{
+        if (admit_http_client(sinfo)) server_accept_client(sinfo);
+}
+
+
+int http_server_handle_communication(const SOCKET serv,
+        const char* reload_path, const int drain_sec, const char* admin_port)
 {
         struct serverinfo sinfo = { 0 };
         initialize_serverinfo(&sinfo, serv);
+        sinfo.profile = &http_profile;
+#ifdef HTTP_TRACE
+        sinfo.on_wait = trace_http_wait;
+#endif  // HTTP_TRACE
+        attach_http_proxies(&sinfo);
+        if (attach_http_shutdown(&sinfo, drain_sec)) {
+                fprintf(stderr, "Failed to handle the stop signals\n");
+                goto out_failure_cleanup_serverinfo;
+        }
+        if (reload_path && attach_http_reload(&sinfo, reload_path)) {
+                fprintf(stderr, "Failed to listen for reloads at %s\n",
+                        reload_path);
+                goto out_failure_cleanup_serverinfo;
+        }
+        if (admin_port && attach_http_admin(&sinfo, admin_port)) {
+                fprintf(stderr, "Failed to serve the admin port %s\n",
+                        admin_port);
+                goto out_failure_cleanup_serverinfo;
+        }
 
-        // Start accepting connections
-        while (1) {
-                int scfds_res = server_check_fds(&sinfo, server_accept_client,
+        // Serve until the sockets are handed over / a stop signal
+        // is received and the clients are gone
+        while (!is_http_server_drained(&sinfo)) {
+                int scfds_res = server_check_fds(&sinfo, accept_http_client,
                         handle_http_input, send_http_response);
                 if (scfds_res) {
                         fprintf(stderr, "server_check_fds() failed");
                         goto out_failure_cleanup_serverinfo;
                 }
+
+                poll_http_trace();
         }
 
         cleanup_serverinfo(&sinfo);
+        cleanup_http_admin();
+        cleanup_http_reload();
+        cleanup_http_proxies();
+        cleanup_http_cache();
+        cleanup_tls_context();
+        cleanup_http_trace();
         return EXIT_SUCCESS;
 
 out_failure_cleanup_serverinfo:
         cleanup_serverinfo(&sinfo);
+        cleanup_http_admin();
+        cleanup_http_reload();
+        cleanup_http_proxies();
+        cleanup_http_cache();
+        cleanup_tls_context();
+        cleanup_http_trace();
         return EXIT_FAILURE;
 }
 
 
-// Starts a HTTP server on the provided port
-int http_server(const char* port)
+// Starts a HTTP server on the provided port,
+// takes the socket over from the server listening
+// for the reloads at "reload_path" if there is one,
+// serves the admin endpoint on "admin_port" (optional)
+//
+// "backlog" limits the connections waiting for accept(),
+// the connections without a request for "defer_sec"
+// seconds are not accepted yet (0 - accepted at once)
+int http_server(const char* port, const char* reload_path,
+        const int drain_sec, const char* admin_port, const int backlog,
+        const int defer_sec)
 {
         sockets_startup();
 
-        // Configure local address
-        struct addrinfo* addr = configure_address(NULL,
-            port, AF_INET6, SOCK_STREAM, AI_PASSIVE);
-        if (!addr) {
-                goto out_failure_sockets_cleanup;
-        }
+        SOCKET serv = INVALID_SOCKET;
+        if (reload_path) serv = take_over_http_server(reload_path);
 
-        // Create a socket
-        SOCKET serv = start_server(addr, MAX_CONN);
-        freeaddrinfo(addr);
         if (!validate_socket(serv)) {
-                goto out_failure_sockets_cleanup;
+                // Configure local address
+                struct addrinfo* addr = configure_address(NULL,
+                    port, AF_INET6, SOCK_STREAM, AI_PASSIVE);
+                if (!addr) {
+                        goto out_failure_sockets_cleanup;
+                }
+
+                // Create a socket
+                serv = start_server(addr, backlog);
+                freeaddrinfo(addr);
+                if (!validate_socket(serv)) {
+                        goto out_failure_sockets_cleanup;
+                }
+        } else if (listen(serv, backlog)) { // taken over: update the backlog
+                psockerror("listen() failed");
+        }
+
+        if (0 < defer_sec && set_socket_defer_accept(serv, defer_sec)) {
+                fprintf(stderr, "Connections are accepted at once\n");
+        }
+        if (apply_listener_profile(serv, &http_profile)) {
+                fprintf(stderr, "Socket profile was not fully applied\n");
         }
 
         // Setup routes
         set_routes();
 
         // Run the server
-        int hshc_res = http_server_handle_communication(serv);
+        int hshc_res = http_server_handle_communication(serv, reload_path,
+                drain_sec, admin_port);
         if (hshc_res) {
                 fprintf(stderr, "server_handle_communication() failed");
                 goto out_failure_sockets_cleanup;
@@ -259,14 +881,139 @@ out_failure_sockets_cleanup:
 }
 
 
+/*
+ * Adds a route forwarding every request starting
+ * with the prefix to the upstreams ("PREFIX=UPSTREAMS")
+ *
+ * Returns:
+ *      - Success: proxy of the route
+ *      - Failure: NULL
+ */
+struct http_proxy* set_proxy_route(const char* spec)
+{
+        const char* eq = strchr(spec, '=');
+        if (!eq || eq == spec) return NULL;
+
+        struct http_proxy* proxy = create_http_proxy(eq + 1, NULL);
+        if (!proxy) return NULL;
+
+        // Routes live until the process exits
+        char* prefix = (char*) calloc((size_t) (eq - spec) + 1, sizeof(char));
+        if (!prefix) return NULL;
+        memcpy(prefix, spec, (size_t) (eq - spec));
+
+        struct http_route rt = {
+                .method = "*",
+                .route = prefix,
+                .prefix = 1,
+                .proxy = proxy
+        };
+
+        return (set_http_route(rt) ? NULL : proxy);
+}
+
+
 int main(int argc, const char* argv[])
 {
-        if (argc != 2) {
-            pfatal("Usage:\n\thttp_server [PORT]");
+        const char* usage = "Usage:\n\thttp_server [PORT]"
+                " [--mime-types FILE] [--proxy PREFIX=HOST:PORT,...]"
+                " [--balance POLICY] [--reload-socket PATH]"
+                " [--drain-sec N] [--tls-cert FILE --tls-key FILE]"
+                " [--trace-file FILE] [--admin-port PORT]"
+                " [--rate-limit RATE[:BURST]]"
+                " [--global-rate-limit RATE[:BURST]]"
+                " [--max-loop-lag-ms N] [--backlog N]"
+                " [--defer-accept-sec N] [--socket-profile OPTIONS]"
+                " [--max-body-size BYTES]\n";
+        if (argc < 2 || argc % 2) {
+            pfatal(usage);
+        }
+
+        // Parse the options
+        struct http_proxy* proxy = NULL; // last proxy route
+        const char* reload_path = NULL;
+        int drain_sec = HTTP_DRAIN_SEC;
+        const char* tls_cert = NULL;
+        const char* tls_key = NULL;
+        const char* admin_port = NULL;
+        int backlog = SOMAXCONN;
+        int defer_sec = 0;
+        for (int i = 2; i + 1 < argc; i += 2) {
+                if (!strcmp(argv[i], "--mime-types")) {
+                        if (load_mime_types(argv[i + 1])) {
+                                pfatal("Failed to load %s\n", argv[i + 1]);
+                        }
+                } else if (!strcmp(argv[i], "--proxy")) {
+                        proxy = set_proxy_route(argv[i + 1]);
+                        if (!proxy) {
+                                pfatal("Invalid proxy route: %s\n",
+                                        argv[i + 1]);
+                        }
+                } else if (!strcmp(argv[i], "--balance") && proxy) {
+                        if (set_http_proxy_balance(proxy, argv[i + 1])) {
+                                pfatal("Unknown balancing policy: %s\n",
+                                        argv[i + 1]);
+                        }
+                } else if (!strcmp(argv[i], "--reload-socket")) {
+                        reload_path = argv[i + 1];
+                } else if (!strcmp(argv[i], "--drain-sec")) {
+                        drain_sec = atoi(argv[i + 1]);
+                } else if (!strcmp(argv[i], "--tls-cert")) {
+                        tls_cert = argv[i + 1];
+                } else if (!strcmp(argv[i], "--tls-key")) {
+                        tls_key = argv[i + 1];
+                } else if (!strcmp(argv[i], "--trace-file")) {
+                        if (attach_http_trace(argv[i + 1])) {
+                                pfatal("Failed to trace to %s\n",
+                                        argv[i + 1]);
+                        }
+                } else if (!strcmp(argv[i], "--admin-port")) {
+                        admin_port = argv[i + 1];
+                } else if (!strcmp(argv[i], "--rate-limit")) {
+                        if (set_http_rate_limit(argv[i + 1])) {
+                                pfatal("Invalid rate limit: %s\n",
+                                        argv[i + 1]);
+                        }
+                } else if (!strcmp(argv[i], "--global-rate-limit")) {
+                        if (set_http_global_rate_limit(argv[i + 1])) {
+                                pfatal("Invalid rate limit: %s\n",
+                                        argv[i + 1]);
+                        }
+                } else if (!strcmp(argv[i], "--max-loop-lag-ms")) {
+                        set_http_max_loop_lag(atoi(argv[i + 1]));
+                } else if (!strcmp(argv[i], "--backlog")) {
+                        backlog = atoi(argv[i + 1]);
+                        if (backlog <= 0) pfatal(usage);
+                } else if (!strcmp(argv[i], "--defer-accept-sec")) {
+                        defer_sec = atoi(argv[i + 1]);
+                } else if (!strcmp(argv[i], "--max-body-size")) {
+                        set_http_max_body_len((size_t) strtoull(argv[i + 1],
+                                NULL, 10));
+                } else if (!strcmp(argv[i], "--socket-profile")) {
+                        if (parse_socket_profile(argv[i + 1], &http_profile)) {
+                                pfatal("Invalid socket profile: %s\n",
+                                        argv[i + 1]);
+                        }
+                } else {
+                        pfatal(usage);
+                }
+        }
+
+        // Both the certificate and its key are needed for TLS
+        if (!tls_cert != !tls_key) pfatal(usage);
+        if (tls_cert && load_tls_context(tls_cert, tls_key)) {
+                pfatal("Failed to load the TLS certificate %s\n", tls_cert);
+        }
+
+        // Built before the first request
+        if (prepare_mime_table()) {
+                fprintf(stderr, "Failed to build the table of content types,"
+                        " \"text/plain\" is sent\n");
         }
 
         setvbuf(stdout, NULL, _IONBF, 0);
 
         const char* port = argv[1];
-        return http_server(port);
+        return http_server(port, reload_path, drain_sec, admin_port,
+                backlog, defer_sec);
 }
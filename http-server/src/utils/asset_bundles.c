@@ -0,0 +1,167 @@
+#include "../headers/asset_bundles.h"
+#include "../headers/http_writers.h"    // http_conn_header()
+#include <ctype.h>      // tolower()
+
+
+#ifdef HTTP_EMBEDDED_ASSETS
+// Sorted by "path", generated by tools/pack_assets.c
+extern const struct asset assets[];
+extern const size_t assets_count;
+#endif // HTTP_EMBEDDED_ASSETS
+
+
+// Compares the path with the path of the resource for bsearch()
+int compare_asset_path(const void* path, const void* a)
+{
+        return strcmp((const char*) path, ((const struct asset*) a)->path);
+}
+
+
+const struct asset* find_asset(const char* path)
+{
+#ifdef HTTP_EMBEDDED_ASSETS
+        return (const struct asset*) bsearch(path, assets, assets_count,
+                sizeof(struct asset), compare_asset_path);
+#else   // HTTP_EMBEDDED_ASSETS
+        (void) path;
+        return NULL;
+#endif  // !HTTP_EMBEDDED_ASSETS
+}
+
+
+// Checks if the "If-None-Match" list has the entity tag
+// ("*" or weak comparison: "W/" prefixes are ignored)
+int match_asset_etag(const char* inm, const char* etag)
+{
+        const char* cur = inm;
+        const char* end = inm + strlen(inm);
+        const char* tok = NULL;
+        size_t len = 0;
+        size_t etag_len = strlen(etag);
+        while (next_http_list_token(&cur, end, &tok, &len)) {
+                if (len == 1 && *tok == '*') return 1;
+                if (len > 2 && tok[0] == 'W' && tok[1] == '/') {
+                        tok += 2;
+                        len -= 2;
+                }
+                if (len == etag_len && !memcmp(tok, etag, len)) return 1;
+        }
+
+        return 0;
+}
+
+
+// Checks if the "q" parameter of a list element is above zero
+// ("params" follow the first ';', no "q" means 1)
+int has_nonzero_weight(const char* params, const char* end)
+{
+        while (params < end) {
+                while (params < end && (*params == ' ' || *params == '\t'
+                        || *params == ';')) {
+                        ++params;
+                }
+
+                const char* next = params;
+                while (next < end && *next != ';') ++next;
+
+                if (params < next && tolower((unsigned char) *params) == 'q') {
+                        const char* v = params + 1;
+                        while (v < next && (*v == ' ' || *v == '\t')) ++v;
+                        if (v < next && *v == '=') {
+                                // "0", "0.", "0.000" are zero
+                                for (++v; v < next; ++v) {
+                                        if ('1' <= *v && *v <= '9') return 1;
+                                }
+
+                                return 0;
+                        }
+                }
+
+                params = next;
+        }
+
+        return 1;
+}
+
+
+// Checks if the "Accept-Encoding" list accepts gzip (RFC 9110, 12.5.3):
+// "gzip" / "x-gzip" or else "*" with a non-zero weight
+int accepts_gzip(const char* aenc)
+{
+        const char* cur = aenc;
+        const char* end = aenc + strlen(aenc);
+        const char* tok = NULL;
+        size_t len = 0;
+        int any = 0;
+        while (next_http_list_token(&cur, end, &tok, &len)) {
+                const char* params = tok;
+                while (params < tok + len && *params != ';') ++params;
+
+                // Coding name without the whitespace before ';'
+                size_t name_len = (size_t) (params - tok);
+                while (name_len && (tok[name_len - 1] == ' '
+                        || tok[name_len - 1] == '\t')) {
+                        --name_len;
+                }
+
+                char name[8] = { 0 };
+                if (sizeof(name) <= name_len) continue;
+                for (size_t i = 0; i < name_len; ++i) {
+                        name[i] = (char) tolower((unsigned char) tok[i]);
+                }
+
+                int nonzero = has_nonzero_weight(params, tok + len);
+                if (!strcmp(name, "gzip") || !strcmp(name, "x-gzip")) {
+                        return nonzero;
+                }
+                if (!strcmp(name, "*")) any = nonzero;
+        }
+
+        return any;
+}
+
+
+int write_asset_response(struct strinfo* sstr, const struct asset* a,
+        const struct http_request* req)
+{
+        const char* conn_header = http_conn_header(req ? req->conn : NULL);
+
+        clear_strinfo(sstr);
+
+        // Pick the variant
+        const char* etag = a->etag;
+        const char* head = a->head;
+        size_t head_len = a->head_len;
+        const char* body = a->body;
+        size_t len = a->len;
+        if (a->gz && req && req->aenc && accepts_gzip(req->aenc)) {
+                etag = a->gz_etag;
+                head = a->gz_head;
+                head_len = a->gz_head_len;
+                body = a->gz;
+                len = a->gzlen;
+        }
+
+        // The client has the variant already
+        if (req && req->inm && match_asset_etag(req->inm, etag)) {
+                int res = appendf_strinfo(sstr,
+                        "%s\r\n%sETag: %s\r\n%s\r\n\r\n",
+                        http_code_to_str_1_1(HTTP_NOT_MODIFIED),
+                        (a->gz ? "Vary: Accept-Encoding\r\n" : ""),
+                        etag, conn_header);
+                return res;
+        }
+
+        // Pre-serialized head, "Connection" header, blank line, contents
+        size_t conn_len = strlen(conn_header);
+        if (reserve_strinfo(sstr, head_len + conn_len + 4 + len)) {
+                return EXIT_FAILURE;
+        }
+
+        append_strinfo(sstr, head, head_len);
+        append_strinfo(sstr, conn_header, conn_len);
+        append_strinfo(sstr, "\r\n\r\n", 4);
+        append_strinfo(sstr, body, len);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,620 @@
+#include "../headers/hpack_codecs.h"
+#include <string.h>             // memcpy(), strlen()
+
+
+#define HPACK_HUFFMAN_SYMS 257          // 256 octets and EOS
+#define HPACK_HUFFMAN_EOS 256
+
+
+// Static table (RFC 7541 Appendix A), index 1 is the first entry
+static const char* const hpack_static_table[HPACK_STATIC_ENTRIES][2] = {
+        { ":authority", "" }, { ":method", "GET" }, { ":method", "POST" },
+        { ":path", "/" }, { ":path", "/index.html" }, { ":scheme", "http" },
+        { ":scheme", "https" }, { ":status", "200" }, { ":status", "204" },
+        { ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+        { ":status", "404" }, { ":status", "500" }, { "accept-charset", "" },
+        { "accept-encoding", "gzip, deflate" }, { "accept-language", "" },
+        { "accept-ranges", "" }, { "accept", "" },
+        { "access-control-allow-origin", "" }, { "age", "" },
+        { "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+        { "content-disposition", "" }, { "content-encoding", "" },
+        { "content-language", "" }, { "content-length", "" },
+        { "content-location", "" }, { "content-range", "" },
+        { "content-type", "" }, { "cookie", "" }, { "date", "" },
+        { "etag", "" }, { "expect", "" }, { "expires", "" }, { "from", "" },
+        { "host", "" }, { "if-match", "" }, { "if-modified-since", "" },
+        { "if-none-match", "" }, { "if-range", "" },
+        { "if-unmodified-since", "" }, { "last-modified", "" },
+        { "link", "" }, { "location", "" }, { "max-forwards", "" },
+        { "proxy-authenticate", "" }, { "proxy-authorization", "" },
+        { "range", "" }, { "referer", "" }, { "refresh", "" },
+        { "retry-after", "" }, { "server", "" }, { "set-cookie", "" },
+        { "strict-transport-security", "" }, { "transfer-encoding", "" },
+        { "user-agent", "" }, { "vary", "" }, { "via", "" },
+        { "www-authenticate", "" }
+};
+
+
+// Huffman code (RFC 7541 Appendix B): the codes and their bit lengths
+static const uint32_t hpack_huffman_codes[HPACK_HUFFMAN_SYMS] = {
+        0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5,
+        0xfffffe6, 0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9,
+        0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee,
+        0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+        0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9,
+        0xffffffa, 0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa,
+        0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa, 0x3fb,
+        0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+        0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b,
+        0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb,
+        0x7ffc, 0x20, 0xffb, 0x3fc, 0x1ffa, 0x21,
+        0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+        0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+        0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e,
+        0x6f, 0x70, 0x71, 0x72, 0xfc, 0x73,
+        0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+        0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5,
+        0x25, 0x26, 0x27, 0x6, 0x74, 0x75,
+        0x28, 0x29, 0x2a, 0x7, 0x2b, 0x76,
+        0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+        0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd,
+        0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8,
+        0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda,
+        0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+        0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1,
+        0x7fffe2, 0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5,
+        0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd,
+        0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+        0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf,
+        0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2,
+        0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2,
+        0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+        0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2,
+        0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde,
+        0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3,
+        0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+        0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3,
+        0x7ffffe4, 0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6,
+        0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb,
+        0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+        0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8,
+        0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed,
+        0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee, 0x3fffffff
+};
+
+static const uint8_t hpack_huffman_lens[HPACK_HUFFMAN_SYMS] = {
+        13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+        28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+        6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+        5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+        13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+        15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+        6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+        20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+        24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+        22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+        21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+        26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+        19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+        20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+        26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+        30
+};
+
+
+/*
+ * TABLES
+ */
+
+
+
+void init_hpack_table(struct hpack_table* table)
+{
+        memset(table, 0, sizeof(*table));
+        table->max_size = HPACK_TABLE_SIZE;
+}
+
+
+// Removes the oldest entry
+void evict_hpack_entry(struct hpack_table* table)
+{
+        size_t last = (table->first + table->count - 1) % HPACK_MAX_ENTRIES;
+        struct hpack_entry* entry = &(table->entries[last]);
+
+        table->size -= entry->name_len + entry->value_len
+                + HPACK_ENTRY_OVERHEAD;
+        free(entry->name);
+        memset(entry, 0, sizeof(*entry));
+        --(table->count);
+}
+
+
+void cleanup_hpack_table(struct hpack_table* table)
+{
+        while (table->count) evict_hpack_entry(table);
+}
+
+
+// Evicts the entries until "size" more bytes fit
+void make_room_hpack_table(struct hpack_table* table, const size_t size)
+{
+        while (table->count && table->max_size < table->size + size) {
+                evict_hpack_entry(table);
+        }
+}
+
+
+void resize_hpack_table(struct hpack_table* table, const size_t max_size)
+{
+        table->max_size = (max_size < HPACK_TABLE_SIZE
+                ? max_size : HPACK_TABLE_SIZE);
+        table->size_update = 1;
+        make_room_hpack_table(table, 0);
+}
+
+
+/*
+ * Adds the newest entry, evicts the oldest ones
+ *
+ * Returns:
+ *      - Success (an entry larger than the table only empties it):
+ *        EXIT_SUCCESS
+ *      - No memory: EXIT_FAILURE
+ */
+int add_hpack_entry(struct hpack_table* table, const char* name,
+        const size_t name_len, const char* value, const size_t value_len)
+{
+        size_t size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+        make_room_hpack_table(table, size);
+        if (table->max_size < table->size + size) return EXIT_SUCCESS;
+
+        char* buf = (char*) malloc(name_len + value_len + 2);
+        if (!buf) return EXIT_FAILURE;
+        memcpy(buf, name, name_len);
+        buf[name_len] = '\0';
+        memcpy(buf + name_len + 1, value, value_len);
+        buf[name_len + 1 + value_len] = '\0';
+
+        table->first = (table->first + HPACK_MAX_ENTRIES - 1)
+                % HPACK_MAX_ENTRIES;
+        struct hpack_entry* entry = &(table->entries[table->first]);
+        entry->name = buf;
+        entry->name_len = name_len;
+        entry->value = buf + name_len + 1;
+        entry->value_len = value_len;
+
+        ++(table->count);
+        table->size += size;
+        return EXIT_SUCCESS;
+}
+
+
+/*
+ * Looks the index up in the static and the dynamic table
+ *
+ * Returns:
+ *      - Valid index: EXIT_SUCCESS
+ *      - Invalid index: EXIT_FAILURE
+ */
+int get_hpack_entry(const struct hpack_table* table, const size_t index,
+        const char** name, size_t* name_len, const char** value,
+        size_t* value_len)
+{
+        if (!index) return EXIT_FAILURE;
+
+        if (index <= HPACK_STATIC_ENTRIES) {
+                *name = hpack_static_table[index - 1][0];
+                *name_len = strlen(*name);
+                *value = hpack_static_table[index - 1][1];
+                *value_len = strlen(*value);
+                return EXIT_SUCCESS;
+        }
+
+        size_t dyn = index - HPACK_STATIC_ENTRIES - 1;
+        if (table->count <= dyn) return EXIT_FAILURE;
+
+        const struct hpack_entry* entry =
+                &(table->entries[(table->first + dyn) % HPACK_MAX_ENTRIES]);
+        *name = entry->name;
+        *name_len = entry->name_len;
+        *value = entry->value;
+        *value_len = entry->value_len;
+        return EXIT_SUCCESS;
+}
+
+
+
+/*
+ * DECODING
+ */
+
+
+
+// Huffman decoding tree: internal nodes, children are
+// node indexes (> 0) or symbols (-symbol - 1), 0 - no code
+static int16_t hpack_huffman_tree[HPACK_HUFFMAN_SYMS][2];
+
+
+// Builds the decoding tree on the first use
+void build_hpack_huffman_tree(void)
+{
+        static int built = 0;
+        if (built) return;
+
+        int16_t nodes = 1; // root
+        for (int sym = 0; sym < HPACK_HUFFMAN_SYMS; ++sym) {
+                int16_t node = 0;
+                for (int bit = hpack_huffman_lens[sym] - 1; 0 < bit; --bit) {
+                        int b = (hpack_huffman_codes[sym] >> bit) & 1;
+                        if (!hpack_huffman_tree[node][b]) {
+                                hpack_huffman_tree[node][b] = nodes++;
+                        }
+                        node = hpack_huffman_tree[node][b];
+                }
+
+                hpack_huffman_tree[node][hpack_huffman_codes[sym] & 1] =
+                        (int16_t) (-sym - 1);
+        }
+
+        built = 1;
+}
+
+
+/*
+ * Decodes the Huffman coded string
+ *
+ * Returns:
+ *      - Success: decoded length
+ *      - Invalid code / padding, too long: -EXIT_FAILURE
+ */
+int decode_hpack_huffman(const uint8_t* in, const size_t len, char* out,
+        const size_t out_sz)
+{
+        build_hpack_huffman_tree();
+
+        size_t out_len = 0;
+        int16_t node = 0;
+        int pad_bits = 0, pad_ones = 1; // bits since the last symbol
+        for (size_t i = 0; i < len; ++i) {
+                for (int bit = 7; 0 <= bit; --bit) {
+                        int b = (in[i] >> bit) & 1;
+                        int16_t next = hpack_huffman_tree[node][b];
+                        if (!next) return -EXIT_FAILURE;
+
+                        if (0 < next) {
+                                node = next;
+                                ++pad_bits;
+                                pad_ones &= b;
+                                continue;
+                        }
+
+                        int sym = -next - 1;
+                        if (sym == HPACK_HUFFMAN_EOS || out_len == out_sz) {
+                                return -EXIT_FAILURE;
+                        }
+
+                        out[out_len++] = (char) sym;
+                        node = 0;
+                        pad_bits = 0;
+                        pad_ones = 1;
+                }
+        }
+
+        // Padding: the most significant bits of EOS (all ones), < 8 bits
+        if (7 < pad_bits || !pad_ones) return -EXIT_FAILURE;
+        return (int) out_len;
+}
+
+
+/*
+ * Decodes an integer with an N-bit prefix (RFC 7541 5.1)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS, "cur" is moved past the integer
+ *      - Truncated / too large: EXIT_FAILURE
+ */
+int decode_hpack_int(const uint8_t** cur, const uint8_t* end,
+        const int prefix, size_t* value)
+{
+        if (end <= *cur) return EXIT_FAILURE;
+
+        const size_t max_prefix = ((size_t) 1 << prefix) - 1;
+        size_t res = *((*cur)++) & max_prefix;
+        if (res < max_prefix) {
+                *value = res;
+                return EXIT_SUCCESS;
+        }
+
+        // Continuation bytes, 7 bits each (at most 28 bits more)
+        for (int shift = 0; shift <= 21; shift += 7) {
+                if (end <= *cur) return EXIT_FAILURE;
+
+                uint8_t b = *((*cur)++);
+                res += (size_t) (b & 0x7f) << shift;
+                if (!(b & 0x80)) {
+                        *value = res;
+                        return EXIT_SUCCESS;
+                }
+        }
+
+        return EXIT_FAILURE;
+}
+
+
+/*
+ * Decodes a string literal (RFC 7541 5.2) to "out"
+ *
+ * Returns:
+ *      - Success: string length
+ *      - Malformed / too long: -EXIT_FAILURE
+ */
+int decode_hpack_string(const uint8_t** cur, const uint8_t* end, char* out,
+        const size_t out_sz)
+{
+        if (end <= *cur) return -EXIT_FAILURE;
+
+        int huffman = (**cur & 0x80);
+        size_t len = 0;
+        if (decode_hpack_int(cur, end, 7, &len)
+                || (size_t) (end - *cur) < len) {
+                return -EXIT_FAILURE;
+        }
+
+        const uint8_t* data = *cur;
+        *cur += len;
+        if (huffman) return decode_hpack_huffman(data, len, out, out_sz);
+
+        if (out_sz < len) return -EXIT_FAILURE;
+        memcpy(out, data, len);
+        return (int) len;
+}
+
+
+int decode_hpack_block(struct hpack_table* table, const uint8_t* in,
+        const size_t len, hpack_header_fn on_header, void* data)
+{
+        static char name_buf[HPACK_MAX_STRING_LEN];
+        static char value_buf[HPACK_MAX_STRING_LEN];
+
+        const uint8_t* cur = in;
+        const uint8_t* end = in + len;
+        int headers = 0; // size updates go first
+        while (cur < end) {
+                uint8_t b = *cur;
+                size_t index = 0;
+
+                // Dynamic table size update
+                if ((b & 0xe0) == 0x20) {
+                        size_t size = 0;
+                        if (headers || decode_hpack_int(&cur, end, 5, &size)
+                                || HPACK_TABLE_SIZE < size) {
+                                return EXIT_FAILURE;
+                        }
+
+                        table->max_size = size;
+                        make_room_hpack_table(table, 0);
+                        continue;
+                }
+                headers = 1;
+
+                const char* name = NULL;
+                const char* value = NULL;
+                size_t name_len = 0, value_len = 0;
+
+                // Indexed header field
+                if (b & 0x80) {
+                        if (decode_hpack_int(&cur, end, 7, &index)
+                                || get_hpack_entry(table, index, &name,
+                                &name_len, &value, &value_len)) {
+                                return EXIT_FAILURE;
+                        }
+
+                        if (on_header(data, name, name_len, value,
+                                value_len)) {
+                                return EXIT_FAILURE;
+                        }
+                        continue;
+                }
+
+                // Literal: with incremental indexing (6-bit index),
+                // without indexing / never indexed (4-bit index)
+                int indexing = ((b & 0xc0) == 0x40);
+                if (decode_hpack_int(&cur, end, indexing ? 6 : 4, &index)) {
+                        return EXIT_FAILURE;
+                }
+
+                if (index) {
+                        if (get_hpack_entry(table, index, &name, &name_len,
+                                &value, &value_len)) {
+                                return EXIT_FAILURE;
+                        }
+
+                        // The entry may be evicted by the insertion
+                        if (sizeof(name_buf) < name_len) return EXIT_FAILURE;
+                        memcpy(name_buf, name, name_len);
+                } else {
+                        int res = decode_hpack_string(&cur, end, name_buf,
+                                sizeof(name_buf));
+                        if (res < 0) return EXIT_FAILURE;
+                        name_len = (size_t) res;
+                }
+
+                int res = decode_hpack_string(&cur, end, value_buf,
+                        sizeof(value_buf));
+                if (res < 0) return EXIT_FAILURE;
+                value_len = (size_t) res;
+
+                if (indexing && add_hpack_entry(table, name_buf, name_len,
+                        value_buf, value_len)) {
+                        return EXIT_FAILURE;
+                }
+
+                if (on_header(data, name_buf, name_len, value_buf,
+                        value_len)) {
+                        return EXIT_FAILURE;
+                }
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+
+/*
+ * ENCODING
+ */
+
+
+
+// Encodes an integer with an N-bit prefix, "first" has the flag bits
+int encode_hpack_int(struct strinfo* out, const uint8_t first,
+        const int prefix, size_t value)
+{
+        const size_t max_prefix = ((size_t) 1 << prefix) - 1;
+        uint8_t buf[16];
+        size_t len = 0;
+
+        if (value < max_prefix) {
+                buf[len++] = first | (uint8_t) value;
+        } else {
+                buf[len++] = first | (uint8_t) max_prefix;
+                value -= max_prefix;
+                while (0x80 <= value) {
+                        buf[len++] = (uint8_t) ((value & 0x7f) | 0x80);
+                        value >>= 7;
+                }
+                buf[len++] = (uint8_t) value;
+        }
+
+        return append_strinfo(out, (const char*) buf, len);
+}
+
+
+// Encodes a string literal, Huffman coded if that is shorter
+int encode_hpack_string(struct strinfo* out, const char* str,
+        const size_t len)
+{
+        size_t bits = 0;
+        for (size_t i = 0; i < len; ++i) {
+                bits += hpack_huffman_lens[(uint8_t) str[i]];
+        }
+
+        size_t huff_len = (bits + 7) / 8;
+        if (len <= huff_len) {
+                int res = encode_hpack_int(out, 0x00, 7, len);
+                res |= append_strinfo(out, str, len);
+                return res ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+
+        if (encode_hpack_int(out, 0x80, 7, huff_len)
+                || reserve_strinfo(out, huff_len)) {
+                return EXIT_FAILURE;
+        }
+
+        uint64_t acc = 0;
+        int acc_bits = 0;
+        uint8_t* dest = (uint8_t*) out->buf + out->len;
+        for (size_t i = 0; i < len; ++i) {
+                uint8_t sym = (uint8_t) str[i];
+                acc = (acc << hpack_huffman_lens[sym])
+                        | hpack_huffman_codes[sym];
+                acc_bits += hpack_huffman_lens[sym];
+                while (8 <= acc_bits) {
+                        acc_bits -= 8;
+                        *(dest++) = (uint8_t) (acc >> acc_bits);
+                }
+        }
+
+        // Pad with the most significant bits of EOS
+        if (acc_bits) {
+                *(dest++) = (uint8_t) ((acc << (8 - acc_bits))
+                        | (0xff >> acc_bits));
+        }
+
+        out->len += huff_len;
+        out->buf[out->len] = '\0';
+        return EXIT_SUCCESS;
+}
+
+
+int begin_hpack_block(struct hpack_table* table, struct strinfo* out)
+{
+        if (!table->size_update) return EXIT_SUCCESS;
+
+        table->size_update = 0;
+        return encode_hpack_int(out, 0x20, 5, table->max_size);
+}
+
+
+// Finds the entry (0 - none), "exact" is set if the value matches too
+size_t find_hpack_entry(const struct hpack_table* table, const char* name,
+        const size_t name_len, const char* value, const size_t value_len,
+        int* exact)
+{
+        size_t name_index = 0;
+        *exact = 0;
+
+        for (size_t i = 0; i < HPACK_STATIC_ENTRIES; ++i) {
+                const char* sname = hpack_static_table[i][0];
+                if (strlen(sname) != name_len
+                        || memcmp(sname, name, name_len)) {
+                        continue;
+                }
+
+                const char* svalue = hpack_static_table[i][1];
+                if (strlen(svalue) == value_len
+                        && !memcmp(svalue, value, value_len)) {
+                        *exact = 1;
+                        return i + 1;
+                }
+                if (!name_index) name_index = i + 1;
+        }
+
+        for (size_t i = 0; i < table->count; ++i) {
+                const struct hpack_entry* entry =
+                        &(table->entries[(table->first + i)
+                        % HPACK_MAX_ENTRIES]);
+                if (entry->name_len != name_len
+                        || memcmp(entry->name, name, name_len)) {
+                        continue;
+                }
+
+                if (entry->value_len == value_len
+                        && !memcmp(entry->value, value, value_len)) {
+                        *exact = 1;
+                        return HPACK_STATIC_ENTRIES + 1 + i;
+                }
+                if (!name_index) name_index = HPACK_STATIC_ENTRIES + 1 + i;
+        }
+
+        return name_index;
+}
+
+
+int encode_hpack_header(struct hpack_table* table, struct strinfo* out,
+        const char* name, const char* value, const size_t value_len,
+        const int index)
+{
+        size_t name_len = strlen(name);
+        int exact = 0;
+        size_t found = find_hpack_entry(table, name, name_len, value,
+                value_len, &exact);
+
+        // Indexed header field
+        if (exact) return encode_hpack_int(out, 0x80, 7, found);
+
+        // Literal with incremental indexing / without indexing
+        int res = (index ? encode_hpack_int(out, 0x40, 6, found)
+                : encode_hpack_int(out, 0x00, 4, found));
+        if (!found) res |= encode_hpack_string(out, name, name_len);
+        res |= encode_hpack_string(out, value, value_len);
+        if (res) return EXIT_FAILURE;
+
+        if (index) {
+                return add_hpack_entry(table, name, name_len, value,
+                        value_len);
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,1113 @@
+#include "../headers/http2_sessions.h"
+#include "../headers/http_writers.h"        // write_http_from_code(), ...
+#include "../headers/http_routers.h"        // get_http_route()
+#include "../headers/http_limits.h"         // check_http_rate_limit()
+
+#include <ctype.h>      // tolower(), isupper()
+
+
+#define HTTP2_MAX_NAME_LEN 128          // longest converted response header
+#define HTTP2_MAX_SETTINGS_LEN 64       // decoded "HTTP2-Settings"
+
+
+
+/*
+ * FRAMES
+ */
+
+
+
+// Reads a 31-bit stream identifier / 32-bit value
+uint32_t read_http2_u32(const uint8_t* p)
+{
+        return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+                | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+
+// Writes a 32-bit value
+void put_http2_u32(uint8_t* p, const uint32_t v)
+{
+        p[0] = (uint8_t) (v >> 24);
+        p[1] = (uint8_t) (v >> 16);
+        p[2] = (uint8_t) (v >> 8);
+        p[3] = (uint8_t) v;
+}
+
+
+// Appends a frame, the payload ("len" bytes) is optional
+int write_http2_frame(struct strinfo* out, const uint8_t type,
+        const uint8_t flags, const uint32_t stream, const void* payload,
+        const size_t len)
+{
+        uint8_t head[HTTP2_FRAME_HEAD_LEN] = {
+                (uint8_t) (len >> 16), (uint8_t) (len >> 8), (uint8_t) len,
+                type, flags
+        };
+        put_http2_u32(head + 5, stream & HTTP2_MAX_WINDOW);
+
+        int res = append_strinfo(out, (const char*) head, sizeof(head));
+        if (payload) res |= append_strinfo(out, (const char*) payload, len);
+
+        return res ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+// Writes the server's SETTINGS (the rest are the defaults)
+int write_http2_settings(struct strinfo* out)
+{
+        uint8_t payload[6] = { 0, HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS };
+        put_http2_u32(payload + 2, HTTP2_MAX_STREAMS);
+
+        return write_http2_frame(out, HTTP2_SETTINGS, 0, 0, payload,
+                sizeof(payload));
+}
+
+
+int write_http2_rst_stream(struct strinfo* out, const uint32_t stream,
+        const enum http2_error code)
+{
+        uint8_t payload[4];
+        put_http2_u32(payload, code);
+
+        return write_http2_frame(out, HTTP2_RST_STREAM, 0, stream, payload,
+                sizeof(payload));
+}
+
+
+int write_http2_window_update(struct strinfo* out, const uint32_t stream,
+        const uint32_t inc)
+{
+        uint8_t payload[4];
+        put_http2_u32(payload, inc);
+
+        return write_http2_frame(out, HTTP2_WINDOW_UPDATE, 0, stream,
+                payload, sizeof(payload));
+}
+
+
+int write_http2_goaway(struct http2_session* s, struct strinfo* out,
+        const enum http2_error code)
+{
+        uint8_t payload[8];
+        put_http2_u32(payload, s->last_stream);
+        put_http2_u32(payload + 4, code);
+
+        s->goaway = 1;
+        return write_http2_frame(out, HTTP2_GOAWAY, 0, 0, payload,
+                sizeof(payload));
+}
+
+
+// Connection error: GOAWAY, the connection is closed once it is sent
+int fail_http2_session(struct http2_session* s, struct strinfo* out,
+        const enum http2_error code)
+{
+        fprintf(stderr, "HTTP/2 connection error %d\n", (int) code);
+        s->closing = 1;
+        return write_http2_goaway(s, out, code);
+}
+
+
+
+/*
+ * STREAMS
+ */
+
+
+
+struct http2_stream* find_http2_stream(struct http2_session* s,
+        const uint32_t id)
+{
+        for (size_t i = 0; i < HTTP2_MAX_STREAMS; ++i) {
+                struct http2_stream* st = &(s->streams[i]);
+                if (st->state != H2S_FREE && st->id == id) return st;
+        }
+
+        return NULL;
+}
+
+
+// Takes a free slot (NULL - HTTP2_MAX_STREAMS are open)
+struct http2_stream* open_http2_stream(struct http2_session* s,
+        const uint32_t id)
+{
+        for (size_t i = 0; i < HTTP2_MAX_STREAMS; ++i) {
+                struct http2_stream* st = &(s->streams[i]);
+                if (st->state != H2S_FREE) continue;
+
+                // The arena of the slot is kept for its next streams
+                struct http_arena arena = st->conn.arena;
+                memset(st, 0, sizeof(*st));
+                st->conn.arena = arena;
+                st->conn.req.arena = &(st->conn.arena);
+                st->id = id;
+                st->state = H2S_RECEIVING;
+                st->send_window = s->init_window;
+                return st;
+        }
+
+        return NULL;
+}
+
+
+void close_http2_stream(struct http2_stream* st)
+{
+        cleanup_http_stream(&(st->conn.strm));
+        reset_http_request_receiving(&(st->conn));
+        cleanup_strinfo(&(st->resp));
+
+        struct http_arena arena = st->conn.arena;
+        memset(st, 0, sizeof(*st));
+        st->conn.arena = arena;
+}
+
+
+// Resets the stream (RST_STREAM), frees it
+int reset_http2_stream(struct http2_stream* st, struct strinfo* out,
+        const enum http2_error code)
+{
+        int res = write_http2_rst_stream(out, st->id, code);
+        close_http2_stream(st);
+        return res;
+}
+
+
+// Executes the received request, the response is sent
+// by send_http2_frames()
+void execute_http2_stream(struct http2_session* s, struct http2_stream* st)
+{
+        struct http_conninfo* conn = &(st->conn);
+        st->state = H2S_RESPONDING;
+
+        // Take the received request over
+        struct http_request req = conn->req;
+        memset(&(conn->req), 0, sizeof(conn->req));
+        struct http_route* rt = conn->rt;
+        conn->rt = NULL;
+
+        // Every stream takes a token of the rate limits
+        int code = (s->cinfo ? check_http_rate_limit(s->cinfo) : HTTP_OK);
+        if (code != HTTP_OK) {
+                cleanup_http_request(&req);
+                if (write_http_limit_response(code, &(st->resp))) {
+                        code = HTTP_INTERNAL_SERVER_ERROR;
+                } else {
+                        code = HTTP_OK; // the response is written
+                }
+        } else if (rt && (rt->proxy || rt->ws)) { // HTTP/1.1 only
+                cleanup_http_request(&req);
+                code = HTTP_NOT_IMPLEMENTED;
+        } else if (s->execute(&req, conn, &(st->resp)) < 0
+                || !st->resp.len) {
+                cleanup_http_stream(&(conn->strm));
+                code = HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (code != HTTP_OK) {
+                write_http_from_code(code, &(st->resp), NULL, 0, NULL, NULL);
+        }
+
+        // DATA frames delimit the pieces of the body
+        conn->strm.chunked = 0;
+}
+
+
+// Answers 413 before the content is received, the rest is discarded
+int reject_http2_content(struct http2_stream* st)
+{
+        st->state = H2S_RESPONDING;
+        st->skip_body = 1;
+        reset_http_request_receiving(&(st->conn));
+        return write_http_from_code(HTTP_CONTENT_TOO_LARGE, &(st->resp),
+                NULL, 0, NULL, NULL);
+}
+
+
+// Completes the received content of the request, executes it
+void complete_http2_request(struct http2_session* s, struct http2_stream* st)
+{
+        struct http_conninfo* conn = &(st->conn);
+        int code = finish_http_request_body(conn, conn->dec.total);
+        if (code == HTTP_OK) {
+                execute_http2_stream(s, st);
+                return;
+        }
+
+        st->state = H2S_RESPONDING;
+        write_http_from_code(code, &(st->resp), NULL, 0, NULL, NULL);
+}
+
+
+// Counts the streams not closed yet
+size_t count_http2_streams(const struct http2_session* s)
+{
+        size_t count = 0;
+        for (size_t i = 0; i < HTTP2_MAX_STREAMS; ++i) {
+                if (s->streams[i].state != H2S_FREE) ++count;
+        }
+
+        return count;
+}
+
+
+
+/*
+ * SESSIONS
+ */
+
+
+
+int is_http2_preface(const struct strinfo* rvstr)
+{
+        size_t len = (rvstr->len < HTTP2_PREFACE_LEN
+                ? rvstr->len : HTTP2_PREFACE_LEN);
+        if (!len || memcmp(rvstr->buf, HTTP2_PREFACE, len)) return 0;
+
+        return len == HTTP2_PREFACE_LEN ? 1 : -1;
+}
+
+
+struct http2_session* allocate_http2_session(http2_execute_fn execute)
+{
+        struct http2_session* s = (struct http2_session*) calloc(1,
+                sizeof(struct http2_session));
+        if (!s) return NULL;
+
+        s->execute = execute;
+        s->preface_left = HTTP2_PREFACE_LEN;
+        init_hpack_table(&(s->decoder));
+        init_hpack_table(&(s->encoder));
+        s->init_window = HTTP2_DEF_WINDOW;
+        s->send_window = HTTP2_DEF_WINDOW;
+
+        return s;
+}
+
+
+struct http2_session* create_http2_session(http2_execute_fn execute,
+        struct strinfo* out)
+{
+        struct http2_session* s = allocate_http2_session(execute);
+        if (!s) return NULL;
+
+        if (write_http2_settings(out)) {
+                cleanup_http2_session(s);
+                return NULL;
+        }
+
+        return s;
+}
+
+
+/*
+ * Applies the peer's SETTINGS payload
+ *
+ * Returns:
+ *      - Success: HTTP2_NO_ERROR
+ *      - Invalid value: error code of the connection
+ */
+enum http2_error apply_http2_settings(struct http2_session* s,
+        const uint8_t* payload, const size_t len)
+{
+        if (len % 6) return HTTP2_FRAME_SIZE_ERROR;
+
+        for (size_t off = 0; off < len; off += 6) {
+                uint16_t id = (uint16_t) ((payload[off] << 8)
+                        | payload[off + 1]);
+                uint32_t value = read_http2_u32(payload + off + 2);
+
+                switch (id) {
+                case HTTP2_SETTINGS_HEADER_TABLE_SIZE:
+                        resize_hpack_table(&(s->encoder), value);
+                        break;
+                case HTTP2_SETTINGS_ENABLE_PUSH: // nothing is pushed
+                        if (1 < value) return HTTP2_PROTOCOL_ERROR;
+                        break;
+                case HTTP2_SETTINGS_INITIAL_WINDOW_SIZE: {
+                        if (HTTP2_MAX_WINDOW < value) {
+                                return HTTP2_FLOW_CONTROL_ERROR;
+                        }
+
+                        // Open streams' windows change by the difference
+                        int64_t delta = (int64_t) value - s->init_window;
+                        for (size_t i = 0; i < HTTP2_MAX_STREAMS; ++i) {
+                                struct http2_stream* st = &(s->streams[i]);
+                                if (st->state == H2S_FREE) continue;
+
+                                st->send_window += delta;
+                                if (HTTP2_MAX_WINDOW < st->send_window) {
+                                        return HTTP2_FLOW_CONTROL_ERROR;
+                                }
+                        }
+
+                        s->init_window = value;
+                        break;
+                }
+                case HTTP2_SETTINGS_MAX_FRAME_SIZE: // frames stay default
+                        if (value < HTTP2_MAX_FRAME_LEN
+                                || 0xffffff < value) {
+                                return HTTP2_PROTOCOL_ERROR;
+                        }
+                        break;
+                default: // unknown settings are ignored
+                        break;
+                }
+        }
+
+        return HTTP2_NO_ERROR;
+}
+
+
+// Decodes base64url ("HTTP2-Settings", no padding)
+int decode_http2_settings(const char* in, uint8_t* out, const size_t out_sz,
+        size_t* len)
+{
+        uint32_t acc = 0;
+        int bits = 0;
+        *len = 0;
+        for (const char* c = in; *c && *c != '='; ++c) {
+                int v = -1;
+                if ('A' <= *c && *c <= 'Z') v = *c - 'A';
+                else if ('a' <= *c && *c <= 'z') v = *c - 'a' + 26;
+                else if ('0' <= *c && *c <= '9') v = *c - '0' + 52;
+                else if (*c == '-' || *c == '+') v = 62;
+                else if (*c == '_' || *c == '/') v = 63;
+                if (v < 0) return EXIT_FAILURE;
+
+                acc = (acc << 6) | (uint32_t) v;
+                bits += 6;
+                if (8 <= bits) {
+                        if (*len == out_sz) return EXIT_FAILURE;
+
+                        bits -= 8;
+                        out[(*len)++] = (uint8_t) (acc >> bits);
+                }
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+struct http2_session* upgrade_http2_session(http2_execute_fn execute,
+        struct http_conninfo* conn, struct strinfo* out)
+{
+        uint8_t settings[HTTP2_MAX_SETTINGS_LEN];
+        size_t len = 0;
+        if (decode_http2_settings(conn->h2c_settings, settings,
+                sizeof(settings), &len)) {
+                return NULL;
+        }
+
+        struct http2_session* s = allocate_http2_session(execute);
+        if (!s) return NULL;
+
+        if (apply_http2_settings(s, settings, len) != HTTP2_NO_ERROR) {
+                goto out_failure_cleanup_session;
+        }
+
+        // The response to the request is sent on stream 1
+        const char* switching = "HTTP/1.1 101 Switching Protocols\r\n"
+                "Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+        if (append_strinfo(out, switching, strlen(switching))
+                || write_http2_settings(out)) {
+                goto out_failure_cleanup_session;
+        }
+
+        struct http2_stream* st = open_http2_stream(s, 1);
+        s->last_stream = 1;
+        st->conn.req = conn->req;
+        memset(&(conn->req), 0, sizeof(conn->req));
+        st->conn.rt = conn->rt;
+        conn->rt = NULL;
+        st->head_req = !strcmp(st->conn.req.method, "HEAD");
+        conn->h2c_settings = NULL; // freed with the request
+
+        execute_http2_stream(s, st);
+        return s;
+
+out_failure_cleanup_session:
+        cleanup_http2_session(s);
+        return NULL;
+}
+
+
+
+/*
+ * RECEIVING
+ */
+
+
+
+/*
+ * Request being decoded from a header block
+ *
+ * @st      Stream of the request (NULL - the headers are dropped)
+ * @regular Regular header was decoded (no pseudo-headers follow)
+ * @error   Request is malformed (stream error)
+ */
+struct http2_request_ctx {
+        struct http2_stream* st;
+        int regular;
+        enum http2_error error;
+};
+
+
+// Checks if the header name is "str"
+int is_http2_name(const char* name, const size_t len, const char* str)
+{
+        return strlen(str) == len && !memcmp(name, str, len);
+}
+
+
+// Copies a header value to a request field (the stream's arena)
+int set_http2_request_field(struct http_request* req, char** dest,
+        const char* value, const size_t len)
+{
+        *dest = http_arena_strndup(req->arena, value, len);
+        return (*dest ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+// Copies a regular header to the table of the request
+enum http2_error add_http2_table_header(struct http_request* req,
+        const char* name, const size_t name_len,
+        const char* value, const size_t value_len)
+{
+        if (!req->headers && !create_http_request_headers(req)) {
+                return HTTP2_INTERNAL_ERROR;
+        }
+
+        char* n = http_arena_strndup(req->arena, name, name_len);
+        char* v = http_arena_strndup(req->arena, value, value_len);
+        if (!n || !v) return HTTP2_INTERNAL_ERROR;
+
+        int code = add_http_header(req->headers, n, name_len, v, value_len);
+        return (code == HTTP_OK ? HTTP2_NO_ERROR : HTTP2_PROTOCOL_ERROR);
+}
+
+
+// Fills the request from the decoded header (hpack_header_fn)
+int add_http2_request_header(void* data, const char* name,
+        const size_t name_len, const char* value, const size_t value_len)
+{
+        struct http2_request_ctx* ctx = (struct http2_request_ctx*) data;
+        if (!ctx->st || ctx->error) return EXIT_SUCCESS; // keep decoding
+
+        struct http_request* req = &(ctx->st->conn.req);
+        char** dest = NULL;
+        int pseudo = (name_len && name[0] == ':');
+
+        if (is_http2_name(name, name_len, ":method")) {
+                dest = &(req->method);
+        } else if (is_http2_name(name, name_len, ":path")) {
+                dest = &(req->url);
+        } else if (is_http2_name(name, name_len, ":scheme")
+                || is_http2_name(name, name_len, ":authority")) {
+                return EXIT_SUCCESS;
+        } else if (pseudo || is_http2_name(name, name_len, "connection")) {
+                ctx->error = HTTP2_PROTOCOL_ERROR;
+                return EXIT_SUCCESS;
+        }
+
+        // Names are lowercase, pseudo-headers precede the rest
+        for (size_t i = 0; i < name_len; ++i) {
+                if (isupper((unsigned char) name[i])) {
+                        ctx->error = HTTP2_PROTOCOL_ERROR;
+                }
+        }
+        if (pseudo && ctx->regular) ctx->error = HTTP2_PROTOCOL_ERROR;
+        if (!pseudo) ctx->regular = 1;
+        if (ctx->error) return EXIT_SUCCESS;
+
+        // Regular headers are looked up in the table of the request
+        if (!pseudo) {
+                ctx->error = add_http2_table_header(req, name, name_len,
+                        value, value_len);
+                return EXIT_SUCCESS;
+        }
+
+        if (*dest) { // repeated
+                ctx->error = HTTP2_PROTOCOL_ERROR;
+                return EXIT_SUCCESS;
+        }
+
+        if (set_http2_request_field(req, dest, value, value_len)) {
+                ctx->error = HTTP2_INTERNAL_ERROR;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+// Decodes the complete header block, starts / refuses the stream
+int end_http2_headers(struct http2_session* s, struct strinfo* out)
+{
+        uint32_t id = s->hblock_stream;
+        uint8_t flags = s->hblock_flags;
+        s->hblock_stream = 0;
+
+        // Trailers of the content are decoded and dropped
+        struct http2_stream* st = find_http2_stream(s, id);
+        int trailers = (st != NULL);
+        if (!st && !s->goaway) st = open_http2_stream(s, id);
+
+        struct http2_request_ctx ctx = { .st = (trailers ? NULL : st) };
+        int res = decode_hpack_block(&(s->decoder),
+                (const uint8_t*) s->hblock.buf, s->hblock.len,
+                add_http2_request_header, &ctx);
+        s->hblock.len = 0;
+        if (res) return fail_http2_session(s, out, HTTP2_COMPRESSION_ERROR);
+
+        if (!st) return write_http2_rst_stream(out, id, HTTP2_REFUSED_STREAM);
+
+        if (trailers) {
+                if (st->skip_body) return EXIT_SUCCESS;
+                if (!(flags & HTTP2_FLAG_END_STREAM)) {
+                        return reset_http2_stream(st, out,
+                                HTTP2_PROTOCOL_ERROR);
+                }
+
+                complete_http2_request(s, st);
+                return EXIT_SUCCESS;
+        }
+
+        struct http_request* req = &(st->conn.req);
+        if (!ctx.error && (!req->method || !req->url)) {
+                ctx.error = HTTP2_PROTOCOL_ERROR;
+        }
+        if (ctx.error) return reset_http2_stream(st, out, ctx.error);
+
+        set_http_request_fields(req);
+        st->head_req = !strcmp(req->method, "HEAD");
+        st->conn.rt = get_http_route(req->method, req->url);
+
+        // "Content-Length" over the limit is rejected up front
+        struct http_body_decoder dec = { .max = get_http_max_body_len() };
+        if (parse_http_body_framing(req->headers, &dec)
+                == HTTP_CONTENT_TOO_LARGE) {
+                return reject_http2_content(st);
+        }
+
+        if (flags & HTTP2_FLAG_END_STREAM) complete_http2_request(s, st);
+
+        return EXIT_SUCCESS;
+}
+
+
+// Strips the padding of DATA / HEADERS, "payload" and "len"
+// are set to the data (EXIT_FAILURE - invalid padding)
+int strip_http2_padding(const uint8_t flags, const uint8_t** payload,
+        size_t* len)
+{
+        if (!(flags & HTTP2_FLAG_PADDED)) return EXIT_SUCCESS;
+        if (!*len || *len <= (*payload)[0]) return EXIT_FAILURE;
+
+        *len -= (size_t) (*payload)[0] + 1;
+        ++(*payload);
+        return EXIT_SUCCESS;
+}
+
+
+int handle_http2_headers(struct http2_session* s, struct strinfo* out,
+        const uint8_t type, const uint8_t flags, const uint32_t id,
+        const uint8_t* payload, size_t len)
+{
+        if (!id) return fail_http2_session(s, out, HTTP2_PROTOCOL_ERROR);
+
+        if (type == HTTP2_HEADERS) {
+                if (strip_http2_padding(flags, &payload, &len)) {
+                        return fail_http2_session(s, out,
+                                HTTP2_PROTOCOL_ERROR);
+                }
+
+                // Priorities are not used
+                if (flags & HTTP2_FLAG_PRIORITY) {
+                        if (len < 5) {
+                                return fail_http2_session(s, out,
+                                        HTTP2_FRAME_SIZE_ERROR);
+                        }
+
+                        payload += 5;
+                        len -= 5;
+                }
+
+                // New streams have increasing odd identifiers
+                struct http2_stream* st = find_http2_stream(s, id);
+                if (!st && (!(id & 1) || id <= s->last_stream)) {
+                        return fail_http2_session(s, out,
+                                HTTP2_PROTOCOL_ERROR);
+                }
+                if (st && st->state != H2S_RECEIVING) {
+                        return fail_http2_session(s, out,
+                                HTTP2_STREAM_CLOSED);
+                }
+                if (!st) s->last_stream = id;
+
+                s->hblock_stream = id;
+                s->hblock_flags = flags;
+        }
+
+        if (HTTP2_MAX_HEADERS_LEN < s->hblock.len + len) {
+                return fail_http2_session(s, out, HTTP2_ENHANCE_YOUR_CALM);
+        }
+        if (append_strinfo(&(s->hblock), (const char*) payload, len)) {
+                return EXIT_FAILURE;
+        }
+
+        if (flags & HTTP2_FLAG_END_HEADERS) return end_http2_headers(s, out);
+        return EXIT_SUCCESS;
+}
+
+
+int handle_http2_data(struct http2_session* s, struct strinfo* out,
+        const uint8_t flags, const uint32_t id, const uint8_t* payload,
+        size_t len)
+{
+        if (!id || s->last_stream < id) {
+                return fail_http2_session(s, out, HTTP2_PROTOCOL_ERROR);
+        }
+
+        // Whole frame counts against the connection window,
+        // the received content is not held back
+        size_t frame_len = len;
+        if (frame_len && write_http2_window_update(out, 0,
+                (uint32_t) frame_len)) {
+                return EXIT_FAILURE;
+        }
+
+        if (strip_http2_padding(flags, &payload, &len)) {
+                return fail_http2_session(s, out, HTTP2_PROTOCOL_ERROR);
+        }
+
+        struct http2_stream* st = find_http2_stream(s, id);
+        if (st && st->skip_body) return EXIT_SUCCESS;
+        if (!st || st->state != H2S_RECEIVING) {
+                return write_http2_rst_stream(out, id, HTTP2_STREAM_CLOSED);
+        }
+
+        // Content over the limit is answered without being received
+        size_t max = get_http_max_body_len();
+        if (max && max - st->conn.dec.total < len) {
+                return reject_http2_content(st);
+        }
+
+        if (len && receive_http_body_piece(&(st->conn),
+                (const char*) payload, len)) {
+                return reset_http2_stream(st, out, HTTP2_INTERNAL_ERROR);
+        }
+        st->conn.dec.total += len;
+
+        if (flags & HTTP2_FLAG_END_STREAM) {
+                complete_http2_request(s, st);
+                return EXIT_SUCCESS;
+        }
+
+        if (frame_len && write_http2_window_update(out, id,
+                (uint32_t) frame_len)) {
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+int handle_http2_settings(struct http2_session* s, struct strinfo* out,
+        const uint8_t flags, const uint32_t id, const uint8_t* payload,
+        const size_t len)
+{
+        if (id) return fail_http2_session(s, out, HTTP2_PROTOCOL_ERROR);
+
+        if (flags & HTTP2_FLAG_ACK) {
+                if (len) {
+                        return fail_http2_session(s, out,
+                                HTTP2_FRAME_SIZE_ERROR);
+                }
+
+                return EXIT_SUCCESS;
+        }
+
+        enum http2_error err = apply_http2_settings(s, payload, len);
+        if (err != HTTP2_NO_ERROR) return fail_http2_session(s, out, err);
+
+        return write_http2_frame(out, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0,
+                NULL, 0);
+}
+
+
+int handle_http2_window_update(struct http2_session* s, struct strinfo* out,
+        const uint32_t id, const uint8_t* payload, const size_t len)
+{
+        if (len != 4) return fail_http2_session(s, out,
+                HTTP2_FRAME_SIZE_ERROR);
+
+        uint32_t inc = read_http2_u32(payload) & HTTP2_MAX_WINDOW;
+        if (!id) {
+                if (!inc) {
+                        return fail_http2_session(s, out,
+                                HTTP2_PROTOCOL_ERROR);
+                }
+
+                s->send_window += inc;
+                if (HTTP2_MAX_WINDOW < s->send_window) {
+                        return fail_http2_session(s, out,
+                                HTTP2_FLOW_CONTROL_ERROR);
+                }
+
+                return EXIT_SUCCESS;
+        }
+
+        struct http2_stream* st = find_http2_stream(s, id);
+        if (!st) return EXIT_SUCCESS; // closed already
+
+        if (!inc) return reset_http2_stream(st, out, HTTP2_PROTOCOL_ERROR);
+
+        st->send_window += inc;
+        if (HTTP2_MAX_WINDOW < st->send_window) {
+                return reset_http2_stream(st, out, HTTP2_FLOW_CONTROL_ERROR);
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+// Handles a received frame
+int handle_http2_frame(struct http2_session* s, struct strinfo* out,
+        const uint8_t type, const uint8_t flags, const uint32_t id,
+        const uint8_t* payload, const size_t len)
+{
+        // Header blocks are not interleaved with other frames
+        if (s->hblock_stream
+                ? (type != HTTP2_CONTINUATION || id != s->hblock_stream)
+                : type == HTTP2_CONTINUATION) {
+                return fail_http2_session(s, out, HTTP2_PROTOCOL_ERROR);
+        }
+
+        switch (type) {
+        case HTTP2_DATA:
+                return handle_http2_data(s, out, flags, id, payload, len);
+        case HTTP2_HEADERS:
+        case HTTP2_CONTINUATION:
+                return handle_http2_headers(s, out, type, flags, id,
+                        payload, len);
+        case HTTP2_PRIORITY:
+                if (len != 5) {
+                        return fail_http2_session(s, out,
+                                HTTP2_FRAME_SIZE_ERROR);
+                }
+
+                return EXIT_SUCCESS;
+        case HTTP2_RST_STREAM: {
+                if (len != 4) {
+                        return fail_http2_session(s, out,
+                                HTTP2_FRAME_SIZE_ERROR);
+                }
+                if (!id || s->last_stream < id) {
+                        return fail_http2_session(s, out,
+                                HTTP2_PROTOCOL_ERROR);
+                }
+
+                struct http2_stream* st = find_http2_stream(s, id);
+                if (st) close_http2_stream(st);
+                return EXIT_SUCCESS;
+        }
+        case HTTP2_SETTINGS:
+                return handle_http2_settings(s, out, flags, id, payload,
+                        len);
+        case HTTP2_PUSH_PROMISE: // clients don't push
+                return fail_http2_session(s, out, HTTP2_PROTOCOL_ERROR);
+        case HTTP2_PING:
+                if (id || len != 8) {
+                        return fail_http2_session(s, out, id
+                                ? HTTP2_PROTOCOL_ERROR
+                                : HTTP2_FRAME_SIZE_ERROR);
+                }
+                if (flags & HTTP2_FLAG_ACK) return EXIT_SUCCESS;
+
+                return write_http2_frame(out, HTTP2_PING, HTTP2_FLAG_ACK, 0,
+                        payload, len);
+        case HTTP2_GOAWAY: // complete the open streams, accept no more
+                s->goaway = 1;
+                return EXIT_SUCCESS;
+        case HTTP2_WINDOW_UPDATE:
+                return handle_http2_window_update(s, out, id, payload, len);
+        default: // unknown frames are ignored
+                return EXIT_SUCCESS;
+        }
+}
+
+
+int receive_http2_frames(struct http2_session* s, struct strinfo* rvstr,
+        struct strinfo* out)
+{
+        size_t off = 0;
+        int res = EXIT_SUCCESS;
+
+        // Client's connection preface
+        if (s->preface_left) {
+                size_t done = HTTP2_PREFACE_LEN - s->preface_left;
+                size_t n = (rvstr->len < s->preface_left
+                        ? rvstr->len : s->preface_left);
+                if (memcmp(rvstr->buf, HTTP2_PREFACE + done, n)) {
+                        res = fail_http2_session(s, out,
+                                HTTP2_PROTOCOL_ERROR);
+                }
+
+                s->preface_left -= n;
+                off = n;
+        }
+
+        // Handle the fully received frames
+        while (!res && !s->closing && !s->preface_left
+                && HTTP2_FRAME_HEAD_LEN <= rvstr->len - off) {
+                const uint8_t* p = (const uint8_t*) rvstr->buf + off;
+                size_t len = ((size_t) p[0] << 16) | ((size_t) p[1] << 8)
+                        | p[2];
+                if (HTTP2_MAX_FRAME_LEN < len) {
+                        res = fail_http2_session(s, out,
+                                HTTP2_FRAME_SIZE_ERROR);
+                        break;
+                }
+                if (rvstr->len - off < HTTP2_FRAME_HEAD_LEN + len) break;
+
+                res = handle_http2_frame(s, out, p[3], p[4],
+                        read_http2_u32(p + 5) & HTTP2_MAX_WINDOW,
+                        p + HTTP2_FRAME_HEAD_LEN, len);
+                off += HTTP2_FRAME_HEAD_LEN + len;
+        }
+
+        consume_strinfo(rvstr, s->closing ? rvstr->len : off);
+
+        // Make room for a whole frame
+        if (reserve_strinfo(rvstr, HTTP2_FRAME_HEAD_LEN
+                + HTTP2_MAX_FRAME_LEN)) {
+                return EXIT_FAILURE;
+        }
+
+        return res;
+}
+
+
+
+/*
+ * SENDING
+ */
+
+
+
+// Checks if the response header is dropped (connection-specific)
+int is_http2_hop_header(const char* name)
+{
+        return !strcmp(name, "connection") || !strcmp(name, "keep-alive")
+                || !strcmp(name, "transfer-encoding")
+                || !strcmp(name, "upgrade")
+                || !strcmp(name, "proxy-connection");
+}
+
+
+// Frees the stream once its response is sent, the client still
+// sending the rejected content is asked to stop (RFC 9113, 8.1)
+int end_http2_stream(struct http2_stream* st, struct strinfo* out)
+{
+        int res = (st->skip_body
+                ? write_http2_rst_stream(out, st->id, HTTP2_NO_ERROR)
+                : EXIT_SUCCESS);
+        close_http2_stream(st);
+        return res;
+}
+
+
+/*
+ * Converts the HTTP/1.1 response head of the stream to HEADERS
+ * (+ CONTINUATION), the body is sent from "resp.adv" then
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - No memory: EXIT_FAILURE
+ */
+int write_http2_headers(struct http2_session* s, struct http2_stream* st,
+        struct strinfo* out)
+{
+        struct strinfo* resp = &(st->resp);
+        const char* head_end = strstr(resp->buf, "\r\n\r\n");
+        if (!head_end || resp->len < 12) {
+                return reset_http2_stream(st, out, HTTP2_INTERNAL_ERROR);
+        }
+
+        // Status code of "HTTP/1.1 200 OK"
+        struct strinfo* hout = &(s->hout);
+        hout->len = 0;
+        int res = begin_hpack_block(&(s->encoder), hout);
+        res |= encode_hpack_header(&(s->encoder), hout, ":status",
+                resp->buf + 9, 3, 0);
+
+        // Headers: lowercase names, values without the spaces
+        const char* line = strstr(resp->buf, "\r\n") + 2;
+        while (!res && line < head_end + 2) {
+                const char* line_end = strstr(line, "\r\n");
+                const char* colon = memchr(line, ':',
+                        (size_t) (line_end - line));
+                size_t name_len = (colon ? (size_t) (colon - line) : 0);
+
+                char name[HTTP2_MAX_NAME_LEN];
+                if (name_len && name_len < sizeof(name)) {
+                        for (size_t i = 0; i < name_len; ++i) {
+                                name[i] = (char) tolower(
+                                        (unsigned char) line[i]);
+                        }
+                        name[name_len] = '\0';
+
+                        const char* value = colon + 1;
+                        while (value < line_end && *value == ' ') ++value;
+
+                        // Values changing with every response aren't indexed
+                        int index = (strcmp(name, "content-length")
+                                && strcmp(name, "date"));
+                        if (!is_http2_hop_header(name)) {
+                                res = encode_hpack_header(&(s->encoder),
+                                        hout, name, value,
+                                        (size_t) (line_end - value), index);
+                        }
+                }
+
+                line = line_end + 2;
+        }
+        if (res) return EXIT_FAILURE;
+
+        // Responses to "HEAD" have no body
+        resp->adv = (size_t) (head_end + 4 - resp->buf);
+        if (st->head_req) {
+                resp->adv = resp->len;
+                cleanup_http_stream(&(st->conn.strm));
+        }
+
+        int end = (resp->adv == resp->len && !st->conn.strm.active);
+        size_t off = 0;
+        do {
+                size_t n = hout->len - off;
+                if (HTTP2_MAX_FRAME_LEN < n) n = HTTP2_MAX_FRAME_LEN;
+
+                uint8_t flags = (off + n == hout->len
+                        ? HTTP2_FLAG_END_HEADERS : 0);
+                if (!off && end) flags |= HTTP2_FLAG_END_STREAM;
+                if (write_http2_frame(out, (off ? HTTP2_CONTINUATION
+                        : HTTP2_HEADERS), flags, st->id, hout->buf + off,
+                        n)) {
+                        return EXIT_FAILURE;
+                }
+
+                off += n;
+        } while (off < hout->len);
+
+        st->resp_head = 1;
+        return end ? end_http2_stream(st, out) : EXIT_SUCCESS;
+}
+
+
+/*
+ * Writes the next DATA frame of the stream
+ *
+ * Returns:
+ *      - Frame written: 1
+ *      - Blocked by the flow control: 0
+ *      - No memory: -EXIT_FAILURE
+ */
+int write_http2_data(struct http2_session* s, struct http2_stream* st,
+        struct strinfo* out)
+{
+        // Produce the next piece of the streamed body
+        struct strinfo* resp = &(st->resp);
+        if (resp->adv == resp->len && st->conn.strm.active
+                && fill_http_stream(&(st->conn.strm), resp)) {
+                return reset_http2_stream(st, out, HTTP2_INTERNAL_ERROR)
+                        ? -EXIT_FAILURE : 1;
+        }
+
+        int64_t window = (s->send_window < st->send_window
+                ? s->send_window : st->send_window);
+        size_t left = resp->len - resp->adv;
+        size_t n = (left < HTTP2_MAX_FRAME_LEN ? left : HTTP2_MAX_FRAME_LEN);
+        if (window < (int64_t) n) n = (0 < window ? (size_t) window : 0);
+
+        int end = (n == left && !st->conn.strm.active);
+        if (!n && !end) return 0;
+
+        if (write_http2_frame(out, HTTP2_DATA,
+                (end ? HTTP2_FLAG_END_STREAM : 0), st->id,
+                resp->buf + resp->adv, n)) {
+                return -EXIT_FAILURE;
+        }
+
+        resp->adv += n;
+        s->send_window -= (int64_t) n;
+        st->send_window -= (int64_t) n;
+        if (end && end_http2_stream(st, out)) return -EXIT_FAILURE;
+
+        return 1;
+}
+
+
+int send_http2_frames(struct http2_session* s, struct strinfo* out)
+{
+        // Upgraded connections respond once the client's preface
+        // arrives (clients buffer little after "101 Switching Protocols")
+        if (s->closing || s->preface_left) return EXIT_SUCCESS;
+
+        // Streams take turns, a frame each
+        int progress = 1;
+        while (progress && out->len < HTTP2_MAX_SEND_LEN) {
+                progress = 0;
+                for (size_t i = 0; i < HTTP2_MAX_STREAMS
+                        && out->len < HTTP2_MAX_SEND_LEN; ++i) {
+                        struct http2_stream* st = &(s->streams[(s->next + i)
+                                % HTTP2_MAX_STREAMS]);
+                        if (st->state != H2S_RESPONDING) continue;
+
+                        if (!st->resp_head) {
+                                if (write_http2_headers(s, st, out)) {
+                                        return EXIT_FAILURE;
+                                }
+
+                                progress = 1;
+                                continue;
+                        }
+
+                        int res = write_http2_data(s, st, out);
+                        if (res < 0) return EXIT_FAILURE;
+                        progress |= res;
+                }
+
+                s->next = (s->next + 1) % HTTP2_MAX_STREAMS;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+int shutdown_http2_session(struct http2_session* s, struct strinfo* out)
+{
+        if (s->goaway) return EXIT_SUCCESS;
+        return write_http2_goaway(s, out, HTTP2_NO_ERROR);
+}
+
+
+int is_http2_session_done(const struct http2_session* s)
+{
+        return s->closing || (s->goaway && !s->hblock_stream
+                && !count_http2_streams(s));
+}
+
+
+void cleanup_http2_session(struct http2_session* s)
+{
+        for (size_t i = 0; i < HTTP2_MAX_STREAMS; ++i) {
+                close_http2_stream(&(s->streams[i]));
+                cleanup_http_arena(&(s->streams[i].conn.arena));
+        }
+
+        cleanup_hpack_table(&(s->decoder));
+        cleanup_hpack_table(&(s->encoder));
+        cleanup_strinfo(&(s->hblock));
+        cleanup_strinfo(&(s->hout));
+        free(s);
+}
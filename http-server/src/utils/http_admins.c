@@ -0,0 +1,431 @@
+#include "../headers/http_admins.h"
+#include "../headers/sockshelp.h"       // configure_address()
+#include "../headers/http_conns.h"      // struct http_conninfo
+#include "../headers/http_caches.h"     // get_http_cache()
+#include "../headers/http_reloads.h"    // is_http_server_draining()
+#include "../headers/http_writers.h"    // write_http_response()
+#include "../headers/http_limits.h"     // get_http_limit_stats()
+#include <stdio.h>                      // printf()
+#include <string.h>                     // strstr()
+#include <time.h>                       // time()
+
+#ifndef MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0
+#endif  // !MSG_NOSIGNAL
+
+
+#define HTTP_ADMIN_TIMEOUT_SEC 5        // admin connections are dropped then
+
+
+/*
+ * Admin endpoint state
+ *
+ * @serv        Listening socket (INVALID_SOCKET - not bound)
+ * @port        Port to listen on ("" - not attached)
+ * @next_bind   Time of the next bind attempt
+ * @started     Time the endpoint was attached (uptime)
+ * @conns       Admin connections
+ * @since       Time each of "conns" was accepted
+ * @loops       Loop iterations at the previous snapshot
+ * @wait_us     Time in select() at the previous snapshot
+ * @busy_us     Busy time at the previous snapshot
+ * @on_select   Hook set before the admin ones (optional)
+ * @on_selected Hook set before the admin ones (optional)
+ */
+struct http_admin {
+        SOCKET serv;
+        char port[MAX_SERVBUF_LEN];
+        time_t next_bind;
+        time_t started;
+
+        struct http_admin_conn conns[HTTP_ADMIN_MAX_CONN];
+        time_t since[HTTP_ADMIN_MAX_CONN];
+
+        uint64_t loops;
+        uint64_t wait_us;
+        uint64_t busy_us;
+
+        void (*on_select)(struct serverinfo* sinfo,
+                fd_set* readfds, fd_set* writefds, SOCKET* max_fd);
+        void (*on_selected)(struct serverinfo* sinfo,
+                const fd_set* readfds, const fd_set* writefds);
+};
+
+
+struct http_admin* get_http_admin(void)
+{
+        static struct http_admin admin = {
+                .serv = INVALID_SOCKET
+        };
+        return &admin;
+}
+
+
+// Names of the client states in the snapshot
+const char* http_admin_state_name(const enum client_state state)
+{
+        switch (state) {
+        case CS_READY:          return "ready";
+        case CS_EXECUTING:      return "executing";
+        case CS_IDLE:           return "idle";
+        case CS_SENDING:        return "sending";
+        case CS_RECEIVING:      return "receiving";
+        }
+
+        return "unknown";
+}
+
+
+// Gets the protocol the client's connection speaks
+const char* http_admin_protocol(const struct clientinfo* cinfo)
+{
+        const struct http_conninfo* conn =
+                (const struct http_conninfo*) cinfo->add_data;
+        if (!conn) return "http/1.1";
+        if (conn->h2) return "h2";
+        if (conn->ws) return "websocket";
+        if (conn->upc) return "proxy";
+        return "http/1.1";
+}
+
+
+// Gets the share of the busy time (0 - the loop only waited)
+double http_admin_load(const uint64_t busy_us, const uint64_t wait_us)
+{
+        if (!(busy_us + wait_us)) return 0.0;
+        return (double) busy_us / (double) (busy_us + wait_us);
+}
+
+
+int write_http_admin_snapshot(struct serverinfo* sinfo, struct strinfo* out)
+{
+        struct http_admin* admin = get_http_admin();
+        time_t now = time(NULL);
+
+        // The loop is single-threaded: it is the only worker,
+        // its load is reported overall and since the last snapshot
+        uint64_t loops = sinfo->loops - admin->loops;
+        uint64_t wait_us = sinfo->wait_us - admin->wait_us;
+        uint64_t busy_us = sinfo->busy_us - admin->busy_us;
+        admin->loops = sinfo->loops;
+        admin->wait_us = sinfo->wait_us;
+        admin->busy_us = sinfo->busy_us;
+
+        int res = appendf_strinfo(out, "{\"uptime_sec\":%lld,"
+                "\"draining\":%s,\"workers\":[{\"id\":0,"
+                "\"loops\":%llu,\"wait_sec\":%.3f,\"busy_sec\":%.3f,"
+                "\"load\":%.3f,\"recent_loops\":%llu,\"recent_load\":%.3f,"
+                "\"lag_ms\":%.3f}],"
+                "\"connections\":[",
+                (long long) (now - admin->started),
+                is_http_server_draining() ? "true" : "false",
+                (unsigned long long) sinfo->loops,
+                (double) sinfo->wait_us / 1e6, (double) sinfo->busy_us / 1e6,
+                http_admin_load(sinfo->busy_us, sinfo->wait_us),
+                (unsigned long long) loops, http_admin_load(busy_us, wait_us),
+                (double) sinfo->lag_us / 1e3);
+        if (res) return EXIT_FAILURE;
+
+        // One pass over the clients, nothing is waited for
+        size_t count = 0;
+        for (size_t i = 0; i < MAX_CONN; ++i) {
+                const struct clientinfo* cinfo = &(sinfo->clients[i]);
+                if (!validate_socket(cinfo->client)) continue;
+
+                char peer[MAX_ADDRBUF_LEN + MAX_SERVBUF_LEN + 4];
+                format_client_address(cinfo, peer, sizeof(peer));
+
+                const struct http_conninfo* conn =
+                        (const struct http_conninfo*) cinfo->add_data;
+                res = appendf_strinfo(out, "%s\n{\"fd\":%lld,"
+                        "\"peer\":\"%s\",\"state\":\"%s\","
+                        "\"protocol\":\"%s\",\"tls\":%s,"
+                        "\"send_buffered\":%zu,\"file_left\":%zu,"
+                        "\"recv_buffered\":%zu,"
+                        "\"age_sec\":%lld,\"idle_sec\":%lld}",
+                        count ? "," : "", (long long) cinfo->client,
+                        peer,
+                        http_admin_state_name(cinfo->state),
+                        http_admin_protocol(cinfo),
+                        (conn && conn->tls) ? "true" : "false",
+                        cinfo->sdstr.len - cinfo->sdstr.adv,
+                        conn ? conn->strm.file_left : 0,
+                        cinfo->rvstr.len,
+                        (long long) (now - cinfo->connected),
+                        (long long) (now - cinfo->active));
+                if (res) return EXIT_FAILURE;
+                ++count;
+        }
+
+        const struct http_cache* cache = get_http_cache();
+        const struct http_limit_stats* limits = get_http_limit_stats();
+        return appendf_strinfo(out, "\n],\"connection_count\":%zu,"
+                "\"max_connections\":%d,\"cache\":{\"entries\":%zu,"
+                "\"slots\":%d,\"hits\":%zu,\"misses\":%zu},"
+                "\"limits\":{\"limited\":%zu,\"overloaded\":%zu,"
+                "\"shed\":%zu,\"full_waits\":%zu}}\n",
+                count, MAX_CONN, cache->count, HTTP_CACHE_SLOTS,
+                cache->hits, cache->misses, limits->limited,
+                limits->overloaded, limits->shed, sinfo->full_waits);
+}
+
+
+// Opens the listening socket of the admin endpoint
+SOCKET open_http_admin_socket(const char* port)
+{
+        struct addrinfo* addr = configure_address(HTTP_ADMIN_ADDR, port,
+                AF_INET, SOCK_STREAM, AI_PASSIVE);
+        if (!addr) return INVALID_SOCKET;
+
+        SOCKET s = socket(addr->ai_family, addr->ai_socktype,
+                addr->ai_protocol);
+        if (!validate_socket(s)) {
+                psockerror("socket() failed");
+                goto out_freeaddrinfo;
+        }
+
+        int opt = 1;
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*) &opt,
+                sizeof(opt))) {
+                psockerror("setsockopt() failed");
+        }
+
+        // The port is still held by the draining process: retried later
+        if (bind(s, addr->ai_addr, addr->ai_addrlen)
+                || listen(s, HTTP_ADMIN_MAX_CONN)
+                || set_socket_nonblocking(s)) {
+                psockerror("Admin port %s is not available", port);
+                goto out_close;
+        }
+
+        freeaddrinfo(addr);
+        printf("Admin endpoint on %s:%s\n", HTTP_ADMIN_ADDR, port);
+        return s;
+
+out_close:
+        if (closesocket(s)) psockerror("close() failed");
+out_freeaddrinfo:
+        freeaddrinfo(addr);
+        return INVALID_SOCKET;
+}
+
+
+// Closes the admin connection, frees its strings
+void close_http_admin_conn(struct http_admin_conn* c)
+{
+        if (validate_socket(c->sock) && closesocket(c->sock)) {
+                psockerror("close() failed");
+        }
+        c->sock = INVALID_SOCKET;
+        cleanup_strinfo(&(c->rvstr));
+        cleanup_strinfo(&(c->sdstr));
+}
+
+
+// Accepts the admin connections there are free slots for
+void accept_http_admin_conns(struct http_admin* admin, const time_t now)
+{
+        for (;;) {
+                SOCKET s = accept(admin->serv, NULL, NULL);
+                if (!validate_socket(s)) return; // no more (non-blocking)
+
+                size_t i = 0;
+                while (i < HTTP_ADMIN_MAX_CONN
+                        && validate_socket(admin->conns[i].sock)) {
+                        ++i;
+                }
+                if (i == HTTP_ADMIN_MAX_CONN || set_socket_nonblocking(s)) {
+                        if (closesocket(s)) psockerror("close() failed");
+                        continue;
+                }
+
+                admin->conns[i].sock = s;
+                admin->since[i] = now;
+        }
+}
+
+
+// Receives the request, writes the response once the head is complete
+//
+// Returns EXIT_FAILURE if the connection is to be closed
+int receive_http_admin_request(struct serverinfo* sinfo,
+        struct http_admin_conn* c)
+{
+        if (reserve_strinfo(&(c->rvstr), MAX_NETBUF_LEN)) {
+                return EXIT_FAILURE;
+        }
+
+        int rcvd = recv(c->sock, c->rvstr.buf + c->rvstr.len,
+                (int) (c->rvstr.sz - c->rvstr.len - 1), 0);
+        if (rcvd <= 0) return EXIT_FAILURE;
+        c->rvstr.len += (size_t) rcvd;
+        c->rvstr.buf[c->rvstr.len] = '\0';
+
+        if (!strstr(c->rvstr.buf, "\r\n\r\n")) {
+                return (HTTP_ADMIN_MAX_REQUEST_LEN < c->rvstr.len
+                        ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        // The only resource is the snapshot ("GET /", "GET /?...")
+        const char* rt = c->rvstr.buf;
+        if (strncmp(rt, "GET /", 5) || (rt[5] != ' ' && rt[5] != '?')) {
+                return write_http_from_code(HTTP_NOT_FOUND, &(c->sdstr),
+                        NULL, 0, NULL, NULL);
+        }
+
+        struct strinfo body = { 0 };
+        initialize_strinfo(&body);
+        int res = write_http_admin_snapshot(sinfo, &body)
+                || write_http_response(&(c->sdstr),
+                http_code_to_str_1_1(HTTP_OK), "application/json",
+                body.len, body.buf, 2, "Cache-Control: no-store",
+                "Connection: close");
+        cleanup_strinfo(&body);
+
+        return (res ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
+// Sends what the socket takes of the response
+//
+// Returns EXIT_FAILURE if the connection is to be closed
+// (failure / the whole response was sent)
+int send_http_admin_response(struct http_admin_conn* c)
+{
+        struct strinfo* s = &(c->sdstr);
+        while (s->adv < s->len) {
+                int sent = send(c->sock, s->buf + s->adv,
+                        (int) (s->len - s->adv), MSG_NOSIGNAL);
+                if (sent <= 0) {
+#ifdef _WIN32
+                        return (sockerrno() == WSAEWOULDBLOCK
+                                ? EXIT_SUCCESS : EXIT_FAILURE);
+#else   // _WIN32
+                        return ((errno == EAGAIN || errno == EWOULDBLOCK)
+                                ? EXIT_SUCCESS : EXIT_FAILURE);
+#endif  // !_WIN32
+                }
+                s->adv += (size_t) sent;
+        }
+
+        return EXIT_FAILURE; // done
+}
+
+
+// Adds the admin sockets to the sets, retries the bind
+void select_http_admin(struct serverinfo* sinfo, fd_set* readfds,
+        fd_set* writefds, SOCKET* max_fd)
+{
+        struct http_admin* admin = get_http_admin();
+        if (admin->on_select) {
+                admin->on_select(sinfo, readfds, writefds, max_fd);
+        }
+
+        // The next process binds the port once this one drains
+        time_t now = time(NULL);
+        if (is_http_server_draining()) {
+                if (validate_socket(admin->serv) && closesocket(admin->serv)) {
+                        psockerror("close() failed");
+                }
+                admin->serv = INVALID_SOCKET;
+        } else if (!validate_socket(admin->serv) && admin->next_bind <= now) {
+                admin->next_bind = now + 1;
+                admin->serv = open_http_admin_socket(admin->port);
+        }
+
+        if (validate_socket(admin->serv)) {
+                FD_SET(admin->serv, readfds);
+                if (*max_fd < admin->serv) *max_fd = admin->serv;
+        }
+
+        for (size_t i = 0; i < HTTP_ADMIN_MAX_CONN; ++i) {
+                struct http_admin_conn* c = &(admin->conns[i]);
+                if (!validate_socket(c->sock)) continue;
+
+                if (admin->since[i] + HTTP_ADMIN_TIMEOUT_SEC <= now) {
+                        close_http_admin_conn(c);
+                        continue;
+                }
+
+                FD_SET(c->sock, (c->sdstr.len ? writefds : readfds));
+                if (*max_fd < c->sock) *max_fd = c->sock;
+        }
+}
+
+
+// Serves the admin connections
+void handle_http_admin(struct serverinfo* sinfo, const fd_set* readfds,
+        const fd_set* writefds)
+{
+        struct http_admin* admin = get_http_admin();
+        if (admin->on_selected) admin->on_selected(sinfo, readfds, writefds);
+
+        for (size_t i = 0; i < HTTP_ADMIN_MAX_CONN; ++i) {
+                struct http_admin_conn* c = &(admin->conns[i]);
+                if (!validate_socket(c->sock)) continue;
+
+                int res = EXIT_SUCCESS;
+                if (!c->sdstr.len && FD_ISSET(c->sock, readfds)) {
+                        res = receive_http_admin_request(sinfo, c);
+                        if (!res && c->sdstr.len) {
+                                res = send_http_admin_response(c);
+                        }
+                } else if (c->sdstr.len && FD_ISSET(c->sock, writefds)) {
+                        res = send_http_admin_response(c);
+                }
+
+                if (res) close_http_admin_conn(c);
+        }
+
+        // Accepted last: the new sockets are not in the sets
+        if (validate_socket(admin->serv) && FD_ISSET(admin->serv, readfds)) {
+                accept_http_admin_conns(admin, time(NULL));
+        }
+}
+
+
+int attach_http_admin(struct serverinfo* sinfo, const char* port)
+{
+        struct http_admin* admin = get_http_admin();
+        if (admin->port[0] || sizeof(admin->port) <= strlen(port)) {
+                return EXIT_FAILURE;
+        }
+        strcpy(admin->port, port);
+
+        for (size_t i = 0; i < HTTP_ADMIN_MAX_CONN; ++i) {
+                admin->conns[i].sock = INVALID_SOCKET;
+                initialize_strinfo(&(admin->conns[i].rvstr));
+                initialize_strinfo(&(admin->conns[i].sdstr));
+        }
+        admin->started = time(NULL);
+        admin->serv = open_http_admin_socket(port);
+        admin->next_bind = admin->started + 1;
+
+        admin->on_select = sinfo->on_select;
+        admin->on_selected = sinfo->on_selected;
+        sinfo->on_select = select_http_admin;
+        sinfo->on_selected = handle_http_admin;
+
+        // Bind retries and the admin timeouts
+        if (sinfo->timeout_ms < 0 || 1000 < sinfo->timeout_ms) {
+                sinfo->timeout_ms = 1000;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+void cleanup_http_admin(void)
+{
+        struct http_admin* admin = get_http_admin();
+        if (validate_socket(admin->serv) && closesocket(admin->serv)) {
+                psockerror("close() failed");
+        }
+        admin->serv = INVALID_SOCKET;
+
+        if (!admin->port[0]) return;
+        for (size_t i = 0; i < HTTP_ADMIN_MAX_CONN; ++i) {
+                close_http_admin_conn(&(admin->conns[i]));
+        }
+        admin->port[0] = '\0';
+}
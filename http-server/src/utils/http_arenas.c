@@ -0,0 +1,89 @@
+#include "../headers/http_arenas.h"
+#include <stdint.h>                     // uintptr_t
+#include <string.h>                     // memcpy()
+
+
+// Adds a block of at least "len" bytes
+struct http_arena_block* grow_http_arena(struct http_arena* arena,
+        const size_t len)
+{
+        size_t sz = HTTP_ARENA_BLOCK_LEN;
+        while (sz < len + HTTP_ARENA_ALIGN) sz *= 2;
+
+        struct http_arena_block* b = (struct http_arena_block*) malloc(
+                sizeof(struct http_arena_block) + sz);
+        if (!b) return NULL;
+
+        b->next = arena->head;
+        b->sz = sz;
+        b->used = 0;
+        arena->head = b;
+        arena->total += sz;
+
+        return b;
+}
+
+
+// Takes "len" aligned bytes of the block (NULL if they don't fit)
+void* take_http_arena_block(struct http_arena_block* b, const size_t len)
+{
+        uintptr_t p = (uintptr_t) (b->data + b->used);
+        size_t pad = (size_t) (-p & (HTTP_ARENA_ALIGN - 1));
+        if (b->sz - b->used < pad + len) return NULL;
+
+        b->used += pad + len;
+        return b->data + b->used - len;
+}
+
+
+void* http_arena_alloc(struct http_arena* arena, const size_t len)
+{
+        if (arena->head) {
+                void* mem = take_http_arena_block(arena->head, len);
+                if (mem) return mem;
+        }
+
+        struct http_arena_block* b = grow_http_arena(arena, len);
+        return (b ? take_http_arena_block(b, len) : NULL);
+}
+
+
+char* http_arena_strndup(struct http_arena* arena, const char* str,
+        const size_t len)
+{
+        char* copy = (char*) http_arena_alloc(arena, len + 1); // + '\0'
+        if (!copy) return NULL;
+
+        if (len) memcpy(copy, str, len);
+        copy[len] = '\0';
+        return copy;
+}
+
+
+void reset_http_arena(struct http_arena* arena)
+{
+        if (!arena->head) return;
+        if (!arena->head->next) {
+                arena->head->used = 0;
+                return;
+        }
+
+        // Merge the blocks (the arena got full once)
+        size_t total = arena->total;
+        cleanup_http_arena(arena);
+        grow_http_arena(arena, total - HTTP_ARENA_ALIGN);
+}
+
+
+void cleanup_http_arena(struct http_arena* arena)
+{
+        struct http_arena_block* b = arena->head;
+        while (b) {
+                struct http_arena_block* next = b->next;
+                free(b);
+                b = next;
+        }
+
+        arena->head = NULL;
+        arena->total = 0;
+}
@@ -0,0 +1,128 @@
+#include "../headers/http_caches.h"
+
+
+struct http_cache* get_http_cache(void)
+{
+        static struct http_cache cache = { 0 };
+        return &cache;
+}
+
+
+int make_http_cache_key(const struct http_request* req,
+        char* key, const size_t sz)
+{
+        // Validators may turn the response into 304, keep the handler
+        if (req->inm) return EXIT_FAILURE;
+
+        // "Connection" and "Accept-Encoding" change the serialized response
+        int len = snprintf(key, sz, "%s %s\n%s\n%s",
+                req->method, req->url,
+                req->conn ? req->conn : "",
+                req->aenc ? req->aenc : "");
+        if (len < 0 || sz <= (size_t) len) return EXIT_FAILURE;
+
+        return EXIT_SUCCESS;
+}
+
+
+// FNV-1a hash of the key, never 0
+uint64_t hash_http_cache_key(const char* key)
+{
+        uint64_t hash = 14695981039346656037ULL;
+        for (const char* cur = key; *cur; ++cur) {
+                hash ^= (unsigned char) *cur;
+                hash *= 1099511628211ULL;
+        }
+
+        return hash ? hash : 1;
+}
+
+
+// Frees the cached response, marks the slot as empty
+void clear_http_cache_entry(struct http_cache_entry* entry)
+{
+        if (entry->hash) --get_http_cache()->count;
+
+        free(entry->key);
+        free(entry->resp);
+        memset(entry, 0, sizeof(*entry));
+}
+
+
+const struct http_cache_entry* http_cache_get(const char* key)
+{
+        struct http_cache* cache = get_http_cache();
+        uint64_t hash = hash_http_cache_key(key);
+        time_t now = time(NULL);
+
+        for (size_t i = 0; i < HTTP_CACHE_PROBES; ++i) {
+                struct http_cache_entry* entry = &(cache->entries[
+                        (hash + i) & (HTTP_CACHE_SLOTS - 1)]);
+                if (entry->hash != hash || strcmp(entry->key, key)) continue;
+
+                if (entry->expires <= now) { // stale
+                        clear_http_cache_entry(entry);
+                        break;
+                }
+
+                ++cache->hits;
+                return entry;
+        }
+
+        ++cache->misses;
+        return NULL;
+}
+
+
+int http_cache_put(const char* key, const char* resp, const size_t len,
+        const unsigned ttl)
+{
+        struct http_cache* cache = get_http_cache();
+        uint64_t hash = hash_http_cache_key(key);
+        time_t now = time(NULL);
+
+        // Same key, empty or stale slot; the one expiring first otherwise
+        struct http_cache_entry* victim = NULL;
+        for (size_t i = 0; i < HTTP_CACHE_PROBES; ++i) {
+                struct http_cache_entry* entry = &(cache->entries[
+                        (hash + i) & (HTTP_CACHE_SLOTS - 1)]);
+                if (!entry->hash || entry->expires <= now
+                        || (entry->hash == hash && !strcmp(entry->key, key))) {
+                        victim = entry;
+                        break;
+                }
+
+                if (!victim || entry->expires < victim->expires) {
+                        victim = entry;
+                }
+        }
+
+        // Copy the response
+        char* key_copy = strdup(key);
+        char* resp_copy = (char*) malloc(len);
+        if (!key_copy || !resp_copy) {
+                free(key_copy);
+                free(resp_copy);
+                return EXIT_FAILURE;
+        }
+        memcpy(resp_copy, resp, len);
+
+        clear_http_cache_entry(victim);
+        victim->hash = hash;
+        victim->key = key_copy;
+        victim->resp = resp_copy;
+        victim->len = len;
+        victim->expires = now + (time_t) ttl;
+        ++cache->count;
+
+        return EXIT_SUCCESS;
+}
+
+
+void cleanup_http_cache(void)
+{
+        struct http_cache* cache = get_http_cache();
+        for (size_t i = 0; i < HTTP_CACHE_SLOTS; ++i) {
+                clear_http_cache_entry(&(cache->entries[i]));
+        }
+}
@@ -4,12 +4,28 @@
 const char* http_code_to_str_1_1(const enum http_code code)
 {
         switch (code) {
+        case HTTP_GATEWAY_TIMEOUT:
+                return "HTTP/1.1 504 Gateway Timeout";
+        case HTTP_SERVICE_UNAVAILABLE:
+                return "HTTP/1.1 503 Service Unavailable";
+        case HTTP_BAD_GATEWAY:
+                return "HTTP/1.1 502 Bad Gateway";
+        case HTTP_NOT_IMPLEMENTED:
+                return "HTTP/1.1 501 Not Implemented";
         case HTTP_INTERNAL_SERVER_ERROR:
                 return "HTTP/1.1 500 Internal Server Error";
+        case HTTP_REQUEST_HEADER_FIELDS_TOO_LARGE:
+                return "HTTP/1.1 431 Request Header Fields Too Large";
+        case HTTP_CONTENT_TOO_LARGE:
+                return "HTTP/1.1 413 Content Too Large";
+        case HTTP_TOO_MANY_REQUESTS:
+                return "HTTP/1.1 429 Too Many Requests";
         case HTTP_NOT_FOUND:
                 return "HTTP/1.1 404 Not Found";
         case HTTP_BAD_REQUEST:
                 return "HTTP/1.1 400 Bad Request";
+        case HTTP_NOT_MODIFIED:
+                return "HTTP/1.1 304 Not Modified";
         case HTTP_OK:
                 return "HTTP/1.1 200 OK";
         default:
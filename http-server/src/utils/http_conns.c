@@ -0,0 +1,232 @@
+#include "../headers/http_conns.h"
+#include "../headers/http_proxies.h"        // abort_http_upconn()
+#include "../headers/http2_sessions.h"      // cleanup_http2_session()
+#include "../headers/tls_conns.h"           // cleanup_tls_conn()
+#include "../headers/ws_sessions.h"         // cleanup_ws_session()
+
+
+// Max request content length (0 - unlimited)
+static size_t http_max_body_len = HTTP_DEF_MAX_BODY_LEN;
+
+
+struct http_conninfo* get_http_conninfo(struct clientinfo* cinfo)
+{
+        if (cinfo->add_data) return (struct http_conninfo*) cinfo->add_data;
+
+        struct http_conninfo* conn = (struct http_conninfo*) calloc(1,
+                sizeof(struct http_conninfo));
+        if (!conn) return NULL;
+
+        cinfo->add_data = conn;
+        cinfo->cleanup_add_data = cleanup_http_conninfo;
+
+        return conn;
+}
+
+
+void cleanup_http_conninfo(void* conn)
+{
+        struct http_conninfo* hconn = (struct http_conninfo*) conn;
+        if (hconn->upc) abort_http_upconn(hconn->upc);
+        if (hconn->h2) cleanup_http2_session(hconn->h2);
+        if (hconn->ws) cleanup_ws_session(hconn->ws);
+        if (hconn->tls) cleanup_tls_conn(hconn->tls);
+        cleanup_http_stream(&(hconn->strm));
+        reset_http_request_receiving(hconn);
+        cleanup_http_arena(&(hconn->arena));
+        free(hconn);
+}
+
+
+void set_http_max_body_len(const size_t len)
+{
+        http_max_body_len = len;
+}
+
+
+size_t get_http_max_body_len(void)
+{
+        return http_max_body_len;
+}
+
+
+// Keeps a piece of the content in memory or in the spill file
+int buffer_http_body(void* data, const char* piece, const size_t len)
+{
+        struct http_conninfo* conn = (struct http_conninfo*) data;
+        struct http_request* req = &(conn->req);
+
+        // Spill to a temporary file once the content gets too long
+        if (!req->body_file
+                && HTTP_MAX_MEM_BODY_LEN < conn->body.len + len) {
+                req->body_file = tmpfile();
+                if (!req->body_file) return EXIT_FAILURE;
+
+                size_t wr = fwrite(conn->body.buf, sizeof(char),
+                        conn->body.len, req->body_file);
+                if (wr != conn->body.len) return EXIT_FAILURE;
+
+                cleanup_strinfo(&(conn->body));
+        }
+
+        if (req->body_file) {
+                size_t wr = fwrite(piece, sizeof(char), len, req->body_file);
+                return wr == len ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        return append_strinfo(&(conn->body), piece, len);
+}
+
+
+// Passes a piece of the content to the route
+int pass_http_body(void* data, const char* piece, const size_t len)
+{
+        struct http_conninfo* conn = (struct http_conninfo*) data;
+        return conn->rt->on_body(&(conn->req), piece, len);
+}
+
+
+int receive_http_body_piece(void* conn, const char* piece, const size_t len)
+{
+        struct http_conninfo* hconn = (struct http_conninfo*) conn;
+        if (hconn->rt && hconn->rt->on_body) {
+                return pass_http_body(conn, piece, len);
+        }
+
+        return buffer_http_body(conn, piece, len);
+}
+
+
+int finish_http_request_body(struct http_conninfo* conn, const size_t total)
+{
+        // Hand the content over to the request
+        struct http_request* req = &(conn->req);
+        req->clen = total;
+        if (req->body_file) {
+                FILE* f = req->body_file;
+                if (fflush(f) || fseek(f, 0, SEEK_SET)) {
+                        reset_http_request_receiving(conn);
+                        return HTTP_INTERNAL_SERVER_ERROR;
+                }
+        } else if (conn->body.buf) {
+                req->content = conn->body.buf;
+                initialize_strinfo(&(conn->body));
+        }
+
+        conn->in_body = 0;
+        return HTTP_OK;
+}
+
+
+// Keeps the settings of the client asking to switch to h2c
+// ("Upgrade: h2c", "Connection: Upgrade, HTTP2-Settings" and
+// "HTTP2-Settings" headers), served as HTTP/1.1 otherwise
+int parse_http2_upgrade(struct http_conninfo* conn)
+{
+        const struct http_headers* hdrs = conn->req.headers;
+        const struct http_header* settings = get_http_header(hdrs,
+                "HTTP2-Settings");
+        if (!has_http_header_token(hdrs, HH_UPGRADE, "h2c")
+                || !has_http_header_token(hdrs, HH_CONNECTION, "upgrade")
+                || !has_http_header_token(hdrs, HH_CONNECTION,
+                "http2-settings")
+                || !settings) {
+                return HTTP_OK;
+        }
+
+        conn->h2c_settings = (char*) settings->value; // request's arena
+        return HTTP_OK;
+}
+
+
+// Keeps the key of the client asking to switch to WebSocket
+// ("Upgrade: websocket", "Connection: Upgrade", version 13)
+int parse_ws_upgrade(struct http_conninfo* conn)
+{
+        const struct http_headers* hdrs = conn->req.headers;
+        const struct http_header* version = get_http_header(hdrs,
+                "Sec-WebSocket-Version");
+        const struct http_header* key = get_http_header(hdrs,
+                "Sec-WebSocket-Key");
+
+        if (!has_http_header_token(hdrs, HH_UPGRADE, "websocket")
+                || !has_http_header_token(hdrs, HH_CONNECTION, "upgrade")
+                || !version || strcmp(version->value, "13")
+                || !key || key->value_len != WS_KEY_LEN) {
+                return HTTP_BAD_REQUEST;
+        }
+
+        conn->ws_key = (char*) key->value; // request's arena
+        return HTTP_OK;
+}
+
+
+int receive_http_request(struct http_conninfo* conn, struct strinfo* rvstr)
+{
+        // Parse the head once it is fully read
+        if (!conn->in_body) {
+                if (http_request_read_status(rvstr->buf) != HTTP_OK) {
+                        // Head does not fit the receive buffer
+                        if (rvstr->sz <= rvstr->len + 1) {
+                                return HTTP_BAD_REQUEST;
+                        }
+
+                        return 0;
+                }
+
+                conn->req.arena = &(conn->arena);
+                int code = parse_http_request(rvstr->buf, &(conn->req));
+                if (code != HTTP_OK) return code;
+
+                conn->dec.max = http_max_body_len;
+                code = parse_http_body_framing(conn->req.headers,
+                        &(conn->dec));
+                if (code != HTTP_OK) {
+                        cleanup_http_request(&(conn->req));
+                        return code;
+                }
+
+                conn->rt = get_http_route(conn->req.method, conn->req.url);
+
+                // Proxied requests are relayed as they are
+                if (conn->rt && conn->rt->proxy) return HTTP_OK;
+
+                code = (conn->rt && conn->rt->ws
+                        ? parse_ws_upgrade(conn)
+                        : parse_http2_upgrade(conn));
+                if (code != HTTP_OK) {
+                        reset_http_request_receiving(conn);
+                        return code;
+                }
+
+                consume_strinfo(rvstr, http_request_head_len(rvstr->buf));
+                conn->in_body = 1;
+        }
+
+        // Decode the received part of the content
+        size_t used = 0;
+        int code = decode_http_body(&(conn->dec), rvstr->buf, rvstr->len,
+                &used, receive_http_body_piece, conn);
+        consume_strinfo(rvstr, used);
+        if (code == 0) return 0; // wait for the rest
+        if (code != HTTP_OK) {
+                reset_http_request_receiving(conn);
+                return code;
+        }
+
+        return finish_http_request_body(conn, conn->dec.total);
+}
+
+
+void reset_http_request_receiving(struct http_conninfo* conn)
+{
+        cleanup_http_request(&(conn->req));
+        cleanup_strinfo(&(conn->body));
+        conn->rt = NULL;
+        conn->in_body = 0;
+
+        // Freed with the arena
+        reset_http_arena(&(conn->arena));
+        conn->h2c_settings = NULL;
+        conn->ws_key = NULL;
+}
@@ -0,0 +1,265 @@
+#include "../headers/http_limits.h"
+#include <stdio.h>                      // printf()
+#include <string.h>                     // memcmp()
+
+#ifndef MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0
+#endif  // !MSG_NOSIGNAL
+
+
+/*
+ * Rate limits of the server
+ *
+ * @rate        Requests a second of an address (0 - unlimited)
+ * @burst       Bucket size of an address
+ * @entries     Buckets of the addresses (open addressing)
+ * @grate       Requests a second of the server (0 - unlimited)
+ * @gburst      Bucket size of the server
+ * @global      Bucket of the server
+ * @max_lag_us  Loop lag the connections are shed at (0 - never)
+ * @stats       Rejected traffic
+ */
+struct http_limits {
+        double rate;
+        double burst;
+        struct http_limit_entry entries[HTTP_LIMIT_SLOTS];
+
+        double grate;
+        double gburst;
+        struct http_bucket global;
+
+        uint64_t max_lag_us;
+        struct http_limit_stats stats;
+};
+
+
+struct http_limits* get_http_limits(void)
+{
+        static struct http_limits limits = { 0 };
+        return &limits;
+}
+
+
+// Responses of the rejected requests, serialized once
+static const char http_limit_429[] =
+        "HTTP/1.1 429 Too Many Requests\r\n"
+        "Content-Length: 0\r\n"
+        "Retry-After: 1\r\n"
+        "Connection: close\r\n\r\n";
+static const char http_limit_503[] =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Content-Length: 0\r\n"
+        "Retry-After: 1\r\n"
+        "Connection: close\r\n\r\n";
+
+
+// Parses "RATE[:BURST]"
+int parse_http_rate(const char* spec, double* rate, double* burst)
+{
+        char* end = NULL;
+        *rate = strtod(spec, &end);
+        if (end == spec || !(0.0 < *rate)) return EXIT_FAILURE;
+
+        *burst = (*rate < 1.0 ? 1.0 : *rate);
+        if (*end == ':') {
+                const char* b = end + 1;
+                *burst = strtod(b, &end);
+                if (end == b || *burst < 1.0) return EXIT_FAILURE;
+        }
+
+        return (*end ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
+int set_http_rate_limit(const char* spec)
+{
+        struct http_limits* limits = get_http_limits();
+        return parse_http_rate(spec, &(limits->rate), &(limits->burst));
+}
+
+
+int set_http_global_rate_limit(const char* spec)
+{
+        struct http_limits* limits = get_http_limits();
+        if (parse_http_rate(spec, &(limits->grate), &(limits->gburst))) {
+                return EXIT_FAILURE;
+        }
+
+        limits->global.tokens = limits->gburst;
+        limits->global.last = get_loop_time_us();
+        return EXIT_SUCCESS;
+}
+
+
+void set_http_max_loop_lag(const int ms)
+{
+        get_http_limits()->max_lag_us = (0 < ms ? (uint64_t) ms * 1000u : 0);
+}
+
+
+// Adds the tokens earned since the last refill (lazily, on use)
+void refill_http_bucket(struct http_bucket* b, const double rate,
+        const double burst, const uint64_t now)
+{
+        if (b->last < now) {
+                b->tokens += (double) (now - b->last) * rate / 1e6;
+                if (burst < b->tokens) b->tokens = burst;
+        }
+        b->last = now;
+}
+
+
+// Gets the IPv6 form of the client's address
+void get_http_limit_addr(const struct clientinfo* cinfo, uint8_t addr[16])
+{
+        memset(addr, 0, 16);
+        if (cinfo->addr.ss_family == AF_INET6) {
+                const struct sockaddr_in6* a6 =
+                        (const struct sockaddr_in6*) &(cinfo->addr);
+                memcpy(addr, &(a6->sin6_addr), 16);
+        } else if (cinfo->addr.ss_family == AF_INET) {
+                const struct sockaddr_in* a4 =
+                        (const struct sockaddr_in*) &(cinfo->addr);
+                addr[10] = 0xff;
+                addr[11] = 0xff;
+                memcpy(addr + 12, &(a4->sin_addr), 4);
+        }
+}
+
+
+// FNV-1a hash of the address
+size_t hash_http_limit_addr(const uint8_t addr[16])
+{
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < 16; ++i) {
+                h ^= addr[i];
+                h *= 16777619u;
+        }
+
+        return (size_t) h;
+}
+
+
+/*
+ * Finds the bucket of the address among its HTTP_LIMIT_PROBES slots
+ *
+ * Description: a new address takes a free slot or the slot
+ * of the fullest bucket (a refilled one is the same
+ * as a new one, the address loses nothing)
+ */
+struct http_bucket* find_http_limit_bucket(struct http_limits* limits,
+        const uint8_t addr[16], const uint64_t now)
+{
+        size_t idx = hash_http_limit_addr(addr);
+        struct http_limit_entry* victim = NULL;
+        for (size_t i = 0; i < HTTP_LIMIT_PROBES; ++i) {
+                struct http_limit_entry* e =
+                        &(limits->entries[(idx + i) & (HTTP_LIMIT_SLOTS - 1)]);
+
+                // Slots are never freed: the address can't be further
+                if (!e->used) {
+                        if (!victim) victim = e;
+                        break;
+                }
+                if (!memcmp(e->addr, addr, 16)) return &(e->bucket);
+
+                refill_http_bucket(&(e->bucket), limits->rate, limits->burst,
+                        now);
+                if (!victim || victim->bucket.tokens < e->bucket.tokens) {
+                        victim = e;
+                }
+        }
+
+        memcpy(victim->addr, addr, 16);
+        victim->used = 1;
+        victim->bucket.tokens = limits->burst;
+        victim->bucket.last = now;
+        return &(victim->bucket);
+}
+
+
+enum http_code check_http_rate_limit(const struct clientinfo* cinfo)
+{
+        struct http_limits* limits = get_http_limits();
+        if (!limits->rate && !limits->grate) return HTTP_OK;
+
+        uint64_t now = get_loop_time_us();
+        struct http_bucket* b = NULL;
+        if (limits->rate) {
+                uint8_t addr[16];
+                get_http_limit_addr(cinfo, addr);
+                b = find_http_limit_bucket(limits, addr, now);
+                refill_http_bucket(b, limits->rate, limits->burst, now);
+                if (b->tokens < 1.0) {
+                        ++(limits->stats.limited);
+                        return HTTP_TOO_MANY_REQUESTS;
+                }
+        }
+
+        if (limits->grate) {
+                struct http_bucket* g = &(limits->global);
+                refill_http_bucket(g, limits->grate, limits->gburst, now);
+                if (g->tokens < 1.0) {
+                        ++(limits->stats.overloaded);
+                        return HTTP_SERVICE_UNAVAILABLE;
+                }
+                g->tokens -= 1.0;
+        }
+
+        if (b) b->tokens -= 1.0;
+        return HTTP_OK;
+}
+
+
+int write_http_limit_response(const enum http_code code, struct strinfo* out)
+{
+        if (code == HTTP_TOO_MANY_REQUESTS) {
+                return append_strinfo(out, http_limit_429,
+                        sizeof(http_limit_429) - 1);
+        }
+
+        return append_strinfo(out, http_limit_503, sizeof(http_limit_503) - 1);
+}
+
+
+int admit_http_client(struct serverinfo* sinfo)
+{
+        struct http_limits* limits = get_http_limits();
+        int lagging = (limits->max_lag_us
+                && limits->max_lag_us < sinfo->lag_us);
+        if (!lagging && 0 <= find_place_for_client(sinfo)) return 1;
+
+        // Answered right away: the clients don't wait for a timeout
+        size_t shed = 0;
+        while (shed < ACCEPT_BUDGET) {
+                SOCKET client = accept(sinfo->serv, NULL, NULL);
+                if (!validate_socket(client)) {
+                        if (sockerrno() != EWOULDBLOCK
+                                && sockerrno() != EAGAIN) {
+                                psockerror("accept() failed");
+                        }
+
+                        break;
+                }
+
+                if (send(client, http_limit_503,
+                        (int) sizeof(http_limit_503) - 1, MSG_NOSIGNAL) < 0) {
+                        psockerror("send() failed");
+                }
+                if (closesocket(client)) psockerror("close() failed");
+                ++shed;
+        }
+
+        limits->stats.shed += shed;
+        if (shed) {
+                printf("Shed %zu connection(s) (%s)\n", shed,
+                        lagging ? "loop lag" : "full");
+        }
+        return 0;
+}
+
+
+const struct http_limit_stats* get_http_limit_stats(void)
+{
+        return &(get_http_limits()->stats);
+}
@@ -1,257 +1,685 @@
 #include "../headers/http_parsers.h"
+#include "../headers/http_traces.h"     // HTTP_TRACE_BEGIN(), ...
 
+#include <ctype.h>                      // tolower()
 
-void cleanup_http_request(struct http_request* req)
+
+
+/*
+ * HEADERS
+ */
+
+
+
+// Finds "\r\n" in the first "len" bytes of "in"
+const char* find_http_line_end(const char* in, const size_t len)
 {
-        if (req->method) free(req->method);
-        if (req->url) free(req->url);
-        if (req->conn) free(req->conn);
-        if (req->ctype) free(req->ctype);
-        if (req->content) free(req->content);
+        for (size_t i = 0; i + 1 < len; ++i) {
+                if (in[i] == '\r' && in[i + 1] == '\n') return in + i;
+        }
 
-        req->method = NULL;
-        req->url = NULL;
-        req->conn = NULL;
-        req->ctype = NULL;
-        req->content = NULL;
-        req->clen = 0;
+        return NULL;
 }
 
 
-enum http_code parse_http_header(const char* const req,
-        char* header, char** dest)
+// FNV-1a hash of the lowercase name
+uint32_t hash_http_header_name(const char* name, const size_t len)
 {
-        // Move to the start of the header
-        char* start = strstr(req, header);
-        if (!start) return HTTP_OK;
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < len; ++i) {
+                h ^= (uint32_t) tolower((unsigned char) name[i]);
+                h *= 16777619u;
+        }
 
-        // Define header value bounds
-        start += strlen(header) + 2; // + ": "
-        char* end = strstr(start, "\r\n");
-        if (!end) return HTTP_BAD_REQUEST;
+        return h;
+}
 
-        // Allocate memory for the header value
-        size_t len = end - start;
-        (*dest) = (char*) calloc(len + 1, sizeof(char)); // for '\0'
-        if (!*dest) return HTTP_INTERNAL_SERVER_ERROR;
 
-        // Copy the header value
-        memcpy(*dest, start, end - start);
+// Compares the names ignoring the case
+int equal_http_header_names(const char* a, const char* b, const size_t len)
+{
+        for (size_t i = 0; i < len; ++i) {
+                if (tolower((unsigned char) a[i])
+                        != tolower((unsigned char) b[i])) {
+                        return 0;
+                }
+        }
 
-        return HTTP_OK;
+        return 1;
 }
 
 
-enum http_code parse_http_method(const char* const req, char** method)
+/*
+ * Name of a common header
+ *
+ * @name  Lowercase name
+ * @len   Length of "name"
+ * @hash  Hash of "name"
+ */
+struct http_known_header {
+        const char* name;
+        size_t len;
+        uint32_t hash;
+};
+
+
+// Gets the names of the common headers (indexed by the identifiers),
+// their hashes are computed on the first use
+const struct http_known_header* get_http_known_headers(void)
 {
-        // Allocate memory for the longest method (OPTIONS / CONNECT)
-        *method = (char*) calloc(8, sizeof(char));
-        if (!*method) return HTTP_INTERNAL_SERVER_ERROR; // no memory
-
-        char* mp = strchr(req, ' '); // first space (e.g GET_)
-        if (!mp) return HTTP_BAD_REQUEST;
-
-        memcpy(*method, req, mp - req); // copy the method
-
-        // Validate the method
-        if (strcmp(*method, "GET")) return HTTP_OK;
-        if (strcmp(*method, "POST")) return HTTP_OK;
-        if (strcmp(*method, "PUT")) return HTTP_OK;
-        if (strcmp(*method, "DELETE")) return HTTP_OK;
-        if (strcmp(*method, "PATCH")) return HTTP_OK;
-        if (strcmp(*method, "HEAD")) return HTTP_OK;
-        if (strcmp(*method, "OPTIONS")) return HTTP_OK;
-        if (strcmp(*method, "TRACE")) return HTTP_OK;
-        if (strcmp(*method, "CONNECT")) return HTTP_OK;
-
-
-        // Free the allocated memory on fail
-        free(*method);
-        return HTTP_BAD_REQUEST;
+        static struct http_known_header known[HH_COUNT] = {
+                [HH_HOST] = { .name = "host" },
+                [HH_CONNECTION] = { .name = "connection" },
+                [HH_CONTENT_LENGTH] = { .name = "content-length" },
+                [HH_CONTENT_TYPE] = { .name = "content-type" },
+                [HH_TRANSFER_ENCODING] = { .name = "transfer-encoding" },
+                [HH_ACCEPT_ENCODING] = { .name = "accept-encoding" },
+                [HH_IF_NONE_MATCH] = { .name = "if-none-match" },
+                [HH_RANGE] = { .name = "range" },
+                [HH_UPGRADE] = { .name = "upgrade" }
+        };
+        static int hashed = 0;
+
+        if (!hashed) {
+                for (size_t i = HH_OTHER + 1; i < HH_COUNT; ++i) {
+                        known[i].len = strlen(known[i].name);
+                        known[i].hash = hash_http_header_name(known[i].name,
+                                known[i].len);
+                }
+                hashed = 1;
+        }
+
+        return known;
 }
 
 
-enum http_code parse_http_url(const char* const req, char** url)
+// Identifies a common header by the hash of its name
+enum http_header_id identify_http_header(const char* name, const size_t len,
+        const uint32_t hash)
 {
-        char* start = strchr(req, ' ');
-        if (!start) return HTTP_BAD_REQUEST;
+        const struct http_known_header* known = get_http_known_headers();
+        for (size_t i = HH_OTHER + 1; i < HH_COUNT; ++i) {
+                if (known[i].hash == hash && known[i].len == len
+                        && equal_http_header_names(known[i].name, name, len)) {
+                        return (enum http_header_id) i;
+                }
+        }
 
-        start += 1;
-        char* end = strchr(start,  ' ');
-        if (!end) return HTTP_BAD_REQUEST;
+        return HH_OTHER;
+}
 
-        *url = (char*) calloc(end - start + 1, sizeof(char)); // + '\0'
-        if (!*url) return HTTP_INTERNAL_SERVER_ERROR;
 
-        memcpy(*url, start, end - start);
-        return HTTP_OK;
+void initialize_http_headers(struct http_headers* hdrs)
+{
+        hdrs->count = 0;
+        memset(hdrs->known, 0, sizeof(hdrs->known));
 }
 
 
-enum http_code parse_http_version(const char* const req, char** ver)
+enum http_code add_http_header(struct http_headers* hdrs,
+        const char* name, const size_t name_len,
+        const char* value, const size_t value_len)
 {
-        const size_t http_ver_bufsz = 9; // "HTTP/1.1" + '\0'
-        *ver = (char*) calloc(http_ver_bufsz, sizeof(char));
-        if (!ver) return HTTP_INTERNAL_SERVER_ERROR;
-
-        char* start = strstr(req, "HTTP/");
-        if (!start) return HTTP_BAD_REQUEST;
-        char* end = strstr(start, "\r\n");
-        if (!end || http_ver_bufsz < (size_t) (end - start)) {
+        if (HTTP_MAX_HEADERS <= hdrs->count) {
+                return HTTP_REQUEST_HEADER_FIELDS_TOO_LARGE;
+        }
+
+        struct http_header* h = &(hdrs->list[hdrs->count]);
+        h->name = name;
+        h->name_len = name_len;
+        h->value = value;
+        h->value_len = value_len;
+        h->hash = hash_http_header_name(name, name_len);
+        h->id = identify_http_header(name, name_len, h->hash);
+        ++(hdrs->count);
+
+        if (h->id == HH_OTHER) return HTTP_OK;
+        if (!hdrs->known[h->id]) {
+                hdrs->known[h->id] = (uint8_t) hdrs->count;
+                return HTTP_OK;
+        }
+
+        // Ambiguous message target / framing
+        const struct http_header* first =
+                &(hdrs->list[hdrs->known[h->id] - 1]);
+        if (h->id == HH_HOST || h->id == HH_TRANSFER_ENCODING) {
+                return HTTP_BAD_REQUEST;
+        }
+        if (h->id == HH_CONTENT_LENGTH && (first->value_len != value_len
+                || memcmp(first->value, value, value_len))) {
                 return HTTP_BAD_REQUEST;
         }
 
-        memcpy(*ver, start, end - start);
         return HTTP_OK;
 }
 
 
-enum http_code parse_http_content(const char* const req,
-        char** content, const size_t clen)
+// Checks if the character is a space or a tab
+static inline
+int is_http_ows(const char c)
 {
-        if (!clen) return HTTP_OK; // nothing to parse
+        return c == ' ' || c == '\t';
+}
 
-        char* start = strstr(req, "\r\n\r\n");
-        if (!start) return HTTP_BAD_REQUEST;
 
-        start += 4;
-        if (strlen(start) < clen) return HTTP_BAD_REQUEST;
+enum http_code parse_http_headers(const char* head, const size_t head_len,
+        struct http_headers* hdrs)
+{
+        initialize_http_headers(hdrs);
+
+        // Skip the start line
+        const char* end = head + head_len;
+        const char* line = find_http_line_end(head, head_len);
+        if (!line) return HTTP_BAD_REQUEST;
+        line += 2; // + "\r\n"
+
+        while (line < end) {
+                const char* eol = find_http_line_end(line,
+                        (size_t) (end - line));
+                if (!eol) return HTTP_BAD_REQUEST;
+                if (eol == line) return HTTP_OK; // blank line
+
+                // Folded lines are obsolete, no whitespace before ':'
+                const char* colon = memchr(line, ':', (size_t) (eol - line));
+                if (!colon || colon == line) return HTTP_BAD_REQUEST;
+                for (const char* c = line; c < colon; ++c) {
+                        if (is_http_ows(*c)) return HTTP_BAD_REQUEST;
+                }
 
-        *content = (char*) calloc(clen, sizeof(char));\
-        if (!*content) return HTTP_INTERNAL_SERVER_ERROR;
+                const char* value = colon + 1;
+                const char* value_end = eol;
+                while (value < value_end && is_http_ows(*value)) ++value;
+                while (value < value_end && is_http_ows(value_end[-1])) {
+                        --value_end;
+                }
 
-        memcpy(*content, start, clen);
-        return HTTP_OK;
+                int code = add_http_header(hdrs, line, (size_t) (colon - line),
+                        value, (size_t) (value_end - value));
+                if (code != HTTP_OK) return code;
+
+                line = eol + 2; // + "\r\n"
+        }
+
+        return HTTP_BAD_REQUEST; // no blank line
 }
 
 
-enum http_code parse_http_content_length(const char* const rbuf, size_t* clen)
+const struct http_header* get_http_known_header(
+        const struct http_headers* hdrs, const enum http_header_id id)
 {
-        char* content_len = NULL;
-        int code = parse_http_header(rbuf, "Content-Length", &content_len);
-        if (code != HTTP_OK) return code;
+        if (!hdrs || id <= HH_OTHER || HH_COUNT <= id || !hdrs->known[id]) {
+                return NULL;
+        }
 
-        if (content_len) {
-                char* end = NULL;
-                int len = strtol(content_len, &end, 10);
+        return &(hdrs->list[hdrs->known[id] - 1]);
+}
 
-                char endval = *end;
-                free(content_len);
 
-                if (endval != '\0' || len < 0) {
-                        return HTTP_BAD_REQUEST;
+const struct http_header* get_http_header(const struct http_headers* hdrs,
+        const char* name)
+{
+        if (!hdrs) return NULL;
+
+        size_t len = strlen(name);
+        uint32_t hash = hash_http_header_name(name, len);
+        for (size_t i = 0; i < hdrs->count; ++i) {
+                const struct http_header* h = &(hdrs->list[i]);
+                if (h->hash == hash && h->name_len == len
+                        && equal_http_header_names(h->name, name, len)) {
+                        return h;
                 }
+        }
+
+        return NULL;
+}
 
-                *clen = (size_t) len;
+
+int next_http_list_token(const char** cur, const char* end,
+        const char** tok, size_t* len)
+{
+        while (*cur < end) {
+                const char* comma = memchr(*cur, ',', (size_t) (end - *cur));
+                const char* start = *cur;
+                const char* stop = (comma ? comma : end);
+                *cur = (comma ? comma + 1 : end);
+
+                while (start < stop && is_http_ows(*start)) ++start;
+                while (start < stop && is_http_ows(stop[-1])) --stop;
+                if (start == stop) continue; // empty element
+
+                *tok = start;
+                *len = (size_t) (stop - start);
+                return 1;
         }
 
-        return HTTP_OK;
+        return 0;
+}
+
+
+int has_http_header_token(const struct http_headers* hdrs,
+        const enum http_header_id id, const char* token)
+{
+        const struct http_header* first = get_http_known_header(hdrs, id);
+        if (!first) return 0;
+
+        size_t tlen = strlen(token);
+        for (size_t i = (size_t) (first - hdrs->list); i < hdrs->count; ++i) {
+                const struct http_header* h = &(hdrs->list[i]);
+                if (h->id != id) continue;
+
+                const char* cur = h->value;
+                const char* end = h->value + h->value_len;
+                const char* tok = NULL;
+                size_t len = 0;
+                while (next_http_list_token(&cur, end, &tok, &len)) {
+                        if (len == tlen
+                                && equal_http_header_names(tok, token, len)) {
+                                return 1;
+                        }
+                }
+        }
+
+        return 0;
 }
 
 
-int move_http_request(struct strinfo* reqstr, size_t content_len)
+
+
+/*
+ * REQUESTS
+ */
+
+
+
+void cleanup_http_request(struct http_request* req)
 {
-        char* end = strstr(reqstr->buf, "\r\n\r\n");
-        if (!end) return EXIT_FAILURE;
+        if (req->content) free(req->content);
+        if (req->body_file) fclose(req->body_file);
+        if (req->arena) reset_http_arena(req->arena);
+
+        req->method = NULL;
+        req->url = NULL;
+        req->http_ver = NULL;
+        req->host = NULL;
+        req->conn = NULL;
+        req->ctype = NULL;
+        req->aenc = NULL;
+        req->inm = NULL;
+        req->content = NULL;
+        req->clen = 0;
+        req->body_file = NULL;
+        req->add_data = NULL;
+        req->headers = NULL;
+}
 
-        end += content_len + 4; // skip "\r\n\r\n"
 
-        // Move the request
-        size_t mv_len = strlen(end) + 1; // + '\0'
-        memmove(reqstr->buf, end, mv_len);
-        
-        return EXIT_SUCCESS;
+struct http_headers* create_http_request_headers(struct http_request* req)
+{
+        req->headers = (struct http_headers*) http_arena_alloc(req->arena,
+                sizeof(struct http_headers));
+        if (req->headers) initialize_http_headers(req->headers);
+
+        return req->headers;
 }
 
 
-int http_request_read_status(const char* const req)
+// Gets the null-terminated value of the common header (NULL if absent)
+char* get_http_request_field(const struct http_request* req,
+        const enum http_header_id id)
 {
-        char* content = strstr(req, "\r\n\r\n");
-        if (!content) return 0;
+        const struct http_header* h = get_http_known_header(req->headers, id);
+        return (h ? (char*) h->value : NULL);
+}
 
-        content += 4; // "\r\n\r\n";
 
-        char* content_len = NULL;
-        int phh_res = parse_http_header(req, "Content-Length", &content_len);
-        if (phh_res == HTTP_INTERNAL_SERVER_ERROR) return phh_res;
+void set_http_request_fields(struct http_request* req)
+{
+        req->host = get_http_request_field(req, HH_HOST);
+        req->conn = get_http_request_field(req, HH_CONNECTION);
+        req->ctype = get_http_request_field(req, HH_CONTENT_TYPE);
+        req->aenc = get_http_request_field(req, HH_ACCEPT_ENCODING);
+        req->inm = get_http_request_field(req, HH_IF_NONE_MATCH);
+}
 
-        if (content_len) {
-                char* end = NULL;
-                int len = strtol(content_len, &end, 10);
-                
-                char endval = *end;
-                int cur_len = (int) strlen(content);
-                free(content_len);
 
-                if (endval != '\0' || len < 0) {
-                        return HTTP_BAD_REQUEST;
+// Checks if the method is a known one
+int is_http_method(const char* method, const size_t len)
+{
+        const char* const methods[] = { "GET", "POST", "PUT", "DELETE",
+                "PATCH", "HEAD", "OPTIONS", "TRACE", "CONNECT" };
+        for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); ++i) {
+                if (strlen(methods[i]) == len
+                        && !memcmp(methods[i], method, len)) {
+                        return 1;
                 }
+        }
+
+        return 0;
+}
 
-                if (len <= cur_len) return HTTP_OK;
-                return 0; // Not read yet
+
+/*
+ * Splits the request line of the head copy
+ * ("METHOD URL HTTP/x.y", the parts are null-terminated in place)
+ *
+ * Returns:
+ *      - Success: HTTP_OK
+ *      - Malformed line: HTTP_BAD_REQUEST
+ */
+enum http_code parse_http_request_line(char* head, const size_t head_len,
+        struct http_request* req)
+{
+        char* eol = (char*) find_http_line_end(head, head_len);
+        if (!eol) return HTTP_BAD_REQUEST;
+
+        char* sp1 = memchr(head, ' ', (size_t) (eol - head));
+        if (!sp1 || !is_http_method(head, (size_t) (sp1 - head))) {
+                return HTTP_BAD_REQUEST;
         }
 
+        char* url = sp1 + 1;
+        char* sp2 = memchr(url, ' ', (size_t) (eol - url));
+        if (!sp2 || sp2 == url) return HTTP_BAD_REQUEST;
+
+        const size_t http_ver_len = 8; // "HTTP/1.1"
+        char* ver = sp2 + 1;
+        if (http_ver_len < (size_t) (eol - ver) || strncmp(ver, "HTTP/", 5)) {
+                return HTTP_BAD_REQUEST;
+        }
+
+        *sp1 = '\0';
+        *sp2 = '\0';
+        *eol = '\0';
+        req->method = head;
+        req->url = url;
+        req->http_ver = ver;
         return HTTP_OK;
 }
 
 
+int http_request_read_status(const char* const req)
+{
+        HTTP_TRACE_BEGIN(read_status);
+        int status = (strstr(req, "\r\n\r\n") ? HTTP_OK : 0);
+        HTTP_TRACE_END(read_status, HTS_READ_STATUS, status);
+
+        return status;
+}
+
+
+size_t http_request_head_len(const char* const req)
+{
+        char* end = strstr(req, "\r\n\r\n");
+        if (!end) return 0;
+
+        return (size_t) (end - req) + 4; // + "\r\n\r\n"
+}
+
+
 enum http_code parse_http_request(const char* const rbuf,
         struct http_request* req)
 {
-        // Parse the method
-        int code = parse_http_method(rbuf, &req->method);    
-        if (code != HTTP_OK) goto out_cleanup_req_return_err;
+        HTTP_TRACE_BEGIN(parse);
 
-        // Parse the URL
-        code = parse_http_url(rbuf, &(req->url));
-        if (code != HTTP_OK) goto out_cleanup_req_return_err;
+        // Copy the head once, the fields are its slices
+        int code = HTTP_BAD_REQUEST;
+        size_t head_len = http_request_head_len(rbuf);
+        if (!head_len) goto out_cleanup_req_return_err;
 
-        // Parse the version
-        code = parse_http_version(rbuf, &(req->http_ver));
-        if (code != HTTP_OK) goto out_cleanup_req_return_err;
+        code = HTTP_INTERNAL_SERVER_ERROR;
+        char* head = http_arena_strndup(req->arena, rbuf, head_len);
+        if (!head || !create_http_request_headers(req)) {
+                goto out_cleanup_req_return_err;
+        }
 
-        // Parse the "Host" header
-        code = parse_http_header(rbuf, "Host", &(req->host));
+        // Parse the headers before the request line is split
+        code = parse_http_headers(head, head_len, req->headers);
         if (code != HTTP_OK) goto out_cleanup_req_return_err;
 
-        // Parse the "Connection" header
-        code = parse_http_header(rbuf, "Connection", &(req->conn));
+        code = parse_http_request_line(head, head_len, req);
         if (code != HTTP_OK) goto out_cleanup_req_return_err;
 
-        // Parse the "Content-Type" header
-        code = parse_http_header(rbuf, "Content-Type", &(req->ctype));
-        if (code != HTTP_OK) goto out_cleanup_req_return_err;
+        // Terminate the values in place (the line ends aren't needed)
+        for (size_t i = 0; i < req->headers->count; ++i) {
+                struct http_header* h = &(req->headers->list[i]);
+                ((char*) h->value)[h->value_len] = '\0';
+        }
+        set_http_request_fields(req);
+
+        HTTP_TRACE_END(parse, HTS_PARSE, HTTP_OK);
+        return HTTP_OK;
+
+out_cleanup_req_return_err:
+        cleanup_http_request(req);
+        HTTP_TRACE_END(parse, HTS_PARSE, code);
+        return code;
+}
+
+
+
+/*
+ * REQUEST BODIES
+ */
+
+
+
+/*
+ * Checks the codings of "Transfer-Encoding": "chunked" is
+ * the only one decoded, it has to be applied last and once
+ *
+ * Returns:
+ *      - "chunked" only: HTTP_OK
+ *      - Other codings before "chunked": HTTP_NOT_IMPLEMENTED
+ *      - Not chunked last / repeated / no codings: HTTP_BAD_REQUEST
+ */
+enum http_code check_http_transfer_coding(const struct http_header* te)
+{
+        const char* cur = te->value;
+        const char* end = te->value + te->value_len;
+        const char* tok = NULL;
+        size_t len = 0;
+        size_t chunked = 0;
+        size_t others = 0;
+        int last_chunked = 0;
+        while (next_http_list_token(&cur, end, &tok, &len)) {
+                last_chunked = (len == 7
+                        && equal_http_header_names(tok, "chunked", len));
+                if (last_chunked) ++chunked;
+                else ++others;
+        }
+
+        // The length of the message is unknown otherwise
+        if (!last_chunked || chunked != 1) return HTTP_BAD_REQUEST;
+        if (others) return HTTP_NOT_IMPLEMENTED;
+
+        return HTTP_OK;
+}
+
+
+enum http_code parse_http_body_framing(const struct http_headers* hdrs,
+        struct http_body_decoder* dec)
+{
+        dec->total = 0;
 
         // Parse the "Content-Length" header
-        code = parse_http_content_length(rbuf, &(req->clen));
-        if (code != HTTP_OK) goto out_cleanup_req_return_err;
+        const struct http_header* cl = get_http_known_header(hdrs,
+                HH_CONTENT_LENGTH);
+        if (cl && !cl->value_len) return HTTP_BAD_REQUEST;
+
+        size_t clen = 0;
+        for (size_t i = 0; cl && i < cl->value_len; ++i) {
+                char c = cl->value[i];
+                if (c < '0' || '9' < c
+                        || (((size_t) -1) - (size_t) (c - '0')) / 10 < clen) {
+                        return HTTP_BAD_REQUEST;
+                }
+                clen = clen * 10 + (size_t) (c - '0');
+        }
 
-        // Parse the content
-        code = parse_http_content(rbuf, &(req->content), req->clen);
-        if (code != HTTP_OK) goto out_cleanup_req_return_err;
+        // Parse the "Transfer-Encoding" header
+        const struct http_header* te = get_http_known_header(hdrs,
+                HH_TRANSFER_ENCODING);
+        if (te) {
+                // Both framings at once may be used for request smuggling
+                if (cl) return HTTP_BAD_REQUEST;
+
+                int code = check_http_transfer_coding(te);
+                if (code != HTTP_OK) return code;
+
+                dec->state = HBS_CHUNK_SIZE;
+                dec->left = 0;
+                return HTTP_OK;
+        }
+
+        if (dec->max && dec->max < clen) return HTTP_CONTENT_TOO_LARGE;
 
+        dec->state = (clen ? HBS_LENGTH : HBS_DONE);
+        dec->left = clen;
         return HTTP_OK;
+}
 
-out_cleanup_req_return_err:
-        cleanup_http_request(req);
+
+// Parses a chunk size line (hex size, optional extensions)
+enum http_code parse_http_chunk_size(const char* line, const char* end,
+        size_t* sz)
+{
+        size_t res = 0;
+        const char* cur = line;
+        for (; cur < end; ++cur) {
+                int digit = -1;
+                if ('0' <= *cur && *cur <= '9') digit = *cur - '0';
+                else if ('a' <= *cur && *cur <= 'f') digit = *cur - 'a' + 10;
+                else if ('A' <= *cur && *cur <= 'F') digit = *cur - 'A' + 10;
+                else break;
+
+                if (res > (((size_t) -1) >> 4)) return HTTP_BAD_REQUEST;
+                res = (res << 4) | (size_t) digit;
+        }
+
+        // At least one digit, then extensions only
+        if (cur == line) return HTTP_BAD_REQUEST;
+        if (cur != end && *cur != ';' && *cur != ' ' && *cur != '\t') {
+                return HTTP_BAD_REQUEST;
+        }
+
+        *sz = res;
+        return HTTP_OK;
+}
+
+
+int decode_http_body(struct http_body_decoder* dec,
+        const char* in, const size_t len, size_t* used,
+        int (*on_data)(void* data, const char* piece, const size_t len),
+        void* data)
+{
+        size_t pos = 0;
+        int code = 0;
+
+        while (dec->state != HBS_DONE) {
+                switch (dec->state) {
+                case HBS_LENGTH:
+                case HBS_CHUNK_DATA: {
+                        size_t n = len - pos;
+                        if (dec->left < n) n = dec->left;
+                        if (!n) goto out_set_used;
+
+                        if (on_data(data, in + pos, n)) {
+                                code = HTTP_INTERNAL_SERVER_ERROR;
+                                goto out_set_used;
+                        }
+
+                        pos += n;
+                        dec->left -= n;
+                        dec->total += n;
+                        if (dec->left) goto out_set_used;
+
+                        dec->state = (dec->state == HBS_LENGTH ?
+                                HBS_DONE : HBS_CHUNK_CRLF);
+                        break;
+                }
+                case HBS_CHUNK_SIZE: {
+                        const char* eol = find_http_line_end(in + pos,
+                                len - pos);
+                        if (!eol) {
+                                if (HTTP_MAX_LINE_LEN < len - pos) {
+                                        code = HTTP_BAD_REQUEST;
+                                }
+                                goto out_set_used;
+                        }
+
+                        size_t sz = 0;
+                        if (parse_http_chunk_size(in + pos, eol, &sz)
+                                != HTTP_OK) {
+                                code = HTTP_BAD_REQUEST;
+                                goto out_set_used;
+                        }
+
+                        // Rejected before the chunk is received
+                        if (dec->max && dec->max - dec->total < sz) {
+                                code = HTTP_CONTENT_TOO_LARGE;
+                                goto out_set_used;
+                        }
+
+                        pos = (size_t) (eol - in) + 2; // + "\r\n"
+                        dec->left = sz;
+                        dec->state = (sz ? HBS_CHUNK_DATA : HBS_TRAILERS);
+                        break;
+                }
+                case HBS_CHUNK_CRLF:
+                        if (len - pos < 2) goto out_set_used;
+                        if (in[pos] != '\r' || in[pos + 1] != '\n') {
+                                code = HTTP_BAD_REQUEST;
+                                goto out_set_used;
+                        }
+
+                        pos += 2;
+                        dec->state = HBS_CHUNK_SIZE;
+                        break;
+                case HBS_TRAILERS: {
+                        // Trailers are skipped up to the blank line
+                        const char* eol = find_http_line_end(in + pos,
+                                len - pos);
+                        if (!eol) {
+                                if (HTTP_MAX_LINE_LEN < len - pos) {
+                                        code = HTTP_BAD_REQUEST;
+                                }
+                                goto out_set_used;
+                        }
+
+                        if (eol == in + pos) dec->state = HBS_DONE;
+                        pos = (size_t) (eol - in) + 2; // + "\r\n"
+                        break;
+                }
+                default:
+                        dec->state = HBS_DONE;
+                        break;
+                }
+        }
+
+        code = HTTP_OK;
+
+out_set_used:
+        *used = pos;
         return code;
 }
 
 
 enum http_code validate_http_1_1_request(char* rbuf)
 {
-        struct http_request req = { 0 };
+        struct http_arena arena = { 0 };
+        struct http_request req = { .arena = &arena };
         int code = parse_http_request(rbuf, &req);
         if (code != HTTP_OK) goto out_cleanup_req;
 
         // Method, URL, version are not NULL
         if (!req.host || strcmp(req.http_ver, "HTTP/1.1")) {
-                return HTTP_BAD_REQUEST;
+                code = HTTP_BAD_REQUEST;
         }
 
         // TODO: check the structure
 
 out_cleanup_req:
         cleanup_http_request(&req);
+        cleanup_http_arena(&arena);
         return code;
 }
@@ -0,0 +1,1284 @@
+#include "../headers/http_proxies.h"
+#include "../headers/sockshelp.h"       // set_socket_nonblocking()
+#include "../headers/http_writers.h"    // write_http_from_code()
+
+#ifdef _WIN32
+        #define strncasecmp _strnicmp
+        #define EINPROGRESS WSAEWOULDBLOCK
+#else   // _WIN32
+        #include <strings.h>            // strncasecmp()
+#endif  // !_WIN32
+
+#ifndef MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0
+#endif  // !MSG_NOSIGNAL
+
+#define HTTP_HASH_SEED 2166136261u      // FNV-1a offset basis
+
+
+// Proxies of the server
+struct http_proxies {
+        struct http_proxy* list[HTTP_MAX_PROXIES];
+        size_t count;
+};
+
+
+struct http_proxies* get_http_proxies(void)
+{
+        static struct http_proxies proxies = { 0 };
+        return &proxies;
+}
+
+
+// Bytes of the string not sent yet
+static inline
+size_t http_pending_len(const struct strinfo* str)
+{
+        return str->len - str->adv;
+}
+
+
+// Milliseconds of a monotonic clock
+uint64_t http_now_ms(void)
+{
+#ifdef _WIN32
+        return (uint64_t) GetTickCount64();
+#else   // _WIN32
+        struct timespec ts = { 0 };
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+#endif  // !_WIN32
+}
+
+
+// FNV-1a hash of the bytes (continues "hash")
+uint32_t hash_http_bytes(uint32_t hash, const void* data, const size_t len)
+{
+        const unsigned char* bytes = (const unsigned char*) data;
+        for (size_t i = 0; i < len; ++i) {
+                hash ^= bytes[i];
+                hash *= 16777619u;
+        }
+
+        return hash;
+}
+
+
+// Spreads the bits of the hash over the ring (MurmurHash3 finalizer)
+static inline
+uint32_t mix_http_hash(uint32_t hash)
+{
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6bu;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35u;
+        hash ^= hash >> 16;
+        return hash;
+}
+
+
+// Resolves "HOST:PORT" ("[ADDR]:PORT" for IPv6)
+int resolve_http_upstream(struct http_upstream* up, const char* name,
+        const size_t len)
+{
+        if (!len || sizeof(up->name) <= len) return EXIT_FAILURE;
+        memcpy(up->name, name, len);
+        up->name[len] = '\0';
+
+        char host[MAX_ADDRBUF_LEN] = { 0 };
+        char* colon = strrchr(up->name, ':');
+        if (!colon || !colon[1]) return EXIT_FAILURE;
+
+        const char* hstart = up->name;
+        size_t hlen = (size_t) (colon - up->name);
+        if (*hstart == '[' && 2 <= hlen && hstart[hlen - 1] == ']') {
+                ++hstart;
+                hlen -= 2;
+        }
+        if (!hlen || sizeof(host) <= hlen) return EXIT_FAILURE;
+        memcpy(host, hstart, hlen);
+
+        struct addrinfo* addr = configure_address(host, colon + 1,
+                AF_UNSPEC, SOCK_STREAM, 0);
+        if (!addr) return EXIT_FAILURE;
+
+        memcpy(&(up->addr), addr->ai_addr, addr->ai_addrlen);
+        up->addr_len = (socklen_t) addr->ai_addrlen;
+        freeaddrinfo(addr);
+
+        return EXIT_SUCCESS;
+}
+
+
+int compare_http_ring_points(const void* a, const void* b)
+{
+        uint32_t ha = ((const struct http_ring_point*) a)->hash;
+        uint32_t hb = ((const struct http_ring_point*) b)->hash;
+        return (hb < ha) - (ha < hb);
+}
+
+
+// Places the upstreams on the ring by their names,
+// so the keys of the other upstreams stay in place
+// when one is added or removed
+void build_http_ring(struct http_proxy* proxy)
+{
+        proxy->nring = 0;
+        for (uint32_t u = 0; u < proxy->nupstreams; ++u) {
+                const char* name = proxy->upstreams[u].name;
+                uint32_t base = hash_http_bytes(HTTP_HASH_SEED, name,
+                        strlen(name));
+
+                for (uint32_t i = 0; i < HTTP_PROXY_RING_POINTS; ++i) {
+                        struct http_ring_point* pt =
+                                &(proxy->ring[proxy->nring++]);
+                        pt->hash = mix_http_hash(hash_http_bytes(base, &i,
+                                sizeof(i)));
+                        pt->upstream = u;
+                }
+        }
+
+        qsort(proxy->ring, proxy->nring, sizeof(proxy->ring[0]),
+                compare_http_ring_points);
+}
+
+
+struct http_proxy* create_http_proxy(const char* upstreams,
+        const char* check_path)
+{
+        struct http_proxies* proxies = get_http_proxies();
+        if (proxies->count == HTTP_MAX_PROXIES) return NULL;
+
+        struct http_proxy* proxy = (struct http_proxy*) calloc(1,
+                sizeof(struct http_proxy));
+        if (!proxy) return NULL;
+
+        snprintf(proxy->check_path, sizeof(proxy->check_path), "%s",
+                check_path ? check_path : "/");
+
+        // Split the list by the commas
+        const char* cur = upstreams;
+        while (*cur) {
+                const char* end = strchr(cur, ',');
+                size_t len = (end ? (size_t) (end - cur) : strlen(cur));
+                if (proxy->nupstreams == HTTP_PROXY_MAX_UPSTREAMS) {
+                        goto out_failure;
+                }
+
+                struct http_upstream* up =
+                        &(proxy->upstreams[proxy->nupstreams]);
+                if (resolve_http_upstream(up, cur, len)) {
+                        fprintf(stderr, "Invalid upstream: %.*s\n",
+                                (int) len, cur);
+                        goto out_failure;
+                }
+
+                up->healthy = 1; // until a check says otherwise
+                for (size_t i = 0; i < HTTP_PROXY_MAX_CONNS; ++i) {
+                        up->conns[i].sock = INVALID_SOCKET;
+                        up->conns[i].up = up;
+                }
+                ++(proxy->nupstreams);
+
+                cur += len;
+                if (*cur == ',') ++cur;
+        }
+
+        if (!proxy->nupstreams) goto out_failure;
+
+        build_http_ring(proxy);
+        proxy->rand = mix_http_hash((uint32_t) time(NULL)
+                ^ (uint32_t) (uintptr_t) proxy) | 1;
+
+        proxies->list[proxies->count++] = proxy;
+        return proxy;
+
+out_failure:
+        free(proxy);
+        return NULL;
+}
+
+
+
+/*
+ * MESSAGE HEADS
+ */
+
+
+
+// Checks if the "Connection" headers name the header
+// (the header is meant for this hop only)
+int is_http_connection_option(const struct http_headers* hdrs,
+        const char* name, const size_t name_len)
+{
+        for (size_t i = 0; i < hdrs->count; ++i) {
+                const struct http_header* h = &(hdrs->list[i]);
+                if (h->id != HH_CONNECTION) continue;
+
+                const char* cur = h->value;
+                const char* end = h->value + h->value_len;
+                const char* tok = NULL;
+                size_t len = 0;
+                while (next_http_list_token(&cur, end, &tok, &len)) {
+                        if (len == name_len
+                                && !strncasecmp(tok, name, len)) {
+                                return 1;
+                        }
+                }
+        }
+
+        return 0;
+}
+
+
+// Checks if the header line is hop-by-hop (not forwarded)
+int is_http_hop_header(const char* line, const struct http_headers* hdrs)
+{
+        static const char* const hops[] = {
+                "Connection:", "Keep-Alive:", "Proxy-Connection:",
+                "Upgrade:", "TE:", "Trailer:"
+        };
+
+        for (size_t i = 0; i < sizeof(hops) / sizeof(hops[0]); ++i) {
+                if (!strncasecmp(line, hops[i], strlen(hops[i]))) return 1;
+        }
+
+        // The framing is forwarded as it is, so are its headers
+        const char* colon = strchr(line, ':');
+        if (!colon) return 0;
+
+        size_t name_len = (size_t) (colon - line);
+        if ((name_len == 14 && !strncasecmp(line, "Content-Length", 14))
+                || (name_len == 17
+                && !strncasecmp(line, "Transfer-Encoding", 17))) {
+                return 0;
+        }
+
+        return is_http_connection_option(hdrs, line, name_len);
+}
+
+
+/*
+ * Copies the head without the hop-by-hop headers
+ * (including the ones named by "Connection"),
+ * adds the "Connection" header line
+ *
+ * @hdrs        Headers of "head"
+ * @connection  "Connection" header line (optional)
+ *
+ * Returns:
+ *      - Success:      EXIT_SUCCESS
+ *      - No memory:    EXIT_FAILURE
+ */
+int copy_http_head(struct strinfo* dest, const char* head,
+        const size_t head_len, const struct http_headers* hdrs,
+        const char* connection)
+{
+        const char* end = head + head_len - 2; // before the blank line
+        const char* line = head;
+        int res = EXIT_SUCCESS;
+
+        while (line < end) {
+                const char* eol = strstr(line, "\r\n");
+                if (!eol || end < eol) break;
+
+                if (line == head || !is_http_hop_header(line, hdrs)) {
+                        res |= append_strinfo(dest, line,
+                                (size_t) (eol - line) + 2);
+                }
+                line = eol + 2;
+        }
+
+        if (connection) res |= appendf_strinfo(dest, "%s\r\n", connection);
+        res |= append_strinfo(dest, "\r\n", 2);
+        return res ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+// Skips the decoded content, the framing is forwarded as it is
+int skip_http_body_piece(void* data, const char* piece, const size_t len)
+{
+        (void) data;
+        (void) piece;
+        (void) len;
+        return EXIT_SUCCESS;
+}
+
+
+
+/*
+ * UPSTREAM CONNECTIONS
+ */
+
+
+
+// Closes the connection, frees the slot
+void close_http_upconn(struct http_upconn* upc)
+{
+        if (validate_socket(upc->sock) && closesocket(upc->sock)) {
+                psockerror("close() failed");
+        }
+
+        struct http_upstream* up = upc->up;
+        cleanup_strinfo(&(upc->out));
+        cleanup_strinfo(&(upc->in));
+        memset(upc, 0, sizeof(*upc));
+        upc->sock = INVALID_SOCKET;
+        upc->state = HUC_FREE;
+        upc->up = up;
+}
+
+
+// Opens a new connection (connect() completes in the background)
+struct http_upconn* open_http_upconn(struct http_upstream* up)
+{
+        struct http_upconn* upc = NULL;
+        for (size_t i = 0; i < HTTP_PROXY_MAX_CONNS && !upc; ++i) {
+                if (up->conns[i].state == HUC_FREE) upc = &(up->conns[i]);
+        }
+        if (!upc) return NULL; // connection limit
+
+        upc->sock = socket(up->addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+        if (!validate_socket(upc->sock)) {
+                psockerror("socket() failed");
+                return NULL;
+        }
+
+        if (set_socket_nonblocking(upc->sock)) goto out_failure_close;
+
+        if (connect(upc->sock, (const struct sockaddr*) &(up->addr),
+                up->addr_len) && sockerrno() != EINPROGRESS) {
+                psockerror("connect() to %s failed", up->name);
+                goto out_failure_close;
+        }
+
+        upc->state = HUC_CONNECTING;
+        upc->deadline = time(NULL) + HTTP_PROXY_TIMEOUT_SEC;
+        return upc;
+
+out_failure_close:
+        close_http_upconn(upc);
+        return NULL;
+}
+
+
+// Checks if every connection slot of the upstream is used
+int is_http_upstream_full(const struct http_upstream* up)
+{
+        for (size_t i = 0; i < HTTP_PROXY_MAX_CONNS; ++i) {
+                if (up->conns[i].state == HUC_FREE) return 0;
+        }
+
+        return 1;
+}
+
+
+// Takes a pooled connection or opens a new one
+struct http_upconn* acquire_http_upconn(struct http_upstream* up)
+{
+        for (size_t i = 0; i < HTTP_PROXY_MAX_CONNS; ++i) {
+                struct http_upconn* upc = &(up->conns[i]);
+                if (upc->state != HUC_IDLE) continue;
+
+                upc->state = HUC_ACTIVE;
+                upc->deadline = time(NULL) + HTTP_PROXY_TIMEOUT_SEC;
+                return upc;
+        }
+
+        return open_http_upconn(up);
+}
+
+
+// Detaches the client from the connection
+void detach_http_upconn(struct http_upconn* upc)
+{
+        if (!upc->client) return;
+
+        struct http_conninfo* conn =
+                (struct http_conninfo*) upc->client->add_data;
+        if (conn) conn->upc = NULL;
+
+        upc->client = NULL;
+        --(upc->up->active);
+}
+
+
+void abort_http_upconn(struct http_upconn* upc)
+{
+        detach_http_upconn(upc);
+        close_http_upconn(upc);
+}
+
+
+
+/*
+ * BALANCING
+ */
+
+
+
+int set_http_proxy_balance(struct http_proxy* proxy, const char* policy)
+{
+        if (!strcmp(policy, "round-robin")) {
+                proxy->balance = HTTP_BALANCE_ROUND_ROBIN;
+        } else if (!strcmp(policy, "least-conn")) {
+                proxy->balance = HTTP_BALANCE_LEAST_CONN;
+        } else if (!strcmp(policy, "two-choices")) {
+                proxy->balance = HTTP_BALANCE_TWO_CHOICES;
+        } else if (!strcmp(policy, "hash")) {
+                proxy->balance = HTTP_BALANCE_HASH;
+                proxy->hash_key[0] = '\0';
+        } else if (!strncmp(policy, "hash:", 5) && policy[5]
+                && strlen(policy + 5) < sizeof(proxy->hash_key)) {
+                proxy->balance = HTTP_BALANCE_HASH;
+                strcpy(proxy->hash_key, policy + 5);
+        } else {
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+// Hashes the configured header of the request (the URL if it is absent)
+uint32_t hash_http_request_key(const struct http_proxy* proxy,
+        const struct http_request* req)
+{
+        size_t len = 0;
+        const char* key = NULL;
+        const struct http_header* h = (proxy->hash_key[0]
+                ? get_http_header(req->headers, proxy->hash_key) : NULL);
+        if (h) {
+                key = h->value;
+                len = h->value_len;
+        } else {
+                key = (req->url ? req->url : "");
+                len = strlen(key);
+        }
+
+        return mix_http_hash(hash_http_bytes(HTTP_HASH_SEED, key, len));
+}
+
+
+// Next number of the proxy's xorshift generator
+static inline
+uint32_t next_http_rand(struct http_proxy* proxy)
+{
+        uint32_t x = proxy->rand;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        proxy->rand = x;
+        return x;
+}
+
+
+// Checks if the upstream is excluded by the mask
+static inline
+int is_http_upstream_skipped(const unsigned skip, const size_t idx)
+{
+        return (skip >> idx) & 1u;
+}
+
+
+// Upstreams in turn
+struct http_upstream* pick_http_round_robin(struct http_proxy* proxy,
+        const unsigned skip)
+{
+        for (size_t i = 0; i < proxy->nupstreams; ++i) {
+                size_t idx = (proxy->next + i) % proxy->nupstreams;
+                if (is_http_upstream_skipped(skip, idx)) continue;
+
+                proxy->next = idx + 1;
+                return &(proxy->upstreams[idx]);
+        }
+
+        return NULL;
+}
+
+
+// Fewest requests in progress, the ties are taken in turn
+struct http_upstream* pick_http_least_conn(struct http_proxy* proxy,
+        const unsigned skip)
+{
+        struct http_upstream* best = NULL;
+        size_t best_idx = 0;
+        for (size_t i = 0; i < proxy->nupstreams; ++i) {
+                size_t idx = (proxy->next + i) % proxy->nupstreams;
+                if (is_http_upstream_skipped(skip, idx)) continue;
+
+                struct http_upstream* up = &(proxy->upstreams[idx]);
+                if (!best || up->active < best->active) {
+                        best = up;
+                        best_idx = idx;
+                }
+        }
+
+        if (best) proxy->next = best_idx + 1;
+        return best;
+}
+
+
+// Less loaded of two random upstreams
+struct http_upstream* pick_http_two_choices(struct http_proxy* proxy,
+        const unsigned skip)
+{
+        size_t cands[HTTP_PROXY_MAX_UPSTREAMS];
+        size_t ncands = 0;
+        for (size_t i = 0; i < proxy->nupstreams; ++i) {
+                if (!is_http_upstream_skipped(skip, i)) cands[ncands++] = i;
+        }
+        if (!ncands) return NULL;
+
+        size_t a = next_http_rand(proxy) % ncands;
+        if (ncands == 1) return &(proxy->upstreams[cands[a]]);
+
+        // Second choice differs from the first one
+        size_t b = (a + 1 + next_http_rand(proxy) % (ncands - 1)) % ncands;
+        struct http_upstream* first = &(proxy->upstreams[cands[a]]);
+        struct http_upstream* second = &(proxy->upstreams[cands[b]]);
+        return (second->active < first->active ? second : first);
+}
+
+
+// First upstream clockwise from the key on the ring
+struct http_upstream* pick_http_hashed(struct http_proxy* proxy,
+        const uint32_t key, const unsigned skip)
+{
+        if (!proxy->nring) return NULL;
+
+        // First point not below the key (binary search)
+        size_t lo = 0, hi = proxy->nring;
+        while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (proxy->ring[mid].hash < key) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+
+        // Keys of the skipped upstreams go to the next ones
+        for (size_t i = 0; i < proxy->nring; ++i) {
+                const struct http_ring_point* pt =
+                        &(proxy->ring[(lo + i) % proxy->nring]);
+                if (!is_http_upstream_skipped(skip, pt->upstream)) {
+                        return &(proxy->upstreams[pt->upstream]);
+                }
+        }
+
+        return NULL;
+}
+
+
+// Picks the upstream by the policy of the proxy,
+// the upstreams having their bits set in "skip" are not picked
+struct http_upstream* pick_http_upstream(struct http_proxy* proxy,
+        const uint32_t key, const unsigned skip)
+{
+        switch (proxy->balance) {
+        case HTTP_BALANCE_LEAST_CONN:
+                return pick_http_least_conn(proxy, skip);
+        case HTTP_BALANCE_TWO_CHOICES:
+                return pick_http_two_choices(proxy, skip);
+        case HTTP_BALANCE_HASH:
+                return pick_http_hashed(proxy, key, skip);
+        default:
+                return pick_http_round_robin(proxy, skip);
+        }
+}
+
+
+/*
+ * Counts the outcome of the upstream's response,
+ * HTTP_PROXY_EJECT_ERRORS consecutive errors eject
+ * the upstream, every next ejection lasts twice as long
+ *
+ * @error Connection failure, timeout, 5xx or slow response
+ */
+void record_http_upstream_result(struct http_upstream* up, const int error)
+{
+        if (!error) {
+                up->errors = 0;
+                up->ejections = 0;
+                return;
+        }
+
+        // Responses to the requests sent before the ejection
+        time_t now = time(NULL);
+        if (now < up->eject_until) return;
+        if (++(up->errors) < HTTP_PROXY_EJECT_ERRORS) return;
+
+        time_t sec = HTTP_PROXY_EJECT_SEC;
+        for (size_t i = 0; i < up->ejections
+                && sec < HTTP_PROXY_MAX_EJECT_SEC; ++i) {
+                sec *= 2;
+        }
+        if (HTTP_PROXY_MAX_EJECT_SEC < sec) sec = HTTP_PROXY_MAX_EJECT_SEC;
+
+        up->errors = 0;
+        ++(up->ejections);
+        up->eject_until = now + sec;
+        fprintf(stderr, "Upstream %s ejected for %lld s\n", up->name,
+                (long long) sec);
+}
+
+
+/*
+ * Takes a connection to an upstream picked by the policy
+ *
+ * Description: unhealthy and ejected upstreams are skipped
+ * (the ejected ones are used if nothing else is healthy),
+ * as are the upstreams at the connection limit
+ *
+ * @key     Hash of the request key (HTTP_BALANCE_HASH)
+ * @code    Status code if there is no connection: HTTP_BAD_GATEWAY
+ *          if connecting failed, HTTP_SERVICE_UNAVAILABLE if no
+ *          healthy upstream is below the connection limit
+ */
+struct http_upconn* choose_http_upconn(struct http_proxy* proxy,
+        const uint32_t key, enum http_code* code)
+{
+        *code = HTTP_SERVICE_UNAVAILABLE;
+
+        time_t now = time(NULL);
+        unsigned unhealthy = 0, ejected = 0;
+        for (size_t i = 0; i < proxy->nupstreams; ++i) {
+                const struct http_upstream* up = &(proxy->upstreams[i]);
+                if (!up->healthy) {
+                        unhealthy |= 1u << i;
+                } else if (now < up->eject_until) {
+                        ejected |= 1u << i;
+                }
+        }
+
+        unsigned skip = unhealthy | ejected;
+        if (skip == (1u << proxy->nupstreams) - 1) skip = unhealthy;
+
+        for (size_t i = 0; i < proxy->nupstreams; ++i) {
+                struct http_upstream* up = pick_http_upstream(proxy, key, skip);
+                if (!up) break;
+
+                struct http_upconn* upc = acquire_http_upconn(up);
+                if (upc) return upc;
+
+                // At the limit or connect() failed right away
+                if (!is_http_upstream_full(up)) {
+                        *code = HTTP_BAD_GATEWAY;
+                        ++(up->failures);
+                        record_http_upstream_result(up, 1);
+                }
+                skip |= 1u << (size_t) (up - proxy->upstreams);
+        }
+
+        return NULL;
+}
+
+
+
+/*
+ * REQUESTS
+ */
+
+
+
+int start_http_proxy_request(struct http_proxy* proxy,
+        struct clientinfo* cinfo, struct http_conninfo* conn)
+{
+        struct strinfo* rvstr = &(cinfo->rvstr);
+        size_t head_len = http_request_head_len(rvstr->buf);
+        struct http_request* req = &(conn->req);
+
+        uint32_t key = 0;
+        if (proxy->balance == HTTP_BALANCE_HASH) {
+                key = hash_http_request_key(proxy, req);
+        }
+
+        enum http_code code = HTTP_OK;
+        struct http_upconn* upc = choose_http_upconn(proxy, key, &code);
+        if (!upc) return code;
+        struct http_upstream* up = upc->up;
+
+        upc->client = cinfo;
+        conn->upc = upc;
+        ++(up->active);
+        ++(up->requests);
+
+        // Pooled connections keep the state of the previous exchange
+        upc->head_req = !strcmp(req->method, "HEAD");
+        upc->req_done = 0;
+        upc->resp_head = 0;
+        upc->until_close = 0;
+        upc->keep_alive = 1;
+        upc->sent_ms = 0;
+        memset(&(upc->dec), 0, sizeof(upc->dec));
+        conn->keep_alive = (req->conn && !strcmp(req->conn, "keep-alive"));
+
+        // Upstream connections are always kept alive
+        if (copy_http_head(&(upc->out), rvstr->buf, head_len, req->headers,
+                "Connection: keep-alive")) {
+                goto out_failure_abort;
+        }
+
+        consume_strinfo(rvstr, head_len);
+        cleanup_http_request(req);
+        conn->rt = NULL;
+
+        int relay_res = relay_http_proxy_request(cinfo, conn);
+        if (relay_res == HTTP_CONTENT_TOO_LARGE) {
+                abort_http_upconn(upc);
+                return relay_res;
+        }
+        if (relay_res) goto out_failure_abort;
+
+        return EXIT_SUCCESS;
+
+out_failure_abort:
+        abort_http_upconn(upc);
+        return HTTP_BAD_REQUEST;
+}
+
+
+int relay_http_proxy_request(struct clientinfo* cinfo,
+        struct http_conninfo* conn)
+{
+        struct http_upconn* upc = conn->upc;
+        struct strinfo* rvstr = &(cinfo->rvstr);
+        if (upc->req_done || !rvstr->buf) return EXIT_SUCCESS;
+
+        // Forward the content with its original framing
+        size_t used = 0;
+        int code = decode_http_body(&(conn->dec), rvstr->buf, rvstr->len,
+                &used, skip_http_body_piece, NULL);
+        if (code == HTTP_CONTENT_TOO_LARGE) return code;
+        if (code && code != HTTP_OK) return EXIT_FAILURE;
+        if (used && append_strinfo(&(upc->out), rvstr->buf, used)) {
+                return EXIT_FAILURE;
+        }
+        consume_strinfo(rvstr, used);
+        if (code == HTTP_OK) upc->req_done = 1;
+        if (upc->req_done && !upc->sent_ms && !http_pending_len(&(upc->out))) {
+                upc->sent_ms = http_now_ms();
+        }
+        if (used) upc->deadline = time(NULL) + HTTP_PROXY_TIMEOUT_SEC;
+
+        // Stop reading the client until the upstream catches up
+        if (cinfo->state == CS_RECEIVING && (upc->req_done
+                || HTTP_PROXY_MAX_BUFFERED <= http_pending_len(&(upc->out)))) {
+                cinfo->state = CS_EXECUTING;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+
+/*
+ * RESPONSES
+ */
+
+
+
+// Lets the client send the relayed bytes
+void resume_http_client(struct clientinfo* cinfo)
+{
+        if (http_pending_len(&(cinfo->sdstr)) && cinfo->state != CS_SENDING) {
+                cinfo->state = CS_READY;
+        }
+}
+
+
+// Sends the rest of the response, closes the connection if asked
+void complete_http_client(struct serverinfo* sinfo, struct clientinfo* cinfo)
+{
+        struct http_conninfo* conn =
+                (struct http_conninfo*) cinfo->add_data;
+        if (http_pending_len(&(cinfo->sdstr))) {
+                resume_http_client(cinfo);
+                return;
+        }
+
+        cleanup_strinfo(&(cinfo->sdstr));
+        cinfo->state = CS_IDLE;
+        if ((!conn || !conn->keep_alive) && drop_client(sinfo, cinfo->client)) {
+                pfatal("drop_client() failed\n"); // bug
+        }
+}
+
+
+// Ends the exchange, pools the connection if it may be reused
+void finish_http_exchange(struct serverinfo* sinfo, struct http_upconn* upc)
+{
+        struct clientinfo* cinfo = upc->client;
+        struct http_conninfo* conn =
+                (struct http_conninfo*) cinfo->add_data;
+
+        // The rest of the request would be taken for the next one
+        if (!upc->req_done) conn->keep_alive = 0;
+
+        int reusable = (upc->keep_alive && upc->req_done
+                && !upc->until_close && !upc->in.len
+                && !http_pending_len(&(upc->out)));
+        detach_http_upconn(upc);
+        if (reusable) {
+                upc->state = HUC_IDLE;
+                upc->out.len = upc->out.adv = 0;
+                upc->in.len = 0;
+                upc->resp_head = 0;
+                upc->req_done = 0;
+                upc->deadline = time(NULL) + HTTP_PROXY_IDLE_SEC;
+        } else {
+                close_http_upconn(upc);
+        }
+
+        complete_http_client(sinfo, cinfo);
+}
+
+
+// Ends the exchange after an error: responds with "code"
+// if the client got nothing yet, drops the client otherwise
+void fail_http_upconn(struct serverinfo* sinfo, struct http_upconn* upc,
+        const enum http_code code)
+{
+        struct clientinfo* cinfo = upc->client;
+        if (!cinfo) { // health check
+                upc->up->healthy = 0;
+                close_http_upconn(upc);
+                return;
+        }
+
+        ++(upc->up->failures);
+        if (code != HTTP_INTERNAL_SERVER_ERROR) {
+                record_http_upstream_result(upc->up, 1);
+        }
+        int head_sent = upc->resp_head;
+        detach_http_upconn(upc);
+        close_http_upconn(upc);
+
+        struct http_conninfo* conn =
+                (struct http_conninfo*) cinfo->add_data;
+        if (head_sent || !conn) {
+                if (drop_client(sinfo, cinfo->client)) {
+                        pfatal("drop_client() failed\n"); // bug
+                }
+                return;
+        }
+
+        // The rest of the request is not read
+        conn->keep_alive = 0;
+        consume_strinfo(&(cinfo->rvstr), cinfo->rvstr.len);
+        if (write_http_from_code(code, &(cinfo->sdstr), NULL, 0, NULL,
+                NULL)) {
+                if (drop_client(sinfo, cinfo->client)) {
+                        pfatal("drop_client() failed\n"); // bug
+                }
+                return;
+        }
+
+        cinfo->state = CS_READY;
+}
+
+
+// Parses the status code of the response head
+int parse_http_status(const char* head)
+{
+        if (strncmp(head, "HTTP/1.", 7) || !head[7] || head[8] != ' ') {
+                return -EXIT_FAILURE;
+        }
+
+        int status = atoi(head + 9);
+        return (100 <= status && status <= 599) ? status : -EXIT_FAILURE;
+}
+
+
+/*
+ * Parses the response head, writes it to the client
+ *
+ * Returns:
+ *      - Final head relayed: EXIT_SUCCESS
+ *      - Head is not complete yet: 1
+ *      - Interim head relayed (the final one follows): 2
+ *      - Failure: HTTP status code for the client
+ */
+int relay_http_response_head(struct http_upconn* upc)
+{
+        struct strinfo* in = &(upc->in);
+        char* end = strstr(in->buf, "\r\n\r\n");
+        if (!end) return (MAX_NETBUF_LEN < in->len ? HTTP_BAD_GATEWAY : 1);
+
+        size_t head_len = (size_t) (end - in->buf) + 4;
+        int status = parse_http_status(in->buf);
+        if (status < 0 || status == 101) return HTTP_BAD_GATEWAY;
+
+        // Headers only: the table slices the head in place
+        struct http_headers hdrs;
+        if (parse_http_headers(in->buf, head_len, &hdrs) != HTTP_OK) {
+                return HTTP_BAD_GATEWAY;
+        }
+
+        const struct http_header* conn_h = get_http_known_header(&hdrs,
+                HH_CONNECTION);
+        if ((conn_h && conn_h->value_len == 5
+                && !strncasecmp(conn_h->value, "close", 5))
+                || !strncmp(in->buf, "HTTP/1.0", 8)) {
+                upc->keep_alive = 0;
+        }
+
+        int code = HTTP_OK;
+        int no_body = (upc->head_req || status < 200 || status == 204
+                || status == 304);
+        if (no_body) {
+                upc->dec.state = HBS_DONE;
+        } else if (get_http_known_header(&hdrs, HH_CONTENT_LENGTH)
+                || get_http_known_header(&hdrs, HH_TRANSFER_ENCODING)) {
+                code = parse_http_body_framing(&hdrs, &(upc->dec));
+        } else {
+                upc->until_close = 1; // framed by the end of the connection
+                upc->keep_alive = 0;
+        }
+        if (code != HTTP_OK) return HTTP_BAD_GATEWAY;
+
+        // The client connection can't outlive the unframed content
+        struct clientinfo* cinfo = upc->client;
+        struct http_conninfo* conn =
+                (struct http_conninfo*) cinfo->add_data;
+        if (upc->until_close) conn->keep_alive = 0;
+
+        // Interim responses leave the connection to the final one
+        const char* connection = NULL;
+        if (200 <= status) {
+                connection = http_conn_header(conn->keep_alive
+                        ? "keep-alive" : NULL);
+        }
+        if (copy_http_head(&(cinfo->sdstr), in->buf, head_len, &hdrs,
+                connection)) {
+                return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        consume_strinfo(in, head_len);
+
+        // Interim responses (100 Continue) are followed by the final one
+        if (status < 200) return 2;
+
+        // Time to the response head since the request was sent
+        int slow = (upc->sent_ms
+                && HTTP_PROXY_SLOW_MS < http_now_ms() - upc->sent_ms);
+        record_http_upstream_result(upc->up, 500 <= status || slow);
+
+        upc->resp_head = 1;
+        return EXIT_SUCCESS;
+}
+
+
+// Relays the received part of the response to the client
+void relay_http_proxy_response(struct serverinfo* sinfo,
+        struct http_upconn* upc)
+{
+        struct clientinfo* cinfo = upc->client;
+        struct strinfo* in = &(upc->in);
+
+        while (!upc->resp_head) {
+                int res = relay_http_response_head(upc);
+                if (res == 1) break; // wait for the rest
+                if (res == 2) continue;
+                if (res) {
+                        fail_http_upconn(sinfo, upc, res);
+                        return;
+                }
+        }
+
+        if (!upc->resp_head) {
+                resume_http_client(cinfo);
+                return;
+        }
+
+        // Forward the content with its original framing
+        int code = 0;
+        size_t used = in->len;
+        if (!upc->until_close) {
+                code = decode_http_body(&(upc->dec), in->buf, in->len,
+                        &used, skip_http_body_piece, NULL);
+                if (code && code != HTTP_OK) {
+                        fail_http_upconn(sinfo, upc, HTTP_BAD_GATEWAY);
+                        return;
+                }
+        }
+
+        if (used && append_strinfo(&(cinfo->sdstr), in->buf, used)) {
+                fail_http_upconn(sinfo, upc, HTTP_INTERNAL_SERVER_ERROR);
+                return;
+        }
+        consume_strinfo(in, used);
+
+        if (code == HTTP_OK) {
+                finish_http_exchange(sinfo, upc);
+                return;
+        }
+
+        resume_http_client(cinfo);
+}
+
+
+// Handles the response to the health check
+void check_http_health_response(struct http_upconn* upc)
+{
+        if (!strstr(upc->in.buf, "\r\n")) {
+                if (MAX_NETBUF_LEN < upc->in.len) {
+                        upc->up->healthy = 0;
+                        close_http_upconn(upc);
+                }
+                return;
+        }
+
+        int status = parse_http_status(upc->in.buf);
+        upc->up->healthy = (0 < status && status < 500);
+        close_http_upconn(upc);
+}
+
+
+// Starts the health check of the upstream
+void start_http_health_check(struct http_proxy* proxy,
+        struct http_upstream* up)
+{
+        // Previous check is still in progress
+        for (size_t i = 0; i < HTTP_PROXY_MAX_CONNS; ++i) {
+                const struct http_upconn* upc = &(up->conns[i]);
+                if (upc->state == HUC_CHECKING || (upc->state == HUC_CONNECTING
+                        && !upc->client)) {
+                        return;
+                }
+        }
+
+        struct http_upconn* upc = open_http_upconn(up);
+        if (!upc) {
+                up->healthy = 0;
+                return;
+        }
+
+        if (appendf_strinfo(&(upc->out), "GET %s HTTP/1.1\r\nHost: %s\r\n"
+                "Connection: close\r\n\r\n", proxy->check_path, up->name)) {
+                close_http_upconn(upc);
+        }
+}
+
+
+
+/*
+ * SELECT() HOOKS
+ */
+
+
+
+// Adds the upstream connections to the sets
+void select_http_upconns(struct serverinfo* sinfo, fd_set* readfds,
+        fd_set* writefds, SOCKET* max_fd)
+{
+        (void) sinfo;
+
+        struct http_proxies* proxies = get_http_proxies();
+        for (size_t p = 0; p < proxies->count; ++p) {
+                struct http_proxy* proxy = proxies->list[p];
+                for (size_t u = 0; u < proxy->nupstreams; ++u) {
+                        struct http_upstream* up = &(proxy->upstreams[u]);
+                        for (size_t i = 0; i < HTTP_PROXY_MAX_CONNS; ++i) {
+                                struct http_upconn* upc = &(up->conns[i]);
+                                if (upc->state == HUC_FREE) continue;
+
+                                int rd = (upc->state != HUC_CONNECTING);
+                                int wr = (upc->state == HUC_CONNECTING
+                                        || http_pending_len(&(upc->out)));
+
+                                // Stop reading until the client catches up
+                                if (upc->client && HTTP_PROXY_MAX_BUFFERED
+                                        <= http_pending_len(
+                                        &(upc->client->sdstr))) {
+                                        rd = 0;
+                                }
+
+                                if (rd) FD_SET(upc->sock, readfds);
+                                if (wr) FD_SET(upc->sock, writefds);
+                                if ((rd || wr) && *max_fd < upc->sock) {
+                                        *max_fd = upc->sock;
+                                }
+                        }
+                }
+        }
+}
+
+
+// Completes the connection, sends the queued request bytes
+void write_http_upconn(struct serverinfo* sinfo, struct http_upconn* upc)
+{
+        if (upc->state == HUC_CONNECTING) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (getsockopt(upc->sock, SOL_SOCKET, SO_ERROR,
+                        (char*) &err, &len) || err) {
+                        fprintf(stderr, "Upstream %s is unreachable\n",
+                                upc->up->name);
+                        upc->up->healthy = 0;
+                        fail_http_upconn(sinfo, upc, HTTP_BAD_GATEWAY);
+                        return;
+                }
+
+                upc->state = (upc->client ? HUC_ACTIVE : HUC_CHECKING);
+        }
+
+        struct strinfo* out = &(upc->out);
+        if (!http_pending_len(out)) return;
+
+        int sent = send(upc->sock, out->buf + out->adv,
+                http_pending_len(out), MSG_NOSIGNAL);
+        if (sent < 0) {
+                if (sockerrno() == EWOULDBLOCK || sockerrno() == EAGAIN) {
+                        return;
+                }
+                fail_http_upconn(sinfo, upc, HTTP_BAD_GATEWAY);
+                return;
+        }
+
+        out->adv += (size_t) sent;
+        upc->deadline = time(NULL) + HTTP_PROXY_TIMEOUT_SEC;
+        if (http_pending_len(out)) return;
+
+        // Sent everything: resume reading the client's content
+        out->len = out->adv = 0;
+        struct clientinfo* cinfo = upc->client;
+        if (cinfo && upc->req_done && !upc->sent_ms) {
+                upc->sent_ms = http_now_ms();
+        }
+        if (cinfo && !upc->req_done && cinfo->state == CS_EXECUTING) {
+                cinfo->state = CS_RECEIVING;
+        }
+}
+
+
+// Receives the response bytes
+void read_http_upconn(struct serverinfo* sinfo, struct http_upconn* upc)
+{
+        struct strinfo* in = &(upc->in);
+        if (reserve_strinfo(in, MAX_NETBUF_LEN)) {
+                fail_http_upconn(sinfo, upc, HTTP_INTERNAL_SERVER_ERROR);
+                return;
+        }
+
+        int recvd = recv(upc->sock, in->buf + in->len, MAX_NETBUF_LEN, 0);
+        if (recvd < 0 && (sockerrno() == EWOULDBLOCK
+                || sockerrno() == EAGAIN)) {
+                return;
+        }
+
+        // Pooled connections only expect the upstream to close them
+        if (upc->state == HUC_IDLE) {
+                close_http_upconn(upc);
+                return;
+        }
+
+        if (recvd <= 0) {
+                if (upc->state == HUC_CHECKING) {
+                        upc->up->healthy = 0;
+                        close_http_upconn(upc);
+                } else if (upc->resp_head && upc->until_close) {
+                        finish_http_exchange(sinfo, upc); // end of content
+                } else {
+                        fail_http_upconn(sinfo, upc, HTTP_BAD_GATEWAY);
+                }
+                return;
+        }
+
+        in->len += (size_t) recvd;
+        in->buf[in->len] = '\0';
+        upc->deadline = time(NULL) + HTTP_PROXY_TIMEOUT_SEC;
+
+        if (upc->state == HUC_CHECKING) {
+                check_http_health_response(upc);
+        } else {
+                relay_http_proxy_response(sinfo, upc);
+        }
+}
+
+
+// Handles the ready upstream connections, the timeouts and the health checks
+void handle_http_upconns(struct serverinfo* sinfo, const fd_set* readfds,
+        const fd_set* writefds)
+{
+        time_t now = time(NULL);
+
+        struct http_proxies* proxies = get_http_proxies();
+        for (size_t p = 0; p < proxies->count; ++p) {
+                struct http_proxy* proxy = proxies->list[p];
+                for (size_t u = 0; u < proxy->nupstreams; ++u) {
+                        struct http_upstream* up = &(proxy->upstreams[u]);
+                        for (size_t i = 0; i < HTTP_PROXY_MAX_CONNS; ++i) {
+                                struct http_upconn* upc = &(up->conns[i]);
+                                if (upc->state == HUC_FREE) continue;
+
+                                SOCKET s = upc->sock;
+                                if (FD_ISSET(s, writefds)) {
+                                        write_http_upconn(sinfo, upc);
+                                }
+                                if (upc->state != HUC_FREE && upc->sock == s
+                                        && FD_ISSET(s, readfds)) {
+                                        read_http_upconn(sinfo, upc);
+                                }
+
+                                if (upc->state == HUC_FREE
+                                        || now < upc->deadline) {
+                                        continue;
+                                }
+
+                                // Slow client, not the upstream
+                                if (upc->client && HTTP_PROXY_MAX_BUFFERED
+                                        <= http_pending_len(
+                                        &(upc->client->sdstr))) {
+                                        upc->deadline = now
+                                                + HTTP_PROXY_TIMEOUT_SEC;
+                                        continue;
+                                }
+
+                                if (upc->state == HUC_IDLE) {
+                                        close_http_upconn(upc);
+                                } else {
+                                        fprintf(stderr, "Upstream %s timed "
+                                                "out\n", up->name);
+                                        fail_http_upconn(sinfo, upc,
+                                                HTTP_GATEWAY_TIMEOUT);
+                                }
+                        }
+
+                        if (up->next_check <= now) {
+                                up->next_check = now + HTTP_PROXY_CHECK_SEC;
+                                start_http_health_check(proxy, up);
+                        }
+                }
+        }
+}
+
+
+void attach_http_proxies(struct serverinfo* sinfo)
+{
+        if (!get_http_proxies()->count) return;
+
+        sinfo->on_select = select_http_upconns;
+        sinfo->on_selected = handle_http_upconns;
+        sinfo->timeout_ms = 1000; // timeouts and health checks
+}
+
+
+void cleanup_http_proxies(void)
+{
+        struct http_proxies* proxies = get_http_proxies();
+        for (size_t p = 0; p < proxies->count; ++p) {
+                struct http_proxy* proxy = proxies->list[p];
+                for (size_t u = 0; u < proxy->nupstreams; ++u) {
+                        struct http_upstream* up = &(proxy->upstreams[u]);
+                        for (size_t i = 0; i < HTTP_PROXY_MAX_CONNS; ++i) {
+                                abort_http_upconn(&(up->conns[i]));
+                        }
+                }
+
+                free(proxy);
+                proxies->list[p] = NULL;
+        }
+
+        proxies->count = 0;
+}
@@ -0,0 +1,523 @@
+#include "../headers/http_reloads.h"
+#include "../headers/http_conns.h"      // struct http_conninfo
+#include "../headers/http2_sessions.h"  // shutdown_http2_session()
+#include "../headers/ws_sessions.h"     // close_ws_session()
+#include <stdio.h>                      // printf()
+#include <time.h>                       // time()
+#include <signal.h>                     // signal()
+
+#ifndef _WIN32
+        #include <sys/un.h>             // struct sockaddr_un
+        #include <fcntl.h>              // fcntl()
+#endif  // !_WIN32
+
+#ifndef MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0
+#endif  // !MSG_NOSIGNAL
+
+
+/*
+ * Reload state of the server
+ *
+ * @ctl         Socket listening for the next server process
+ * @path        Path of "ctl"
+ * @handed_over Sockets were handed over to the next process
+ * @sig_pipe    Self-pipe written by the signal handler (Unix)
+ * @signals     Stop signals handled
+ * @drain_sec   Time the connections are given to complete
+ * @draining    Server stopped accepting
+ * @deadline    Remaining connections are dropped then
+ * @hooked      select() hooks are set
+ * @on_select   Hook set before the reload ones (optional)
+ * @on_selected Hook set before the reload ones (optional)
+ */
+struct http_reload {
+        SOCKET ctl;
+        char path[MAX_ADDRBUF_LEN];
+        int handed_over;
+
+        int sig_pipe[2];
+        sig_atomic_t signals;
+
+        int drain_sec;
+        int draining;
+        time_t deadline;
+
+        int hooked;
+        void (*on_select)(struct serverinfo* sinfo,
+                fd_set* readfds, fd_set* writefds, SOCKET* max_fd);
+        void (*on_selected)(struct serverinfo* sinfo,
+                const fd_set* readfds, const fd_set* writefds);
+};
+
+
+struct http_reload* get_http_reload(void)
+{
+        static struct http_reload reload = {
+                .ctl = INVALID_SOCKET,
+                .sig_pipe = { -1, -1 },
+                .drain_sec = HTTP_DRAIN_SEC
+        };
+        return &reload;
+}
+
+
+// SIGINT / SIGTERM received (read by the server loop)
+static volatile sig_atomic_t http_stop_signals = 0;
+
+
+void handle_http_stop_signal(int sig)
+{
+        (void) sig;
+        http_stop_signals = http_stop_signals + 1;
+
+#ifndef _WIN32
+        // Wake up select()
+        int saved_errno = errno;
+        int fd = get_http_reload()->sig_pipe[1];
+        char byte = 0;
+        if (0 <= fd && write(fd, &byte, 1) < 0) {
+                // the pipe is full: select() is woken up anyway
+        }
+        errno = saved_errno;
+#endif  // !_WIN32
+}
+
+
+#ifndef _WIN32
+
+
+// Fills the address of the reload socket
+int make_http_reload_addr(struct sockaddr_un* addr, const char* path)
+{
+        memset(addr, 0, sizeof(*addr));
+        addr->sun_family = AF_UNIX;
+        if (sizeof(addr->sun_path) <= strlen(path)) return EXIT_FAILURE;
+
+        strcpy(addr->sun_path, path);
+        return EXIT_SUCCESS;
+}
+
+
+SOCKET take_over_http_server(const char* path)
+{
+        struct http_reload* reload = get_http_reload();
+        struct sockaddr_un addr = { 0 };
+        if (make_http_reload_addr(&addr, path)) return INVALID_SOCKET;
+
+        SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (!validate_socket(s)) {
+                psockerror("socket() failed");
+                return INVALID_SOCKET;
+        }
+
+        // Nobody is listening: this is the first server
+        SOCKET serv = INVALID_SOCKET;
+        if (connect(s, (const struct sockaddr*) &addr, sizeof(addr))) {
+                goto out_close;
+        }
+
+        struct timeval tv = { .tv_sec = HTTP_RELOAD_TIMEOUT_SEC };
+        if (setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))) {
+                psockerror("setsockopt() failed");
+        }
+
+        // The listening socket and the reload socket
+        char byte = 0;
+        struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+        union {
+                char buf[CMSG_SPACE(2 * sizeof(int))];
+                struct cmsghdr align;
+        } ctrl;
+        memset(&ctrl, 0, sizeof(ctrl));
+
+        struct msghdr msg = { 0 };
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = sizeof(ctrl.buf);
+        if (recvmsg(s, &msg, 0) <= 0) {
+                psockerror("recvmsg() from the running server failed");
+                goto out_close;
+        }
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_level != SOL_SOCKET
+                || cmsg->cmsg_type != SCM_RIGHTS
+                || cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+                fprintf(stderr, "Running server sent no sockets\n");
+                goto out_close;
+        }
+
+        int fds[2] = { 0 };
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        serv = fds[0];
+        reload->ctl = fds[1];
+        printf("Listening socket was taken over\n");
+
+out_close:
+        if (closesocket(s)) psockerror("close() failed");
+        return serv;
+}
+
+
+// Creates the reload socket (a stale one is removed)
+SOCKET open_http_reload_socket(const char* path)
+{
+        struct sockaddr_un addr = { 0 };
+        if (make_http_reload_addr(&addr, path)) {
+                fprintf(stderr, "Reload socket path is too long\n");
+                return INVALID_SOCKET;
+        }
+
+        SOCKET ctl = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (!validate_socket(ctl)) {
+                psockerror("socket() failed");
+                return INVALID_SOCKET;
+        }
+
+        unlink(path);
+        if (bind(ctl, (const struct sockaddr*) &addr, sizeof(addr))
+                || listen(ctl, 1)) {
+                psockerror("bind() / listen() of %s failed", path);
+                if (closesocket(ctl)) psockerror("close() failed");
+                return INVALID_SOCKET;
+        }
+
+        return ctl;
+}
+
+
+// Sends the listening socket and the reload socket to the next process
+int hand_over_http_server(struct serverinfo* sinfo, const SOCKET s)
+{
+        struct http_reload* reload = get_http_reload();
+        int fds[2] = { sinfo->serv, reload->ctl };
+
+        char byte = 0;
+        struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+        union {
+                char buf[CMSG_SPACE(sizeof(fds))];
+                struct cmsghdr align;
+        } ctrl;
+        memset(&ctrl, 0, sizeof(ctrl));
+
+        struct msghdr msg = { 0 };
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = sizeof(ctrl.buf);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        if (sendmsg(s, &msg, MSG_NOSIGNAL) != 1) {
+                psockerror("sendmsg() to the next server failed");
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+#else   // _WIN32
+
+
+SOCKET take_over_http_server(const char* path)
+{
+        (void) path;
+        return INVALID_SOCKET;
+}
+
+
+SOCKET open_http_reload_socket(const char* path)
+{
+        (void) path;
+        fprintf(stderr, "Reloads are not supported on Windows\n");
+        return INVALID_SOCKET;
+}
+
+
+int hand_over_http_server(struct serverinfo* sinfo, const SOCKET s)
+{
+        (void) sinfo;
+        (void) s;
+        return EXIT_FAILURE;
+}
+
+
+#endif  // _WIN32
+
+
+// Closes the reload socket, removes it if it was not handed over
+void close_http_reload_socket(void)
+{
+        struct http_reload* reload = get_http_reload();
+        if (validate_socket(reload->ctl) && closesocket(reload->ctl)) {
+                psockerror("close() failed");
+        }
+        reload->ctl = INVALID_SOCKET;
+
+#ifndef _WIN32
+        if (reload->path[0] && !reload->handed_over) unlink(reload->path);
+#endif  // !_WIN32
+        reload->path[0] = '\0';
+}
+
+
+// Adds the reload socket and the signal pipe to the read set
+void select_http_reload(struct serverinfo* sinfo, fd_set* readfds,
+        fd_set* writefds, SOCKET* max_fd)
+{
+        struct http_reload* reload = get_http_reload();
+        if (reload->on_select) {
+                reload->on_select(sinfo, readfds, writefds, max_fd);
+        }
+
+        if (0 <= reload->sig_pipe[0]) {
+                FD_SET(reload->sig_pipe[0], readfds);
+                if (*max_fd < reload->sig_pipe[0]) {
+                        *max_fd = reload->sig_pipe[0];
+                }
+        }
+
+        if (!validate_socket(reload->ctl)) return;
+        FD_SET(reload->ctl, readfds);
+        if (*max_fd < reload->ctl) *max_fd = reload->ctl;
+}
+
+
+// Starts draining on the first stop signal,
+// drops the connections on the next one
+void handle_http_stop_signals(struct serverinfo* sinfo,
+        const fd_set* readfds)
+{
+        struct http_reload* reload = get_http_reload();
+
+#ifndef _WIN32
+        if (0 <= reload->sig_pipe[0] && FD_ISSET(reload->sig_pipe[0],
+                readfds)) {
+                char buf[64];
+                while (0 < read(reload->sig_pipe[0], buf, sizeof(buf))) {
+                        // empty the pipe
+                }
+        }
+#else   // _WIN32
+        (void) readfds;
+#endif  // _WIN32
+
+        sig_atomic_t signals = http_stop_signals;
+        if (signals == reload->signals) return;
+        reload->signals = signals;
+
+        if (!reload->draining) {
+                printf("Shutting down, draining the connections\n");
+                start_http_drain(sinfo, reload->drain_sec);
+        } else {
+                printf("Shutting down now\n");
+                reload->deadline = time(NULL);
+        }
+}
+
+
+// Handles the stop signals, hands the sockets
+// over to the connecting process
+void handle_http_reload(struct serverinfo* sinfo, const fd_set* readfds,
+        const fd_set* writefds)
+{
+        struct http_reload* reload = get_http_reload();
+        if (reload->on_selected) reload->on_selected(sinfo, readfds, writefds);
+
+        handle_http_stop_signals(sinfo, readfds);
+        if (!validate_socket(reload->ctl)
+                || !FD_ISSET(reload->ctl, readfds)) {
+                return;
+        }
+
+        SOCKET s = accept(reload->ctl, NULL, NULL);
+        if (!validate_socket(s)) {
+                psockerror("accept() of the next server failed");
+                return;
+        }
+
+        int res = hand_over_http_server(sinfo, s);
+        if (closesocket(s)) psockerror("close() failed");
+        if (res) return; // keep serving
+
+        // The next process owns the sockets now
+        printf("Sockets were handed over, draining\n");
+        reload->handed_over = 1;
+        close_http_reload_socket();
+        start_http_drain(sinfo, reload->drain_sec);
+}
+
+
+// Sets the select() hooks once, keeps the ones already set
+void hook_http_reload(struct serverinfo* sinfo)
+{
+        struct http_reload* reload = get_http_reload();
+        if (reload->hooked) return;
+
+        reload->hooked = 1;
+        reload->on_select = sinfo->on_select;
+        reload->on_selected = sinfo->on_selected;
+        sinfo->on_select = select_http_reload;
+        sinfo->on_selected = handle_http_reload;
+}
+
+
+int attach_http_reload(struct serverinfo* sinfo, const char* path)
+{
+        struct http_reload* reload = get_http_reload();
+        if (sizeof(reload->path) <= strlen(path)) return EXIT_FAILURE;
+        strcpy(reload->path, path);
+
+        // Not taken over from the previous process
+        if (!validate_socket(reload->ctl)) {
+                reload->ctl = open_http_reload_socket(path);
+                if (!validate_socket(reload->ctl)) return EXIT_FAILURE;
+        }
+
+        hook_http_reload(sinfo);
+        return EXIT_SUCCESS;
+}
+
+
+int attach_http_shutdown(struct serverinfo* sinfo, const int drain_sec)
+{
+        struct http_reload* reload = get_http_reload();
+        reload->drain_sec = drain_sec;
+
+#ifndef _WIN32
+        // Neither end may block: the handler can't wait, the loop neither
+        if (pipe(reload->sig_pipe)) {
+                perror("pipe() failed");
+                return EXIT_FAILURE;
+        }
+        for (int i = 0; i < 2; ++i) {
+                int flags = fcntl(reload->sig_pipe[i], F_GETFL, 0);
+                if (flags < 0 || fcntl(reload->sig_pipe[i], F_SETFL,
+                        flags | O_NONBLOCK)) {
+                        perror("fcntl() failed");
+                        return EXIT_FAILURE;
+                }
+        }
+
+        // Writes to the clients that are gone fail with EPIPE
+        // instead (send(), sendfile(), OpenSSL)
+        signal(SIGPIPE, SIG_IGN);
+#else   // _WIN32
+        // No pipes for select(): poll the counter
+        if (sinfo->timeout_ms < 0 || 1000 < sinfo->timeout_ms) {
+                sinfo->timeout_ms = 1000;
+        }
+#endif  // _WIN32
+
+        signal(SIGINT, handle_http_stop_signal);
+        signal(SIGTERM, handle_http_stop_signal);
+
+        hook_http_reload(sinfo);
+        return EXIT_SUCCESS;
+}
+
+
+void start_http_drain(struct serverinfo* sinfo, const int sec)
+{
+        struct http_reload* reload = get_http_reload();
+        if (reload->draining) return;
+
+        reload->draining = 1;
+        reload->deadline = time(NULL) + sec;
+
+        if (validate_socket(sinfo->serv) && closesocket(sinfo->serv)) {
+                psockerror("close() failed");
+        }
+        sinfo->serv = INVALID_SOCKET;
+        close_http_reload_socket();
+
+        // Wake up to check the deadline
+        if (sinfo->timeout_ms < 0 || 1000 < sinfo->timeout_ms) {
+                sinfo->timeout_ms = 1000;
+        }
+
+        for (size_t i = 0; i < MAX_CONN; ++i) {
+                struct clientinfo* cinfo = &(sinfo->clients[i]);
+                if (!validate_socket(cinfo->client)) continue;
+
+                // Idle keep-alive connections are closed right away,
+                // new ones (no state yet) are served their request
+                struct http_conninfo* conn =
+                        (struct http_conninfo*) cinfo->add_data;
+
+                // HTTP/2 connections complete their open streams (GOAWAY)
+                if (conn && conn->h2) {
+                        if (shutdown_http2_session(conn->h2, &(cinfo->sdstr))
+                                && drop_client(sinfo, cinfo->client)) {
+                                pfatal("drop_client() failed\n"); // bug
+                        }
+                        if (cinfo->state == CS_IDLE) cinfo->state = CS_READY;
+                        continue;
+                }
+
+                // WebSocket connections are closed ("going away")
+                if (conn && conn->ws) {
+                        if (close_ws_session(conn->ws, WS_CLOSE_GOING_AWAY)
+                                && drop_client(sinfo, cinfo->client)) {
+                                pfatal("drop_client() failed\n"); // bug
+                        }
+                        continue;
+                }
+
+                if (conn && cinfo->state == CS_IDLE && !cinfo->rvstr.len
+                        && !conn->upc) {
+                        if (drop_client(sinfo, cinfo->client)) {
+                                pfatal("drop_client() failed\n"); // bug
+                        }
+                        continue;
+                }
+
+                if (conn) conn->keep_alive = 0;
+        }
+}
+
+
+int is_http_server_draining(void)
+{
+        return get_http_reload()->draining;
+}
+
+
+int is_http_server_drained(struct serverinfo* sinfo)
+{
+        struct http_reload* reload = get_http_reload();
+        if (!reload->draining) return 0;
+
+        size_t left = 0;
+        for (size_t i = 0; i < MAX_CONN; ++i) {
+                if (validate_socket(sinfo->clients[i].client)) ++left;
+        }
+        if (!left) return 1;
+
+        if (time(NULL) < reload->deadline) return 0;
+
+        fprintf(stderr, "Drain deadline passed, dropping %zu "
+                "connections\n", left);
+        return 1; // the connections are closed by the cleanup
+}
+
+
+void cleanup_http_reload(void)
+{
+        close_http_reload_socket();
+
+#ifndef _WIN32
+        struct http_reload* reload = get_http_reload();
+        for (int i = 0; i < 2; ++i) {
+                if (0 <= reload->sig_pipe[i]) close(reload->sig_pipe[i]);
+                reload->sig_pipe[i] = -1;
+        }
+#endif  // !_WIN32
+}
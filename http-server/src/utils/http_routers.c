@@ -59,8 +59,14 @@ struct http_route* get_http_route(const char* method, const char* route)
 
         struct http_rts_lnode* cur = router->head;
         while (cur) {
-                if (!strcmp(cur->rt.method, method)
-                        && !strcmp(cur->rt.route, route)) return &(cur->rt);
+                const struct http_route* rt = &(cur->rt);
+                int method_ok = (!strcmp(rt->method, "*")
+                        || !strcmp(rt->method, method));
+                int route_ok = (rt->prefix
+                        ? !strncmp(rt->route, route, strlen(rt->route))
+                        : !strcmp(rt->route, route));
+                if (method_ok && route_ok) return &(cur->rt);
+
                 cur = cur->next;
         }
 
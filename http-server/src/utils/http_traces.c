@@ -0,0 +1,170 @@
+#include "../headers/http_traces.h"
+#include <stdio.h>              // FILE, fprintf()
+#include <signal.h>             // signal()
+#include <time.h>               // timespec_get()
+
+
+#ifdef HTTP_TRACE
+/*
+ * Trace of the event loop (single-threaded, one ring)
+ *
+ * @events      Ring of the events
+ * @next        Slot of the next event
+ * @count       Events in the ring
+ * @clock0      Clock value of the first event
+ * @ns0         Time of the first event (clock calibration)
+ * @path        File the trace is written to (optional)
+ */
+struct http_trace {
+        struct http_trace_event events[HTTP_TRACE_RING_LEN];
+        size_t next;
+        size_t count;
+
+        uint64_t clock0;
+        uint64_t ns0;
+        const char* path;
+};
+
+
+static struct http_trace http_trace_ring = { 0 };
+static volatile sig_atomic_t http_trace_requested = 0;
+
+
+// Names of the stages in the trace
+static const char* const http_trace_names[HTS_COUNT] = {
+        "select", "recv", "read_status", "parse", "handler", "format", "send"
+};
+
+
+// Gets the wall clock time in nanoseconds
+uint64_t get_http_trace_ns(void)
+{
+        struct timespec ts = { 0 };
+        timespec_get(&ts, TIME_UTC);
+        return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+
+#ifndef _WIN32
+// Asks the event loop to write the trace (SIGUSR1)
+void handle_http_trace_signal(int sig)
+{
+        (void) sig;
+        http_trace_requested = 1;
+}
+#endif  // !_WIN32
+#endif  // HTTP_TRACE
+
+
+void record_http_trace(const enum http_trace_stage stage,
+        const uint64_t start, const size_t arg)
+{
+#ifdef HTTP_TRACE
+        struct http_trace* t = &http_trace_ring;
+        if (!t->clock0) {
+                t->clock0 = start;
+                t->ns0 = get_http_trace_ns();
+        }
+
+        struct http_trace_event* e = &(t->events[t->next]);
+        e->start = start;
+        e->end = read_http_trace_clock();
+        e->arg = (uint32_t) arg;
+        e->stage = (uint32_t) stage;
+
+        t->next = (t->next + 1) % HTTP_TRACE_RING_LEN;
+        if (t->count < HTTP_TRACE_RING_LEN) ++(t->count);
+#else   // HTTP_TRACE
+        (void) stage;
+        (void) start;
+        (void) arg;
+#endif  // !HTTP_TRACE
+}
+
+
+int attach_http_trace(const char* path)
+{
+#ifdef HTTP_TRACE
+        http_trace_ring.path = path;
+#ifndef _WIN32
+        signal(SIGUSR1, handle_http_trace_signal);
+#endif  // !_WIN32
+
+        return EXIT_SUCCESS;
+#else   // HTTP_TRACE
+        (void) path;
+        fprintf(stderr, "Tracing is not built in (HTTP_TRACE)\n");
+        return EXIT_FAILURE;
+#endif  // !HTTP_TRACE
+}
+
+
+void poll_http_trace(void)
+{
+#ifdef HTTP_TRACE
+        if (!http_trace_requested) return;
+
+        http_trace_requested = 0;
+        if (dump_http_trace()) fprintf(stderr, "dump_http_trace() failed\n");
+#endif  // HTTP_TRACE
+}
+
+
+int dump_http_trace(void)
+{
+#ifdef HTTP_TRACE
+        struct http_trace* t = &http_trace_ring;
+        if (!t->path) return EXIT_FAILURE;
+
+        FILE* f = fopen(t->path, "w");
+        if (!f) {
+                perror("fopen() failed");
+                return EXIT_FAILURE;
+        }
+
+        // Clock ticks per microsecond, measured since the first event
+        double ticks_per_us = 1000.0; // nanoseconds
+        uint64_t ns = get_http_trace_ns();
+        if (t->count && t->ns0 < ns) {
+                ticks_per_us = (double) (read_http_trace_clock() - t->clock0)
+                        / ((double) (ns - t->ns0) / 1000.0);
+        }
+
+        // Complete events ("X") of the loop's thread, oldest first
+        fprintf(f, "{\"traceEvents\":[");
+        size_t first = (t->next + HTTP_TRACE_RING_LEN - t->count)
+                % HTTP_TRACE_RING_LEN;
+        for (size_t i = 0; i < t->count; ++i) {
+                const struct http_trace_event* e =
+                        &(t->events[(first + i) % HTTP_TRACE_RING_LEN]);
+                double ts = (double) (e->start - t->clock0) / ticks_per_us;
+                double dur = (double) (e->end - e->start) / ticks_per_us;
+
+                fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"http\","
+                        "\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"pid\":1,\"tid\":1,\"args\":{\"n\":%u}}",
+                        i ? "," : "", http_trace_names[e->stage], ts, dur,
+                        (unsigned) e->arg);
+        }
+        fprintf(f, "\n]}\n");
+
+        int res = (ferror(f) ? EXIT_FAILURE : EXIT_SUCCESS);
+        if (fclose(f)) res = EXIT_FAILURE;
+        if (!res) printf("Trace written to %s (%zu events)\n", t->path,
+                t->count);
+
+        return res;
+#else   // HTTP_TRACE
+        return EXIT_FAILURE;
+#endif  // !HTTP_TRACE
+}
+
+
+void cleanup_http_trace(void)
+{
+#ifdef HTTP_TRACE
+        if (http_trace_ring.path && dump_http_trace()) {
+                fprintf(stderr, "dump_http_trace() failed\n");
+        }
+#endif  // HTTP_TRACE
+}
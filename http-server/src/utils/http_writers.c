@@ -1,4 +1,5 @@
 #include "../headers/http_writers.h"
+#include "../headers/http_traces.h"     // HTTP_TRACE_BEGIN(), ...
 
 
 size_t calculate_http_response_size(const char* response,
@@ -20,11 +21,13 @@ size_t calculate_http_response_size(const char* response,
                 memset(clen_str, 0, sizeof(clen_str));
                 sprintf(clen_str, "%zu", content_len);
                 total_sz += strlen("Content-Length: ") + strlen(clen_str) + 2;
-
-                total_sz += 2;  // blank line
                 total_sz += content_len;
+        } else {
+                total_sz += strlen("Content-Length: 0") + 2;
         }
 
+        total_sz += 2;  // blank line
+
         va_list chrs_args = { 0 };
         va_copy(chrs_args, args);
         for (size_t i = 0; i < argc; ++i) {
@@ -45,20 +48,21 @@ int write_http_response(struct strinfo* sstr,
         const size_t argc,
         ...)
 {
+        HTTP_TRACE_BEGIN(format);
+
         // Calculate the total response size
         va_list args = { 0 };
         va_start(args, argc);
         size_t total_sz = calculate_http_response_size(response,
                 content_type, content_len, content, argc, args);
 
-        // Allocate the memory
-        if (sstr->buf) {
-                cleanup_strinfo(sstr);
+        // Reuse the buffer of the previous response
+        clear_strinfo(sstr);
+        if (reserve_strinfo(sstr, total_sz - 1)) {
+                va_end(args);
+                return EXIT_FAILURE;
         }
-        sstr->buf = (char*) calloc(total_sz, 1);
-        if (!sstr->buf) return EXIT_FAILURE;
-        sstr->sz = total_sz;
-        sstr->len = sstr->sz - 1;
+        sstr->len = total_sz - 1;
 
         // Write the response
         char* cur = sstr->buf;
@@ -71,6 +75,8 @@ int write_http_response(struct strinfo* sstr,
                         "Content-Type: %s\r\n"
                         "Content-Length: %zu\r\n",
                         content_type, content_len);
+        } else {
+                cur += sprintf(cur, "Content-Length: 0\r\n");
         }
 
         // Write the additional headers
@@ -81,10 +87,13 @@ int write_http_response(struct strinfo* sstr,
         va_end(args);
 
         // Write the contents
+        cur += sprintf(cur, "\r\n");
         if (write_contents) {
-                cur += sprintf(cur, "\r\n%s", content);
+                memcpy(cur, content, content_len);
         }
+        sstr->buf[sstr->len] = '\0';
 
+        HTTP_TRACE_END(format, HTS_FORMAT, sstr->len);
         return EXIT_SUCCESS;
 }
 
@@ -92,13 +101,119 @@ int write_http_from_code(const enum http_code code, struct strinfo* sstr,
         const char* content_type, const size_t content_len,
         const char* content, const char* connection)
 {
-        const char* conn_header = "Connection: close";
+        return write_http_response(sstr, http_code_to_str_1_1(code),
+                content_type, content_len, content,
+                1, http_conn_header(connection));
+}
+
 
+const char* http_conn_header(const char* connection)
+{
         if (connection && !strcmp(connection, "keep-alive")) {
-                conn_header = "Connection: keep-alive";
+                return "Connection: keep-alive";
         }
 
-        return write_http_response(sstr, http_code_to_str_1_1(code),
-                content_type, content_len, content,
-                1, conn_header);
+        return "Connection: close";
+}
+
+
+int write_http_stream_response(struct strinfo* sstr,
+        struct http_stream* strm,
+        const char* response,
+        const char* content_type,
+        const size_t content_len,
+        const size_t argc,
+        ...)
+{
+        HTTP_TRACE_BEGIN(format);
+        clear_strinfo(sstr);
+
+        // Write the status line and content related info
+        int res = appendf_strinfo(sstr, "%s\r\n", response);
+        if (content_type) {
+                res |= appendf_strinfo(sstr, "Content-Type: %s\r\n",
+                        content_type);
+        }
+
+        strm->chunked = (content_len == HTTP_UNKNOWN_LEN);
+        if (strm->chunked) {
+                res |= appendf_strinfo(sstr, "Transfer-Encoding: chunked\r\n");
+        } else {
+                res |= appendf_strinfo(sstr, "Content-Length: %zu\r\n",
+                        content_len);
+        }
+
+        // Write the additional headers
+        va_list args = { 0 };
+        va_start(args, argc);
+        for (size_t i = 0; i < argc; ++i) {
+                const char* arg = va_arg(args, const char*);
+                res |= appendf_strinfo(sstr, "%s\r\n", arg);
+        }
+        va_end(args);
+
+        // Blank line, the body follows with fill_http_stream()
+        res |= append_strinfo(sstr, "\r\n", 2);
+        if (res) return EXIT_FAILURE;
+
+        strm->active = 1;
+        HTTP_TRACE_END(format, HTS_FORMAT, sstr->len);
+        return EXIT_SUCCESS;
+}
+
+
+int write_http_stream(struct strinfo* sstr, const struct http_stream* strm,
+        const char* data, const size_t len)
+{
+        if (!len) return EXIT_SUCCESS; // zero size chunk ends the body
+        if (!strm->chunked) return append_strinfo(sstr, data, len);
+
+        // Chunk: size in hex, data, "\r\n"
+        int res = appendf_strinfo(sstr, "%zx\r\n", len);
+        res |= append_strinfo(sstr, data, len);
+        res |= append_strinfo(sstr, "\r\n", 2);
+
+        return res ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+int fill_http_stream(struct http_stream* strm, struct strinfo* sstr)
+{
+        // Reuse the send buffer
+        sstr->len = 0;
+        sstr->adv = 0;
+
+        int written = strm->next(strm, sstr);
+        if (written < 0) {
+                cleanup_http_stream(strm);
+                return EXIT_FAILURE;
+        }
+
+        if (written > 0) return EXIT_SUCCESS;
+
+        // End of the body
+        int res = EXIT_SUCCESS;
+        if (strm->chunked) {
+                res = append_strinfo(sstr, "0\r\n\r\n", 5);
+        }
+
+        cleanup_http_stream(strm);
+        return res;
+}
+
+
+void cleanup_http_stream(struct http_stream* strm)
+{
+        if (strm->cleanup && strm->data) {
+                strm->cleanup(strm->data);
+        }
+
+        strm->next = NULL;
+        strm->cleanup = NULL;
+        strm->data = NULL;
+        strm->chunked = 0;
+        strm->active = 0;
+        strm->file = NULL;
+        strm->file_off = 0;
+        strm->file_left = 0;
 }
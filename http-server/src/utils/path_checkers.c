@@ -1,5 +1,6 @@
 #include "../headers/path_checkers.h"
 #include <stdlib.h>
+#include <stdio.h>  // fopen(), fgets(), ...
 
 
 void make_path_cross_platform(char* const cur_path) {
@@ -54,40 +55,395 @@ int check_path(const char* path, const char* prefix, const int max_ups)
 }
 
 
-#define MAX_EXT_LEN 64  // max file extension length
+#define MIME_MAX_DISP   65535   // max displacement tried per bucket
 
 
-const char* path_to_content_type(const char* const path)
+/*
+ * Extension and the related content type
+ *
+ * @ext   Extension without the dot
+ * @ctype Content type
+ */
+struct mime_type {
+        const char* ext;
+        const char* ctype;
+};
+
+
+// Built-in content types
+static const struct mime_type builtin_mime_types[] = {
+        // Programming
+        { "html", "text/html" },
+        { "htm", "text/html" },
+        { "css", "text/css" },
+        { "js", "text/javascript" },
+        { "mjs", "text/javascript" },
+        { "md", "text/markdown" },
+        { "txt", "text/plain" },
+        { "csv", "text/csv" },
+        { "xml", "application/xml" },
+        { "json", "application/json" },
+        { "map", "application/json" },
+        { "wasm", "application/wasm" },
+        { "pdf", "application/pdf" },
+        // Images
+        { "png", "image/png" },
+        { "apng", "image/apng" },
+        { "jpeg", "image/jpeg" },
+        { "jpg", "image/jpeg" },
+        { "gif", "image/gif" },
+        { "webp", "image/webp" },
+        { "avif", "image/avif" },
+        { "bmp", "image/bmp" },
+        { "tif", "image/tiff" },
+        { "tiff", "image/tiff" },
+        { "ico", "image/vnd.microsoft.icon" },
+        { "svg", "image/svg+xml" },
+        // Fonts
+        { "ttf", "font/ttf" },
+        { "otf", "font/otf" },
+        { "woff", "font/woff" },
+        { "woff2", "font/woff2" },
+        { "eot", "application/vnd.ms-fontobject" },
+        // Audio / video
+        { "mp3", "audio/mpeg" },
+        { "wav", "audio/wav" },
+        { "flac", "audio/flac" },
+        { "aac", "audio/aac" },
+        { "m4a", "audio/mp4" },
+        { "oga", "audio/ogg" },
+        { "ogg", "audio/ogg" },
+        { "opus", "audio/opus" },
+        { "mp4", "video/mp4" },
+        { "webm", "video/webm" },
+        { "ogv", "video/ogg" },
+        { "mov", "video/quicktime" },
+        // Archives
+        { "zip", "application/zip" },
+        { "gz", "application/gzip" },
+        { "tar", "application/x-tar" },
+        { "7z", "application/x-7z-compressed" }
+};
+
+
+/*
+ * Perfect hash table of content types (hash and displace)
+ *
+ * @keys      Packed extensions (0 for an empty slot)
+ * @ctypes    Related content types
+ * @disps     Displacement of each bucket giving no collisions
+ * @bits      log2(table size)
+ * @bkt_bits  log2(buckets count)
+ * @ready     Table was built
+ * @failed    Building failed, not retried ("text/plain" is used)
+ */
+struct mime_table {
+        uint64_t keys[2 * MAX_MIME_TYPES];
+        const char* ctypes[2 * MAX_MIME_TYPES];
+        uint16_t disps[MAX_MIME_TYPES];
+        unsigned bits;
+        unsigned bkt_bits;
+        int ready;
+        int failed;
+};
+
+
+// Content types loaded with load_mime_types() (override the built-in ones)
+struct mime_list {
+        uint64_t keys[MAX_MIME_TYPES];
+        char* ctypes[MAX_MIME_TYPES];
+        size_t count;
+};
+
+
+// Gets the table of content types
+struct mime_table* get_mime_table(void)
+{
+        static struct mime_table table = { 0 };
+        return &table;
+}
+
+
+// Gets the loaded content types
+struct mime_list* get_mime_list(void)
+{
+        static struct mime_list list = { 0 };
+        return &list;
+}
+
+
+/*
+ * Packs the lowercased extension into 64 bits
+ *
+ * Returns:
+ *      - Success: non-zero key
+ *      - Empty / too long extension: 0
+ */
+uint64_t pack_extension(const char* ext, const size_t len)
 {
-        const char* last_dot = NULL;
-        size_t path_len = strlen(path);
-        for (int i = (int) path_len - 1; i >= 0; i--) {
-                if (path[i] == '.') {
-                        last_dot = path + i;
-                        break;
+        if (!len || MAX_EXT_LEN < len) return 0;
+
+        uint64_t key = 0;
+        for (size_t i = 0; i < len; ++i) {
+                unsigned char c = (unsigned char) ext[i];
+                if ('A' <= c && c <= 'Z') c = (unsigned char) (c - 'A' + 'a');
+                key |= ((uint64_t) c) << (8 * i);
+        }
+
+        return key;
+}
+
+
+// Mixes the bits of the key (splitmix64 finalizer)
+static inline
+uint64_t mix_mime_key(uint64_t key)
+{
+        key ^= key >> 30;
+        key *= 0xBF58476D1CE4E5B9ULL;
+        key ^= key >> 27;
+        key *= 0x94D049BB133111EBULL;
+        key ^= key >> 31;
+
+        return key;
+}
+
+
+// Gets the bucket of the key
+static inline
+size_t mime_bucket(const struct mime_table* table, const uint64_t key)
+{
+        return (size_t) (mix_mime_key(key) >> (64 - table->bkt_bits));
+}
+
+
+// Gets the slot of the key displaced by "disp"
+static inline
+size_t mime_slot(const struct mime_table* table, const uint64_t key,
+        const uint16_t disp)
+{
+        uint64_t h = mix_mime_key(key + 0x9E3779B97F4A7C15ULL * (disp + 1));
+        return (size_t) (h >> (64 - table->bits));
+}
+
+
+/*
+ * Finds a displacement placing all the keys
+ * of the bucket to distinct free slots
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int place_mime_bucket(struct mime_table* table, const size_t bkt,
+        const uint64_t* keys, const char* const* ctypes,
+        const size_t* idxs, const size_t n)
+{
+        size_t slots[MAX_MIME_TYPES];
+        for (uint32_t disp = 0; disp <= MIME_MAX_DISP; ++disp) {
+                size_t placed = 0;
+                for (; placed < n; ++placed) {
+                        size_t slot = mime_slot(table, keys[idxs[placed]],
+                                (uint16_t) disp);
+                        if (table->keys[slot]) break;
+
+                        // Occupied by a key of the same bucket
+                        size_t j = 0;
+                        while (j < placed && slots[j] != slot) ++j;
+                        if (j < placed) break;
+
+                        slots[placed] = slot;
+                }
+
+                if (placed < n) continue;
+
+                for (size_t i = 0; i < n; ++i) {
+                        table->keys[slots[i]] = keys[idxs[i]];
+                        table->ctypes[slots[i]] = ctypes[idxs[i]];
                 }
+                table->disps[bkt] = (uint16_t) disp;
+
+                return EXIT_SUCCESS;
         }
 
-        // Transform
-        const char* ext = "text/plain";
-        if (MAX_EXT_LEN <= path - last_dot) {
-                return ext;
+        return EXIT_FAILURE;
+}
+
+
+/*
+ * Builds the perfect hash table from the loaded and built-in types
+ *
+ * Description: keys are split into buckets, the biggest
+ * buckets are placed first, each bucket gets a displacement
+ * moving its keys to free slots
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int build_mime_table(void)
+{
+        static uint64_t keys[MAX_MIME_TYPES];
+        static const char* ctypes[MAX_MIME_TYPES];
+        static size_t idxs[MAX_MIME_TYPES];
+        static size_t bkt_start[MAX_MIME_TYPES + 1];
+        static size_t bkt_fill[MAX_MIME_TYPES + 1];
+        const size_t n_builtin = sizeof(builtin_mime_types)
+                / sizeof(builtin_mime_types[0]);
+        struct mime_list* list = get_mime_list();
+        struct mime_table* table = get_mime_table();
+
+        // Loaded types go first to override the built-in ones
+        size_t count = 0;
+        for (size_t i = 0; i < list->count + n_builtin; ++i) {
+                uint64_t key = 0;
+                const char* ctype = NULL;
+                if (i < list->count) {
+                        key = list->keys[i];
+                        ctype = list->ctypes[i];
+                } else {
+                        const struct mime_type* mt =
+                                &(builtin_mime_types[i - list->count]);
+                        key = pack_extension(mt->ext, strlen(mt->ext));
+                        ctype = mt->ctype;
+                }
+
+                // Skip duplicates: the first one wins
+                size_t j = 0;
+                while (j < count && keys[j] != key) ++j;
+                if (!key || j < count) continue;
+                if (count == MAX_MIME_TYPES) return EXIT_FAILURE;
+
+                keys[count] = key;
+                ctypes[count++] = ctype;
         }
 
-        // Programming
-        if (!strcmp(last_dot, ".html")) ext = "text/html";
-        else if (!strcmp(last_dot, ".css")) ext = "text/css";
-        else if (!strcmp(last_dot, ".js")) ext = "text/javascript";
-        else if (!strcmp(last_dot, ".md")) ext = "text/markdown";
-        else if (!strcmp(last_dot, ".json")) ext = "application/json";
-        // Images
-        else if (!strcmp(last_dot, ".png")) ext = "image/png";
-        else if (!strcmp(last_dot, ".jpeg")) ext = "image/jpeg";
-        else if (!strcmp(last_dot, ".jpg")) ext = "image/jpeg";
-        else if (!strcmp(last_dot, ".ico")) ext = "image/vnd.microsoft.icon";
-        else if (!strcmp(last_dot, ".svg")) ext = "image/svg+xml";
-        // Fonts
-        else if (!strcmp(last_dot, ".ttf")) ext = "application/x-font-ttf";
+        // Load factor of at most 1/2, about two keys per bucket
+        table->bits = 1;
+        while (((size_t) 1 << table->bits) < 2 * count) ++table->bits;
+        table->bkt_bits = (table->bits < 3 ? 1 : table->bits - 2);
+        const size_t n_bkts = (size_t) 1 << table->bkt_bits;
+
+        memset(table->keys, 0, sizeof(table->keys));
+        table->ready = 0;
+
+        // Group the keys by bucket (counting sort)
+        memset(bkt_start, 0, sizeof(bkt_start));
+        for (size_t i = 0; i < count; ++i) {
+                ++bkt_start[mime_bucket(table, keys[i]) + 1];
+        }
+        for (size_t bkt = 0; bkt < n_bkts; ++bkt) {
+                bkt_start[bkt + 1] += bkt_start[bkt];
+        }
+        memcpy(bkt_fill, bkt_start, sizeof(bkt_fill));
+        for (size_t i = 0; i < count; ++i) {
+                idxs[bkt_fill[mime_bucket(table, keys[i])]++] = i;
+        }
+
+        // Place the biggest buckets first
+        size_t max_sz = 0;
+        for (size_t bkt = 0; bkt < n_bkts; ++bkt) {
+                size_t sz = bkt_start[bkt + 1] - bkt_start[bkt];
+                if (max_sz < sz) max_sz = sz;
+        }
+        for (size_t sz = max_sz; sz > 0; --sz) {
+                for (size_t bkt = 0; bkt < n_bkts; ++bkt) {
+                        if (bkt_start[bkt + 1] - bkt_start[bkt] != sz) continue;
+
+                        if (place_mime_bucket(table, bkt, keys, ctypes,
+                                idxs + bkt_start[bkt], sz)) {
+                                return EXIT_FAILURE;
+                        }
+                }
+        }
+
+        table->ready = 1;
+        return EXIT_SUCCESS;
+}
+
+
+int load_mime_types(const char* path)
+{
+        FILE* f = fopen(path, "r");
+        if (!f) return EXIT_FAILURE;
+
+        struct mime_list* list = get_mime_list();
+        int ret = EXIT_SUCCESS;
+        char line[1024];
+        while (!ret && fgets(line, sizeof(line), f)) {
+                char* comment = strchr(line, '#');
+                if (comment) *comment = '\0';
+
+                // Content type, then the extensions
+                const char* delims = " \t\r\n";
+                char* ctype = strtok(line, delims);
+                if (!ctype) continue;
+
+                char* ctype_copy = NULL;
+                char* ext = NULL;
+                while ((ext = strtok(NULL, delims))) {
+                        uint64_t key = pack_extension(ext, strlen(ext));
+                        if (!key) continue;
+
+                        if (list->count == MAX_MIME_TYPES) {
+                                ret = EXIT_FAILURE;
+                                break;
+                        }
+
+                        if (!ctype_copy) {
+                                ctype_copy = strdup(ctype);
+                                if (!ctype_copy) {
+                                        ret = EXIT_FAILURE;
+                                        break;
+                                }
+                        }
+
+                        list->keys[list->count] = key;
+                        list->ctypes[list->count++] = ctype_copy;
+                }
+        }
+
+        fclose(f);
+        if (ret) return ret;
+
+        return build_mime_table();
+}
+
+
+int prepare_mime_table(void)
+{
+        struct mime_table* table = get_mime_table();
+        if (table->ready) return EXIT_SUCCESS;
+        if (table->failed) return EXIT_FAILURE;
+
+        if (build_mime_table()) {
+                table->failed = 1;
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+const char* path_to_content_type(const char* const path)
+{
+        const char* ctype = "text/plain";
+
+        struct mime_table* table = get_mime_table();
+        if (prepare_mime_table()) return ctype;
+
+        // Find the extension of the last path segment
+        const char* last_dot = strrchr(path, '.');
+        const char* last_slash = strrchr(path, '/');
+        if (!last_dot || (last_slash && last_dot < last_slash)) return ctype;
+
+        const char* ext = last_dot + 1;
+        uint64_t key = pack_extension(ext, strlen(ext));
+        if (!key) return ctype;
+
+        // Bucket displacement, then a single probe
+        uint16_t disp = table->disps[mime_bucket(table, key)];
+        size_t slot = mime_slot(table, key, disp);
+        if (table->keys[slot] == key) ctype = table->ctypes[slot];
 
-        return ext;
+        return ctype;
 }
@@ -1,4 +1,15 @@
+#ifdef __linux__
+        #define _GNU_SOURCE      // sched_getcpu()
+        #include <sched.h>       // sched_setaffinity()
+#endif  // __linux__
+
 #include "../headers/sockshelp.h"
+#include <string.h>              // strncmp()
+
+#ifndef _WIN32
+        #include <fcntl.h>       // fcntl()
+        #include <netinet/tcp.h> // TCP_DEFER_ACCEPT, TCP_NODELAY, ...
+#endif  // !_WIN32
 
 
 int allocate_max(char** dest, const int mn, const int mx)
@@ -51,6 +62,219 @@ int sockets_cleanup(void)
 }
 
 
+int set_socket_nonblocking(const SOCKET s)
+{
+#ifdef _WIN32
+        u_long mode = 1;
+        return ioctlsocket(s, FIONBIO, &mode) ? EXIT_FAILURE : EXIT_SUCCESS;
+#else   // _WIN32
+        int flags = fcntl(s, F_GETFL, 0);
+        if (flags < 0 || fcntl(s, F_SETFL, flags | O_NONBLOCK)) {
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+#endif  // !_WIN32
+}
+
+
+int set_socket_defer_accept(const SOCKET s, const int sec)
+{
+#ifdef TCP_DEFER_ACCEPT
+        if (setsockopt(s, IPPROTO_TCP, TCP_DEFER_ACCEPT, &sec, sizeof(sec))) {
+                psockerror("setsockopt() failed");
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+#else   // TCP_DEFER_ACCEPT
+        (void) s;
+        (void) sec;
+        return EXIT_FAILURE;
+#endif  // !TCP_DEFER_ACCEPT
+}
+
+
+void initialize_socket_profile(struct socket_profile* prof)
+{
+        memset(prof, 0, sizeof(*prof));
+        prof->incoming_cpu = SOCKET_CPU_UNSET;
+}
+
+
+// Parses the value of "name=VALUE" (non-negative)
+int parse_socket_profile_value(const char* opt, const size_t len,
+        const char* name, int* value)
+{
+        size_t name_len = strlen(name);
+        if (len <= name_len + 1 || strncmp(opt, name, name_len)
+                || opt[name_len] != '=') {
+                return EXIT_FAILURE;
+        }
+
+        char* end = NULL;
+        long v = strtol(opt + name_len + 1, &end, 10);
+        if (end != opt + len || v < 0 || 0x7fffffffL < v) return EXIT_FAILURE;
+
+        *value = (int) v;
+        return EXIT_SUCCESS;
+}
+
+
+int parse_socket_profile(const char* spec, struct socket_profile* prof)
+{
+        while (*spec) {
+                const char* comma = strchr(spec, ',');
+                size_t len = (comma ? (size_t) (comma - spec) : strlen(spec));
+
+                int res = EXIT_SUCCESS;
+                if (len == 7 && !strncmp(spec, "nodelay", len)) {
+                        prof->nodelay = 1;
+                } else if (len == 4 && !strncmp(spec, "cork", len)) {
+                        prof->cork = 1;
+                } else if (len == 12 && !strncmp(spec, "incoming-cpu", len)) {
+                        prof->incoming_cpu = SOCKET_CPU_WORKER;
+                } else if (!strncmp(spec, "fastopen", 8)) {
+                        res = parse_socket_profile_value(spec, len,
+                                "fastopen", &(prof->fastopen));
+                } else if (!strncmp(spec, "sndbuf", 6)) {
+                        res = parse_socket_profile_value(spec, len,
+                                "sndbuf", &(prof->sndbuf));
+                } else if (!strncmp(spec, "rcvbuf", 6)) {
+                        res = parse_socket_profile_value(spec, len,
+                                "rcvbuf", &(prof->rcvbuf));
+                } else if (!strncmp(spec, "busy-poll", 9)) {
+                        res = parse_socket_profile_value(spec, len,
+                                "busy-poll", &(prof->busy_poll_us));
+                } else if (!strncmp(spec, "incoming-cpu", 12)) {
+                        res = parse_socket_profile_value(spec, len,
+                                "incoming-cpu", &(prof->incoming_cpu));
+                } else {
+                        res = EXIT_FAILURE;
+                }
+                if (res) return EXIT_FAILURE;
+
+                spec += len + (comma ? 1 : 0);
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+// Sets the integer socket option, logs the failure
+int set_socket_int_option(const SOCKET s, const int level, const int name,
+        const int value, const char* what)
+{
+        if (setsockopt(s, level, name, (const char*) &value, sizeof(value))) {
+                psockerror("setsockopt(%s) failed", what);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+// Applies the options shared by the listening and the accepted sockets
+int apply_common_socket_profile(const SOCKET s,
+        const struct socket_profile* prof)
+{
+        int res = EXIT_SUCCESS;
+        if (prof->sndbuf && set_socket_int_option(s, SOL_SOCKET, SO_SNDBUF,
+                prof->sndbuf, "SO_SNDBUF")) {
+                res = EXIT_FAILURE;
+        }
+        if (prof->rcvbuf && set_socket_int_option(s, SOL_SOCKET, SO_RCVBUF,
+                prof->rcvbuf, "SO_RCVBUF")) {
+                res = EXIT_FAILURE;
+        }
+
+#ifdef SO_BUSY_POLL
+        if (prof->busy_poll_us && set_socket_int_option(s, SOL_SOCKET,
+                SO_BUSY_POLL, prof->busy_poll_us, "SO_BUSY_POLL")) {
+                res = EXIT_FAILURE;
+        }
+#else   // SO_BUSY_POLL
+        if (prof->busy_poll_us) res = EXIT_FAILURE;
+#endif  // !SO_BUSY_POLL
+
+#ifdef SO_INCOMING_CPU
+        if (0 <= prof->incoming_cpu && set_socket_int_option(s, SOL_SOCKET,
+                SO_INCOMING_CPU, prof->incoming_cpu, "SO_INCOMING_CPU")) {
+                res = EXIT_FAILURE;
+        }
+#else   // SO_INCOMING_CPU
+        if (0 <= prof->incoming_cpu) res = EXIT_FAILURE;
+#endif  // !SO_INCOMING_CPU
+
+        return res;
+}
+
+
+int apply_listener_profile(const SOCKET s, struct socket_profile* prof)
+{
+        int res = EXIT_SUCCESS;
+
+        // The loop stays on its CPU, the connections are steered there
+        if (prof->incoming_cpu == SOCKET_CPU_WORKER) {
+#ifdef __linux__
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                int cpu = sched_getcpu();
+                if (0 <= cpu) CPU_SET(cpu, &set);
+                if (cpu < 0 || sched_setaffinity(0, sizeof(set), &set)) {
+                        perror("Failed to pin the server to its CPU");
+                        prof->incoming_cpu = SOCKET_CPU_UNSET;
+                        res = EXIT_FAILURE;
+                } else {
+                        prof->incoming_cpu = cpu;
+                        printf("Server loop was pinned to CPU %d\n", cpu);
+                }
+#else   // __linux__
+                prof->incoming_cpu = SOCKET_CPU_UNSET;
+                res = EXIT_FAILURE;
+#endif  // !__linux__
+        }
+
+#ifdef TCP_FASTOPEN
+        if (prof->fastopen && set_socket_int_option(s, IPPROTO_TCP,
+                TCP_FASTOPEN, prof->fastopen, "TCP_FASTOPEN")) {
+                res = EXIT_FAILURE;
+        }
+#else   // TCP_FASTOPEN
+        if (prof->fastopen) res = EXIT_FAILURE;
+#endif  // !TCP_FASTOPEN
+
+        if (apply_common_socket_profile(s, prof)) res = EXIT_FAILURE;
+        return res;
+}
+
+
+int apply_socket_profile(const SOCKET s, const struct socket_profile* prof)
+{
+        int res = EXIT_SUCCESS;
+        if (prof->nodelay && set_socket_int_option(s, IPPROTO_TCP,
+                TCP_NODELAY, 1, "TCP_NODELAY")) {
+                res = EXIT_FAILURE;
+        }
+
+        if (apply_common_socket_profile(s, prof)) res = EXIT_FAILURE;
+        return res;
+}
+
+
+int set_socket_cork(const SOCKET s, const int on)
+{
+#ifdef TCP_CORK
+        return set_socket_int_option(s, IPPROTO_TCP, TCP_CORK, on,
+                "TCP_CORK");
+#else   // TCP_CORK
+        (void) s;
+        (void) on;
+        return EXIT_FAILURE;
+#endif  // !TCP_CORK
+}
+
+
 struct addrinfo* configure_address(const char* addr,
         const char* serv,
         const int family,
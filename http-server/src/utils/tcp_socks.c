@@ -1,3 +1,7 @@
+#ifdef __linux__
+        #define _GNU_SOURCE             // accept4()
+#endif  // __linux__
+
 #include "../headers/tcp_socks.h"
 
 
@@ -20,13 +24,94 @@ void cleanup_strinfo(struct strinfo* strinf)
 }
 
 
+void clear_strinfo(struct strinfo* strinf)
+{
+        strinf->len = 0;
+        strinf->adv = 0;
+        if (strinf->buf) strinf->buf[0] = '\0';
+}
+
+
+int reserve_strinfo(struct strinfo* strinf, const size_t len)
+{
+        if (strinf->len + len + 1 <= strinf->sz) return EXIT_SUCCESS;
+
+        // Grow the buffer geometrically
+        size_t new_sz = (strinf->sz ? strinf->sz : MIN_NETBUF_LEN);
+        while (new_sz < strinf->len + len + 1) { // + '\0'
+                new_sz *= 2;
+        }
+
+        char* new_buf = (char*) realloc(strinf->buf, new_sz);
+        if (!new_buf) return EXIT_FAILURE;
+
+        strinf->buf = new_buf;
+        strinf->sz = new_sz;
+
+        return EXIT_SUCCESS;
+}
+
+
+int append_strinfo(struct strinfo* strinf, const char* data, const size_t len)
+{
+        if (reserve_strinfo(strinf, len)) return EXIT_FAILURE;
+
+        if (len) memcpy(strinf->buf + strinf->len, data, len);
+        strinf->len += len;
+        strinf->buf[strinf->len] = '\0';
+
+        return EXIT_SUCCESS;
+}
+
+
+int appendf_strinfo(struct strinfo* strinf, const char* format, ...)
+{
+        // Calculate the formatted string length
+        va_list args = { 0 };
+        va_start(args, format);
+        va_list len_args = { 0 };
+        va_copy(len_args, args);
+        int len = vsnprintf(NULL, 0, format, len_args);
+        va_end(len_args);
+
+        if (len < 0 || reserve_strinfo(strinf, (size_t) len)) {
+                va_end(args);
+                return EXIT_FAILURE;
+        }
+
+        // Write in place
+        vsnprintf(strinf->buf + strinf->len, (size_t) len + 1, format, args);
+        strinf->len += (size_t) len;
+        va_end(args);
+
+        return EXIT_SUCCESS;
+}
+
+
+void consume_strinfo(struct strinfo* strinf, const size_t len)
+{
+        if (!len) return;
+
+        size_t n = (len < strinf->len ? len : strinf->len);
+        memmove(strinf->buf, strinf->buf + n, strinf->len - n);
+        strinf->len -= n;
+        strinf->buf[strinf->len] = '\0';
+}
+
+
 void initialize_clientinfo(struct clientinfo* cinfo)
 {
         cinfo->client = INVALID_SOCKET;
         cinfo->state = CS_IDLE;
         cinfo->add_data = NULL;
+        cinfo->cleanup_add_data = NULL;
         initialize_strinfo(&(cinfo->sdstr));
         initialize_strinfo(&(cinfo->rvstr));
+
+        memset(&(cinfo->addr), 0, sizeof(cinfo->addr));
+        cinfo->addr_len = 0;
+        cinfo->connected = 0;
+        cinfo->active = 0;
 }
 
 
@@ -37,12 +122,18 @@ void cleanup_clientinfo(struct clientinfo* cinfo)
                 int cs_res = closesocket(cinfo->client);
                 cinfo->client = INVALID_SOCKET;
                 cinfo->state = CS_IDLE;
-                cinfo->add_data = NULL;
                 if (cs_res) {
                         psockerror("close() failed");
                 }
         }
 
+        // Free the additional data
+        if (cinfo->add_data && cinfo->cleanup_add_data) {
+                cinfo->cleanup_add_data(cinfo->add_data);
+        }
+        cinfo->add_data = NULL;
+        cinfo->cleanup_add_data = NULL;
+
         // Cleanup the related strinfo structures
         cleanup_strinfo(&(cinfo->sdstr));
         cleanup_strinfo(&(cinfo->rvstr));
@@ -53,17 +144,32 @@ void initialize_serverinfo(struct serverinfo* sinfo, const SOCKET serv)
 {
         sinfo->serv = serv;
         sinfo->max_fd = serv;
+        sinfo->timeout_ms = -1;
+        sinfo->on_select = NULL;
+        sinfo->on_selected = NULL;
+        sinfo->on_wait = NULL;
+        sinfo->loops = 0;
+        sinfo->wait_us = 0;
+        sinfo->busy_us = 0;
+        sinfo->lag_us = 0;
+        sinfo->profile = NULL;
+        sinfo->full = 0;
+        sinfo->full_waits = 0;
         for (size_t i = 0; i < MAX_CONN; ++i) {
                 initialize_clientinfo(&(sinfo->clients[i]));
         }
+
+        // The accept loop stops once the backlog is empty
+        if (validate_socket(serv) && set_socket_nonblocking(serv)) {
+                psockerror("Failed to make the server socket non-blocking");
+        }
 }
 
 
 void cleanup_serverinfo(struct serverinfo* sinfo)
 {
-        // Close the fd
-        int ret = closesocket(sinfo->serv);
-        if (ret) {
+        // Close the fd (unless the server stopped accepting)
+        if (validate_socket(sinfo->serv) && closesocket(sinfo->serv)) {
                 psockerror("close() failed");
         }
 
@@ -96,6 +202,10 @@ int server_receive_request(struct serverinfo* sinfo, struct clientinfo* cinfo,
         // Receive the request
         int recvd = recv(client, cinfo->rvstr.buf + cinfo->rvstr.len,
                 cinfo->rvstr.sz - cinfo->rvstr.len - 1, 0);
+        if (recvd < 0 && (sockerrno() == EWOULDBLOCK
+                || sockerrno() == EAGAIN)) {
+                return EXIT_SUCCESS; // spurious wakeup (non-blocking)
+        }
         if (recvd <= 0) { // client has disconnected
                 if (on_disconnect(sinfo, client)) {
                         fprintf(stderr, "on_disconnect() failed\n");
@@ -112,38 +222,89 @@ int server_receive_request(struct serverinfo* sinfo, struct clientinfo* cinfo,
 }
 
 
-void server_accept_client(struct serverinfo* sinfo)
+// Accepts a waiting client (non-blocking, not inherited by exec())
+SOCKET accept_client_socket(const SOCKET serv, struct sockaddr_storage* addr,
+        socklen_t* addr_len)
 {
-        int cidx = find_place_for_client(sinfo);
-        if (cidx < 0) {
-                fprintf(stderr, "Too much clients: server_accept_client()\n");
-                return;
+#ifdef __linux__
+        return accept4(serv, (struct sockaddr*) addr, addr_len,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else   // __linux__
+        SOCKET client = accept(serv, (struct sockaddr*) addr, addr_len);
+        if (validate_socket(client) && set_socket_nonblocking(client)) {
+                psockerror("Failed to make the client socket non-blocking");
         }
 
-        // Accept the client
-        struct sockaddr_storage caddr = { 0 };
-        socklen_t caddr_len = sizeof(caddr);
-        SOCKET client = accept(sinfo->serv,
-                (struct sockaddr*) &caddr, &caddr_len);
-        if (!validate_socket(client)) {
-                psockerror("accept() failed");
-                return;
+        return client;
+#endif  // !__linux__
+}
+
+
+void server_accept_client(struct serverinfo* sinfo)
+{
+        // Drain the backlog, the other fds wait at most ACCEPT_BUDGET accepts
+        size_t accepted = 0;
+        while (accepted < ACCEPT_BUDGET) {
+                // The clients wait in the backlog, reported once
+                int cidx = find_place_for_client(sinfo);
+                if (cidx < 0) {
+                        if (!sinfo->full) {
+                                fprintf(stderr, "Too much clients: "
+                                        "server_accept_client()\n");
+                        }
+                        sinfo->full = 1;
+                        ++(sinfo->full_waits);
+                        break;
+                }
+                sinfo->full = 0;
+
+                struct clientinfo* cinfo = &(sinfo->clients[cidx]);
+                cinfo->addr_len = sizeof(cinfo->addr);
+                SOCKET client = accept_client_socket(sinfo->serv,
+                        &(cinfo->addr), &(cinfo->addr_len));
+                if (!validate_socket(client)) {
+                        if (sockerrno() != EWOULDBLOCK
+                                && sockerrno() != EAGAIN) {
+                                psockerror("accept() failed");
+                        }
+
+                        cinfo->addr_len = 0;
+                        break;
+                }
+
+                if (sinfo->profile
+                        && apply_socket_profile(client, sinfo->profile)) {
+                        fprintf(stderr, "Socket profile was not applied\n");
+                }
+
+                // Initialize the client's cell, the address is
+                // formatted when needed (format_client_address())
+                cinfo->client = client;
+                cinfo->connected = time(NULL);
+                cinfo->active = cinfo->connected;
+                ++accepted;
         }
 
-        // Initialize the client's cell
-        sinfo->clients[cidx].client = client;
+        if (accepted) printf("Accepted %zu connection(s)\n", accepted);
+}
+
 
-        // Get the string representation
+void format_client_address(const struct clientinfo* cinfo, char* buf,
+        const size_t len)
+{
         char addr[MAX_ADDRBUF_LEN];
         char serv[MAX_SERVBUF_LEN];
-        int gni_res = getnameinfo((struct sockaddr*) &caddr, caddr_len,
+        if (!cinfo->addr_len || getnameinfo(
+                (const struct sockaddr*) &(cinfo->addr), cinfo->addr_len,
                 addr, sizeof(addr), serv, sizeof(serv),
-                NI_NUMERICHOST | NI_NUMERICHOST);
-        if (gni_res) {
-                psockerror("getnameinfo() failed");
+                NI_NUMERICHOST | NI_NUMERICSERV)) {
+                snprintf(buf, len, "?");
+                return;
         }
-        
-        printf("Connection from %s:%s\n", addr, serv);
+
+        int v6 = (strchr(addr, ':') != NULL);
+        snprintf(buf, len, "%s%s%s:%s", v6 ? "[" : "", addr, v6 ? "]" : "",
+                serv);
 }
 
 
@@ -166,7 +327,7 @@ void sinfo_to_fd_set(const struct serverinfo* sinfo, fd_set* res)
 {
         // Initialize, set the server fd
         FD_ZERO(res);
-        FD_SET(sinfo->serv, res);
+        if (validate_socket(sinfo->serv)) FD_SET(sinfo->serv, res);
 
         // Set the clients
         for (size_t i = 0; i < MAX_CONN; ++i) {
@@ -182,7 +343,7 @@ void sinfo_to_read_fds(const struct serverinfo* sinfo, fd_set* res)
 {
         // Initialize, set the server fd
         FD_ZERO(res);
-        FD_SET(sinfo->serv, res);
+        if (validate_socket(sinfo->serv)) FD_SET(sinfo->serv, res);
 
         // Set the clients
         for (size_t i = 0; i < MAX_CONN; ++i) {
@@ -223,7 +384,15 @@ void server_handle_clients(struct serverinfo* sinfo,
         void (*on_read_set)(struct serverinfo* sinfo, const SOCKET client),
         void (*on_write_set)(struct serverinfo* sinfo, const SOCKET client))
 {
+        time_t now = time(NULL);
         for (size_t i = 0; i < MAX_CONN; ++i) {
+                struct clientinfo* cinfo = &(sinfo->clients[i]);
+                if (validate_socket(cinfo->client)
+                        && (FD_ISSET(cinfo->client, &writefds)
+                        || FD_ISSET(cinfo->client, &readfds))) {
+                        cinfo->active = now;
+                }
+
                 // Check for the ability to send the response first
                 if (validate_socket(sinfo->clients[i].client)) {
                         if (FD_ISSET(sinfo->clients[i].client, &writefds)) {
@@ -254,6 +423,15 @@ void update_max_fd(struct serverinfo* sinfo)
 }
 
 
+uint64_t get_loop_time_us(void)
+{
+        struct timespec ts = { 0 };
+        timespec_get(&ts, TIME_UTC);
+        return (uint64_t) ts.tv_sec * 1000000u
+                + (uint64_t) ts.tv_nsec / 1000u;
+}
+
+
 int server_check_fds(struct serverinfo* sinfo,
         void (*on_serv_set)(struct serverinfo* sinfo),
         void (*on_read_set)(struct serverinfo* sinfo, const SOCKET client),
@@ -265,23 +443,48 @@ int server_check_fds(struct serverinfo* sinfo,
         fd_set writefds = { 0 };
         sinfo_to_write_fds(sinfo, &writefds);
 
-        int slct_res = select(sinfo->max_fd + 1,
-                &readfds, &writefds, NULL, NULL);
-        if (slct_res <= 0) {    // must be positive
+        SOCKET max_fd = sinfo->max_fd;
+        if (sinfo->on_select) {
+                sinfo->on_select(sinfo, &readfds, &writefds, &max_fd);
+        }
+
+        struct timeval tv = { 0 };
+        tv.tv_sec = sinfo->timeout_ms / 1000;
+        tv.tv_usec = (sinfo->timeout_ms % 1000) * 1000;
+        uint64_t wait_start = get_loop_time_us();
+        if (sinfo->on_wait) sinfo->on_wait(sinfo, 0, 0);
+        int slct_res = select(max_fd + 1, &readfds, &writefds, NULL,
+                sinfo->timeout_ms < 0 ? NULL : &tv);
+        if (sinfo->on_wait) sinfo->on_wait(sinfo, 1, slct_res);
+        uint64_t busy_start = get_loop_time_us();
+        sinfo->wait_us += busy_start - wait_start;
+        if (slct_res < 0 && sockerrno() != EINTR) {
                 psockerror("select() failed");
                 return EXIT_FAILURE;
         }
 
+        // Timeout / signal: only the timers of the hooks are due
+        if (slct_res <= 0) {
+                FD_ZERO(&readfds);
+                FD_ZERO(&writefds);
+        }
+
         // A new client is trying to connect
-        if (FD_ISSET(sinfo->serv, &readfds)) {
+        if (validate_socket(sinfo->serv) && FD_ISSET(sinfo->serv, &readfds)) {
                 on_serv_set(sinfo);
         }
 
         // Handle clients
         server_handle_clients(sinfo, readfds, writefds,
                 on_read_set, on_write_set);
+        if (sinfo->on_selected) {
+                sinfo->on_selected(sinfo, &readfds, &writefds);
+        }
         update_max_fd(sinfo);
 
+        sinfo->lag_us = get_loop_time_us() - busy_start;
+        sinfo->busy_us += sinfo->lag_us;
+        ++(sinfo->loops);
         return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,299 @@
+#include "../headers/tls_conns.h"
+#include "../headers/sockshelp.h"       // set_socket_nonblocking()
+#include <string.h>                     // strlen()
+#include <errno.h>                      // errno
+
+#ifdef HTTP_TLS
+        #include <openssl/ssl.h>
+        #include <openssl/err.h>
+#endif  // HTTP_TLS
+
+#ifdef __linux__
+        #include <sys/sendfile.h>       // sendfile()
+#endif  // __linux__
+
+
+#ifdef HTTP_TLS
+/*
+ * TLS connection
+ *
+ * @ssl         OpenSSL connection
+ * @handshaken  Handshake was completed (and logged)
+ */
+struct tls_conn {
+        SSL* ssl;
+        int handshaken;
+};
+
+
+// Shared by the connections: certificate, session cache, ticket keys
+static SSL_CTX* tls_ctx = NULL;
+
+
+// Picks "h2" if the client offers it, "http/1.1" otherwise (ALPN)
+int select_tls_alpn(SSL* ssl, const unsigned char** out,
+        unsigned char* outlen, const unsigned char* in, unsigned int inlen,
+        void* arg)
+{
+        (void) ssl;
+        (void) arg;
+
+        static const unsigned char protos[] = "\x02h2\x08http/1.1";
+        unsigned char* sel = NULL;
+        int res = SSL_select_next_proto(&sel, outlen, protos,
+                sizeof(protos) - 1, in, inlen);
+        if (res != OPENSSL_NPN_NEGOTIATED) return SSL_TLSEXT_ERR_NOACK;
+
+        *out = sel;
+        return SSL_TLSEXT_ERR_OK;
+}
+
+
+// Logs the completed handshake once
+void log_tls_handshake(struct tls_conn* tls)
+{
+        if (tls->handshaken || !SSL_is_init_finished(tls->ssl)) return;
+        tls->handshaken = 1;
+
+        const unsigned char* alpn = NULL;
+        unsigned int alpn_len = 0;
+        SSL_get0_alpn_selected(tls->ssl, &alpn, &alpn_len);
+        if (!alpn_len) {
+                alpn = (const unsigned char*) "http/1.1";
+                alpn_len = 8;
+        }
+
+        printf("TLS handshake: %s%s%s, %.*s\n", SSL_get_version(tls->ssl),
+                SSL_session_reused(tls->ssl) ? ", resumed" : "",
+                BIO_get_ktls_send(SSL_get_wbio(tls->ssl))
+                        ? ", kernel TLS" : "",
+                (int) alpn_len, (const char*) alpn);
+}
+
+
+// Maps the result of an SSL_*() I/O call
+int get_tls_io_result(struct tls_conn* tls, const int res)
+{
+        int err = SSL_get_error(tls->ssl, res);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+                return TLS_CONN_AGAIN;
+        }
+
+        // Closed (with or without close_notify)
+        if (err == SSL_ERROR_ZERO_RETURN
+                || (err == SSL_ERROR_SYSCALL && !ERR_peek_error())) {
+                return 0;
+        }
+
+        unsigned long code = ERR_get_error();
+        fprintf(stderr, "TLS error: %s\n", code
+                ? ERR_reason_error_string(code) : "I/O failure");
+        ERR_clear_error();
+        return -EXIT_FAILURE;
+}
+#endif  // HTTP_TLS
+
+
+int load_tls_context(const char* cert_path, const char* key_path)
+{
+#ifdef HTTP_TLS
+        SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+        if (!ctx) return EXIT_FAILURE;
+
+        // Kernel TLS is switched on after the handshakes when available,
+        // writes may be partial / retried from a reallocated buffer
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS
+                | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+                | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+                | SSL_MODE_RELEASE_BUFFERS);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+        // Clients may close without "close_notify" (OpenSSL 3)
+        SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif  // SSL_OP_IGNORE_UNEXPECTED_EOF
+
+        // Resumption: session IDs (TLS 1.2) cached by the server,
+        // stateless session tickets
+        const char* sid_ctx = "http_server";
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_set_session_id_context(ctx, (const unsigned char*) sid_ctx,
+                (unsigned int) strlen(sid_ctx));
+        SSL_CTX_set_timeout(ctx, TLS_SESSION_TIMEOUT_SEC);
+
+        SSL_CTX_set_alpn_select_cb(ctx, select_tls_alpn, NULL);
+
+        if (SSL_CTX_use_certificate_chain_file(ctx, cert_path) != 1
+                || SSL_CTX_use_PrivateKey_file(ctx, key_path,
+                SSL_FILETYPE_PEM) != 1
+                || SSL_CTX_check_private_key(ctx) != 1) {
+                unsigned long code = ERR_get_error();
+                fprintf(stderr, "TLS: %s\n", code
+                        ? ERR_reason_error_string(code) : "invalid key");
+                SSL_CTX_free(ctx);
+                return EXIT_FAILURE;
+        }
+
+        cleanup_tls_context();
+        tls_ctx = ctx;
+        return EXIT_SUCCESS;
+#else   // HTTP_TLS
+        (void) cert_path;
+        (void) key_path;
+        fprintf(stderr, "TLS support is not built in (HTTP_TLS)\n");
+        return EXIT_FAILURE;
+#endif  // !HTTP_TLS
+}
+
+
+int is_tls_enabled(void)
+{
+#ifdef HTTP_TLS
+        return tls_ctx != NULL;
+#else   // HTTP_TLS
+        return 0;
+#endif  // !HTTP_TLS
+}
+
+
+struct tls_conn* create_tls_conn(const SOCKET client)
+{
+#ifdef HTTP_TLS
+        if (!tls_ctx || set_socket_nonblocking(client)) return NULL;
+
+        struct tls_conn* tls = (struct tls_conn*) calloc(1,
+                sizeof(struct tls_conn));
+        if (!tls) return NULL;
+
+        tls->ssl = SSL_new(tls_ctx);
+        if (!tls->ssl || SSL_set_fd(tls->ssl, (int) client) != 1) {
+                cleanup_tls_conn(tls);
+                return NULL;
+        }
+
+        SSL_set_accept_state(tls->ssl);
+        return tls;
+#else   // HTTP_TLS
+        (void) client;
+        return NULL;
+#endif  // !HTTP_TLS
+}
+
+
+int recv_tls_conn(const SOCKET client, struct tls_conn* tls, char* buf,
+        const size_t len)
+{
+#ifdef HTTP_TLS
+        if (tls) {
+                ERR_clear_error();
+                int res = SSL_read(tls->ssl, buf, (int) len);
+                log_tls_handshake(tls);
+
+                return (0 < res ? res : get_tls_io_result(tls, res));
+        }
+#endif  // HTTP_TLS
+
+        (void) tls;
+        int res = recv(client, buf, len, 0);
+        return (res < 0 ? -EXIT_FAILURE : res);
+}
+
+
+size_t tls_conn_pending(struct tls_conn* tls)
+{
+#ifdef HTTP_TLS
+        if (tls) return (size_t) SSL_pending(tls->ssl);
+#endif  // HTTP_TLS
+
+        (void) tls;
+        return 0;
+}
+
+
+int send_tls_conn(const SOCKET client, struct tls_conn* tls,
+        const char* buf, const size_t len)
+{
+#ifdef HTTP_TLS
+        if (tls) {
+                ERR_clear_error();
+                int res = SSL_write(tls->ssl, buf, (int) len);
+                return (0 < res ? res : get_tls_io_result(tls, res));
+        }
+#endif  // HTTP_TLS
+
+        (void) tls;
+        int res = send(client, buf, len, 0);
+        if (res < 0 && (sockerrno() == EWOULDBLOCK
+                || sockerrno() == EAGAIN)) {
+                return TLS_CONN_AGAIN; // non-blocking sockets
+        }
+        if (res < 0) psockerror("send() failed");
+        return (res < 0 ? -EXIT_FAILURE : res);
+}
+
+
+int can_sendfile_tls_conn(struct tls_conn* tls)
+{
+#ifdef __linux__
+#ifdef HTTP_TLS
+        if (tls) return BIO_get_ktls_send(SSL_get_wbio(tls->ssl));
+#endif  // HTTP_TLS
+
+        return tls == NULL;
+#else   // __linux__
+        (void) tls;
+        return 0;
+#endif  // !__linux__
+}
+
+
+int sendfile_tls_conn(const SOCKET client, struct tls_conn* tls, FILE* f,
+        const size_t off, const size_t len)
+{
+#ifdef __linux__
+#ifdef HTTP_TLS
+        // Encrypted by the kernel
+        if (tls) {
+                ERR_clear_error();
+                ossl_ssize_t res = SSL_sendfile(tls->ssl, fileno(f),
+                        (off_t) off, len, 0);
+                return (0 < res ? (int) res
+                        : get_tls_io_result(tls, (int) res));
+        }
+#endif  // HTTP_TLS
+
+        (void) tls;
+        off_t offset = (off_t) off;
+        ssize_t res = sendfile(client, fileno(f), &offset, len);
+        if (res < 0 && errno == EAGAIN) return TLS_CONN_AGAIN;
+        if (res < 0) perror("sendfile() failed");
+
+        return (res < 0 ? -EXIT_FAILURE : (int) res);
+#else   // __linux__
+        (void) client;
+        (void) tls;
+        (void) f;
+        (void) off;
+        (void) len;
+        return -EXIT_FAILURE;
+#endif  // !__linux__
+}
+
+
+void cleanup_tls_conn(struct tls_conn* tls)
+{
+#ifdef HTTP_TLS
+        if (tls->ssl) SSL_free(tls->ssl);
+#endif  // HTTP_TLS
+
+        free(tls);
+}
+
+
+void cleanup_tls_context(void)
+{
+#ifdef HTTP_TLS
+        if (tls_ctx) SSL_CTX_free(tls_ctx);
+        tls_ctx = NULL;
+#endif  // HTTP_TLS
+}
@@ -0,0 +1,601 @@
+#include "../headers/ws_sessions.h"
+#include <stdio.h>      // fprintf()
+#include <string.h>     // memcpy()
+
+
+
+/*
+ * HANDSHAKE
+ */
+
+
+
+// Rotates a 32-bit word left
+uint32_t rotl_ws_u32(const uint32_t x, const int n)
+{
+        return (x << n) | (x >> (32 - n));
+}
+
+
+// Processes a 64-byte block of SHA-1
+void process_ws_sha1_block(uint32_t h[5], const uint8_t* p)
+{
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+                w[i] = ((uint32_t) p[4 * i] << 24)
+                        | ((uint32_t) p[4 * i + 1] << 16)
+                        | ((uint32_t) p[4 * i + 2] << 8)
+                        | (uint32_t) p[4 * i + 3];
+        }
+        for (int i = 16; i < 80; ++i) {
+                w[i] = rotl_ws_u32(w[i - 3] ^ w[i - 8] ^ w[i - 14]
+                        ^ w[i - 16], 1);
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+                uint32_t f, k;
+                if (i < 20) {
+                        f = (b & c) | (~b & d);
+                        k = 0x5a827999;
+                } else if (i < 40) {
+                        f = b ^ c ^ d;
+                        k = 0x6ed9eba1;
+                } else if (i < 60) {
+                        f = (b & c) | (b & d) | (c & d);
+                        k = 0x8f1bbcdc;
+                } else {
+                        f = b ^ c ^ d;
+                        k = 0xca62c1d6;
+                }
+
+                uint32_t t = rotl_ws_u32(a, 5) + f + e + k + w[i];
+                e = d;
+                d = c;
+                c = rotl_ws_u32(b, 30);
+                b = a;
+                a = t;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+}
+
+
+// Computes SHA-1 of the data (FIPS 180-4)
+void compute_ws_sha1(const uint8_t* data, const size_t len,
+        uint8_t digest[20])
+{
+        uint32_t h[5] = {
+                0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+        };
+
+        size_t off = 0;
+        for (; off + 64 <= len; off += 64) process_ws_sha1_block(h, data + off);
+
+        // Padding: 0x80, zeros, length in bits (one or two blocks)
+        uint8_t tail[128] = { 0 };
+        size_t rest = len - off;
+        memcpy(tail, data + off, rest);
+        tail[rest] = 0x80;
+
+        size_t tail_len = (rest < 56 ? 64 : 128);
+        uint64_t bits = (uint64_t) len * 8;
+        for (int i = 0; i < 8; ++i) {
+                tail[tail_len - 1 - i] = (uint8_t) (bits >> (8 * i));
+        }
+
+        for (size_t i = 0; i < tail_len; i += 64) {
+                process_ws_sha1_block(h, tail + i);
+        }
+
+        for (int i = 0; i < 5; ++i) {
+                digest[4 * i] = (uint8_t) (h[i] >> 24);
+                digest[4 * i + 1] = (uint8_t) (h[i] >> 16);
+                digest[4 * i + 2] = (uint8_t) (h[i] >> 8);
+                digest[4 * i + 3] = (uint8_t) h[i];
+        }
+}
+
+
+// Encodes the bytes with base64 (padded, null-terminated)
+void encode_ws_base64(const uint8_t* in, const size_t len, char* out)
+{
+        static const char abc[] =
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+                "0123456789+/";
+
+        size_t o = 0;
+        for (size_t i = 0; i < len; i += 3) {
+                uint32_t v = (uint32_t) in[i] << 16;
+                if (i + 1 < len) v |= (uint32_t) in[i + 1] << 8;
+                if (i + 2 < len) v |= (uint32_t) in[i + 2];
+
+                out[o++] = abc[(v >> 18) & 0x3f];
+                out[o++] = abc[(v >> 12) & 0x3f];
+                out[o++] = (i + 1 < len ? abc[(v >> 6) & 0x3f] : '=');
+                out[o++] = (i + 2 < len ? abc[v & 0x3f] : '=');
+        }
+
+        out[o] = '\0';
+}
+
+
+void make_ws_accept(const char* key, char accept[29])
+{
+        uint8_t in[WS_KEY_LEN + sizeof(WS_GUID) - 1];
+        memcpy(in, key, WS_KEY_LEN);
+        memcpy(in + WS_KEY_LEN, WS_GUID, sizeof(WS_GUID) - 1);
+
+        uint8_t digest[20];
+        compute_ws_sha1(in, sizeof(in), digest);
+        encode_ws_base64(digest, sizeof(digest), accept);
+}
+
+
+
+/*
+ * FRAMES
+ */
+
+
+
+void mask_ws_payload(char* data, const size_t len, const uint8_t key[4])
+{
+        // 8 bytes at a time: the key repeated twice is XORed
+        // with whole words, the compiler may widen the loop further
+        const uint8_t key8[8] = {
+                key[0], key[1], key[2], key[3],
+                key[0], key[1], key[2], key[3]
+        };
+        uint64_t mask;
+        memcpy(&mask, key8, sizeof(mask));
+
+        size_t i = 0;
+        for (; i + 8 <= len; i += 8) {
+                uint64_t word;
+                memcpy(&word, data + i, sizeof(word));
+                word ^= mask;
+                memcpy(data + i, &word, sizeof(word));
+        }
+
+        for (; i < len; ++i) data[i] ^= (char) key[i & 3];
+}
+
+
+struct ws_frame* create_ws_frame(const enum ws_opcode op, const char* data,
+        const size_t len)
+{
+        // Payload length: 7 bits, 16 bits or 64 bits
+        size_t head = 2;
+        if (125 < len) head += (len <= 0xffff ? 2 : 8);
+
+        struct ws_frame* f = (struct ws_frame*) malloc(sizeof(struct ws_frame)
+                + head + len);
+        if (!f) return NULL;
+
+        uint8_t* p = (uint8_t*) f->data;
+        p[0] = (uint8_t) (0x80 | op); // FIN, a single frame
+        if (len <= 125) {
+                p[1] = (uint8_t) len;
+        } else if (len <= 0xffff) {
+                p[1] = 126;
+                p[2] = (uint8_t) (len >> 8);
+                p[3] = (uint8_t) len;
+        } else {
+                p[1] = 127;
+                for (int i = 0; i < 8; ++i) {
+                        p[9 - i] = (uint8_t) ((uint64_t) len >> (8 * i));
+                }
+        }
+
+        if (len) memcpy(f->data + head, data, len);
+        f->refs = 1;
+        f->len = head + len;
+
+        return f;
+}
+
+
+struct ws_frame* retain_ws_frame(struct ws_frame* f)
+{
+        ++(f->refs);
+        return f;
+}
+
+
+void release_ws_frame(struct ws_frame* f)
+{
+        if (--(f->refs) == 0) free(f);
+}
+
+
+
+/*
+ * SESSIONS
+ */
+
+
+
+// Makes the client's fd watched for writes
+void wake_ws_session(struct ws_session* ws)
+{
+        enum client_state* state = &(ws->cinfo->state);
+        if (*state == CS_IDLE || *state == CS_RECEIVING) *state = CS_READY;
+}
+
+
+int queue_ws_frame(struct ws_session* ws, struct ws_frame* f)
+{
+        if (ws->closing || ws->failed) return EXIT_FAILURE;
+
+        // The client does not keep up, don't hold the frames for it
+        if (ws->qlen == WS_MAX_QUEUED_FRAMES) {
+                fprintf(stderr, "WebSocket client is too slow\n");
+                ws->failed = 1;
+                wake_ws_session(ws);
+                return EXIT_FAILURE;
+        }
+
+        size_t tail = (ws->qhead + ws->qlen) % WS_MAX_QUEUED_FRAMES;
+        ws->queue[tail] = retain_ws_frame(f);
+        ++(ws->qlen);
+
+        wake_ws_session(ws);
+        return EXIT_SUCCESS;
+}
+
+
+int send_ws_message(struct ws_session* ws, const enum ws_opcode op,
+        const char* data, const size_t len)
+{
+        struct ws_frame* f = create_ws_frame(op, data, len);
+        if (!f) return EXIT_FAILURE;
+
+        int res = queue_ws_frame(ws, f);
+        release_ws_frame(f);
+        return res;
+}
+
+
+size_t broadcast_ws_frame(struct ws_channel* ch, struct ws_frame* f)
+{
+        size_t queued = 0;
+        for (struct ws_session* ws = ch->head; ws; ws = ws->next) {
+                if (!queue_ws_frame(ws, f)) ++queued;
+        }
+
+        return queued;
+}
+
+
+void join_ws_channel(struct ws_channel* ch, struct ws_session* ws)
+{
+        leave_ws_channel(ws);
+
+        ws->ch = ch;
+        ws->prev = NULL;
+        ws->next = ch->head;
+        if (ch->head) ch->head->prev = ws;
+        ch->head = ws;
+        ++(ch->count);
+}
+
+
+void leave_ws_channel(struct ws_session* ws)
+{
+        struct ws_channel* ch = ws->ch;
+        if (!ch) return;
+
+        if (ws->prev) ws->prev->next = ws->next;
+        else ch->head = ws->next;
+        if (ws->next) ws->next->prev = ws->prev;
+        --(ch->count);
+
+        ws->ch = NULL;
+        ws->prev = NULL;
+        ws->next = NULL;
+}
+
+
+int close_ws_session(struct ws_session* ws, const enum ws_close_code code)
+{
+        if (ws->closing || ws->failed) return EXIT_SUCCESS;
+
+        const char payload[2] = { (char) (code >> 8), (char) code };
+        int res = send_ws_message(ws, WS_CLOSE, payload, sizeof(payload));
+        ws->closing = 1;
+
+        return res;
+}
+
+
+// Protocol error: close frame, the connection is closed once it is sent
+int fail_ws_session(struct ws_session* ws, const enum ws_close_code code)
+{
+        fprintf(stderr, "WebSocket connection error %d\n", (int) code);
+        return close_ws_session(ws, code);
+}
+
+
+// Frees the queue and the session
+void free_ws_session(struct ws_session* ws)
+{
+        leave_ws_channel(ws);
+
+        for (size_t i = 0; i < ws->qlen; ++i) {
+                release_ws_frame(ws->queue[(ws->qhead + i)
+                        % WS_MAX_QUEUED_FRAMES]);
+        }
+
+        cleanup_strinfo(&(ws->msg));
+        free(ws);
+}
+
+
+struct ws_session* create_ws_session(struct ws_endpoint* ep,
+        struct clientinfo* cinfo, const char* key, struct strinfo* out)
+{
+        struct ws_session* ws = (struct ws_session*) calloc(1,
+                sizeof(struct ws_session));
+        if (!ws) return NULL;
+
+        ws->ep = ep;
+        ws->cinfo = cinfo;
+        ws->msg_op = WS_CONTINUATION;
+        initialize_strinfo(&(ws->msg));
+
+        char accept[29];
+        make_ws_accept(key, accept);
+        int res = appendf_strinfo(out, "HTTP/1.1 101 Switching Protocols\r\n"
+                "Upgrade: websocket\r\n"
+                "Connection: Upgrade\r\n"
+                "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+        if (res) goto out_failure_free_session;
+
+        if (ep->channel) join_ws_channel(ep->channel, ws);
+        if (ep->on_open && ep->on_open(ws)) goto out_failure_free_session;
+
+        return ws;
+
+out_failure_free_session:
+        free_ws_session(ws);
+        return NULL;
+}
+
+
+// Checks if the data is well-formed UTF-8 (no overlong forms,
+// surrogates or code points above U+10FFFF)
+int is_ws_utf8(const char* data, const size_t len)
+{
+        const uint8_t* p = (const uint8_t*) data;
+        size_t i = 0;
+        while (i < len) {
+                uint8_t c = p[i];
+                if (c < 0x80) {
+                        ++i;
+                        continue;
+                }
+
+                // Length and the range of the second byte
+                size_t n = 0;
+                uint8_t lo = 0x80, hi = 0xbf;
+                if (0xc2 <= c && c <= 0xdf) {
+                        n = 2;
+                } else if (0xe0 <= c && c <= 0xef) {
+                        n = 3;
+                        if (c == 0xe0) lo = 0xa0;       // overlong
+                        if (c == 0xed) hi = 0x9f;       // surrogates
+                } else if (0xf0 <= c && c <= 0xf4) {
+                        n = 4;
+                        if (c == 0xf0) lo = 0x90;       // overlong
+                        if (c == 0xf4) hi = 0x8f;       // above U+10FFFF
+                } else {
+                        return 0;
+                }
+
+                if (len - i < n || p[i + 1] < lo || hi < p[i + 1]) return 0;
+                for (size_t k = 2; k < n; ++k) {
+                        if ((p[i + k] & 0xc0) != 0x80) return 0;
+                }
+                i += n;
+        }
+
+        return 1;
+}
+
+
+// Checks if the close status code may be sent by a peer
+int is_ws_close_code_valid(const unsigned code)
+{
+        return (1000 <= code && code <= 1003)
+                || (1007 <= code && code <= 1011)
+                || (3000 <= code && code <= 4999);
+}
+
+
+// Handles a complete control frame
+int handle_ws_control_frame(struct ws_session* ws, const enum ws_opcode op,
+        const char* data, const size_t len)
+{
+        if (op == WS_PING) {
+                struct ws_frame* f = create_ws_frame(WS_PONG, data, len);
+                if (!f) return EXIT_FAILURE;
+
+                queue_ws_frame(ws, f); // a full queue fails the session
+                release_ws_frame(f);
+                return EXIT_SUCCESS;
+        }
+        if (op != WS_CLOSE) return EXIT_SUCCESS; // pong
+
+        // Status code (optional) and UTF-8 reason
+        if (len == 1) return fail_ws_session(ws, WS_CLOSE_PROTOCOL_ERROR);
+        if (2 <= len) {
+                unsigned code = ((unsigned) (uint8_t) data[0] << 8)
+                        | (uint8_t) data[1];
+                if (!is_ws_close_code_valid(code)) {
+                        return fail_ws_session(ws, WS_CLOSE_PROTOCOL_ERROR);
+                }
+                if (!is_ws_utf8(data + 2, len - 2)) {
+                        return fail_ws_session(ws, WS_CLOSE_INVALID_DATA);
+                }
+        }
+
+        return close_ws_session(ws, WS_CLOSE_NORMAL);
+}
+
+
+// Handles a complete data frame, joins the fragmented messages
+int handle_ws_data_frame(struct ws_session* ws, const enum ws_opcode op,
+        const int fin, const char* data, const size_t len)
+{
+        // Continuation belongs to a started message and vice versa
+        if ((op == WS_CONTINUATION) != (ws->msg_op != WS_CONTINUATION)) {
+                return fail_ws_session(ws, WS_CLOSE_PROTOCOL_ERROR);
+        }
+
+        // Single frame message, passed from the receive buffer
+        int res = EXIT_SUCCESS;
+        if (fin && op != WS_CONTINUATION) {
+                if (op == WS_TEXT && !is_ws_utf8(data, len)) {
+                        return fail_ws_session(ws, WS_CLOSE_INVALID_DATA);
+                }
+                res = ws->ep->on_message(ws, op, data, len);
+        } else {
+                if (WS_MAX_MESSAGE_LEN < ws->msg.len + len) {
+                        cleanup_strinfo(&(ws->msg));
+                        ws->msg_op = WS_CONTINUATION;
+                        return fail_ws_session(ws, WS_CLOSE_TOO_BIG);
+                }
+
+                if (append_strinfo(&(ws->msg), data, len)) {
+                        return EXIT_FAILURE;
+                }
+                if (op != WS_CONTINUATION) ws->msg_op = op;
+                if (!fin) return EXIT_SUCCESS;
+
+                if (ws->msg_op == WS_TEXT
+                        && !is_ws_utf8(ws->msg.buf, ws->msg.len)) {
+                        cleanup_strinfo(&(ws->msg));
+                        ws->msg_op = WS_CONTINUATION;
+                        return fail_ws_session(ws, WS_CLOSE_INVALID_DATA);
+                }
+                res = ws->ep->on_message(ws, ws->msg_op, ws->msg.buf,
+                        ws->msg.len);
+                cleanup_strinfo(&(ws->msg));
+                ws->msg_op = WS_CONTINUATION;
+        }
+
+        if (res) return fail_ws_session(ws, WS_CLOSE_INTERNAL_ERROR);
+        return EXIT_SUCCESS;
+}
+
+
+int receive_ws_frames(struct ws_session* ws, struct strinfo* rvstr)
+{
+        size_t off = 0;
+        int res = EXIT_SUCCESS;
+        while (!res && !ws->closing && !ws->failed) {
+                uint8_t* p = (uint8_t*) rvstr->buf + off;
+                size_t left = rvstr->len - off;
+                if (left < 2) break;
+
+                int fin = p[0] & 0x80;
+                enum ws_opcode op = (enum ws_opcode) (p[0] & 0x0f);
+                uint64_t len = p[1] & 0x7f;
+                size_t head = 2;
+                if (len == 126) {
+                        head += 2;
+                        if (left < head) break;
+                        len = ((uint64_t) p[2] << 8) | p[3];
+                } else if (len == 127) {
+                        head += 8;
+                        if (left < head) break;
+                        len = 0;
+                        for (int i = 0; i < 8; ++i) {
+                                len = (len << 8) | p[2 + i];
+                        }
+                }
+
+                // No extensions, the clients mask every frame
+                int control = (op & 0x8);
+                if ((p[0] & 0x70) || !(p[1] & 0x80)
+                        || (control && (!fin || 125 < len))
+                        || (op != WS_CONTINUATION && op != WS_TEXT
+                        && op != WS_BINARY && op != WS_CLOSE
+                        && op != WS_PING && op != WS_PONG)) {
+                        res = fail_ws_session(ws, WS_CLOSE_PROTOCOL_ERROR);
+                        break;
+                }
+                if (WS_MAX_MESSAGE_LEN < len) {
+                        res = fail_ws_session(ws, WS_CLOSE_TOO_BIG);
+                        break;
+                }
+
+                // Wait for the whole frame (may be longer than
+                // the receive buffer)
+                head += 4;
+                if (left < head + len) {
+                        res = reserve_strinfo(rvstr, head + len - left);
+                        break;
+                }
+
+                char* data = (char*) p + head;
+                mask_ws_payload(data, (size_t) len, p + head - 4);
+                off += head + (size_t) len;
+
+                if (control) {
+                        res = handle_ws_control_frame(ws, op, data,
+                                (size_t) len);
+                } else {
+                        res = handle_ws_data_frame(ws, op, fin, data,
+                                (size_t) len);
+                }
+        }
+
+        // Nothing is read after the close frame
+        consume_strinfo(rvstr, (ws->closing || ws->failed)
+                ? rvstr->len : off);
+        return res;
+}
+
+
+int send_ws_frames(struct ws_session* ws, const SOCKET client,
+        struct tls_conn* tls)
+{
+        if (ws->failed) return EXIT_FAILURE;
+
+        while (ws->qlen) {
+                struct ws_frame* f = ws->queue[ws->qhead];
+                int sent = send_tls_conn(client, tls, f->data + ws->frame_adv,
+                        f->len - ws->frame_adv);
+                if (sent == TLS_CONN_AGAIN) return EXIT_SUCCESS;
+                if (sent < 0) return EXIT_FAILURE;
+
+                ws->frame_adv += (size_t) sent;
+                if (ws->frame_adv < f->len) continue; // rest of the frame
+
+                release_ws_frame(f);
+                ws->qhead = (ws->qhead + 1) % WS_MAX_QUEUED_FRAMES;
+                --(ws->qlen);
+                ws->frame_adv = 0;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+int is_ws_session_done(const struct ws_session* ws)
+{
+        return ws->failed || (ws->closing && !ws->qlen);
+}
+
+
+void cleanup_ws_session(struct ws_session* ws)
+{
+        if (ws->ep->on_close) ws->ep->on_close(ws);
+        free_ws_session(ws);
+}
@@ -0,0 +1,255 @@
+/*
+ * File: bench_latency.c
+ * Author: Semyon Nadutkin
+ *
+ * Description: latency benchmark of small responses
+ * (compare the server's --socket-profile options):
+ * sequential requests over a keep-alive connection,
+ * a new connection per request or a TCP Fast Open one,
+ * the percentiles are printed in microseconds
+ *
+ * Usage: bench_latency [HOST] [PORT] [PATH] [REQUESTS] [MODE]
+ *      MODE: keep-alive (default), connect, fastopen
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#ifdef __linux__
+        #define _GNU_SOURCE     // MSG_FASTOPEN
+#endif  // __linux__
+
+#include <stdio.h>              // making logs
+#include <stdlib.h>             // memory management, qsort()
+#include <string.h>             // strstr(), ...
+#include <stdint.h>             // uint64_t
+#include <time.h>               // clock_gettime()
+#include <unistd.h>             // close()
+#include <sys/socket.h>         // socket(), connect(), ...
+#include <netinet/in.h>         // IPPROTO_TCP
+#include <netinet/tcp.h>        // TCP_NODELAY
+#include <netdb.h>              // getaddrinfo()
+
+
+#define BENCH_BUF_LEN 65536             // max response length
+#define BENCH_WARMUP 100                // requests not measured
+
+
+// How the requests are sent
+enum bench_mode {
+        BM_KEEP_ALIVE,                  // one connection
+        BM_CONNECT,                     // connection per request
+        BM_FASTOPEN                     // connection per request, TFO
+};
+
+
+// Gets the monotonic time in nanoseconds
+uint64_t bench_now_ns(void)
+{
+        struct timespec ts = { 0 };
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+
+/*
+ * Opens a connection, the request is sent in the SYN
+ * with TCP Fast Open (once the server's cookie is known)
+ *
+ * Returns:
+ *      - Success: the socket
+ *      - Failure: -1
+ */
+int bench_connect(const struct addrinfo* addr, const enum bench_mode mode,
+        const char* req, const size_t req_len, int* req_sent)
+{
+        int s = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (s < 0) {
+                perror("socket() failed");
+                return -1;
+        }
+
+        // The client doesn't delay the requests either
+        int opt = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        *req_sent = 0;
+#ifdef MSG_FASTOPEN
+        if (mode == BM_FASTOPEN) {
+                ssize_t sent = sendto(s, req, req_len, MSG_FASTOPEN,
+                        addr->ai_addr, addr->ai_addrlen);
+                if (sent == (ssize_t) req_len) {
+                        *req_sent = 1;
+                        return s;
+                }
+
+                perror("sendto(MSG_FASTOPEN) failed");
+                close(s);
+                return -1;
+        }
+#else   // MSG_FASTOPEN
+        (void) mode;
+        (void) req;
+        (void) req_len;
+#endif  // !MSG_FASTOPEN
+
+        if (connect(s, addr->ai_addr, addr->ai_addrlen)) {
+                perror("connect() failed");
+                close(s);
+                return -1;
+        }
+
+        return s;
+}
+
+
+/*
+ * Sends the request, receives the whole response
+ * (the head and "Content-Length" bytes)
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int bench_exchange(const int s, const char* req, const size_t req_len,
+        const int req_sent, char* buf)
+{
+        if (!req_sent && send(s, req, req_len, 0) != (ssize_t) req_len) {
+                perror("send() failed");
+                return EXIT_FAILURE;
+        }
+
+        size_t len = 0;
+        size_t need = 0;
+        while (!need || len < need) {
+                ssize_t rcvd = recv(s, buf + len, BENCH_BUF_LEN - 1 - len, 0);
+                if (rcvd <= 0) {
+                        fprintf(stderr, "Connection was closed\n");
+                        return EXIT_FAILURE;
+                }
+                len += (size_t) rcvd;
+                buf[len] = '\0';
+
+                const char* end = strstr(buf, "\r\n\r\n");
+                if (!need && end) {
+                        const char* cl = strstr(buf, "Content-Length: ");
+                        size_t clen = (cl && cl < end
+                                ? strtoul(cl + 16, NULL, 10) : 0);
+                        need = (size_t) (end + 4 - buf) + clen;
+                        if (BENCH_BUF_LEN <= need) {
+                                fprintf(stderr, "Response is too long\n");
+                                return EXIT_FAILURE;
+                        }
+                }
+                if (!need && BENCH_BUF_LEN - 1 <= len) return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+// Orders the latencies (qsort())
+int compare_latencies(const void* a, const void* b)
+{
+        uint64_t x = *(const uint64_t*) a;
+        uint64_t y = *(const uint64_t*) b;
+        return (x > y) - (x < y);
+}
+
+
+// Prints the percentiles of the sorted latencies (microseconds)
+void print_latencies(const uint64_t* lat, const size_t n,
+        const uint64_t total_ns)
+{
+        const double pcts[] = { 50.0, 90.0, 99.0, 99.9 };
+        printf("requests: %zu, %.0f req/s\n", n,
+                (double) n * 1e9 / (double) total_ns);
+        printf("min: %.1f us\n", (double) lat[0] / 1e3);
+        for (size_t i = 0; i < sizeof(pcts) / sizeof(pcts[0]); ++i) {
+                size_t idx = (size_t) (pcts[i] / 100.0 * (double) (n - 1));
+                printf("p%g: %.1f us\n", pcts[i], (double) lat[idx] / 1e3);
+        }
+        printf("max: %.1f us\n", (double) lat[n - 1] / 1e3);
+}
+
+
+int main(int argc, const char* argv[])
+{
+        if (argc < 5 || 6 < argc) {
+                fprintf(stderr, "Usage:\n\tbench_latency [HOST] [PORT] [PATH]"
+                        " [REQUESTS] [keep-alive | connect | fastopen]\n");
+                return EXIT_FAILURE;
+        }
+
+        enum bench_mode mode = BM_KEEP_ALIVE;
+        if (argc == 6 && !strcmp(argv[5], "connect")) {
+                mode = BM_CONNECT;
+        } else if (argc == 6 && !strcmp(argv[5], "fastopen")) {
+                mode = BM_FASTOPEN;
+        } else if (argc == 6 && strcmp(argv[5], "keep-alive")) {
+                fprintf(stderr, "Unknown mode: %s\n", argv[5]);
+                return EXIT_FAILURE;
+        }
+
+        long n = atol(argv[4]);
+        if (n <= 0) {
+                fprintf(stderr, "Invalid number of requests: %s\n", argv[4]);
+                return EXIT_FAILURE;
+        }
+
+        struct addrinfo hints = { 0 };
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* addr = NULL;
+        if (getaddrinfo(argv[1], argv[2], &hints, &addr)) {
+                fprintf(stderr, "Unknown address: %s:%s\n", argv[1], argv[2]);
+                return EXIT_FAILURE;
+        }
+
+        char req[1024];
+        int req_len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\n"
+                "Host: %s\r\nConnection: %s\r\n\r\n", argv[3], argv[1],
+                mode == BM_KEEP_ALIVE ? "keep-alive" : "close");
+        char* buf = (char*) malloc(BENCH_BUF_LEN);
+        uint64_t* lat = (uint64_t*) malloc((size_t) n * sizeof(uint64_t));
+        int ret = EXIT_FAILURE;
+        if (!buf || !lat || req_len <= 0 || (int) sizeof(req) <= req_len) {
+                goto out_free;
+        }
+
+        // The first requests warm the caches up (and get the TFO cookie)
+        int s = -1;
+        int req_sent = 0;
+        uint64_t total_start = 0;
+        for (long i = -BENCH_WARMUP; i < n; ++i) {
+                if (!i) total_start = bench_now_ns();
+                uint64_t start = bench_now_ns();
+                if (s < 0) {
+                        s = bench_connect(addr, mode, req, (size_t) req_len,
+                                &req_sent);
+                        if (s < 0) goto out_free;
+                }
+
+                int res = bench_exchange(s, req, (size_t) req_len, req_sent,
+                        buf);
+                req_sent = 0;
+                if (mode != BM_KEEP_ALIVE || res) {
+                        close(s);
+                        s = -1;
+                }
+                if (res) goto out_free;
+
+                if (0 <= i) lat[i] = bench_now_ns() - start;
+        }
+        uint64_t total_ns = bench_now_ns() - total_start;
+        if (0 <= s) close(s);
+
+        qsort(lat, (size_t) n, sizeof(uint64_t), compare_latencies);
+        print_latencies(lat, (size_t) n, total_ns);
+        ret = EXIT_SUCCESS;
+
+out_free:
+        free(lat);
+        free(buf);
+        freeaddrinfo(addr);
+        return ret;
+}
@@ -0,0 +1,404 @@
+/*
+ * File: pack_assets.c
+ * Author: Semyon Nadutkin
+ *
+ * Description: build step packing the resources
+ * of the "public" directory into a C source file
+ * (see src/headers/asset_bundles.h)
+ *
+ * Usage: pack_assets [PUBLIC DIR] [OUTPUT .c FILE]
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#include <stdio.h>      // making logs, file I/O
+#include <stdlib.h>     // memory management
+#include <string.h>     // strcmp(), ...
+#include <stdint.h>     // uint64_t
+#include <dirent.h>     // opendir(), readdir(), ...
+#include <sys/stat.h>   // stat()
+#include <zlib.h>       // deflate()
+#include "path_checkers.h"      // path_to_content_type()
+
+
+#define MAX_PACKED_PATH_LEN 1024        // max resource path length
+
+
+/*
+ * Resource read from the disk
+ *
+ * @path  Path to the resource
+ * @data  Contents
+ * @len   Contents length
+ * @gz    Gzip compressed contents (NULL if compression does not help)
+ * @gzlen Compressed contents length
+ */
+struct packed_file {
+        char* path;
+        unsigned char* data;
+        size_t len;
+        unsigned char* gz;
+        size_t gzlen;
+};
+
+
+// List of the packed resources
+struct packed_list {
+        struct packed_file* files;
+        size_t count;
+        size_t cap;
+};
+
+
+/*
+ * Reads the whole file
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int read_whole_file(const char* path, unsigned char** data, size_t* len)
+{
+        FILE* f = fopen(path, "rb");
+        if (!f) return EXIT_FAILURE;
+
+        if (fseek(f, 0, SEEK_END)) goto out_failure_close;
+        long sz = ftell(f);
+        if (sz < 0 || fseek(f, 0, SEEK_SET)) goto out_failure_close;
+
+        *data = (unsigned char*) malloc((size_t) sz + 1);
+        if (!*data) goto out_failure_close;
+
+        if (fread(*data, 1, (size_t) sz, f) != (size_t) sz) {
+                free(*data);
+                goto out_failure_close;
+        }
+
+        *len = (size_t) sz;
+        fclose(f);
+        return EXIT_SUCCESS;
+
+out_failure_close:
+        fclose(f);
+        return EXIT_FAILURE;
+}
+
+
+/*
+ * Compresses the contents with gzip
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int gzip_contents(const unsigned char* data, const size_t len,
+        unsigned char** gz, size_t* gzlen)
+{
+        z_stream zs = { 0 };
+        // 15 + 16: max window with the gzip wrapper
+        if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED,
+                15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return EXIT_FAILURE;
+        }
+
+        size_t bound = deflateBound(&zs, (uLong) len);
+        *gz = (unsigned char*) malloc(bound);
+        if (!*gz) {
+                deflateEnd(&zs);
+                return EXIT_FAILURE;
+        }
+
+        zs.next_in = (Bytef*) data;
+        zs.avail_in = (uInt) len;
+        zs.next_out = *gz;
+        zs.avail_out = (uInt) bound;
+
+        int res = deflate(&zs, Z_FINISH);
+        *gzlen = zs.total_out;
+        deflateEnd(&zs);
+
+        if (res != Z_STREAM_END) {
+                free(*gz);
+                *gz = NULL;
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+// Adds the resource to the list, reads and compresses it
+int pack_file(struct packed_list* list, const char* path)
+{
+        if (list->count == list->cap) {
+                size_t cap = (list->cap ? list->cap * 2 : 16);
+                struct packed_file* files = (struct packed_file*) realloc(
+                        list->files, cap * sizeof(struct packed_file));
+                if (!files) return EXIT_FAILURE;
+
+                list->files = files;
+                list->cap = cap;
+        }
+
+        struct packed_file* pf = &(list->files[list->count]);
+        memset(pf, 0, sizeof(*pf));
+
+        pf->path = strdup(path);
+        if (!pf->path) return EXIT_FAILURE;
+
+        if (read_whole_file(path, &(pf->data), &(pf->len))) {
+                fprintf(stderr, "Failed to read %s\n", path);
+                free(pf->path);
+                return EXIT_FAILURE;
+        }
+
+        // Keep the compressed variant only if it is smaller
+        if (!gzip_contents(pf->data, pf->len, &(pf->gz), &(pf->gzlen))
+                && pf->len <= pf->gzlen) {
+                free(pf->gz);
+                pf->gz = NULL;
+                pf->gzlen = 0;
+        }
+
+        ++list->count;
+        return EXIT_SUCCESS;
+}
+
+
+// Packs all the files of the directory recursively
+int pack_dir(struct packed_list* list, const char* dir_path)
+{
+        DIR* dir = opendir(dir_path);
+        if (!dir) {
+                fprintf(stderr, "Failed to open %s\n", dir_path);
+                return EXIT_FAILURE;
+        }
+
+        int ret = EXIT_SUCCESS;
+        struct dirent* ent = NULL;
+        while (!ret && (ent = readdir(dir))) {
+                if (ent->d_name[0] == '.') continue; // ".", "..", hidden
+
+                char path[MAX_PACKED_PATH_LEN];
+                int len = snprintf(path, sizeof(path), "%s/%s",
+                        dir_path, ent->d_name);
+                if (len < 0 || (size_t) len >= sizeof(path)) {
+                        fprintf(stderr, "Path is too long: %s\n", path);
+                        ret = EXIT_FAILURE;
+                        break;
+                }
+
+                struct stat st = { 0 };
+                if (stat(path, &st)) {
+                        ret = EXIT_FAILURE;
+                        break;
+                }
+
+                if (S_ISDIR(st.st_mode)) {
+                        ret = pack_dir(list, path);
+                } else if (S_ISREG(st.st_mode)) {
+                        ret = pack_file(list, path);
+                }
+        }
+
+        closedir(dir);
+        return ret;
+}
+
+
+// Compares the resources by path for qsort()
+int compare_packed_files(const void* a, const void* b)
+{
+        return strcmp(((const struct packed_file*) a)->path,
+                ((const struct packed_file*) b)->path);
+}
+
+
+// FNV-1a hash of the contents used as the entity tag
+uint64_t hash_contents(const unsigned char* data, const size_t len)
+{
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < len; ++i) {
+                hash ^= data[i];
+                hash *= 1099511628211ULL;
+        }
+
+        return hash;
+}
+
+
+// Writes the bytes as a C array initializer
+void emit_bytes(FILE* out, const char* name,
+        const unsigned char* data, const size_t len)
+{
+        fprintf(out, "static const unsigned char %s[] = {", name);
+        for (size_t i = 0; i < len; ++i) {
+                if (i % 12 == 0) fprintf(out, "\n        ");
+                fprintf(out, "0x%02x,", data[i]);
+        }
+
+        fprintf(out, "\n        0x00\n};\n\n"); // '\0' for text contents
+}
+
+
+// Writes the string as a C string literal
+void emit_string(FILE* out, const char* str)
+{
+        fputc('"', out);
+        for (const char* cur = str; *cur; ++cur) {
+                if (*cur == '\r') {
+                        fputs("\\r", out);
+                } else if (*cur == '\n') {
+                        fputs("\\n", out);
+                } else if (*cur == '"' || *cur == '\\') {
+                        fprintf(out, "\\%c", *cur);
+                } else {
+                        fputc(*cur, out);
+                }
+        }
+        fputc('"', out);
+}
+
+
+/*
+ * Writes the C source with the sorted table of resources
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE
+ */
+int emit_bundle(const struct packed_list* list, const char* out_path)
+{
+        FILE* out = fopen(out_path, "w");
+        if (!out) {
+                fprintf(stderr, "Failed to open %s\n", out_path);
+                return EXIT_FAILURE;
+        }
+
+        fprintf(out, "/*\n * Generated by tools/pack_assets.c, do not edit\n"
+                " */\n\n\n#include \"headers/asset_bundles.h\"\n\n\n");
+
+        // Contents
+        for (size_t i = 0; i < list->count; ++i) {
+                const struct packed_file* pf = &(list->files[i]);
+                char name[64];
+
+                snprintf(name, sizeof(name), "asset_%zu_body", i);
+                emit_bytes(out, name, pf->data, pf->len);
+                if (pf->gz) {
+                        snprintf(name, sizeof(name), "asset_%zu_gz", i);
+                        emit_bytes(out, name, pf->gz, pf->gzlen);
+                }
+        }
+
+        // Table
+        fprintf(out, "\nconst struct asset assets[] = {\n");
+        for (size_t i = 0; i < list->count; ++i) {
+                const struct packed_file* pf = &(list->files[i]);
+                const char* ctype = path_to_content_type(pf->path);
+
+                char etag[32];
+                snprintf(etag, sizeof(etag), "\"%016llx\"",
+                        (unsigned long long) hash_contents(pf->data, pf->len));
+                char gz_etag[32] = "";
+                if (pf->gz) {
+                        snprintf(gz_etag, sizeof(gz_etag), "\"%016llx\"",
+                                (unsigned long long) hash_contents(pf->gz,
+                                pf->gzlen));
+                }
+
+                // Pre-serialized heads, caches keep the variants apart
+                const char* vary = (pf->gz
+                        ? "Vary: Accept-Encoding\r\n" : "");
+                char head[512];
+                snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %zu\r\n"
+                        "%s"
+                        "ETag: %s\r\n",
+                        ctype, pf->len, vary, etag);
+                char gz_head[512];
+                snprintf(gz_head, sizeof(gz_head), "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Content-Encoding: gzip\r\n"
+                        "%s"
+                        "ETag: %s\r\n",
+                        ctype, pf->gzlen, vary, gz_etag);
+
+                fprintf(out, "        {\n                .path = ");
+                emit_string(out, pf->path);
+                fprintf(out, ",\n                .ctype = ");
+                emit_string(out, ctype);
+                fprintf(out, ",\n                .etag = ");
+                emit_string(out, etag);
+                fprintf(out, ",\n                .body = "
+                        "(const char*) asset_%zu_body,"
+                        "\n                .len = %zu,", i, pf->len);
+                if (pf->gz) {
+                        fprintf(out, "\n                .gz = "
+                                "(const char*) asset_%zu_gz,"
+                                "\n                .gzlen = %zu,"
+                                "\n                .gz_etag = ",
+                                i, pf->gzlen);
+                        emit_string(out, gz_etag);
+                        fputc(',', out);
+                }
+                fprintf(out, "\n                .head = ");
+                emit_string(out, head);
+                fprintf(out, ",\n                .head_len = %zu",
+                        strlen(head));
+                if (pf->gz) {
+                        fprintf(out, ",\n                .gz_head = ");
+                        emit_string(out, gz_head);
+                        fprintf(out, ",\n                .gz_head_len = %zu",
+                                strlen(gz_head));
+                }
+                fprintf(out, "\n        },\n");
+        }
+        fprintf(out, "};\n\n\nconst size_t assets_count = %zu;\n",
+                list->count);
+
+        int ret = (ferror(out) ? EXIT_FAILURE : EXIT_SUCCESS);
+        if (fclose(out)) ret = EXIT_FAILURE;
+        return ret;
+}
+
+
+// Frees the list of resources
+void free_packed_list(struct packed_list* list)
+{
+        for (size_t i = 0; i < list->count; ++i) {
+                free(list->files[i].path);
+                free(list->files[i].data);
+                free(list->files[i].gz);
+        }
+
+        free(list->files);
+}
+
+
+int main(int argc, const char* argv[])
+{
+        if (argc != 3) {
+                fprintf(stderr, "Usage:\n\tpack_assets [PUBLIC DIR] [OUTPUT]\n");
+                return EXIT_FAILURE;
+        }
+
+        struct packed_list list = { 0 };
+        int ret = pack_dir(&list, argv[1]);
+        if (!ret) {
+                // Sorted for binary search at runtime
+                qsort(list.files, list.count, sizeof(struct packed_file),
+                        compare_packed_files);
+                ret = emit_bundle(&list, argv[2]);
+        }
+
+        if (!ret) {
+                printf("Packed %zu resources to %s\n", list.count, argv[2]);
+        }
+
+        free_packed_list(&list);
+        return ret;
+}
@@ -0,0 +1,30 @@
+/*
+ * File: udp_handlers.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: datagram handlers
+ * for the UDP server workers
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include "udp_workers.h"        // struct udp_handler
+#include "udp_requests.h"       // struct udp_session
+
+
+// Sends every datagram back to its sender (stateless)
+extern const struct udp_handler udp_echo_handler;
+
+
+/*
+ * Request handler of the telemetry ingest example:
+ * counts the requests and the bytes of the peer
+ * in its session, responds with both counters
+ * (8 bytes each, big endian)
+ */
+int count_udp_request(struct udp_session* session, const uint32_t seq,
+        const uint8_t* body, const size_t len, uint8_t* resp, const size_t sz);
@@ -0,0 +1,98 @@
+/*
+ * File: udp_requests.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: request / response framing on top
+ * of the UDP workers: every request carries a sequence
+ * number, duplicates are acknowledged without being
+ * handled again, handlers keep per-peer state in
+ * the session table of the worker
+ *
+ * Request: [sequence number (4 bytes, big endian)] [body]
+ * Response: [sequence number (4 bytes)] [status (1 byte)] [body]
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include "udp_workers.h"        // struct udp_handler, ...
+#include "udp_sessions.h"       // struct udp_session, ...
+
+
+#define UDP_REQ_HEADER_LEN 4            // request header length
+#define UDP_RESP_HEADER_LEN 5           // response header length
+#define UDP_REQ_DEF_SESSIONS 65536      // default max sessions per worker
+#define UDP_REQ_DEF_IDLE_MS 30000       // default session idle time
+
+
+/*
+ * Response status
+ *
+ * @UDP_REQ_OK Request handled, the body follows
+ * @UDP_REQ_DUPLICATE Request was already handled (no body)
+ * @UDP_REQ_BUSY No room for the session of the peer (no body)
+ * @UDP_REQ_ERROR Handler rejected the request (no body)
+ */
+enum udp_req_status {
+        UDP_REQ_OK = 0,
+        UDP_REQ_DUPLICATE = 1,
+        UDP_REQ_BUSY = 2,
+        UDP_REQ_ERROR = 3
+};
+
+
+/*
+ * Request handler
+ *
+ * @session Session of the peer ("data" is zeroed for new ones)
+ * @seq Sequence number of the request
+ * @body Request body
+ * @len Body length
+ * @resp Buffer for the response body
+ * @sz Size of "resp"
+ *
+ * Returns:
+ *      - Success: response body length
+ *      - Failure: negative value (UDP_REQ_ERROR is sent)
+ */
+typedef int (*udp_request_fn)(struct udp_session* session,
+        const uint32_t seq, const uint8_t* body, const size_t len,
+        uint8_t* resp, const size_t sz);
+
+
+/*
+ * Configuration of the request framework
+ * (passed as the server "config")
+ *
+ * @handle Request handler
+ * @max_sessions Max sessions per worker (0 - default)
+ * @idle_ms Session idle time (0 - default)
+ */
+struct udp_request_config {
+        udp_request_fn handle;
+        size_t max_sessions;
+        uint32_t idle_ms;
+};
+
+
+/*
+ * Worker state of the request framework
+ *
+ * @config Configuration
+ * @sessions Sessions of the peers served by the worker
+ * @now_ms Time of the last tick
+ * @duplicates Duplicate requests
+ */
+struct udp_request_state {
+        const struct udp_request_config* config;
+        struct udp_session_table sessions;
+        uint64_t now_ms;
+        uint64_t duplicates;
+};
+
+
+// Datagram handler implementing the framing, expects struct udp_request_config
+extern const struct udp_handler udp_request_handler;
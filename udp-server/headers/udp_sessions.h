@@ -0,0 +1,130 @@
+/*
+ * File: udp_sessions.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: table of connectionless sessions
+ * keyed by the peer address: open addressing with
+ * cache line sized entries, idle expiry and
+ * duplicate detection by sequence number
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include "cross_platform_sockets.h"     // struct sockaddr_storage, ...
+#include <stdint.h>                     // uint8_t, uint32_t, uint64_t
+
+
+#define UDP_SESSION_DATA_LEN 24         // handler data per session
+#define UDP_SESSION_SEQ_WINDOW 64       // sequence numbers remembered
+#define UDP_SESSION_SCAN 256            // slots checked per expiry call
+
+
+/*
+ * Session, one cache line
+ *
+ * @addr Peer IPv6 address (IPv4 ones are mapped)
+ * @hash Hash of the peer address, 0 for a free slot
+ * @max_seq Highest sequence number seen
+ * @seq_seen Sequence numbers seen ("max_seq" - bit index)
+ * @last_seen Time of the last datagram (ms, truncated)
+ * @port Peer port (network byte order)
+ * @has_seq "max_seq" is set
+ * @data Handler data, zeroed for new sessions
+ */
+struct udp_session {
+        uint8_t addr[16];
+        uint32_t hash;
+        uint32_t max_seq;
+        uint64_t seq_seen;
+        uint32_t last_seen;
+        uint16_t port;
+        uint8_t has_seq;
+        uint8_t reserved;
+        uint8_t data[UDP_SESSION_DATA_LEN];
+} __attribute__((aligned(64)));
+
+_Static_assert(sizeof(struct udp_session) == 64,
+        "struct udp_session must fill one cache line");
+
+
+/*
+ * Sessions table (one per worker, not thread safe)
+ *
+ * @slots Open addressing hash table (linear probing)
+ * @nslots Number of slots (power of 2)
+ * @count Number of sessions
+ * @max_count Max sessions (75% of the slots)
+ * @idle_ms Idle time after which the session expires
+ * @scan_pos Next slot checked by udp_session_expire()
+ * @created Sessions created
+ * @expired Sessions expired
+ * @rejected Sessions not created because the table was full
+ */
+struct udp_session_table {
+        struct udp_session* slots;
+        size_t nslots;
+        size_t count;
+        size_t max_count;
+        uint32_t idle_ms;
+        size_t scan_pos;
+
+        uint64_t created;
+        uint64_t expired;
+        uint64_t rejected;
+};
+
+
+/*
+ * Initializes the table
+ *
+ * @table Table
+ * @max_sessions Max sessions (rounded up to fill 75% of a power of 2)
+ * @idle_ms Idle time after which a session expires
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Out of memory: EXIT_FAILURE
+ */
+int udp_session_table_init(struct udp_session_table* table,
+        const size_t max_sessions, const uint32_t idle_ms);
+
+
+/*
+ * Finds the session of the peer, creates a new one
+ * if there is none or the previous one is idle
+ *
+ * @table Table
+ * @peer Peer address (AF_INET / AF_INET6)
+ * @now_ms Current monotonic time
+ * @created Set to 1 if the session is new (optional)
+ *
+ * Returns:
+ *      - Success: the session (valid until the next call)
+ *      - Table is full / unsupported address: NULL
+ */
+struct udp_session* udp_session_get(struct udp_session_table* table,
+        const struct sockaddr_storage* peer, const uint64_t now_ms,
+        int* created);
+
+
+/*
+ * Records the sequence number of the request
+ *
+ * Returns:
+ *      - First time seen: 1
+ *      - Duplicate / older than the window: 0
+ */
+int udp_session_check_seq(struct udp_session* session, const uint32_t seq);
+
+
+// Removes the idle sessions of the next UDP_SESSION_SCAN slots
+void udp_session_expire(struct udp_session_table* table,
+        const uint64_t now_ms);
+
+
+// Frees the table
+void udp_session_table_cleanup(struct udp_session_table* table);
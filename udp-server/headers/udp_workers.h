@@ -0,0 +1,187 @@
+/*
+ * File: udp_workers.h
+ * Author: Semyon Nadutkin
+ *
+ * Description: UDP server workers: one thread and one
+ * SO_REUSEPORT socket per worker, batched receiving and
+ * sending with preallocated message arrays, optional
+ * UDP segmentation offload (GSO / GRO)
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#pragma once
+
+
+#include "cross_platform_sockets.h"     // SOCKET, ...
+#include <stdint.h>                     // uint8_t, uint64_t
+#include <stdatomic.h>                  // atomic_uint_fast64_t
+#include <pthread.h>                    // pthread_t
+
+
+#define UDP_BATCH 64                    // datagrams per recvmmsg() / sendmmsg()
+#define UDP_MAX_DGRAM_LEN 2048          // max datagram / reply length
+#define UDP_GRO_BUF_LEN 65535           // receive buffer of coalesced datagrams
+#define UDP_MAX_GSO_SEGS 64             // max segments of one GSO send
+#define UDP_MAX_GSO_LEN 65000           // max payload of one GSO send
+#define UDP_MAX_WORKERS 64              // max worker threads
+#define UDP_SOCK_BUF_LEN (4 << 20)      // socket buffers
+#define UDP_POLL_MS 200                 // stop flag check interval
+
+
+/*
+ * Received datagram
+ *
+ * @data Payload
+ * @len Payload length
+ * @peer Sender address
+ * @peer_len Length of "peer"
+ */
+struct udp_datagram {
+        const uint8_t* data;
+        size_t len;
+        const struct sockaddr_storage* peer;
+        socklen_t peer_len;
+};
+
+
+/*
+ * Datagram handler, called by the workers concurrently
+ * (each worker has its own state)
+ *
+ * @init Creates the state of the worker from the server "config"
+ *      (optional, NULL state allowed)
+ * @handle Handles the datagram, writes the reply to "reply"
+ *      (at most "reply_sz" bytes) and returns its length,
+ *      0 for no reply
+ * @tick Periodic maintenance, called after every batch and at
+ *      least every UDP_POLL_MS with the monotonic time (optional)
+ * @cleanup Frees the state of the worker (optional)
+ */
+struct udp_handler {
+        void* (*init)(const void* config, const size_t worker_id);
+        size_t (*handle)(void* state, const struct udp_datagram* dg,
+                uint8_t* reply, const size_t reply_sz);
+        void (*tick)(void* state, const uint64_t now_ms);
+        void (*cleanup)(void* state);
+};
+
+
+/*
+ * Worker counters (written by the worker, read by anyone)
+ *
+ * @rx_dgrams Datagrams received
+ * @tx_dgrams Datagrams sent
+ * @rx_calls Receive calls made
+ * @tx_calls Send calls made
+ */
+struct udp_worker_stats {
+        atomic_uint_fast64_t rx_dgrams;
+        atomic_uint_fast64_t tx_dgrams;
+        atomic_uint_fast64_t rx_calls;
+        atomic_uint_fast64_t tx_calls;
+};
+
+
+// Reply queued for sending
+struct udp_reply {
+        size_t peer;            // index of the peer in "rx_peers"
+        size_t off;             // offset in "tx_arena"
+        size_t len;             // total length (all the segments)
+        size_t seg_len;         // segment length (GSO)
+        size_t segs;            // number of segments
+};
+
+
+/*
+ * Worker
+ *
+ * @id Worker index
+ * @sock Socket bound with SO_REUSEPORT
+ * @thread Worker thread
+ * @server Server of the worker
+ * @state Handler state
+ * @gro GRO is enabled
+ * @gso GSO is enabled
+ * @stats Counters
+ * @rx_bufs Receive buffers
+ * @rx_buf_len Length of each receive buffer
+ * @rx_peers Senders of the received datagrams
+ * @rx_peer_lens Lengths of the sender addresses
+ * @rx_ctrl Control messages of the received datagrams (GRO)
+ * @tx_arena Replies payload
+ * @tx_arena_len Size of "tx_arena"
+ * @tx_used Bytes of "tx_arena" in use
+ * @tx Queued replies
+ * @ntx Number of queued replies
+ */
+struct udp_worker {
+        size_t id;
+        SOCKET sock;
+        pthread_t thread;
+        struct udp_server* server;
+        void* state;
+        int gro;
+        int gso;
+        struct udp_worker_stats stats;
+
+        uint8_t* rx_bufs;
+        size_t rx_buf_len;
+        struct sockaddr_storage rx_peers[UDP_BATCH];
+        socklen_t rx_peer_lens[UDP_BATCH];
+        uint8_t rx_ctrl[UDP_BATCH][64];
+
+        uint8_t* tx_arena;
+        size_t tx_arena_len;
+        size_t tx_used;
+        struct udp_reply tx[UDP_BATCH];
+        size_t ntx;
+};
+
+
+/*
+ * Server
+ *
+ * @port Port to listen on
+ * @handler Datagram handler
+ * @config Handler configuration, passed to its init()
+ * @offload Use GSO / GRO if the kernel supports them
+ * @nworkers Number of workers
+ * @workers Workers
+ * @stop Stop flag for the workers
+ */
+struct udp_server {
+        const char* port;
+        const struct udp_handler* handler;
+        const void* config;
+        int offload;
+
+        size_t nworkers;
+        struct udp_worker workers[UDP_MAX_WORKERS];
+
+        atomic_int stop;
+};
+
+
+// Gets monotonic time in milliseconds
+uint64_t udp_now_ms(void);
+
+
+/*
+ * Starts the workers
+ *
+ * Returns:
+ *      - Success: EXIT_SUCCESS
+ *      - Failure: EXIT_FAILURE (started workers are stopped)
+ */
+int start_udp_server(struct udp_server* server);
+
+
+// Stops the workers and waits for them
+void stop_udp_server(struct udp_server* server);
+
+
+// Sums the counters of the workers
+void get_udp_server_stats(struct udp_server* server,
+        uint64_t* rx_dgrams, uint64_t* tx_dgrams);
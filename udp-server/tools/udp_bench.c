@@ -0,0 +1,243 @@
+/*
+ * File: udp_bench.c
+ * Author: Semyon Nadutkin
+ *
+ * Description: packets per second benchmark
+ * of an echo server, every thread keeps a window
+ * of datagrams in flight on its own socket
+ *
+ * Usage: udp_bench [SERVER] [PORT] [SECONDS] [THREADS] [SIZE]
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#ifdef __linux__
+        #define _GNU_SOURCE     // recvmmsg(), sendmmsg()
+#endif  // __linux__
+
+
+#include "../headers/cross_platform_sockets.h"
+#include "../headers/udp_workers.h"     // UDP_BATCH, ...
+
+#include <stdio.h>      // printf(), fprintf()
+#include <stdlib.h>     // strtoul()
+#include <string.h>     // memset()
+#include <time.h>       // clock_gettime()
+#include <poll.h>       // poll()
+#include <pthread.h>    // pthread_create()
+
+
+#define BENCH_WINDOW 256        // datagrams in flight per thread
+#define BENCH_STALL_MS 50       // window is reset after the silence
+#define BENCH_MAX_THREADS 64    // max sender threads
+
+
+/*
+ * Sender thread
+ *
+ * @addr Server address
+ * @size Datagram size
+ * @seconds Benchmark duration
+ * @sent Datagrams sent
+ * @received Datagrams received
+ * @failed Failed to set up the socket
+ */
+struct bench_thread {
+        pthread_t thread;
+        const struct addrinfo* addr;
+        size_t size;
+        double seconds;
+
+        uint64_t sent;
+        uint64_t received;
+        int failed;
+};
+
+
+// Gets monotonic time in seconds
+double bench_now(void)
+{
+        struct timespec ts = { 0 };
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+
+// Sends up to "count" datagrams, returns the number sent
+size_t send_bench_batch(const SOCKET s, uint8_t* payload, const size_t size,
+        const size_t count)
+{
+#ifdef __linux__
+        struct mmsghdr msgs[UDP_BATCH];
+        struct iovec iov = { .iov_base = payload, .iov_len = size };
+        memset(msgs, 0, sizeof(msgs));
+        for (size_t i = 0; i < count; ++i) {
+                msgs[i].msg_hdr.msg_iov = &iov;
+                msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int res = sendmmsg(s, msgs, (unsigned) count, MSG_DONTWAIT);
+        return (0 < res ? (size_t) res : 0);
+#else   // __linux__
+        size_t sent = 0;
+        while (sent < count && 0 <= send(s, payload, size, MSG_DONTWAIT)) {
+                ++sent;
+        }
+        return sent;
+#endif  // !__linux__
+}
+
+
+// Receives the available datagrams, returns their number
+size_t receive_bench_batch(const SOCKET s, uint8_t (*bufs)[UDP_MAX_DGRAM_LEN])
+{
+#ifdef __linux__
+        struct mmsghdr msgs[UDP_BATCH];
+        struct iovec iovs[UDP_BATCH];
+        memset(msgs, 0, sizeof(msgs));
+        for (size_t i = 0; i < UDP_BATCH; ++i) {
+                iovs[i].iov_base = bufs[i];
+                iovs[i].iov_len = UDP_MAX_DGRAM_LEN;
+                msgs[i].msg_hdr.msg_iov = &(iovs[i]);
+                msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int res = recvmmsg(s, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+        return (0 < res ? (size_t) res : 0);
+#else   // __linux__
+        return (0 <= recv(s, bufs[0], UDP_MAX_DGRAM_LEN, MSG_DONTWAIT));
+#endif  // !__linux__
+}
+
+
+// Keeps the window full until the time is out
+void* run_bench_thread(void* arg)
+{
+        struct bench_thread* bt = (struct bench_thread*) arg;
+        static __thread uint8_t bufs[UDP_BATCH][UDP_MAX_DGRAM_LEN];
+        uint8_t payload[UDP_MAX_DGRAM_LEN];
+        memset(payload, 'x', sizeof(payload));
+
+        SOCKET s = socket(bt->addr->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+        if (!validate_socket(s)) {
+                psockerror("socket() failed");
+                bt->failed = 1;
+                return NULL;
+        }
+
+        int opt = UDP_SOCK_BUF_LEN;
+        setsockopt(s, SOL_SOCKET, SO_RCVBUF, &opt, sizeof(opt));
+        setsockopt(s, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(opt));
+        if (connect(s, bt->addr->ai_addr, bt->addr->ai_addrlen)) {
+                psockerror("connect() failed");
+                closesocket(s);
+                bt->failed = 1;
+                return NULL;
+        }
+
+        size_t inflight = 0;
+        double end = bench_now() + bt->seconds;
+        double last_rx = bench_now();
+        while (1) {
+                double now = bench_now();
+                if (end <= now) break;
+
+                if (inflight < BENCH_WINDOW) {
+                        size_t count = BENCH_WINDOW - inflight;
+                        if (UDP_BATCH < count) count = UDP_BATCH;
+                        size_t sent = send_bench_batch(s, payload, bt->size,
+                                count);
+                        bt->sent += sent;
+                        inflight += sent;
+                }
+
+                size_t got = receive_bench_batch(s, bufs);
+                if (got) {
+                        bt->received += got;
+                        inflight = (got < inflight ? inflight - got : 0);
+                        last_rx = now;
+                        continue;
+                }
+
+                // Datagrams were lost, refill the window
+                if ((now - last_rx) * 1000.0 >= BENCH_STALL_MS) {
+                        inflight = 0;
+                        last_rx = now;
+                        continue;
+                }
+
+                struct pollfd pfd = { .fd = s, .events = POLLIN };
+                poll(&pfd, 1, 1);
+        }
+
+        // Count the late echoes
+        double drain_end = bench_now() + BENCH_STALL_MS / 1000.0;
+        while (bench_now() < drain_end) {
+                bt->received += receive_bench_batch(s, bufs);
+        }
+
+        closesocket(s);
+        return NULL;
+}
+
+
+int main(int argc, const char* argv[])
+{
+        if (argc != 6) {
+                fprintf(stderr, "Usage:\n\tudp_bench [SERVER] [PORT] "
+                        "[SECONDS] [THREADS] [SIZE]\n");
+                return EXIT_FAILURE;
+        }
+
+        double seconds = atof(argv[3]);
+        size_t nthreads = (size_t) strtoul(argv[4], NULL, 10);
+        size_t size = (size_t) strtoul(argv[5], NULL, 10);
+        if (seconds <= 0 || !nthreads || BENCH_MAX_THREADS < nthreads
+                || !size || UDP_MAX_DGRAM_LEN < size) {
+                fprintf(stderr, "Invalid arguments (threads: 1-%d, "
+                        "size: 1-%d)\n", BENCH_MAX_THREADS, UDP_MAX_DGRAM_LEN);
+                return EXIT_FAILURE;
+        }
+
+        struct addrinfo hints = { 0 };
+        hints.ai_flags = AI_NUMERICHOST;
+        hints.ai_socktype = SOCK_DGRAM;
+        struct addrinfo* addr = NULL;
+        if (getaddrinfo(argv[1], argv[2], &hints, &addr)) {
+                fprintf(stderr, "Invalid server address: %s\n", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        static struct bench_thread threads[BENCH_MAX_THREADS];
+        size_t started = 0;
+        for (; started < nthreads; ++started) {
+                threads[started].addr = addr;
+                threads[started].size = size;
+                threads[started].seconds = seconds;
+                if (pthread_create(&(threads[started].thread), NULL,
+                        run_bench_thread, &(threads[started]))) {
+                        fprintf(stderr, "pthread_create() failed\n");
+                        break;
+                }
+        }
+
+        uint64_t sent = 0, received = 0;
+        int failed = (started < nthreads);
+        for (size_t i = 0; i < started; ++i) {
+                pthread_join(threads[i].thread, NULL);
+                sent += threads[i].sent;
+                received += threads[i].received;
+                failed |= threads[i].failed;
+        }
+        freeaddrinfo(addr);
+
+        printf("Sent: %llu (%.0f pps), received: %llu (%.0f pps)\n",
+                (unsigned long long) sent, (double) sent / seconds,
+                (unsigned long long) received, (double) received / seconds);
+        printf("Lost: %.2f%%\n", sent
+                ? 100.0 * (double) (sent - (received < sent ? received : sent))
+                / (double) sent : 0.0);
+
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+/*
+ * File: udp_server.c
+ * Author: Semyon Nadutkin
+ *
+ * Description: multithreaded UDP echo / telemetry
+ * server, every worker receives and sends the datagrams
+ * in batches on its own SO_REUSEPORT socket
+ *
+ * Usage: udp_server [PORT] [OPTIONS]
+ *
+ * Copyright (C) 2025 Semyon Nadutkin
+ */
+
+
+#include "headers/cross_platform_sockets.h"
+#include "headers/udp_workers.h"
+#include "headers/udp_handlers.h"
+
+#include <stdio.h>      // printf(), fprintf()
+#include <stdlib.h>     // EXIT_SUCCESS / EXIT_FAILURE
+#include <string.h>     // strcmp()
+#include <signal.h>     // signal()
+#include <unistd.h>     // sleep()
+
+
+#define DEF_PORT "8080" // port used if none is given
+
+
+// Set by SIGINT / SIGTERM
+static volatile sig_atomic_t stop_requested = 0;
+
+
+void handle_stop_signal(int sig)
+{
+        (void) sig;
+        stop_requested = 1;
+}
+
+
+// Prints the usage
+void print_usage(void)
+{
+        fprintf(stderr, "Usage:\n\tudp_server [PORT] [OPTIONS]\n\n"
+                "Options:\n"
+                "\t--workers N\tnumber of workers (default: CPUs)\n"
+                "\t--offload\tuse UDP GSO / GRO if supported\n"
+                "\t--stats\t\tprint datagrams per second\n"
+                "\t--requests\tcount the requests of every peer "
+                "instead of echoing\n"
+                "\t--sessions N\tmax peers per worker (--requests)\n"
+                "\t--idle-ms N\tpeer session idle time (--requests)\n");
+}
+
+
+int main(int argc, const char* argv[])
+{
+        static struct udp_server server = { 0 };
+        server.port = DEF_PORT;
+        server.handler = &udp_echo_handler;
+
+        static struct udp_request_config requests = { 0 };
+        requests.handle = count_udp_request;
+
+        int print_stats = 0;
+        for (int i = 1; i < argc; ++i) {
+                if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+                        server.nworkers = (size_t) strtoul(argv[++i], NULL, 10);
+                } else if (!strcmp(argv[i], "--offload")) {
+                        server.offload = 1;
+                } else if (!strcmp(argv[i], "--stats")) {
+                        print_stats = 1;
+                } else if (!strcmp(argv[i], "--requests")) {
+                        server.handler = &udp_request_handler;
+                        server.config = &requests;
+                } else if (!strcmp(argv[i], "--sessions") && i + 1 < argc) {
+                        requests.max_sessions = (size_t) strtoul(argv[++i],
+                                NULL, 10);
+                } else if (!strcmp(argv[i], "--idle-ms") && i + 1 < argc) {
+                        requests.idle_ms = (uint32_t) strtoul(argv[++i],
+                                NULL, 10);
+                } else if (argv[i][0] != '-' && i == 1) {
+                        server.port = argv[i];
+                } else {
+                        print_usage();
+                        return EXIT_FAILURE;
+                }
+        }
+
+        signal(SIGINT, handle_stop_signal);
+        signal(SIGTERM, handle_stop_signal);
+
+        if (start_udp_server(&server)) return EXIT_FAILURE;
+
+        int gro = 0, gso = 0;
+        for (size_t i = 0; i < server.nworkers; ++i) {
+                gro += server.workers[i].gro;
+                gso += server.workers[i].gso;
+        }
+        printf("Listening on port %s: %zu workers, GRO %s, GSO %s\n",
+                server.port, server.nworkers, gro ? "on" : "off",
+                gso ? "on" : "off");
+
+        uint64_t last_rx = 0, last_tx = 0;
+        while (!stop_requested) {
+                sleep(1);
+                if (!print_stats) continue;
+
+                uint64_t rx = 0, tx = 0;
+                get_udp_server_stats(&server, &rx, &tx);
+                printf("rx: %llu pps, tx: %llu pps\n",
+                        (unsigned long long) (rx - last_rx),
+                        (unsigned long long) (tx - last_tx));
+                fflush(stdout);
+                last_rx = rx;
+                last_tx = tx;
+        }
+
+        uint64_t rx = 0, tx = 0;
+        get_udp_server_stats(&server, &rx, &tx);
+        stop_udp_server(&server);
+
+        printf("Received: %llu, sent: %llu datagrams\n",
+                (unsigned long long) rx, (unsigned long long) tx);
+        return EXIT_SUCCESS;
+}
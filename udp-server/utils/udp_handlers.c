@@ -0,0 +1,61 @@
+#include "../headers/udp_handlers.h"
+#include <string.h>             // memcpy()
+
+
+// Copies the datagram to the reply
+size_t handle_udp_echo(void* state, const struct udp_datagram* dg,
+        uint8_t* reply, const size_t reply_sz)
+{
+        (void) state;
+
+        size_t len = (dg->len < reply_sz ? dg->len : reply_sz);
+        memcpy(reply, dg->data, len);
+        return len;
+}
+
+
+const struct udp_handler udp_echo_handler = {
+        .init = NULL,
+        .handle = handle_udp_echo,
+        .tick = NULL,
+        .cleanup = NULL
+};
+
+
+// Counters kept in the session data
+struct udp_peer_counters {
+        uint64_t requests;
+        uint64_t bytes;
+};
+
+_Static_assert(sizeof(struct udp_peer_counters) <= UDP_SESSION_DATA_LEN,
+        "struct udp_peer_counters must fit the session data");
+
+
+// Writes the value in big endian
+void write_u64_be(uint8_t* buf, uint64_t val)
+{
+        for (int i = 7; 0 <= i; --i) {
+                buf[i] = (uint8_t) val;
+                val >>= 8;
+        }
+}
+
+
+int count_udp_request(struct udp_session* session, const uint32_t seq,
+        const uint8_t* body, const size_t len, uint8_t* resp, const size_t sz)
+{
+        (void) seq;
+        (void) body;
+        if (sz < 16) return -EXIT_FAILURE;
+
+        struct udp_peer_counters counters;
+        memcpy(&counters, session->data, sizeof(counters));
+        ++counters.requests;
+        counters.bytes += len;
+        memcpy(session->data, &counters, sizeof(counters));
+
+        write_u64_be(resp, counters.requests);
+        write_u64_be(resp + 8, counters.bytes);
+        return 16;
+}
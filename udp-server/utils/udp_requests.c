@@ -0,0 +1,97 @@
+#include "../headers/udp_requests.h"
+#include <string.h>             // memcpy()
+
+
+// Creates the sessions table of the worker
+void* init_udp_requests(const void* config, const size_t worker_id)
+{
+        (void) worker_id;
+
+        const struct udp_request_config* cfg =
+                (const struct udp_request_config*) config;
+        if (!cfg || !cfg->handle) return NULL;
+
+        struct udp_request_state* st = (struct udp_request_state*)
+                calloc(1, sizeof(struct udp_request_state));
+        if (!st) return NULL;
+
+        st->config = cfg;
+        st->now_ms = udp_now_ms();
+        if (udp_session_table_init(&(st->sessions),
+                cfg->max_sessions ? cfg->max_sessions : UDP_REQ_DEF_SESSIONS,
+                cfg->idle_ms ? cfg->idle_ms : UDP_REQ_DEF_IDLE_MS)) {
+                free(st);
+                return NULL;
+        }
+
+        return st;
+}
+
+
+// Checks the sequence number, passes the request to the handler
+size_t handle_udp_request(void* state, const struct udp_datagram* dg,
+        uint8_t* reply, const size_t reply_sz)
+{
+        struct udp_request_state* st = (struct udp_request_state*) state;
+        if (dg->len < UDP_REQ_HEADER_LEN || reply_sz < UDP_RESP_HEADER_LEN) {
+                return 0; // not a request
+        }
+
+        uint32_t seq = ((uint32_t) dg->data[0] << 24)
+                | ((uint32_t) dg->data[1] << 16)
+                | ((uint32_t) dg->data[2] << 8)
+                | (uint32_t) dg->data[3];
+        memcpy(reply, dg->data, UDP_REQ_HEADER_LEN);
+
+        // "now_ms" is refreshed every batch, precise enough for the expiry
+        struct udp_session* session = udp_session_get(&(st->sessions),
+                dg->peer, st->now_ms, NULL);
+        if (!session) {
+                reply[4] = UDP_REQ_BUSY;
+                return UDP_RESP_HEADER_LEN;
+        }
+
+        // Acknowledge the retransmission, the response was lost
+        if (!udp_session_check_seq(session, seq)) {
+                ++(st->duplicates);
+                reply[4] = UDP_REQ_DUPLICATE;
+                return UDP_RESP_HEADER_LEN;
+        }
+
+        int len = st->config->handle(session, seq,
+                dg->data + UDP_REQ_HEADER_LEN, dg->len - UDP_REQ_HEADER_LEN,
+                reply + UDP_RESP_HEADER_LEN, reply_sz - UDP_RESP_HEADER_LEN);
+        if (len < 0) {
+                reply[4] = UDP_REQ_ERROR;
+                return UDP_RESP_HEADER_LEN;
+        }
+
+        reply[4] = UDP_REQ_OK;
+        return UDP_RESP_HEADER_LEN + (size_t) len;
+}
+
+
+// Updates the clock, expires the idle sessions
+void tick_udp_requests(void* state, const uint64_t now_ms)
+{
+        struct udp_request_state* st = (struct udp_request_state*) state;
+        st->now_ms = now_ms;
+        udp_session_expire(&(st->sessions), now_ms);
+}
+
+
+// Frees the sessions table
+void cleanup_udp_requests(void* state)
+{
+        struct udp_request_state* st = (struct udp_request_state*) state;
+        udp_session_table_cleanup(&(st->sessions));
+        free(st);
+}
+
+
+const struct udp_handler udp_request_handler = {
+        .init = init_udp_requests,
+        .handle = handle_udp_request,
+        .tick = tick_udp_requests,
+        .cleanup = cleanup_udp_requests
+};
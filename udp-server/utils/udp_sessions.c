@@ -0,0 +1,206 @@
+#include "../headers/udp_sessions.h"
+#include <string.h>             // memset(), memcpy(), memcmp()
+
+
+// Converts the address to the key, IPv4 is mapped to IPv6
+int make_udp_session_key(const struct sockaddr_storage* peer,
+        uint8_t addr[16], uint16_t* port)
+{
+        if (peer->ss_family == AF_INET6) {
+                const struct sockaddr_in6* in6 =
+                        (const struct sockaddr_in6*) peer;
+                memcpy(addr, &(in6->sin6_addr), 16);
+                *port = in6->sin6_port;
+                return EXIT_SUCCESS;
+        }
+
+        if (peer->ss_family == AF_INET) {
+                const struct sockaddr_in* in4 =
+                        (const struct sockaddr_in*) peer;
+                memset(addr, 0, 10);
+                addr[10] = 0xFF;
+                addr[11] = 0xFF;
+                memcpy(addr + 12, &(in4->sin_addr), 4);
+                *port = in4->sin_port;
+                return EXIT_SUCCESS;
+        }
+
+        return EXIT_FAILURE;
+}
+
+
+// FNV-1a hash of the key, never 0
+uint32_t hash_udp_session_key(const uint8_t addr[16], const uint16_t port)
+{
+        uint32_t hash = 2166136261U;
+        for (size_t i = 0; i < 16; ++i) {
+                hash ^= addr[i];
+                hash *= 16777619U;
+        }
+        hash ^= (uint32_t) (port & 0xFF);
+        hash *= 16777619U;
+        hash ^= (uint32_t) (port >> 8);
+        hash *= 16777619U;
+
+        return hash ? hash : 1;
+}
+
+
+// Checks if the session was idle for too long
+static inline
+int udp_session_idle(const struct udp_session_table* table,
+        const struct udp_session* session, const uint64_t now_ms)
+{
+        return table->idle_ms <= (uint32_t) now_ms - session->last_seen;
+}
+
+
+int udp_session_table_init(struct udp_session_table* table,
+        const size_t max_sessions, const uint32_t idle_ms)
+{
+        memset(table, 0, sizeof(*table));
+
+        // Keep the load factor at 75% for short probe sequences
+        size_t nslots = 16;
+        while (nslots / 4 * 3 < max_sessions) nslots *= 2;
+
+        table->slots = (struct udp_session*) aligned_alloc(64,
+                nslots * sizeof(struct udp_session));
+        if (!table->slots) return EXIT_FAILURE;
+        memset(table->slots, 0, nslots * sizeof(struct udp_session));
+
+        table->nslots = nslots;
+        table->max_count = nslots / 4 * 3;
+        table->idle_ms = idle_ms;
+        return EXIT_SUCCESS;
+}
+
+
+// Removes the session, shifts the next ones back to close the gap
+void remove_udp_session(struct udp_session_table* table, size_t pos)
+{
+        size_t mask = table->nslots - 1;
+        size_t next = (pos + 1) & mask;
+
+        while (table->slots[next].hash) {
+                size_t home = table->slots[next].hash & mask;
+
+                // Move the entry if its home is not in (pos, next]
+                if (((next - home) & mask) >= ((next - pos) & mask)) {
+                        table->slots[pos] = table->slots[next];
+                        pos = next;
+                }
+                next = (next + 1) & mask;
+        }
+
+        memset(&(table->slots[pos]), 0, sizeof(struct udp_session));
+        --(table->count);
+}
+
+
+struct udp_session* udp_session_get(struct udp_session_table* table,
+        const struct sockaddr_storage* peer, const uint64_t now_ms,
+        int* created)
+{
+        uint8_t addr[16];
+        uint16_t port = 0;
+        if (make_udp_session_key(peer, addr, &port)) return NULL;
+
+        uint32_t hash = hash_udp_session_key(addr, port);
+        size_t mask = table->nslots - 1;
+        size_t pos = hash & mask;
+
+        while (table->slots[pos].hash) {
+                struct udp_session* session = &(table->slots[pos]);
+                if (session->hash == hash && session->port == port
+                        && !memcmp(session->addr, addr, 16)) {
+                        // A peer coming back after the expiry starts anew
+                        int fresh = udp_session_idle(table, session, now_ms);
+                        if (fresh) {
+                                memset(session->data, 0, sizeof(session->data));
+                                session->has_seq = 0;
+                                session->seq_seen = 0;
+                                ++(table->expired);
+                                ++(table->created);
+                        }
+                        if (created) *created = fresh;
+
+                        session->last_seen = (uint32_t) now_ms;
+                        return session;
+                }
+                pos = (pos + 1) & mask;
+        }
+
+        if (table->count == table->max_count) {
+                ++(table->rejected);
+                return NULL;
+        }
+
+        struct udp_session* session = &(table->slots[pos]);
+        memcpy(session->addr, addr, 16);
+        session->hash = hash;
+        session->port = port;
+        session->last_seen = (uint32_t) now_ms;
+
+        ++(table->count);
+        ++(table->created);
+        if (created) *created = 1;
+        return session;
+}
+
+
+int udp_session_check_seq(struct udp_session* session, const uint32_t seq)
+{
+        if (!session->has_seq) {
+                session->has_seq = 1;
+                session->max_seq = seq;
+                session->seq_seen = 1;
+                return 1;
+        }
+
+        // Serial number arithmetic, survives the wrap around
+        int32_t diff = (int32_t) (seq - session->max_seq);
+        if (0 < diff) {
+                session->seq_seen = (diff < UDP_SESSION_SEQ_WINDOW
+                        ? session->seq_seen << diff : 0) | 1;
+                session->max_seq = seq;
+                return 1;
+        }
+
+        uint32_t back = (uint32_t) -diff;
+        if (UDP_SESSION_SEQ_WINDOW <= back) return 0;
+
+        uint64_t bit = (uint64_t) 1 << back;
+        if (session->seq_seen & bit) return 0;
+
+        session->seq_seen |= bit;
+        return 1;
+}
+
+
+void udp_session_expire(struct udp_session_table* table,
+        const uint64_t now_ms)
+{
+        if (!table->count) return;
+
+        size_t mask = table->nslots - 1;
+        for (size_t i = 0; i < UDP_SESSION_SCAN; ++i) {
+                size_t pos = table->scan_pos;
+                struct udp_session* session = &(table->slots[pos]);
+
+                // The removal may shift another session into the slot
+                if (session->hash && udp_session_idle(table, session, now_ms)) {
+                        remove_udp_session(table, pos);
+                        ++(table->expired);
+                        continue;
+                }
+                table->scan_pos = (pos + 1) & mask;
+        }
+}
+
+
+void udp_session_table_cleanup(struct udp_session_table* table)
+{
+        free(table->slots);
+        memset(table, 0, sizeof(*table));
+}
@@ -0,0 +1,507 @@
+#ifdef __linux__
+        #define _GNU_SOURCE     // recvmmsg(), sendmmsg()
+#endif  // __linux__
+
+
+#include "../headers/udp_workers.h"
+#include <string.h>             // memset(), memcpy()
+#include <unistd.h>             // sysconf()
+#include <sys/time.h>           // struct timeval
+#include <time.h>               // clock_gettime()
+
+#ifdef __linux__
+        #include <netinet/udp.h>        // UDP_SEGMENT, UDP_GRO
+#endif  // __linux__
+
+
+// Older headers lack the offload options
+#ifndef SOL_UDP
+        #define SOL_UDP 17
+#endif  // !SOL_UDP
+#ifndef UDP_SEGMENT
+        #define UDP_SEGMENT 103
+#endif  // !UDP_SEGMENT
+#ifndef UDP_GRO
+        #define UDP_GRO 104
+#endif  // !UDP_GRO
+
+
+/*
+ * Message arrays of a worker, set up once
+ * on its stack and reused by every batch
+ *
+ * @rx_msgs Receive messages
+ * @rx_iovs Receive buffers
+ * @tx_msgs Send messages
+ * @tx_iovs Send buffers
+ * @tx_ctrl Control messages of the sends (GSO)
+ */
+struct udp_msgs {
+#ifdef __linux__
+        struct mmsghdr rx_msgs[UDP_BATCH];
+        struct mmsghdr tx_msgs[UDP_BATCH];
+#endif  // __linux__
+        struct iovec rx_iovs[UDP_BATCH];
+        struct iovec tx_iovs[UDP_BATCH];
+        uint8_t tx_ctrl[UDP_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+};
+
+
+uint64_t udp_now_ms(void)
+{
+        struct timespec ts = { 0 };
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+
+// Creates the socket of the worker, enables the offloads if asked
+int open_udp_worker_socket(struct udp_worker* worker)
+{
+        struct addrinfo hints = { 0 };
+        hints.ai_family = AF_INET6;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_PASSIVE;
+
+        struct addrinfo* addr = NULL;
+        if (getaddrinfo(NULL, worker->server->port, &hints, &addr)) {
+                fprintf(stderr, "Invalid port: %s\n", worker->server->port);
+                return EXIT_FAILURE;
+        }
+
+        worker->sock = socket(addr->ai_family, addr->ai_socktype,
+                addr->ai_protocol);
+        if (!validate_socket(worker->sock)) {
+                psockerror("socket() failed");
+                goto out_failure_free;
+        }
+
+        // Dual-stack, every worker binds the same port
+        int opt = 0;
+        setsockopt(worker->sock, IPPROTO_IPV6, IPV6_V6ONLY,
+                (const char*) &opt, sizeof(opt));
+        opt = 1;
+        setsockopt(worker->sock, SOL_SOCKET, SO_REUSEADDR,
+                (const char*) &opt, sizeof(opt));
+        if (setsockopt(worker->sock, SOL_SOCKET, SO_REUSEPORT,
+                (const char*) &opt, sizeof(opt))) {
+                psockerror("SO_REUSEPORT is not supported");
+                goto out_failure_close;
+        }
+
+        // Absorb the bursts between the batches
+        opt = UDP_SOCK_BUF_LEN;
+        setsockopt(worker->sock, SOL_SOCKET, SO_RCVBUF,
+                (const char*) &opt, sizeof(opt));
+        setsockopt(worker->sock, SOL_SOCKET, SO_SNDBUF,
+                (const char*) &opt, sizeof(opt));
+
+        // Wake up to check the stop flag
+        struct timeval tv = { 0 };
+        tv.tv_usec = UDP_POLL_MS * 1000;
+        setsockopt(worker->sock, SOL_SOCKET, SO_RCVTIMEO,
+                (const char*) &tv, sizeof(tv));
+
+        if (bind(worker->sock, addr->ai_addr, addr->ai_addrlen)) {
+                psockerror("bind() failed");
+                goto out_failure_close;
+        }
+
+        // Probe the offloads, the server works without them
+        if (worker->server->offload) {
+                opt = 1;
+                worker->gro = !setsockopt(worker->sock, SOL_UDP, UDP_GRO,
+                        (const char*) &opt, sizeof(opt));
+                opt = 0;
+                worker->gso = !setsockopt(worker->sock, SOL_UDP, UDP_SEGMENT,
+                        (const char*) &opt, sizeof(opt));
+        }
+
+        freeaddrinfo(addr);
+        return EXIT_SUCCESS;
+
+out_failure_close:
+        closesocket(worker->sock);
+        worker->sock = INVALID_SOCKET;
+out_failure_free:
+        freeaddrinfo(addr);
+        return EXIT_FAILURE;
+}
+
+
+// Sends the queued replies
+void flush_udp_replies(struct udp_worker* worker, struct udp_msgs* msgs)
+{
+        if (!worker->ntx) return;
+
+        size_t dgrams = 0;
+        for (size_t i = 0; i < worker->ntx; ++i) {
+                const struct udp_reply* rp = &(worker->tx[i]);
+                msgs->tx_iovs[i].iov_base = worker->tx_arena + rp->off;
+                msgs->tx_iovs[i].iov_len = rp->len;
+                dgrams += rp->segs;
+        }
+
+#ifdef __linux__
+        for (size_t i = 0; i < worker->ntx; ++i) {
+                const struct udp_reply* rp = &(worker->tx[i]);
+                struct msghdr* hdr = &(msgs->tx_msgs[i].msg_hdr);
+                hdr->msg_name = &(worker->rx_peers[rp->peer]);
+                hdr->msg_namelen = worker->rx_peer_lens[rp->peer];
+                hdr->msg_iov = &(msgs->tx_iovs[i]);
+                hdr->msg_iovlen = 1;
+                hdr->msg_control = NULL;
+                hdr->msg_controllen = 0;
+
+                // Let the kernel split the reply into equal datagrams
+                if (1 < rp->segs) {
+                        hdr->msg_control = msgs->tx_ctrl[i];
+                        hdr->msg_controllen = sizeof(msgs->tx_ctrl[i]);
+                        struct cmsghdr* cm = CMSG_FIRSTHDR(hdr);
+                        cm->cmsg_level = SOL_UDP;
+                        cm->cmsg_type = UDP_SEGMENT;
+                        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                        uint16_t seg = (uint16_t) rp->seg_len;
+                        memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+                }
+        }
+
+        size_t done = 0;
+        while (done < worker->ntx) {
+                int res = sendmmsg(worker->sock, msgs->tx_msgs + done,
+                        (unsigned) (worker->ntx - done), 0);
+                atomic_fetch_add_explicit(&(worker->stats.tx_calls), 1,
+                        memory_order_relaxed);
+                if (res < 0) {
+                        if (errno == EINTR) continue;
+
+                        // Drop the failed reply, UDP gives no guarantees
+                        dgrams -= worker->tx[done].segs;
+                        ++done;
+                        continue;
+                }
+                done += (size_t) res;
+        }
+#else   // __linux__
+        for (size_t i = 0; i < worker->ntx; ++i) {
+                const struct udp_reply* rp = &(worker->tx[i]);
+                atomic_fetch_add_explicit(&(worker->stats.tx_calls), 1,
+                        memory_order_relaxed);
+                if (sendto(worker->sock, msgs->tx_iovs[i].iov_base, rp->len,
+                        0, (const struct sockaddr*) &(worker->rx_peers[rp->peer]),
+                        worker->rx_peer_lens[rp->peer]) < 0) {
+                        --dgrams;
+                }
+        }
+#endif  // !__linux__
+
+        atomic_fetch_add_explicit(&(worker->stats.tx_dgrams), dgrams,
+                memory_order_relaxed);
+        worker->ntx = 0;
+        worker->tx_used = 0;
+}
+
+
+// Checks if the received datagrams came from the same address
+static inline
+int same_udp_peer(const struct udp_worker* worker, const size_t a,
+        const size_t b)
+{
+        return a == b || (worker->rx_peer_lens[a] == worker->rx_peer_lens[b]
+                && !memcmp(&(worker->rx_peers[a]), &(worker->rx_peers[b]),
+                worker->rx_peer_lens[a]));
+}
+
+
+// Passes the datagram to the handler, queues the reply
+void handle_udp_datagram(struct udp_worker* worker, struct udp_msgs* msgs,
+        const size_t peer, const uint8_t* data, const size_t len)
+{
+        // The reply is written to the arena right away
+        if (worker->ntx == UDP_BATCH
+                || worker->tx_arena_len - worker->tx_used < UDP_MAX_DGRAM_LEN) {
+                flush_udp_replies(worker, msgs);
+        }
+
+        struct udp_datagram dg = {
+                .data = data,
+                .len = len,
+                .peer = &(worker->rx_peers[peer]),
+                .peer_len = worker->rx_peer_lens[peer]
+        };
+
+        uint8_t* reply = worker->tx_arena + worker->tx_used;
+        size_t rlen = worker->server->handler->handle(worker->state, &dg,
+                reply, UDP_MAX_DGRAM_LEN);
+        if (!rlen) return;
+
+        // Append equal replies to the same peer to the previous GSO send
+        if (worker->gso && worker->ntx) {
+                struct udp_reply* last = &(worker->tx[worker->ntx - 1]);
+                if (last->seg_len == rlen && last->segs < UDP_MAX_GSO_SEGS
+                        && last->len + rlen <= UDP_MAX_GSO_LEN
+                        && last->off + last->len == worker->tx_used
+                        && same_udp_peer(worker, last->peer, peer)) {
+                        last->len += rlen;
+                        ++(last->segs);
+                        worker->tx_used += rlen;
+                        return;
+                }
+        }
+
+        struct udp_reply* rp = &(worker->tx[worker->ntx++]);
+        rp->peer = peer;
+        rp->off = worker->tx_used;
+        rp->len = rlen;
+        rp->seg_len = rlen;
+        rp->segs = 1;
+        worker->tx_used += rlen;
+}
+
+
+#ifdef __linux__
+// Gets the segment size of the coalesced datagram (GRO), 0 if not coalesced
+size_t get_udp_gro_size(struct msghdr* hdr)
+{
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(hdr); cm;
+                cm = CMSG_NXTHDR(hdr, cm)) {
+                if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                        int seg = 0;
+                        memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+                        return (0 < seg ? (size_t) seg : 0);
+                }
+        }
+
+        return 0;
+}
+#endif  // __linux__
+
+
+// Receives the datagrams in batches until the server stops
+void* run_udp_worker(void* arg)
+{
+        struct udp_worker* worker = (struct udp_worker*) arg;
+        const struct udp_handler* handler = worker->server->handler;
+        struct udp_msgs msgs;
+        memset(&msgs, 0, sizeof(msgs));
+
+        for (size_t i = 0; i < UDP_BATCH; ++i) {
+                msgs.rx_iovs[i].iov_base = worker->rx_bufs
+                        + i * worker->rx_buf_len;
+                msgs.rx_iovs[i].iov_len = worker->rx_buf_len;
+        }
+
+        while (!atomic_load_explicit(&(worker->server->stop),
+                memory_order_relaxed)) {
+                size_t n = 0;
+
+#ifdef __linux__
+                // The kernel overwrites the lengths
+                for (size_t i = 0; i < UDP_BATCH; ++i) {
+                        struct msghdr* hdr = &(msgs.rx_msgs[i].msg_hdr);
+                        hdr->msg_name = &(worker->rx_peers[i]);
+                        hdr->msg_namelen = sizeof(worker->rx_peers[i]);
+                        hdr->msg_iov = &(msgs.rx_iovs[i]);
+                        hdr->msg_iovlen = 1;
+                        hdr->msg_control = (worker->gro
+                                ? worker->rx_ctrl[i] : NULL);
+                        hdr->msg_controllen = (worker->gro
+                                ? sizeof(worker->rx_ctrl[i]) : 0);
+                        hdr->msg_flags = 0;
+                }
+
+                int res = recvmmsg(worker->sock, msgs.rx_msgs, UDP_BATCH,
+                        MSG_WAITFORONE, NULL);
+#else   // __linux__
+                worker->rx_peer_lens[0] = sizeof(worker->rx_peers[0]);
+                int res = recvfrom(worker->sock, msgs.rx_iovs[0].iov_base,
+                        worker->rx_buf_len, 0,
+                        (struct sockaddr*) &(worker->rx_peers[0]),
+                        &(worker->rx_peer_lens[0]));
+#endif  // !__linux__
+
+                if (res < 0) {
+                        int err = sockerrno();
+                        if (err == EAGAIN || err == EWOULDBLOCK
+                                || err == EINTR) {
+                                if (handler->tick) {
+                                        handler->tick(worker->state,
+                                                udp_now_ms());
+                                }
+                                continue;
+                        }
+
+                        psockerror("Worker %zu: receiving failed", worker->id);
+                        break;
+                }
+                atomic_fetch_add_explicit(&(worker->stats.rx_calls), 1,
+                        memory_order_relaxed);
+
+#ifdef __linux__
+                n = (size_t) res;
+#else   // __linux__
+                n = 1;
+#endif  // !__linux__
+
+                size_t dgrams = 0;
+                for (size_t i = 0; i < n; ++i) {
+                        const uint8_t* data = (const uint8_t*)
+                                msgs.rx_iovs[i].iov_base;
+
+#ifdef __linux__
+                        worker->rx_peer_lens[i] = msgs.rx_msgs[i].msg_hdr
+                                .msg_namelen;
+                        size_t len = msgs.rx_msgs[i].msg_len;
+                        size_t seg = (worker->gro
+                                ? get_udp_gro_size(&(msgs.rx_msgs[i].msg_hdr))
+                                : 0);
+#else   // __linux__
+                        size_t len = (size_t) res;
+                        size_t seg = 0;
+#endif  // !__linux__
+                        if (!seg || len < seg) seg = (len ? len : 1);
+
+                        // Split the coalesced datagrams back
+                        size_t off = 0;
+                        do {
+                                size_t dlen = (len - off < seg
+                                        ? len - off : seg);
+                                handle_udp_datagram(worker, &msgs, i,
+                                        data + off, dlen);
+                                off += dlen;
+                                ++dgrams;
+                        } while (off < len);
+                }
+
+                atomic_fetch_add_explicit(&(worker->stats.rx_dgrams), dgrams,
+                        memory_order_relaxed);
+
+                // The peer addresses are overwritten by the next batch
+                flush_udp_replies(worker, &msgs);
+
+                if (handler->tick) handler->tick(worker->state, udp_now_ms());
+        }
+
+        return NULL;
+}
+
+
+// Frees the resources of the worker
+void cleanup_udp_worker(struct udp_worker* worker)
+{
+        const struct udp_handler* handler = worker->server->handler;
+        if (handler->cleanup && worker->state) handler->cleanup(worker->state);
+        worker->state = NULL;
+
+        if (validate_socket(worker->sock)) closesocket(worker->sock);
+        worker->sock = INVALID_SOCKET;
+
+        free(worker->rx_bufs);
+        worker->rx_bufs = NULL;
+        free(worker->tx_arena);
+        worker->tx_arena = NULL;
+}
+
+
+// Sets up the worker and starts its thread
+int start_udp_worker(struct udp_server* server, const size_t id)
+{
+        struct udp_worker* worker = &(server->workers[id]);
+        memset(worker, 0, sizeof(*worker));
+        worker->id = id;
+        worker->server = server;
+        worker->sock = INVALID_SOCKET;
+
+        if (open_udp_worker_socket(worker)) return EXIT_FAILURE;
+
+        // Coalesced receives need room for 64 KB each
+        worker->rx_buf_len = (worker->gro
+                ? UDP_GRO_BUF_LEN : UDP_MAX_DGRAM_LEN);
+        worker->rx_bufs = (uint8_t*) malloc(UDP_BATCH * worker->rx_buf_len);
+
+        // GSO sends hold up to UDP_MAX_GSO_LEN each
+        worker->tx_arena_len = (worker->gso
+                ? 2 * (UDP_MAX_GSO_LEN + UDP_MAX_DGRAM_LEN)
+                : UDP_BATCH * UDP_MAX_DGRAM_LEN);
+        worker->tx_arena = (uint8_t*) malloc(worker->tx_arena_len);
+        if (!worker->rx_bufs || !worker->tx_arena) {
+                fprintf(stderr, "Worker %zu: out of memory\n", id);
+                goto out_failure;
+        }
+
+        if (server->handler->init) {
+                worker->state = server->handler->init(server->config, id);
+                if (!worker->state) {
+                        fprintf(stderr, "Worker %zu: handler init failed\n",
+                                id);
+                        goto out_failure;
+                }
+        }
+
+        if (pthread_create(&(worker->thread), NULL, run_udp_worker, worker)) {
+                fprintf(stderr, "Worker %zu: pthread_create() failed\n", id);
+                goto out_failure;
+        }
+
+        return EXIT_SUCCESS;
+
+out_failure:
+        cleanup_udp_worker(worker);
+        return EXIT_FAILURE;
+}
+
+
+int start_udp_server(struct udp_server* server)
+{
+        if (!server->nworkers) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                server->nworkers = (0 < cpus ? (size_t) cpus : 1);
+        }
+        if (UDP_MAX_WORKERS < server->nworkers) {
+                server->nworkers = UDP_MAX_WORKERS;
+        }
+
+        atomic_store(&(server->stop), 0);
+
+        size_t started = 0;
+        for (; started < server->nworkers; ++started) {
+                if (start_udp_worker(server, started)) break;
+        }
+
+        if (started < server->nworkers) {
+                server->nworkers = started;
+                stop_udp_server(server);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+void stop_udp_server(struct udp_server* server)
+{
+        atomic_store(&(server->stop), 1);
+
+        for (size_t i = 0; i < server->nworkers; ++i) {
+                pthread_join(server->workers[i].thread, NULL);
+                cleanup_udp_worker(&(server->workers[i]));
+        }
+
+        server->nworkers = 0;
+}
+
+
+void get_udp_server_stats(struct udp_server* server,
+        uint64_t* rx_dgrams, uint64_t* tx_dgrams)
+{
+        *rx_dgrams = 0;
+        *tx_dgrams = 0;
+
+        for (size_t i = 0; i < server->nworkers; ++i) {
+                struct udp_worker_stats* st = &(server->workers[i].stats);
+                *rx_dgrams += atomic_load_explicit(&(st->rx_dgrams),
+                        memory_order_relaxed);
+                *tx_dgrams += atomic_load_explicit(&(st->tx_dgrams),
+                        memory_order_relaxed);
+        }
+}